@@ -0,0 +1,656 @@
+/**********************************************************************************
+*
+*  Arrow export for the FDC+ Serial Drive Simulator
+*
+*  Writes the transactions of one or more captures as an Arrow IPC file
+*  (Feather v2), one row per transaction with the time of every phase, for
+*  pandas, polars or DuckDB without any parsing:
+*
+*      fdc-sim-gui --export site.cap,bench.cap --output site.arrow
+*
+*      >>> import pyarrow.feather as feather
+*      >>> df = feather.read_table("site.arrow").to_pandas()
+*      >>> (df.t_done_ns - df.t_sent_ns).groupby(df.cmd).describe()
+*
+*  link is the position of the capture in the --export list; the names are
+*  in the schema metadata under "links". Times are ns on the capture's
+*  clock, null where the transaction never got that far. retries counts the
+*  failed attempts at the same command, drive and track just before it.
+*
+*  The flatbuffers the format needs are built by hand (FDCFlatBuilder), so
+*  there is nothing to link against.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+
+#include <vector>
+
+#include <string.h>
+
+#include "fdc-arrow.h"
+#include "fdc-metrics.h"
+#include "fdc-link.h"
+
+#define ARROW_MAGIC		"ARROW1"
+#define ARROW_CONTINUATION	0xffffffff
+#define ARROW_VERSION		4			// MetadataVersion V5
+
+#define ARROW_HEADER_SCHEMA	1			// MessageHeader union
+#define ARROW_HEADER_BATCH	3
+#define ARROW_TYPE_INT		2			// Type union
+#define ARROW_TYPE_UTF8		5
+
+#define COL_LINK		0
+#define COL_SEQ			1
+#define COL_CMD			2
+#define COL_DRIVE		3
+#define COL_TRACK		4
+#define COL_LENGTH		5
+#define COL_RESULT		6
+#define COL_RCODE		7
+#define COL_RDATA		8
+#define COL_BYTES		9
+#define COL_RETRIES		10
+#define COL_T_QUEUED		11			// then each phase in tcaprecord_t order
+
+const tarrowcol_t FDCArrowWriter::columns[] = {
+	{ "link",		ARROW_COL_INT,	16, false, false },
+	{ "seq",		ARROW_COL_INT,	64, false, false },
+	{ "cmd",		ARROW_COL_UTF8,	0,  false, false },
+	{ "drive",		ARROW_COL_INT,	8,  false, false },
+	{ "track",		ARROW_COL_INT,	16, false, false },
+	{ "length",		ARROW_COL_INT,	16, false, false },
+	{ "result",		ARROW_COL_INT,	8,  false, false },
+	{ "rcode",		ARROW_COL_INT,	16, false, false },
+	{ "rdata",		ARROW_COL_INT,	16, false, false },
+	{ "bytes",		ARROW_COL_INT,	32, false, false },
+	{ "retries",		ARROW_COL_INT,	16, false, false },
+	{ "t_queued_ns",	ARROW_COL_INT,	64, true,  true },
+	{ "t_sent_ns",		ARROW_COL_INT,	64, true,  true },
+	{ "t_first_ns",		ARROW_COL_INT,	64, true,  true },
+	{ "t_resp_ns",		ARROW_COL_INT,	64, true,  true },
+	{ "t_data_ns",		ARROW_COL_INT,	64, true,  true },
+	{ "t_wsta_ns",		ARROW_COL_INT,	64, true,  true },
+	{ "t_done_ns",		ARROW_COL_INT,	64, true,  true },
+	{ NULL,			0,		0,  false, false }
+};
+
+//
+// Minimal flatbuffer builder. Like the real one it builds from the back of
+// the buffer, so children are made before the tables that refer to them
+// and offsets are sizes counted from the end.
+//
+class FDCFlatBuilder
+{
+public:
+	FDCFlatBuilder() : buf(1024), head(1024), minAlign(1), tableStart(0) {}
+
+	quint32 size(void) const { return buf.size() - head; }
+
+	void pad(int n)
+	{
+		reserve(n);
+		while (n--) {
+			buf[--head] = 0;
+		}
+	}
+
+	// Pad so that after extra more bytes the size is a multiple of n
+	void align(int n, int extra = 0)
+	{
+		minAlign = qMax(minAlign, n);
+		pad((n - (size() + extra) % n) % n);
+	}
+
+	template<typename T> void push(T v)
+	{
+		reserve(sizeof(v));
+		head -= sizeof(v);
+		memcpy(&buf[head], &v, sizeof(v));
+	}
+
+	void bytes(const void *p, int n)
+	{
+		reserve(n);
+		head -= n;
+		memcpy(&buf[head], p, n);
+	}
+
+	quint32 string(const QByteArray &s)
+	{
+		align(4, s.size() + 1);
+		pad(1);
+		bytes(s.constData(), s.size());
+		push((quint32) s.size());
+		return size();
+	}
+
+	quint32 structs(const void *p, int n, int elemSize, int elemAlign)
+	{
+		align(4, n * elemSize);
+		align(elemAlign, n * elemSize);
+		bytes(p, n * elemSize);
+		push((quint32) n);
+		return size();
+	}
+
+	quint32 offsets(const QVector<quint32> &offs)
+	{
+		int i;
+
+		align(4, offs.size() * 4);
+		for (i = offs.size() - 1; i >= 0; i--) {
+			push(refer(offs[i]));
+		}
+		push((quint32) offs.size());
+		return size();
+	}
+
+	void start(void)
+	{
+		fieldIds.clear();
+		fieldAt.clear();
+		tableStart = size();
+	}
+
+	template<typename T> void field(int id, T v)
+	{
+		align(sizeof(v));
+		push(v);
+		fieldIds.append(id);
+		fieldAt.append(size());
+	}
+
+	void offsetField(int id, quint32 off)
+	{
+		align(4);
+		push(refer(off));
+		fieldIds.append(id);
+		fieldAt.append(size());
+	}
+
+	quint32 end(void)
+	{
+		QVector<quint16> vtableSlots;
+		quint32 table, vtable;
+		qint32 soffset;
+		int i, n;
+
+		align(4);
+		push((qint32) 0);
+		table = size();
+
+		for (n = 0, i = 0; i < fieldIds.size(); i++) {
+			n = qMax(n, fieldIds[i] + 1);
+		}
+
+		vtableSlots.fill(0, n);
+		for (i = 0; i < fieldIds.size(); i++) {
+			vtableSlots[fieldIds[i]] = table - fieldAt[i];
+		}
+
+		for (i = n - 1; i >= 0; i--) {
+			push(vtableSlots[i]);
+		}
+		push((quint16) (table - tableStart));
+		push((quint16) (4 + 2 * n));
+		vtable = size();
+
+		// The table starts with the distance back to its vtable
+		soffset = vtable - table;
+		memcpy(&buf[buf.size() - table], &soffset, sizeof(soffset));
+
+		return table;
+	}
+
+	QByteArray finish(quint32 root)
+	{
+		align(qMax(minAlign, ARROW_ALIGN), 4);
+		push(refer(root));
+		return QByteArray((const char *) &buf[head], size());
+	}
+
+private:
+	std::vector<quint8> buf;
+	quint32 head;
+	int minAlign;
+	quint32 tableStart;
+	QVector<int> fieldIds;
+	QVector<quint32> fieldAt;			// where each field ended
+
+	// uoffset from where the next 4 bytes go to off
+	quint32 refer(quint32 off) const { return size() + 4 - off; }
+
+	void reserve(int n)
+	{
+		quint32 used, grown;
+
+		if (head >= (quint32) n) {
+			return;
+		}
+
+		used = size();
+		grown = qMax((quint32) buf.size() * 2, used + n);
+		std::vector<quint8> bigger(grown);
+		memcpy(&bigger[grown - used], &buf[head], used);
+		buf.swap(bigger);
+		head = grown - used;
+	}
+};
+
+//
+// Schema table, for the schema message and again in the footer
+//
+static quint32 buildSchema(FDCFlatBuilder &fb, const QStringList &links)
+{
+	QVector<quint32> fieldOffs, metaOffs, none;
+	quint32 type, name, children, key, value;
+	int c;
+
+	for (c = 0; FDCArrowWriter::columns[c].name != NULL; c++) {
+		const tarrowcol_t &col = FDCArrowWriter::columns[c];
+
+		fb.start();
+		if (col.type == ARROW_COL_INT) {
+			fb.field(0, (qint32) col.bits);
+			fb.field(1, (quint8) col.isSigned);
+		}
+		type = fb.end();
+
+		name = fb.string(col.name);
+		children = fb.offsets(none);
+
+		fb.start();
+		fb.offsetField(0, name);
+		fb.field(1, (quint8) col.nullable);
+		fb.field(2, (quint8) ((col.type == ARROW_COL_INT) ? ARROW_TYPE_INT : ARROW_TYPE_UTF8));
+		fb.offsetField(3, type);
+		fb.offsetField(5, children);
+		fieldOffs.append(fb.end());
+	}
+
+	key = fb.string("links");
+	value = fb.string(links.join(',').toUtf8());
+
+	fb.start();
+	fb.offsetField(0, key);
+	fb.offsetField(1, value);
+	metaOffs.append(fb.end());
+
+	fieldOffs = QVector<quint32>() << fb.offsets(fieldOffs);
+	metaOffs = QVector<quint32>() << fb.offsets(metaOffs);
+
+	fb.start();
+	fb.field(0, (qint16) 0);			// little endian
+	fb.offsetField(1, fieldOffs[0]);
+	fb.offsetField(2, metaOffs[0]);
+
+	return fb.end();
+}
+
+static QByteArray message(FDCFlatBuilder &fb, quint8 headerType, quint32 header, qint64 bodyLength)
+{
+	fb.start();
+	fb.field(0, (qint16) ARROW_VERSION);
+	fb.field(1, headerType);
+	fb.offsetField(2, header);
+	fb.field(3, bodyLength);
+
+	return fb.finish(fb.end());
+}
+
+//
+// Bytes the transaction put on the line, as far as it got
+//
+static quint32 lineBytes(const tcaprecord_t &rec)
+{
+	quint32 n;
+
+	n = CMDBUF_SIZE;
+
+	if (rec.cmd == CMD_READ) {
+		n += (rec.result == LINK_OK) ? rec.length + 2 : 0;
+	}
+	else {
+		n += (rec.tResp) ? CMDBUF_SIZE : 0;
+	}
+
+	if (rec.cmd == CMD_WRIT) {
+		n += (rec.tData) ? rec.length + 2 : 0;
+		n += (rec.tWsta) ? CMDBUF_SIZE : 0;
+	}
+
+	return n;
+}
+
+static qint64 value(const tarrowrow_t &row, int col)
+{
+	const qint64 *times = &row.rec.tQueued;
+
+	switch (col) {
+		case COL_LINK:		return row.link;
+		case COL_SEQ:		return row.seq;
+		case COL_DRIVE:		return row.rec.drive;
+		case COL_TRACK:		return row.rec.track;
+		case COL_LENGTH:	return row.rec.length;
+		case COL_RESULT:	return row.rec.result;
+		case COL_RCODE:		return row.rec.rcode;
+		case COL_RDATA:		return row.rec.rdata;
+		case COL_BYTES:		return lineBytes(row.rec);
+		case COL_RETRIES:	return row.retries;
+		default:		return times[col - COL_T_QUEUED];
+	}
+}
+
+FDCArrowWriter::FDCArrowWriter()
+{
+	rows = 0;
+	batches = 0;
+}
+
+FDCArrowWriter::~FDCArrowWriter()
+{
+	if (file.isOpen()) {
+		close();
+	}
+}
+
+QByteArray FDCArrowWriter::schema(bool isMessage) const
+{
+	FDCFlatBuilder fb;
+	quint32 s;
+
+	s = buildSchema(fb, linkNames);
+
+	if (isMessage) {
+		return message(fb, ARROW_HEADER_SCHEMA, s, 0);
+	}
+
+	return fb.finish(s);
+}
+
+bool FDCArrowWriter::create(const QString &fileName, const QStringList &links)
+{
+	static const char lead[8] = ARROW_MAGIC;
+
+	file.setFileName(fileName);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	linkNames = links;
+	pending.reserve(ARROW_BATCH);
+	blocks.clear();
+	rows = 0;
+	batches = 0;
+
+	if (file.write(lead, sizeof(lead)) != sizeof(lead) || !writeMessage(schema(true), QByteArray(), NULL)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		file.close();
+		return false;
+	}
+
+	return true;
+}
+
+bool FDCArrowWriter::append(const tarrowrow_t &row)
+{
+	pending.append(row);
+	rows++;
+
+	return (pending.size() < ARROW_BATCH) ? true : flushBatch();
+}
+
+//
+// Continuation marker, metadata length, flatbuffer padded to ARROW_ALIGN,
+// then the body
+//
+bool FDCArrowWriter::writeMessage(const QByteArray &meta, const QByteArray &body, tarrowblock_t *block)
+{
+	QByteArray prefix(8, 0);
+	qint32 length;
+	quint32 marker;
+
+	length = (meta.size() + ARROW_ALIGN - 1) & ~(ARROW_ALIGN - 1);
+	marker = ARROW_CONTINUATION;
+	memcpy(prefix.data(), &marker, 4);
+	memcpy(prefix.data() + 4, &length, 4);
+
+	if (block != NULL) {
+		block->offset = file.pos();
+		block->metaLength = 8 + length;
+		block->bodyLength = body.size();
+	}
+
+	return file.write(prefix) == prefix.size()
+		&& file.write(meta) == meta.size()
+		&& file.write(QByteArray(length - meta.size(), 0)) == length - meta.size()
+		&& file.write(body) == body.size();
+}
+
+//
+// One record batch of everything pending: for each column a validity
+// bitmap (empty when nothing is null), then the values, or for strings the
+// offsets and then the bytes
+//
+bool FDCArrowWriter::flushBatch()
+{
+	FDCFlatBuilder fb;
+	QByteArray body;
+	QVector<qint64> nodes, buffers;
+	quint32 nodeVec, bufferVec, batch;
+	qint64 n, nulls, start, v;
+	tarrowblock_t block;
+	quint8 *p;
+	qint32 offset;
+	int c, i, width;
+
+	if (pending.isEmpty()) {
+		return true;
+	}
+
+	n = pending.size();
+
+	auto addBuffer = [&](qint64 length) -> quint8 * {
+		start = body.size();
+		body.resize(start + ((length + ARROW_ALIGN - 1) & ~(ARROW_ALIGN - 1)));
+		memset(body.data() + start, 0, body.size() - start);
+		buffers << start << length;
+		return (quint8 *) body.data() + start;
+	};
+
+	for (c = 0; columns[c].name != NULL; c++) {
+		const tarrowcol_t &col = columns[c];
+
+		// Validity
+		for (nulls = 0, i = 0; col.nullable && i < n; i++) {
+			nulls += (value(pending[i], c) == 0);
+		}
+
+		if (nulls) {
+			p = addBuffer((n + 7) / 8);
+			for (i = 0; i < n; i++) {
+				if (value(pending[i], c) != 0) {
+					p[i / 8] |= 1 << (i % 8);
+				}
+			}
+		}
+		else {
+			buffers << body.size() << 0;
+		}
+
+		nodes << n << nulls;
+
+		if (col.type == ARROW_COL_UTF8) {
+			p = addBuffer((n + 1) * 4);
+			for (offset = 0, i = 0; i < n; i++) {
+				memcpy(p + i * 4, &offset, 4);
+				offset += strlen(FDCMetrics::commandName(pending[i].rec.cmd));
+			}
+			memcpy(p + n * 4, &offset, 4);
+
+			p = addBuffer(offset);
+			for (i = 0; i < n; i++) {
+				const char *s = FDCMetrics::commandName(pending[i].rec.cmd);
+				memcpy(p, s, strlen(s));
+				p += strlen(s);
+			}
+			continue;
+		}
+
+		// Little endian integers, as on every host this builds for
+		width = col.bits / 8;
+		p = addBuffer(n * width);
+		for (i = 0; i < n; i++) {
+			v = value(pending[i], c);
+			memcpy(p + i * width, &v, width);
+		}
+	}
+
+	nodeVec = fb.structs(nodes.constData(), nodes.size() / 2, 16, 8);
+	bufferVec = fb.structs(buffers.constData(), buffers.size() / 2, 16, 8);
+
+	fb.start();
+	fb.field(0, n);
+	fb.offsetField(1, nodeVec);
+	fb.offsetField(2, bufferVec);
+	batch = fb.end();
+
+	if (!writeMessage(message(fb, ARROW_HEADER_BATCH, batch, body.size()), body, &block)) {
+		lastError = QString("%1: %2").arg(file.fileName()).arg(file.errorString());
+		return false;
+	}
+
+	blocks.append(block);
+	batches++;
+	pending.clear();
+
+	return true;
+}
+
+//
+// Last batch, end of stream, then the footer: schema and where each batch
+// is, its length, and the magic again
+//
+bool FDCArrowWriter::close()
+{
+	static const char trail[6] = { 'A', 'R', 'R', 'O', 'W', '1' };
+	FDCFlatBuilder fb;
+	QByteArray footer, blockBytes, eos(8, 0);
+	quint32 s, blockVec;
+	quint32 marker;
+	qint32 length;
+	bool ok;
+	int i;
+
+	ok = flushBatch();
+
+	marker = ARROW_CONTINUATION;
+	memcpy(eos.data(), &marker, 4);
+
+	// Block is { long offset; int metaDataLength; (pad); long bodyLength }
+	blockBytes = QByteArray(blocks.size() * 24, 0);
+	for (i = 0; i < blocks.size(); i++) {
+		memcpy(blockBytes.data() + i * 24, &blocks[i].offset, 8);
+		memcpy(blockBytes.data() + i * 24 + 8, &blocks[i].metaLength, 4);
+		memcpy(blockBytes.data() + i * 24 + 16, &blocks[i].bodyLength, 8);
+	}
+
+	s = buildSchema(fb, linkNames);
+	blockVec = fb.structs(blockBytes.constData(), blocks.size(), 24, 8);
+
+	fb.start();
+	fb.field(0, (qint16) ARROW_VERSION);
+	fb.offsetField(1, s);
+	fb.offsetField(3, blockVec);
+	footer = fb.finish(fb.end());
+	length = footer.size();
+
+	ok = ok && file.write(eos) == eos.size()
+		&& file.write(footer) == footer.size()
+		&& file.write((const char *) &length, 4) == 4
+		&& file.write(trail, sizeof(trail)) == sizeof(trail);
+
+	if (!ok && lastError.isEmpty()) {
+		lastError = QString("%1: %2").arg(file.fileName()).arg(file.errorString());
+	}
+
+	file.close();
+
+	return ok;
+}
+
+//
+// Every transaction of every --export capture, link by link
+//
+int runExport(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCArrowWriter writer;
+	FDCCapture capture;
+	QStringList links;
+	tarrowrow_t row, last;
+	qint64 t0, elapsed;
+	int link;
+
+	for (const QString &fileName : opts.exportFiles) {
+		if (!capture.open(fileName)) {
+			out << capture.errorString() << "\n";
+			return 1;
+		}
+		links.append(fileName);
+		capture.close();
+	}
+
+	if (!writer.create(opts.outputFile, links)) {
+		out << writer.errorString() << "\n";
+		return 1;
+	}
+
+	t0 = fdcNow();
+
+	for (link = 0; link < opts.exportFiles.size(); link++) {
+		capture.open(opts.exportFiles[link]);
+
+		memset(&row, 0, sizeof(row));
+		memset(&last, 0, sizeof(last));
+		row.link = link;
+
+		while (capture.read(&row.rec)) {
+			// Same command again straight after it failed
+			if (row.seq && last.rec.result != LINK_OK && last.rec.cmd == row.rec.cmd
+				&& last.rec.drive == row.rec.drive && last.rec.track == row.rec.track) {
+				row.retries = last.retries + 1;
+			}
+			else {
+				row.retries = 0;
+			}
+
+			if (!writer.append(row)) {
+				out << writer.errorString() << "\n";
+				return 1;
+			}
+
+			last = row;
+			row.seq++;
+		}
+
+		capture.close();
+	}
+
+	if (!writer.close()) {
+		out << writer.errorString() << "\n";
+		return 1;
+	}
+
+	elapsed = qMax((qint64) 1, fdcNow() - t0);
+
+	out << QString("%1: %2 transactions from %3 capture%4 in %5 record batches, %6 ms (%7 M rows/s)\n")
+		.arg(opts.outputFile).arg(writer.rows).arg(links.size()).arg((links.size() == 1) ? "" : "s")
+		.arg(writer.batches).arg(elapsed / 1e6, 0, 'f', 1).arg(writer.rows * 1e3 / elapsed, 0, 'f', 2);
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+#ifndef FDCARROW_H
+#define FDCARROW_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QFile>
+#include <QVector>
+
+#include "fdc-capture.h"
+#include "fdc-bench.h"
+
+#define ARROW_BATCH		65536			// rows per record batch
+#define ARROW_ALIGN		8			// body buffers and messages
+
+#define ARROW_COL_INT		0			// signed or unsigned integer
+#define ARROW_COL_UTF8		1			// string
+
+//
+// One column of the export: integer columns take their value from
+// tarrowrow_t; nullable times are null where the capture has 0
+//
+typedef struct TARROWCOL {
+	const char *name;
+	int type;				// ARROW_COL_
+	int bits;				// integer width
+	bool isSigned;
+	bool nullable;
+} tarrowcol_t;
+
+typedef struct TARROWROW {
+	tcaprecord_t rec;
+	quint64 seq;				// transaction number on its link
+	quint16 link;				// index of the capture it came from
+	quint16 retries;			// failed attempts at the same command just before
+} tarrowrow_t;
+
+//
+// The batch's place in the file, for the footer
+//
+typedef struct TARROWBLOCK {
+	qint64 offset;				// message start
+	qint32 metaLength;			// prefix and flatbuffer, padded
+	qint64 bodyLength;
+} tarrowblock_t;
+
+//
+// Per transaction records in the Arrow IPC file format (Feather v2), read
+// directly by pyarrow, pandas, polars and DuckDB. Rows are buffered and
+// written as a record batch every ARROW_BATCH, so memory stays flat however
+// long the export. The schema, the batches' positions and the link names
+// (schema metadata "links") go in the footer when the file is closed.
+//
+class FDCArrowWriter
+{
+public:
+	FDCArrowWriter();
+	~FDCArrowWriter();
+
+	bool create(const QString &fileName, const QStringList &links);
+	bool append(const tarrowrow_t &row);
+	bool close(void);
+	QString errorString(void) const { return lastError; }
+
+	quint64 rows;
+	quint64 batches;
+
+	static const tarrowcol_t columns[];
+
+private:
+	QFile file;
+	QStringList linkNames;
+	QVector<tarrowrow_t> pending;
+	QVector<tarrowblock_t> blocks;
+	QString lastError;
+
+	QByteArray schema(bool message) const;
+	bool flushBatch(void);
+	bool writeMessage(const QByteArray &meta, const QByteArray &body, tarrowblock_t *block);
+};
+
+int runExport(const tbenchopts_t &opts);
+
+#endif
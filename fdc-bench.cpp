@@ -0,0 +1,670 @@
+/**********************************************************************************
+*
+*  Headless benchmarks for the FDC+ Serial Drive Simulator
+*
+*  Run from the command line against a live server, e.g.
+*
+*      fdc-sim-gui --bench-serial --port ttyUSB0 --baud 403200 --drive 0
+*      fdc-sim-gui --bench-cache --port ttyUSB0 --drive 0 --sweep 200
+*      fdc-sim-gui --bench-writ --port ttyUSB0 --drive 1 --burst 1,4,16
+*
+*  or, with no server,
+*
+*      fdc-sim-gui --bench-fingerprint --disk 8
+*      fdc-sim-gui --bench-hugepages --disks 512
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QFile>
+#include <QVector>
+#include <QThread>
+
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "fdc-bench.h"
+#include "fdc-link.h"
+#include "fdc-fingerprint.h"
+#include "fdc-store.h"
+#include "fdc-memory.h"
+#include "fdc-writ.h"
+
+#define FP_LIBRARY_DRIVES	16			// drive addresses in a READ/WRIT param1
+
+typedef struct TPROCSTATS {
+	qint64 syscr;				// read syscalls
+	qint64 syscw;				// write syscalls
+	qint64 cpuUsec;				// user + system CPU
+	qint64 ctxSwitches;			// voluntary + involuntary
+} tprocstats_t;
+
+static void procStats(tprocstats_t *stats)
+{
+	struct rusage ru;
+	QFile io("/proc/self/io");
+	QByteArray line;
+
+	stats->syscr = 0;
+	stats->syscw = 0;
+
+	if (io.open(QIODevice::ReadOnly)) {
+		while (!(line = io.readLine()).isEmpty()) {
+			if (line.startsWith("syscr:")) {
+				stats->syscr = line.mid(6).trimmed().toLongLong();
+			}
+			else if (line.startsWith("syscw:")) {
+				stats->syscw = line.mid(6).trimmed().toLongLong();
+			}
+		}
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	stats->cpuUsec = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000LL + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+	stats->ctxSwitches = ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+//
+// READ every track of a drive with each serial backend and compare syscalls,
+// CPU and latency per track.
+//
+int benchSerial(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCShm shm;
+	FDCCapture capture;
+	FDCFeed feed;
+	quint8 trackBuf[TRACKBUF_LEN_CRC];
+	tprocstats_t before, after;
+	int backend, pass, track, errors, n;
+	int result;
+
+	result = 0;
+
+	if (!opts.captureFile.isEmpty() && opts.backend == -1) {
+		out << "--capture needs --backend\n";
+		return 2;
+	}
+
+	link.setOutQueueLimit(opts.outQueueLimit);
+
+	if (!opts.shmName.isEmpty()) {
+		if (!shm.create(opts.shmName)) {
+			out << shm.errorString() << "\n";
+			return 1;
+		}
+		link.setShm(&shm, opts.portName);
+	}
+
+	out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9\n")
+		.arg("backend", -14).arg("tracks", 7).arg("errors", 7)
+		.arg("syscall/trk", 12).arg("cpu us/trk", 11).arg("csw/trk", 8)
+		.arg("p50 ms", 8).arg("p99 ms", 8).arg("outq max", 9);
+
+	for (backend = SERIAL_BACKEND_QT; backend <= SERIAL_BACKEND_POSIX; backend++) {
+		if (!FDCSerial::available(backend) || (opts.backend != -1 && opts.backend != backend)) {
+			continue;
+		}
+
+		if (!link.open(opts.portName, opts.baudRate, backend)) {
+			out << link.errorString() << "\n";
+			result = 1;
+			continue;
+		}
+
+		// Make sure the server is there before timing anything
+		if (link.stat(opts.drive, 0) != LINK_OK) {
+			out << QString("%1: no STAT response\n").arg(link.serial()->name());
+			link.close();
+			result = 1;
+			continue;
+		}
+
+		if (!opts.captureFile.isEmpty()) {
+			if (!capture.create(opts.captureFile, link.serial()->name(), opts.portName, opts.baudRate)) {
+				out << capture.errorString() << "\n";
+				link.close();
+				return 1;
+			}
+			link.setCapture(&capture);
+		}
+
+		if (!opts.feedName.isEmpty()) {
+			if (!feed.create(opts.feedName, link.serial()->name(), opts.portName, opts.baudRate)) {
+				out << feed.errorString() << "\n";
+				link.setCapture(NULL);
+				capture.close();
+				link.close();
+				return 1;
+			}
+			link.setFeed(&feed);
+		}
+
+		link.metrics.reset();
+		errors = 0;
+
+		procStats(&before);
+
+		for (pass = 0; pass < opts.passes; pass++) {
+			for (track = 0; track < opts.trackMax; track++) {
+				if (link.read(opts.drive, track, opts.trackLen, trackBuf) != LINK_OK) {
+					errors++;
+				}
+			}
+		}
+
+		procStats(&after);
+
+		link.setCapture(NULL);
+		link.setFeed(NULL);
+		capture.close();
+		feed.close();
+		link.close();
+
+		n = qMax((quint64) 1, link.metrics.commands[CMD_READ]);
+
+		// READ latency from the command leaving the wire to the last byte in
+		out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9\n")
+			.arg(link.serial()->name(), -14)
+			.arg(n, 7)
+			.arg(errors, 7)
+			.arg((double) (after.syscr + after.syscw - before.syscr - before.syscw) / n, 12, 'f', 1)
+			.arg((double) (after.cpuUsec - before.cpuUsec) / n, 11, 'f', 1)
+			.arg((double) (after.ctxSwitches - before.ctxSwitches) / n, 8, 'f', 1)
+			.arg(link.metrics.latency[CMD_READ].percentile(0.50) / 1e6, 8, 'f', 2)
+			.arg(link.metrics.latency[CMD_READ].percentile(0.99) / 1e6, 8, 'f', 2)
+			.arg(link.metrics.outQueue.max(), 9);
+
+		if (errors) {
+			result = 1;
+		}
+	}
+
+	return result;
+}
+
+//
+// READ bursts of consecutive tracks and WRIT them straight back unchanged,
+// for each burst length, and break every WRIT into ack, data and commit.
+// Commit by position in the burst shows whether the server flushes each
+// track or caches them. A track that didn't READ cleanly isn't written.
+//
+int benchWrit(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	QByteArray tracks;
+	QString detail;
+	quint8 *buf;
+	int burst, longest, pass, first, i, read, errors;
+	int result;
+
+	link.setOutQueueLimit(opts.outQueueLimit);
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	if (!(link.response.rdata & (1 << opts.drive))) {
+		out << QString("Drive %1 is not mounted\n").arg(opts.drive);
+		return 1;
+	}
+
+	result = 0;
+	longest = 0;
+
+	out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+		.arg("burst", 6).arg("writes", 7).arg("errors", 7).arg("ack p50", 9).arg("data p50", 9)
+		.arg("commit p50", 11).arg("commit p99", 11).arg("tail p50", 9);
+
+	for (int length : opts.bursts) {
+		burst = qBound(1, length, (int) opts.trackMax);
+		tracks.resize(burst * TRACKBUF_LEN_CRC);
+		link.writs.reset();
+		errors = 0;
+
+		for (pass = 0; pass < opts.passes; pass++) {
+			for (first = 0; first + burst <= opts.trackMax; first += burst) {
+				for (read = 0; read < burst; read++) {
+					buf = (quint8 *) tracks.data() + read * TRACKBUF_LEN_CRC;
+					if (link.read(opts.drive, first + read, opts.trackLen, buf) != LINK_OK) {
+						errors++;
+						break;
+					}
+				}
+
+				// Idle long enough that the WRITs are a burst of their own
+				QThread::msleep(WRIT_BURST_GAP);
+
+				for (i = 0; i < read; i++) {
+					buf = (quint8 *) tracks.data() + i * TRACKBUF_LEN_CRC;
+					if (link.writ(opts.drive, first + i, opts.trackLen, buf) != LINK_OK || link.response.rcode != STAT_OK) {
+						errors++;
+					}
+				}
+			}
+		}
+
+		const FDCHistogram *phases = link.writs.phases[opts.drive];
+		const FDCHistogram &last = link.writs.commitByBurst[FDCWritPhases::burstClass(burst)];
+
+		out << QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+			.arg(burst, 6).arg(phases[WRIT_PHASE_ACK].count(), 7).arg(errors, 7)
+			.arg(phases[WRIT_PHASE_ACK].percentile(0.50) / 1e6, 9, 'f', 2)
+			.arg(phases[WRIT_PHASE_DATA].percentile(0.50) / 1e6, 9, 'f', 2)
+			.arg(phases[WRIT_PHASE_COMMIT].percentile(0.50) / 1e6, 11, 'f', 2)
+			.arg(phases[WRIT_PHASE_COMMIT].percentile(0.99) / 1e6, 11, 'f', 2)
+			.arg(last.percentile(0.50) / 1e6, 9, 'f', 2);
+		out.flush();
+
+		if (errors) {
+			result = 1;
+		}
+
+		if (burst > longest) {
+			longest = burst;
+			detail = link.writs.report();
+		}
+	}
+
+	// Commit along the longest burst
+	if (longest > 1) {
+		out << "\n" << detail;
+	}
+
+	link.close();
+
+	return result;
+}
+
+//
+// Server time of the last transaction: latency less the wire time of the
+// command, response and track, so cache effects aren't hidden by the line
+//
+static qint64 serverTime(const FDCLink &link, quint16 trackLen)
+{
+	qint64 wire;
+
+	wire = (link.serial()->baud()) ? (CMDBUF_SIZE + trackLen + 2) * 10 * 1000000000LL / link.serial()->baud() : 0;
+
+	return qMax((qint64) 0, link.last.tDone - link.last.tSent - wire);
+}
+
+//
+// Time the first READ of every track of a freshly mounted drive (cold) and
+// immediate repeats (warm). Then, for growing working sets, prime a probe
+// track, READ the set and re-read the probe: once the set no longer fits in
+// the server's cache the probe reads cold again, which gives its size.
+//
+int benchCache(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCCapture capture;
+	quint8 trackBuf[TRACKBUF_LEN_CRC];
+	QVector<quint32> pool;
+	FDCHistogram cold, warm, coldServer, warmServer;
+	qint64 threshold, probe, fits, limit;
+	quint16 mounted;
+	int track, pass, drive, set, i, n, errors;
+
+	link.setOutQueueLimit(opts.outQueueLimit);
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	mounted = link.response.rdata;
+
+	if (!opts.captureFile.isEmpty()) {
+		if (!capture.create(opts.captureFile, link.serial()->name(), opts.portName, opts.baudRate)) {
+			out << capture.errorString() << "\n";
+			return 1;
+		}
+		link.setCapture(&capture);
+	}
+
+	if (!(mounted & (1 << opts.drive))) {
+		out << QString("Drive %1 is not mounted\n").arg(opts.drive);
+		return 1;
+	}
+
+	errors = 0;
+
+	// Cold, then warm repeats of the same track
+	for (track = 0; track < opts.trackMax; track++) {
+		if (link.read(opts.drive, track, opts.trackLen, trackBuf) != LINK_OK) {
+			errors++;
+			continue;
+		}
+		cold.record(link.last.tDone - link.last.tSent);
+		coldServer.record(serverTime(link, opts.trackLen));
+
+		for (pass = 0; pass < opts.passes; pass++) {
+			if (link.read(opts.drive, track, opts.trackLen, trackBuf) != LINK_OK) {
+				errors++;
+				continue;
+			}
+			warm.record(link.last.tDone - link.last.tSent);
+			warmServer.record(serverTime(link, opts.trackLen));
+		}
+	}
+
+	out << QString("%1 %2 %3 %4 %5 %6\n")
+		.arg("", -6).arg("reads", 7).arg("p50 ms", 9).arg("p99 ms", 9).arg("server p50", 11).arg("server p99", 11);
+	out << QString("%1 %2 %3 %4 %5 %6\n")
+		.arg("cold", -6).arg(cold.count(), 7)
+		.arg(cold.percentile(0.50) / 1e6, 9, 'f', 2).arg(cold.percentile(0.99) / 1e6, 9, 'f', 2)
+		.arg(coldServer.percentile(0.50) / 1e6, 11, 'f', 3).arg(coldServer.percentile(0.99) / 1e6, 11, 'f', 3);
+	out << QString("%1 %2 %3 %4 %5 %6\n")
+		.arg("warm", -6).arg(warm.count(), 7)
+		.arg(warm.percentile(0.50) / 1e6, 9, 'f', 2).arg(warm.percentile(0.99) / 1e6, 9, 'f', 2)
+		.arg(warmServer.percentile(0.50) / 1e6, 11, 'f', 3).arg(warmServer.percentile(0.99) / 1e6, 11, 'f', 3);
+	out << QString("cold/warm latency %1, server time %2\n")
+		.arg((double) cold.percentile(0.50) / qMax((qint64) 1, warm.percentile(0.50)), 0, 'f', 2)
+		.arg((double) coldServer.percentile(0.50) / qMax((qint64) 1, warmServer.percentile(0.50)), 0, 'f', 2);
+
+	// Working set pool: every track of every mounted drive but the probe
+	for (drive = 0; drive < MAX_DRIVE; drive++) {
+		if (mounted & (1 << drive)) {
+			for (track = 0; track < opts.trackMax; track++) {
+				if (drive != opts.drive || track != 0) {
+					pool.append((drive << 16) | track);
+				}
+			}
+		}
+	}
+
+	n = (opts.sweep > 0) ? qMin(opts.sweep, (int) pool.size()) : pool.size();
+
+	// A probe re-read slower than halfway between warm and cold missed. The
+	// wire time is the same for both so plain latency will do.
+	threshold = (cold.percentile(0.50) + warm.percentile(0.50)) / 2;
+	fits = 0;
+	limit = 0;
+
+	out << QString("\n%1 %2 %3 %4\n").arg("set", 6).arg("bytes", 10).arg("probe ms", 9).arg("cache", 6);
+
+	for (set = 1; set <= n; set = (set < n && set * 2 > n) ? n : set * 2) {
+		link.read(opts.drive, 0, opts.trackLen, trackBuf);
+
+		for (i = 0; i < set; i++) {
+			if (link.read(pool[i] >> 16, pool[i] & 0xffff, opts.trackLen, trackBuf) != LINK_OK) {
+				errors++;
+			}
+		}
+
+		if (link.read(opts.drive, 0, opts.trackLen, trackBuf) != LINK_OK) {
+			errors++;
+			continue;
+		}
+
+		probe = link.last.tDone - link.last.tSent;
+
+		out << QString("%1 %2 %3 %4\n")
+			.arg(set + 1, 6).arg((qint64) (set + 1) * opts.trackLen, 10)
+			.arg(probe / 1e6, 9, 'f', 2)
+			.arg((probe < threshold) ? "hit" : "miss", 6);
+
+		// Largest working set still cached, smallest that wasn't
+		if (probe < threshold && !limit) {
+			fits = set + 1;
+		}
+		else if (probe >= threshold && !limit) {
+			limit = set + 1;
+		}
+
+		if (set == n) {
+			break;
+		}
+	}
+
+	if (fits == 0) {
+		out << "Inferred cache size: under 2 tracks or no cache\n";
+	}
+	else if (limit == 0) {
+		out << QString("Inferred cache size: at least %1 tracks (%2 KB), sweep more to find the limit\n")
+			.arg(fits).arg(fits * opts.trackLen / 1024);
+	}
+	else {
+		out << QString("Inferred cache size: %1 to %2 tracks (%3 to %4 KB)\n")
+			.arg(fits).arg(limit - 1).arg(fits * opts.trackLen / 1024).arg((limit - 1) * opts.trackLen / 1024);
+	}
+
+	if (errors) {
+		out << QString("%1 READ errors\n").arg(errors);
+	}
+
+	link.setCapture(NULL);
+	link.close();
+
+	return (errors) ? 1 : 0;
+}
+
+//
+// Fingerprint every track of a full library (FP_LIBRARY_DRIVES drives of
+// the --disk type) with each CRC32C implementation the CPU has, best of
+// --passes, and check they agree. Needs no server.
+//
+int benchFingerprint(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	QVector<quint8> library;
+	QVector<tfingerprint_t> prints, reference;
+	FDCFingerprint fp;
+	tfingerprint_t print;
+	quint32 seed;
+	qint64 start, best, elapsed, bytes, tracks;
+	int impl, saved, pass, i, off, piece, errors;
+
+	tracks = (qint64) FP_LIBRARY_DRIVES * opts.trackMax;
+	bytes = tracks * opts.trackLen;
+	library.resize(bytes);
+	prints.resize(tracks);
+
+	// Anything but zeros, so the table lookups can't all hit one line
+	for (seed = 1, i = 0; i < bytes; i++) {
+		seed = seed * 1103515245 + 12345;
+		library[i] = seed >> 24;
+	}
+
+	saved = FDCFingerprint::implementation();
+	errors = 0;
+
+	out << QString("%1 drives, %2 tracks, %3 KB\n").arg(FP_LIBRARY_DRIVES).arg(tracks).arg(bytes / 1024);
+	out << QString("%1 %2 %3 %4\n").arg("crc32c", -10).arg("ms", 8).arg("GB/s", 8).arg("us/trk", 8);
+
+	for (impl = CRC_IMPL_TABLE; impl <= CRC_IMPL_HW; impl++) {
+		if (!FDCFingerprint::setImplementation(impl)) {
+			continue;
+		}
+
+		for (best = 0, pass = 0; pass < qMax(opts.passes, 3); pass++) {
+			start = fdcNow();
+
+			for (i = 0; i < tracks; i++) {
+				prints[i] = FDCFingerprint::of(&library[i * opts.trackLen], opts.trackLen);
+			}
+
+			elapsed = fdcNow() - start;
+			best = (!best || elapsed < best) ? elapsed : best;
+		}
+
+		out << QString("%1 %2 %3 %4\n")
+			.arg(FDCFingerprint::implementationName(), -10)
+			.arg(best / 1e6, 8, 'f', 3)
+			.arg((double) bytes / qMax((qint64) 1, best), 8, 'f', 2)
+			.arg(best / 1e3 / tracks, 8, 'f', 2);
+
+		if (reference.isEmpty()) {
+			reference = prints;
+		}
+		else if (prints != reference) {
+			out << QString("%1 fingerprints differ from the table's\n").arg(FDCFingerprint::implementationName());
+			errors++;
+		}
+	}
+
+	FDCFingerprint::setImplementation(saved);
+
+	// Streaming in serial sized pieces must give the same answer
+	for (i = 0; i < tracks; i++) {
+		fp.reset();
+
+		for (off = 0; off < opts.trackLen; off += piece) {
+			piece = qMin(61, opts.trackLen - off);
+			fp.update(&library[i * opts.trackLen + off], piece);
+		}
+
+		print = fp.result();
+
+		if (print != reference[i]) {
+			out << QString("Streamed fingerprint of track %1 differs\n").arg(i);
+			errors++;
+			break;
+		}
+	}
+
+	return (errors) ? 1 : 0;
+}
+
+//
+// Bulk verify and diff of a store of --disks disks with each kind of page
+// (or just --pages). Verify fingerprints every track, in random order,
+// against fingerprints taken when the store was filled; diff compares each
+// track with the same track of another disk. Random order means nearly
+// every track lands on a page the TLB hasn't seen lately.
+//
+int benchHugePages(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCTrackStore store;
+	QVector<tfingerprint_t> reference;
+	QVector<quint32> order, other;
+	qint64 start, elapsed, verify, diff, tracks;
+	quint32 seed, t;
+	int disks, pages, pass, i, j, errors;
+
+	disks = opts.disks;
+
+	// Shrink to what the store budget allows rather than fail outright
+	if (FDCMemory::available(MEM_STORE) != -1 && FDCMemory::available(MEM_STORE) / STORE_HUGE_PAGE * STORE_HUGE_PAGE < (qint64) disks * opts.trackMax * opts.trackLen) {
+		disks = FDCMemory::available(MEM_STORE) / STORE_HUGE_PAGE * STORE_HUGE_PAGE / ((qint64) opts.trackMax * opts.trackLen);
+
+		if (disks < 1) {
+			out << "Store memory budget too small for one disk\n";
+			return 1;
+		}
+	}
+
+	tracks = (qint64) disks * opts.trackMax;
+	order.resize(tracks);
+	other.resize(tracks);
+
+	for (i = 0; i < tracks; i++) {
+		order[i] = i;
+	}
+
+	for (seed = 1, i = tracks - 1; i > 0; i--) {
+		seed = seed * 1103515245 + 12345;
+		j = (seed >> 8) % (i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	// Same track on some other disk
+	for (i = 0; i < tracks; i++) {
+		seed = seed * 1103515245 + 12345;
+		other[i] = (disks > 1) ? ((order[i] / opts.trackMax + 1 + (seed >> 8) % (disks - 1)) % disks) * opts.trackMax + order[i] % opts.trackMax : order[i];
+	}
+
+	errors = 0;
+
+	out << QString("%1 disks%2, %3 MB\n").arg(disks).arg((disks < opts.disks) ? " (store budget)" : "").arg((double) tracks * opts.trackLen / (1024 * 1024), 0, 'f', 1);
+	out << QString("%1 %2 %3 %4 %5\n").arg("pages", -8).arg("got", -8).arg("huge MB", 8).arg("verify GB/s", 12).arg("diff GB/s", 10);
+
+	for (pages = STORE_PAGES_NORMAL; pages <= STORE_PAGES_HUGETLB; pages++) {
+		if (opts.pages != -1 && opts.pages != pages) {
+			continue;
+		}
+
+		if (!store.create(disks, opts.trackMax, opts.trackLen, pages)) {
+			out << QString("%1: %2\n").arg(FDCTrackStore::pagesName(pages)).arg(store.errorString());
+			errors++;
+			continue;
+		}
+
+		// Every disk the same image, so diff has to compare every byte
+		for (seed = 1, i = 0; i < store.diskSize(); i++) {
+			seed = seed * 1103515245 + 12345;
+			store.disk(0)[i] = seed >> 24;
+		}
+
+		for (i = 1; i < disks; i++) {
+			memcpy(store.disk(i), store.disk(0), store.diskSize());
+		}
+
+		reference.resize(tracks);
+
+		for (i = 0; i < tracks; i++) {
+			reference[i] = FDCFingerprint::of(store.track(i / opts.trackMax, i % opts.trackMax), opts.trackLen);
+		}
+
+		verify = 0;
+		diff = 0;
+
+		for (pass = 0; pass < qMax(opts.passes, 3); pass++) {
+			start = fdcNow();
+
+			for (i = 0; i < tracks; i++) {
+				if (FDCFingerprint::of(store.track(order[i] / opts.trackMax, order[i] % opts.trackMax), opts.trackLen) != reference[order[i]]) {
+					errors++;
+				}
+			}
+
+			elapsed = fdcNow() - start;
+			verify = (!verify || elapsed < verify) ? elapsed : verify;
+
+			start = fdcNow();
+
+			for (i = 0; i < tracks; i++) {
+				if (memcmp(store.track(order[i] / opts.trackMax, order[i] % opts.trackMax), store.track(other[i] / opts.trackMax, other[i] % opts.trackMax), opts.trackLen)) {
+					errors++;
+				}
+			}
+
+			elapsed = fdcNow() - start;
+			diff = (!diff || elapsed < diff) ? elapsed : diff;
+		}
+
+		// Diff reads two tracks for every one verify reads
+		out << QString("%1 %2 %3 %4 %5\n")
+			.arg(FDCTrackStore::pagesName(pages), -8)
+			.arg(FDCTrackStore::pagesName(store.pages()), -8)
+			.arg(store.hugeBytes() / (1024.0 * 1024.0), 8, 'f', 1)
+			.arg((double) tracks * opts.trackLen / qMax((qint64) 1, verify), 12, 'f', 2)
+			.arg((double) tracks * opts.trackLen * 2 / qMax((qint64) 1, diff), 10, 'f', 2);
+
+		store.close();
+	}
+
+	if (errors) {
+		out << QString("%1 tracks failed to verify or compare\n").arg(errors);
+	}
+
+	return (errors) ? 1 : 0;
+}
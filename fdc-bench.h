@@ -0,0 +1,62 @@
+#ifndef FDCBENCH_H
+#define FDCBENCH_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+typedef struct TBENCHOPTS {
+	QString portName;
+	QStringList ports;
+	quint32 baudRate;
+	int backend;
+	quint8 drive;
+	quint16 trackMax;
+	quint16 trackLen;
+	int passes;
+	qint64 outQueueLimit;
+	int threads;
+	int workflows;
+	int deadline;				// ms per transaction, 0 for protocol timeouts
+	QString shmName;			// metrics segment, empty for none
+	int interval;				// ms between --monitor or --top updates, 0 for once or default
+	int sweep;				// largest --bench-cache working set, 0 for all
+	QString captureFile;			// record every transaction, empty for none
+	QString modelFile;			// capture to model
+	QVector<quint32> modelBauds;		// baud rates to model
+	int modelOverhead;			// us per transaction, -1 for as captured
+	int stats;				// STATs sent by --clock-sync
+	QString serverLog;			// server log for --clock-fit
+	QString outputFile;			// merged log from --clock-fit
+	int disks;				// disks resident in a track store
+	int pages;				// STORE_PAGES_ for the track store, -1 for each
+	QString mountHook;			// mounts and unmounts drives on the server
+	QVector<int> bursts;			// WRIT burst lengths for --bench-writ
+	qint64 ops;				// transactions in a --stress run
+	int writePercent;			// of them WRITs
+	quint32 seed;				// --stress random sequence, 0 for a new one
+	QString feedName;			// live transaction feed, empty for none
+	int kneeMode;				// KNEE_MODE_ for --knee
+	double statRate;			// STATs per second per link (--knee first step, --open-loop)
+	double readRate;			// READs per second per link (--knee first step, --open-loop)
+	int steps;				// --knee steps
+	int stepTime;				// ms per --knee step
+	QString slo;				// --knee latency objectives
+	int duration;				// ms of --open-loop schedule
+	QString edits;				// --edit list, track:where=hex
+	QString cacheDir;			// persistent track cache, empty for none
+	QString serverId;			// names the server's cache file
+	QStringList importFiles;		// logic analyzer exports for --import
+	QStringList exportFiles;		// captures for --export
+	QStringList merkleFiles;		// images or directories for the --merkle commands
+	bool merkleSync;			// copy the tracks --merkle-diff finds
+} tbenchopts_t;
+
+int benchSerial(const tbenchopts_t &opts);
+int benchCache(const tbenchopts_t &opts);
+int benchFingerprint(const tbenchopts_t &opts);
+int benchHugePages(const tbenchopts_t &opts);
+int benchWrit(const tbenchopts_t &opts);
+
+#endif
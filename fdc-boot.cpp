@@ -0,0 +1,249 @@
+/**********************************************************************************
+*
+*  CP/M boot profile for the FDC+ Serial Drive Simulator
+*
+*  Replays the disk traffic of an Altair cold booting CP/M 2.2 from a drive
+*  and reports the time to the A> prompt, the one number that compares
+*  servers, baud rates and adapters the way a user feels them:
+*
+*      fdc-sim-gui --boot --port ttyUSB0 --drive 0 --passes 5
+*
+*  The Altair side (stepping, settling, sectors passing under the head) runs
+*  on a simulated clock from the drive's mechanics; every READ and STAT goes
+*  to the server for real and its measured time is added in. STATs go out
+*  every BOOT_STAT_INTERVAL ms of simulated time as the FDC+ sends them, and
+*  only hold the Altair up when a READ has to wait for one to finish.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QVector>
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fdc-boot.h"
+#include "fdc-link.h"
+#include "fdc-capture.h"
+#include "fdc-feed.h"
+
+//
+// 8" disk: the loader in sector 0 reads the rest of the system tracks 0-1,
+// the BIOS warm boots and reloads CCP and BDOS (44 sectors), the BDOS logs
+// in A: and reads the 64 entry directory on track 2, and the CCP searches
+// it again for $$$.SUB.
+//
+static const tbootstep_t steps8[] = {
+	{ BOOT_PHASE_LOADER, 0, 32 },
+	{ BOOT_PHASE_LOADER, 1, 32 },
+	{ BOOT_PHASE_SYSTEM, 0, 28 },
+	{ BOOT_PHASE_SYSTEM, 1, 16 },
+	{ BOOT_PHASE_LOGIN, 0, 0 },
+	{ BOOT_PHASE_LOGIN, 2, 16 },
+	{ BOOT_PHASE_CCP, 2, 16 }
+};
+
+//
+// Minidisk: system on tracks 0-3, directory on track 4
+//
+static const tbootstep_t steps5[] = {
+	{ BOOT_PHASE_LOADER, 0, 16 },
+	{ BOOT_PHASE_LOADER, 1, 16 },
+	{ BOOT_PHASE_LOADER, 2, 16 },
+	{ BOOT_PHASE_LOADER, 3, 16 },
+	{ BOOT_PHASE_SYSTEM, 0, 12 },
+	{ BOOT_PHASE_SYSTEM, 1, 16 },
+	{ BOOT_PHASE_SYSTEM, 2, 16 },
+	{ BOOT_PHASE_LOGIN, 0, 0 },
+	{ BOOT_PHASE_LOGIN, 4, 16 },
+	{ BOOT_PHASE_CCP, 4, 16 }
+};
+
+static const tbootprofile_t profile8 = {
+	"8\" CP/M 2.2", TRACK_MAX_8, TRACK_LEN_8, 32, 360, 2, 10, 20, steps8, sizeof(steps8) / sizeof(steps8[0])
+};
+
+static const tbootprofile_t profile5 = {
+	"Minidisk CP/M 2.2", TRACK_MAX_5, TRACK_LEN_5, 16, 300, 2, 20, 15, steps5, sizeof(steps5) / sizeof(steps5[0])
+};
+
+static const char *phaseNames[BOOT_PHASES] = { "boot loader", "CCP/BDOS", "login", "CCP" };
+
+typedef struct TBOOTRUN {
+	qint64 time;				// ns, reset to A>
+	qint64 local[BOOT_PHASES];		// ns, Altair and drive mechanics
+	qint64 link[BOOT_PHASES];		// ns, waiting on the server
+	int reads[BOOT_PHASES];
+	int stats;
+	int errors;
+} tbootrun_t;
+
+//
+// One boot from power on with no track buffered, on the simulated clock
+//
+static void boot(FDCLink &link, const tbootprofile_t &profile, quint8 drive, quint8 *trackBuf, tbootrun_t *run)
+{
+	qint64 sim, nextStat, busyUntil, rev, local, start, latency;
+	int s, head, buffered, phase;
+
+	memset(run, 0, sizeof(*run));
+
+	rev = 60000000000LL / profile.rpm;
+	sim = 0;
+	nextStat = 0;
+	busyUntil = 0;
+	head = 0;
+	buffered = -1;
+
+	for (s = 0; s < profile.count; s++) {
+		const tbootstep_t &step = profile.steps[s];
+
+		phase = step.phase;
+
+		if (step.track != head) {
+			local = (abs(step.track - head) * profile.stepMs + profile.settleMs) * 1000000LL;
+			sim += local;
+			run->local[phase] += local;
+			head = step.track;
+		}
+
+		// STATs due by now, each after the one before
+		for (; nextStat <= sim; nextStat += BOOT_STAT_INTERVAL * 1000000LL) {
+			start = qMax(nextStat, busyUntil);
+			if (link.stat(drive | 0x0100, head) != LINK_OK) {
+				run->errors++;
+			}
+			busyUntil = start + link.last.tDone - link.last.tQueued;
+			run->stats++;
+		}
+
+		if (buffered != head) {
+			start = qMax(sim, busyUntil);
+			if (link.read(drive, head, profile.trackLen, trackBuf) != LINK_OK) {
+				run->errors++;
+			}
+			latency = link.last.tDone - link.last.tQueued;
+			run->link[phase] += start - sim + latency;
+			run->reads[phase]++;
+			sim = start + latency;
+			busyUntil = sim;
+			buffered = head;
+		}
+
+		// Half a turn to the first sector, then one sector in interleave
+		if (step.sectors) {
+			local = rev / 2 + rev * step.sectors * profile.interleave / profile.sectors;
+			sim += local;
+			run->local[phase] += local;
+		}
+	}
+
+	run->time = sim;
+}
+
+int bootProfile(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCCapture capture;
+	FDCFeed feed;
+	const tbootprofile_t *profile;
+	quint8 trackBuf[TRACKBUF_LEN_CRC];
+	QVector<tbootrun_t> runs;
+	QVector<qint64> times;
+	tbootrun_t run;
+	qint64 local, wait;
+	int pass, phase, reads, errors;
+
+	profile = (opts.trackLen == TRACK_LEN_5) ? &profile5 : &profile8;
+
+	link.setOutQueueLimit(opts.outQueueLimit);
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	if (!(link.response.rdata & (1 << opts.drive))) {
+		out << QString("Drive %1 is not mounted\n").arg(opts.drive);
+		return 1;
+	}
+
+	if (!opts.feedName.isEmpty()) {
+		if (!feed.create(opts.feedName, link.serial()->name(), opts.portName, opts.baudRate)) {
+			out << feed.errorString() << "\n";
+			return 1;
+		}
+		link.setFeed(&feed);
+	}
+
+	if (!opts.captureFile.isEmpty()) {
+		if (!capture.create(opts.captureFile, link.serial()->name(), opts.portName, opts.baudRate)) {
+			out << capture.errorString() << "\n";
+			return 1;
+		}
+		link.setCapture(&capture);
+	}
+
+	out << QString("%1 from drive %2 at %3 baud\n\n").arg(profile->name).arg(opts.drive).arg(opts.baudRate);
+	out << QString("%1 %2 %3 %4 %5 %6\n").arg("boot", 5).arg("time ms", 9).arg("server ms", 10).arg("reads", 6).arg("stats", 6).arg("errors", 7);
+
+	for (errors = 0, pass = 0; pass < opts.passes; pass++) {
+		boot(link, *profile, opts.drive, trackBuf, &run);
+
+		for (wait = 0, reads = 0, phase = 0; phase < BOOT_PHASES; phase++) {
+			wait += run.link[phase];
+			reads += run.reads[phase];
+		}
+
+		out << QString("%1 %2 %3 %4 %5 %6\n")
+			.arg(pass + 1, 5).arg(run.time / 1e6, 9, 'f', 1).arg(wait / 1e6, 10, 'f', 1)
+			.arg(reads, 6).arg(run.stats, 6).arg(run.errors, 7);
+		out.flush();
+
+		runs.append(run);
+		times.append(run.time);
+		errors += run.errors;
+	}
+
+	link.setCapture(NULL);
+	link.setFeed(NULL);
+	capture.close();
+	link.close();
+
+	// Where the time goes, averaged over the boots
+	out << QString("\n%1 %2 %3 %4\n").arg("phase", -12).arg("local ms", 9).arg("server ms", 10).arg("reads", 6);
+
+	for (phase = 0; phase < BOOT_PHASES; phase++) {
+		for (local = 0, wait = 0, reads = 0, pass = 0; pass < runs.size(); pass++) {
+			local += runs[pass].local[phase];
+			wait += runs[pass].link[phase];
+			reads += runs[pass].reads[phase];
+		}
+
+		out << QString("%1 %2 %3 %4\n")
+			.arg(phaseNames[phase], -12)
+			.arg(local / 1e6 / runs.size(), 9, 'f', 1)
+			.arg(wait / 1e6 / runs.size(), 10, 'f', 1)
+			.arg((double) reads / runs.size(), 6, 'f', 1);
+	}
+
+	std::sort(times.begin(), times.end());
+
+	out << QString("\nBoot to A> in %1 ms (median of %2, best %3, worst %4)\n")
+		.arg(times[times.size() / 2] / 1e6, 0, 'f', 1).arg(times.size())
+		.arg(times.first() / 1e6, 0, 'f', 1).arg(times.last() / 1e6, 0, 'f', 1);
+
+	if (errors) {
+		out << QString("%1 transactions failed\n").arg(errors);
+	}
+
+	return (errors) ? 1 : 0;
+}
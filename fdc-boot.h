@@ -0,0 +1,45 @@
+#ifndef FDCBOOT_H
+#define FDCBOOT_H
+
+#include <QtGlobal>
+
+#include "fdc-bench.h"
+
+#define BOOT_STAT_INTERVAL	100			// ms, the FDC+ STATs about ten times a second
+
+#define BOOT_PHASE_LOADER	0			// boot loader reads the system tracks
+#define BOOT_PHASE_SYSTEM	1			// BIOS warm boot reloads CCP and BDOS
+#define BOOT_PHASE_LOGIN	2			// BDOS homes and reads the directory
+#define BOOT_PHASE_CCP		3			// CCP looks for $$$.SUB, then A>
+#define BOOT_PHASES		4
+
+//
+// One head position in the boot and the sectors the Altair reads there.
+// Arriving at a track the FDC+ fetches it whole with a READ; sectors are
+// then read from its buffer at rotational speed.
+//
+typedef struct TBOOTSTEP {
+	int phase;				// BOOT_PHASE_
+	quint16 track;
+	int sectors;
+} tbootstep_t;
+
+//
+// A drive and the CP/M boot from it
+//
+typedef struct TBOOTPROFILE {
+	const char *name;
+	quint16 trackMax;
+	quint16 trackLen;
+	int sectors;				// per track
+	int rpm;
+	int interleave;				// sector times per sector read
+	int stepMs;				// per track stepped
+	int settleMs;				// head settle after stepping
+	const tbootstep_t *steps;
+	int count;
+} tbootprofile_t;
+
+int bootProfile(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,555 @@
+/**********************************************************************************
+*
+*  Persistent track cache for the FDC+ Serial Drive Simulator
+*
+*  Tracks read from a server are kept in a file and mapped back in by the
+*  next session, so an investigation spread over several runs pays the wire
+*  time for each track once:
+*
+*      fdc-sim-gui --cache-fill --port ttyUSB0 --drive 0 --track-cache ~/.cache/fdc-sim-gui
+*      fdc-sim-gui --edit 2:s3+7=e5e5 --port ttyUSB0 --drive 0 --track-cache ~/.cache/fdc-sim-gui
+*
+*  There is one file per server (--server-id, default the port name) and
+*  disk type. Held tracks are revalidated lazily: the first time a drive is
+*  used its directory track is read anyway, and if the server no longer has
+*  it the drive starts a new generation and everything held for it is
+*  dropped. Edits go through confirm(), which always reads the track and
+*  drops the drive's copies if the held one differs. --merkle-verify and
+*  the dialog's READ and sector editor use the cache too, the dialog when
+*  FDC_TRACK_CACHE names the directory.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QDateTime>
+#include <QDir>
+
+#include <atomic>
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "fdc-cache.h"
+#include "fdc-memory.h"
+
+FDCTrackCache::FDCTrackCache()
+{
+	header = NULL;
+	entries = NULL;
+	tracks = NULL;
+	size = 0;
+	mapped = 0;
+	dirTrack = 0;
+	hits = 0;
+	misses = 0;
+	confirmed = 0;
+	stale = 0;
+	damaged = 0;
+}
+
+FDCTrackCache::~FDCTrackCache()
+{
+	close();
+}
+
+QString FDCTrackCache::fileFor(const QString &dir, const QString &identity, quint16 trackMax, quint16 trackLen)
+{
+	QString name;
+
+	for (const QChar &c : identity) {
+		name += (c.isLetterOrNumber() || c == '.' || c == '-') ? c : QChar('_');
+	}
+
+	return QString("%1/%2-%3x%4.cache").arg(dir).arg(name).arg(trackMax).arg(trackLen);
+}
+
+//
+// Map the file for this server and geometry, making it if need be. A file
+// left by another version, geometry or server starts over empty. The file is
+// locked, so only one session at a time uses it. If the whole file is over
+// what is left of the store budget, only as many drives' track data as fit
+// are mapped; it fails only if not even one drive fits.
+//
+bool FDCTrackCache::open(const QString &dir, const QString &identity, quint16 trackMax, quint16 trackLen)
+{
+#ifdef Q_OS_UNIX
+	QByteArray id;
+	struct stat st;
+	size_t entryBytes, driveBytes, fileSize;
+	qint64 available;
+	void *p;
+	int fd, d;
+
+	close();
+
+	path = fileFor(dir, identity, trackMax, trackLen);
+	id = identity.toUtf8();
+	entryBytes = ((MAX_DRIVE * trackMax * sizeof(tcacheentry_t)) + CACHE_HEADER_LEN - 1) & ~((size_t) CACHE_HEADER_LEN - 1);
+	driveBytes = (size_t) trackMax * trackLen;
+	fileSize = CACHE_HEADER_LEN + entryBytes + MAX_DRIVE * driveBytes;
+
+	if (!QDir().mkpath(dir)) {
+		lastError = QString("%1: can't make the directory").arg(dir);
+		return false;
+	}
+
+	// Shrink to the drives that fit rather than not cache at all
+	mapped = MAX_DRIVE;
+	if ((available = FDCMemory::available(MEM_STORE)) != -1 && (size_t) available < fileSize) {
+		mapped = ((size_t) available > CACHE_HEADER_LEN + entryBytes) ? (available - CACHE_HEADER_LEN - entryBytes) / driveBytes : 0;
+	}
+	size = CACHE_HEADER_LEN + entryBytes + mapped * driveBytes;
+
+	if (mapped == 0 || !FDCMemory::reserve(MEM_STORE, size)) {
+		lastError = QString("%1: not even one drive (%2 KB) fits the store budget of %3 MB")
+			.arg(path).arg((CACHE_HEADER_LEN + entryBytes + driveBytes) >> 10).arg(FDCMemory::limit(MEM_STORE) >> 20);
+		mapped = 0;
+		size = 0;
+		return false;
+	}
+
+	if ((fd = ::open(path.toLocal8Bit().constData(), O_RDWR | O_CREAT, 0644)) == -1) {
+		lastError = QString("%1: %2").arg(path).arg(strerror(errno));
+		FDCMemory::release(MEM_STORE, size);
+		return false;
+	}
+
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+		lastError = QString("%1: in use by another session").arg(path);
+		::close(fd);
+		FDCMemory::release(MEM_STORE, size);
+		return false;
+	}
+
+	// The file always has every drive, for sessions with more budget
+	if (fstat(fd, &st) == -1 || ((size_t) st.st_size != fileSize && ftruncate(fd, fileSize) == -1)) {
+		lastError = QString("%1: %2").arg(path).arg(strerror(errno));
+		::close(fd);
+		FDCMemory::release(MEM_STORE, size);
+		return false;
+	}
+
+	// The lock lasts as long as the mapping holds the file open
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED) {
+		lastError = QString("%1: %2").arg(path).arg(strerror(errno));
+		FDCMemory::release(MEM_STORE, size);
+		return false;
+	}
+
+	header = (tcacheheader_t *) p;
+	entries = (tcacheentry_t *) ((char *) p + CACHE_HEADER_LEN);
+	tracks = (quint8 *) p + CACHE_HEADER_LEN + entryBytes;
+
+	if (header->magic != CACHE_MAGIC || header->version != CACHE_VERSION
+		|| header->headerLen != CACHE_HEADER_LEN || header->entryLen != sizeof(tcacheentry_t)
+		|| header->trackMax != trackMax || header->trackLen != trackLen
+		|| header->identity != FDCFingerprint::hash64((const quint8 *) id.constData(), id.size())) {
+		// Entries zeroed first, so nothing is held even if this is cut short
+		header->magic = 0;
+		memset(entries, 0, entryBytes);
+		memset(header, 0, CACHE_HEADER_LEN);
+
+		header->version = CACHE_VERSION;
+		header->headerLen = CACHE_HEADER_LEN;
+		header->entryLen = sizeof(tcacheentry_t);
+		header->trackMax = trackMax;
+		header->trackLen = trackLen;
+		header->identity = FDCFingerprint::hash64((const quint8 *) id.constData(), id.size());
+		strncpy(header->name, id.constData(), sizeof(header->name) - 1);
+
+		for (d = 0; d < MAX_DRIVE; d++) {
+			header->gen[d] = 1;
+		}
+
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = CACHE_MAGIC;
+	}
+
+	for (d = 0; d < MAX_DRIVE; d++) {
+		checked[d] = false;
+	}
+
+	dirTrack = (trackLen == TRACK_LEN_5) ? CACHE_DIR_TRACK_5 : CACHE_DIR_TRACK_8;
+	mountEvents = -1;
+	lastError.clear();
+
+	return true;
+#else
+	Q_UNUSED(dir);
+	Q_UNUSED(identity);
+	Q_UNUSED(trackMax);
+	Q_UNUSED(trackLen);
+	lastError = QString("Track cache not supported");
+	return false;
+#endif
+}
+
+void FDCTrackCache::close()
+{
+#ifdef Q_OS_UNIX
+	if (header != NULL) {
+		munmap(header, size);
+		FDCMemory::release(MEM_STORE, size);
+	}
+#endif
+
+	header = NULL;
+	entries = NULL;
+	tracks = NULL;
+	size = 0;
+	mapped = 0;
+}
+
+//
+// Read a track into buf, track data then checksum as from FDCLink::read,
+// from the file if it is held and its drive has been checked this session.
+// how is set to the CACHE_ code saying where it came from; the call that
+// checks the drive says how that went. Returns the READ's LINK_ code when
+// it had to go to the server.
+//
+int FDCTrackCache::read(FDCLink *link, quint8 drive, quint16 track, quint8 *buf, int *how, FDCCancel *cancel)
+{
+	quint16 len, sum;
+	int r, checkHow;
+
+	len = header->trackLen;
+	checkHow = -1;
+
+	followMounts(link->mounts);
+
+	if (drive < mapped && !checked[drive]) {
+		if ((r = check(link, drive, buf, &checkHow, cancel)) != LINK_OK) {
+			return r;
+		}
+
+		// The check read it already
+		if (track == dirTrack) {
+			if (how != NULL) {
+				*how = checkHow;
+			}
+			return LINK_OK;
+		}
+	}
+
+	if (isHeld(link, drive, track)) {
+		tcacheentry_t &e = entry(drive, track);
+
+		memcpy(buf, data(drive, track), len);
+
+		if (FDCFingerprint::of(buf, len) == e.print) {
+			buf[len] = e.sum & 0x00ff;
+			buf[len + 1] = (e.sum >> 8) & 0x00ff;
+			hits++;
+			if (how != NULL) {
+				*how = (checkHow != -1) ? checkHow : CACHE_HIT;
+			}
+			return LINK_OK;
+		}
+
+		// Torn by a crash mid store, or damaged since
+		e.gen = 0;
+		damaged++;
+	}
+
+	if ((r = link->read(drive, track, len, buf, 0, cancel)) != LINK_OK) {
+		return r;
+	}
+
+	sum = buf[len] | (buf[len + 1] << 8);
+
+	misses++;
+	if (how != NULL) {
+		*how = (checkHow != -1) ? checkHow : CACHE_MISS;
+	}
+
+	store(drive, track, buf, sum);
+
+	return LINK_OK;
+}
+
+//
+// Read a track from the server whatever is held, for an edit that has to
+// start from exactly what the server has. A held copy that differs means
+// the disk was written while nobody was watching, which the directory
+// check doesn't see if the directory didn't change, so nothing held for
+// the drive is trusted any more.
+//
+int FDCTrackCache::confirm(FDCLink *link, quint8 drive, quint16 track, quint8 *buf, int *how, FDCCancel *cancel)
+{
+	quint8 dir[TRACKBUF_LEN_CRC];
+	quint16 len, sum;
+	bool held;
+	int r, checkHow;
+
+	len = header->trackLen;
+
+	followMounts(link->mounts);
+
+	if (drive < mapped && !checked[drive] && (r = check(link, drive, dir, &checkHow, cancel)) != LINK_OK) {
+		return r;
+	}
+
+	held = isHeld(link, drive, track);
+
+	if ((r = link->read(drive, track, len, buf, 0, cancel)) != LINK_OK) {
+		return r;
+	}
+
+	sum = buf[len] | (buf[len + 1] << 8);
+
+	if (!held) {
+		misses++;
+		if (how != NULL) {
+			*how = CACHE_MISS;
+		}
+	}
+	else if (link->last.print == entry(drive, track).print && sum == entry(drive, track).sum) {
+		confirmed++;
+		if (how != NULL) {
+			*how = CACHE_CONFIRMED;
+		}
+	}
+	else {
+		stale++;
+		newGeneration(drive);
+		if (how != NULL) {
+			*how = CACHE_STALE;
+		}
+
+		// The new generation starts with its directory, for the next session
+		// to check against; if that READ fails it is dropped then instead
+		check(link, drive, dir, &checkHow, cancel);
+	}
+
+	store(drive, track, buf, sum);
+
+	return LINK_OK;
+}
+
+//
+// Is the drive's disk the one held? Its directory track is read into buf
+// and compared with the held copy. A mismatch, or no directory held to
+// compare with while other tracks are, drops everything held for the
+// drive.
+//
+int FDCTrackCache::check(FDCLink *link, quint8 drive, quint8 *buf, int *how, FDCCancel *cancel)
+{
+	quint16 len, sum;
+	int r;
+
+	len = header->trackLen;
+
+	if ((r = link->read(drive, dirTrack, len, buf, 0, cancel)) != LINK_OK) {
+		return r;
+	}
+
+	sum = buf[len] | (buf[len + 1] << 8);
+
+	if (isHeld(link, drive, dirTrack) && link->last.print == entry(drive, dirTrack).print && sum == entry(drive, dirTrack).sum) {
+		confirmed++;
+		*how = CACHE_CONFIRMED;
+	}
+	else if (held(drive)) {
+		stale++;
+		newGeneration(drive);
+		*how = CACHE_STALE;
+	}
+	else {
+		misses++;
+		*how = CACHE_MISS;
+	}
+
+	checked[drive] = true;
+	store(drive, dirTrack, buf, sum);
+
+	return LINK_OK;
+}
+
+bool FDCTrackCache::isHeld(FDCLink *link, quint8 drive, quint16 track) const
+{
+	return (drive < mapped && entry(drive, track).gen == header->gen[drive]
+		&& (!link->mounts.known() || (link->mounts.mask() & (1 << drive))));
+}
+
+//
+// Hold a track as the server now has it, e.g. after a WRIT it accepted
+//
+void FDCTrackCache::store(quint8 drive, quint16 track, const quint8 *data, quint16 sum)
+{
+	if (drive >= mapped) {
+		return;
+	}
+
+	tcacheentry_t &e = entry(drive, track);
+
+	// Not held while it changes, in case the process dies half way
+	e.gen = 0;
+	std::atomic_thread_fence(std::memory_order_release);
+
+	memcpy(this->data(drive, track), data, header->trackLen);
+	e.sum = sum;
+	e.print = FDCFingerprint::of(data, header->trackLen);
+	e.stored = QDateTime::currentMSecsSinceEpoch();
+
+	std::atomic_thread_fence(std::memory_order_release);
+	e.gen = header->gen[drive];
+}
+
+void FDCTrackCache::drop(quint8 drive, quint16 track)
+{
+	if (drive < mapped) {
+		entry(drive, track).gen = 0;
+	}
+}
+
+int FDCTrackCache::held(quint8 drive) const
+{
+	int t, n;
+
+	if (drive >= mapped) {
+		return 0;
+	}
+
+	for (n = 0, t = 0; t < header->trackMax; t++) {
+		n += (entry(drive, t).gen == header->gen[drive]);
+	}
+
+	return n;
+}
+
+//
+// Drop everything held for the drive. The next read reads its directory
+// again, so the next session has it to check against.
+//
+void FDCTrackCache::newGeneration(quint8 drive)
+{
+	if (++header->gen[drive] == 0) {
+		header->gen[drive] = 1;
+	}
+
+	checked[drive] = false;
+}
+
+//
+// Any drive mounted or unmounted since the last look gets a new generation
+//
+void FDCTrackCache::followMounts(const FDCMountWatch &mounts)
+{
+	int d;
+
+	// Changes before the cache was first used were before anything was read
+	if (mountEvents == -1 || mounts.events() < mountEvents) {
+		mountEvents = mounts.events();
+		return;
+	}
+
+	if (mounts.events() - mountEvents > MOUNT_LOG_LEN) {
+		for (d = 0; d < MAX_DRIVE; d++) {
+			newGeneration(d);
+		}
+		mountEvents = mounts.events();
+	}
+
+	for (; mountEvents < mounts.events(); mountEvents++) {
+		if (mounts.event(mountEvents).drive < MAX_DRIVE) {
+			newGeneration(mounts.event(mountEvents).drive);
+		}
+	}
+}
+
+//
+// Read every track of --drive through the cache and show what it saved
+//
+int runCacheFill(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCTrackCache cache;
+	quint8 buf[TRACKBUF_LEN_CRC];
+	qint64 took[4], t0;
+	int count[4];
+	int t, r, how, failed;
+
+	if (opts.cacheDir.isEmpty()) {
+		out << "--cache-fill needs --track-cache\n";
+		return 2;
+	}
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	if (!(link.response.rdata & (1 << opts.drive))) {
+		out << QString("Drive %1 is not mounted\n").arg(opts.drive);
+		return 1;
+	}
+
+	// The whole disk's geometry, whatever --tracks limits this run to
+	if (!cache.open(opts.cacheDir, opts.serverId, (opts.trackLen == TRACK_LEN_5) ? TRACK_MAX_5 : TRACK_MAX_8, opts.trackLen)) {
+		out << cache.errorString() << "\n";
+		return 1;
+	}
+
+	out << QString("%1: drive %2 generation %3, %4 tracks held\n")
+		.arg(cache.fileName()).arg(opts.drive).arg(cache.generation(opts.drive)).arg(cache.held(opts.drive));
+
+	if (opts.drive >= cache.drives()) {
+		out << QString("Only drives 0-%1 fit the store budget, drive %2 is read but not kept\n").arg(cache.drives() - 1).arg(opts.drive);
+	}
+	out.flush();
+
+	memset(took, 0, sizeof(took));
+	memset(count, 0, sizeof(count));
+
+	for (failed = 0, t = 0; t < opts.trackMax; t++) {
+		t0 = fdcNow();
+
+		if ((r = cache.read(&link, opts.drive, t, buf, &how)) != LINK_OK) {
+			out << QString("Track %1 could not be read (result %2)\n").arg(t).arg(r);
+			failed++;
+			continue;
+		}
+
+		took[how] += fdcNow() - t0;
+		count[how]++;
+	}
+
+	out << QString("%1 %2 %3\n").arg("", -18).arg("tracks", 6).arg("ms/track", 10);
+	out << QString("%1 %2 %3\n").arg("from the file", -18).arg(count[CACHE_HIT], 6)
+		.arg((count[CACHE_HIT]) ? took[CACHE_HIT] / 1e6 / count[CACHE_HIT] : 0.0, 10, 'f', 3);
+	out << QString("%1 %2 %3\n").arg("read, not held", -18).arg(count[CACHE_MISS], 6)
+		.arg((count[CACHE_MISS]) ? took[CACHE_MISS] / 1e6 / count[CACHE_MISS] : 0.0, 10, 'f', 3);
+	out << QString("%1 %2 %3\n").arg("read to check", -18).arg(count[CACHE_CONFIRMED] + count[CACHE_STALE], 6)
+		.arg((count[CACHE_CONFIRMED] + count[CACHE_STALE]) ? (took[CACHE_CONFIRMED] + took[CACHE_STALE]) / 1e6 / (count[CACHE_CONFIRMED] + count[CACHE_STALE]) : 0.0, 10, 'f', 3);
+
+	if (count[CACHE_STALE]) {
+		out << QString("Drive %1 no longer has the disk that was cached, now generation %2\n")
+			.arg(opts.drive).arg(cache.generation(opts.drive));
+	}
+	if (cache.damaged) {
+		out << QString("%1 held tracks were damaged and read again\n").arg(cache.damaged);
+	}
+
+	out << QString("%1 ms from the file, %2 ms on the wire\n")
+		.arg(took[CACHE_HIT] / 1e6, 0, 'f', 1)
+		.arg((took[CACHE_MISS] + took[CACHE_CONFIRMED] + took[CACHE_STALE]) / 1e6, 0, 'f', 1);
+
+	return (failed) ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+#ifndef FDCCACHE_H
+#define FDCCACHE_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include "fdc-link.h"
+#include "fdc-fingerprint.h"
+#include "fdc-bench.h"
+
+#define CACHE_MAGIC		0x43544446		// "FDTC"
+#define CACHE_VERSION		1			// bump on any layout change
+#define CACHE_HEADER_LEN	4096			// header page, entries start after it
+#define CACHE_NAME_LEN		64			// server identity kept in the header
+#define CACHE_DIR_TRACK_8	2			// CP/M directory, after the system tracks
+#define CACHE_DIR_TRACK_5	4
+
+#define CACHE_HIT		0			// served from the file
+#define CACHE_MISS		1			// not held, read from the server
+#define CACHE_CONFIRMED		2			// read to check the drive or track, and it matched
+#define CACHE_STALE		3			// read to check the drive or track, and it didn't
+
+//
+// File layout: header page, one entry per track of every drive, then the
+// track data, track t of drive d at (d * trackMax + t) * trackLen. A track
+// is held if its entry's generation is the drive's current one; bumping a
+// drive's generation drops all of it without touching the entries.
+//
+typedef struct TCACHEHEADER {
+	quint32 magic;
+	quint16 version;
+	quint16 headerLen;			// CACHE_HEADER_LEN
+	quint32 entryLen;			// sizeof(tcacheentry_t)
+	quint16 trackMax;
+	quint16 trackLen;
+	quint64 identity;			// XXH64 of the server identity
+	quint32 gen[MAX_DRIVE];			// mount generation of each drive, from 1
+	char name[CACHE_NAME_LEN];		// the identity, for people
+} tcacheheader_t;
+
+typedef struct TCACHEENTRY {
+	quint32 gen;				// generation read in, 0 while empty or being written
+	quint16 sum;				// 16 bit track checksum as sent
+	quint16 reserved;
+	tfingerprint_t print;			// of the track data in the file
+	qint64 stored;				// wall clock ms when stored
+} tcacheentry_t;
+
+//
+// Track payloads kept in a file across sessions, one file per server
+// identity and disk geometry, mapped shared so what is read in one run is
+// there for the next. Nothing is trusted blindly on the way back in: the
+// first time a drive is used in a session its directory track is READ and
+// compared with what is held, and a mismatch (another disk mounted while
+// nobody was watching) starts a new generation for the drive. The system
+// tracks can't tell disks apart, being the same on every disk with the
+// same CP/M; the directory names the files and where they are. Mounts and
+// unmounts seen in STAT responses during the session start a generation
+// too, as does confirm() finding a held track changed. Every hit is fingerprinted
+// against its entry, so a torn or damaged file reads as a miss. The
+// mapping counts against the MEM_STORE budget; at the cap it covers only
+// the first drives, and the others are read straight from the server.
+//
+class FDCTrackCache
+{
+public:
+	FDCTrackCache();
+	~FDCTrackCache();
+
+	bool open(const QString &dir, const QString &identity, quint16 trackMax, quint16 trackLen);
+	void close(void);
+	bool isOpen(void) const { return header != NULL; }
+	QString errorString(void) const { return lastError; }
+	QString fileName(void) const { return path; }
+	quint16 trackLen(void) const { return (header != NULL) ? header->trackLen : 0; }
+	int drives(void) const { return mapped; }
+
+	int read(FDCLink *link, quint8 drive, quint16 track, quint8 *buf, int *how = NULL, FDCCancel *cancel = NULL);
+	int confirm(FDCLink *link, quint8 drive, quint16 track, quint8 *buf, int *how = NULL, FDCCancel *cancel = NULL);
+	void store(quint8 drive, quint16 track, const quint8 *data, quint16 sum);
+	void drop(quint8 drive, quint16 track);
+	int held(quint8 drive) const;
+	quint32 generation(quint8 drive) const { return header->gen[drive]; }
+
+	quint64 hits;
+	quint64 misses;
+	quint64 confirmed;			// directories and tracks checked and good
+	quint64 stale;				// found changed, generation bumped
+	quint64 damaged;			// held tracks that failed their fingerprint
+
+	static QString fileFor(const QString &dir, const QString &identity, quint16 trackMax, quint16 trackLen);
+
+private:
+	tcacheheader_t *header;
+	tcacheentry_t *entries;
+	quint8 *tracks;
+	size_t size;
+	int mapped;				// drives with track data in the mapping
+	quint16 dirTrack;
+	QString path;
+	QString lastError;
+	bool checked[MAX_DRIVE];		// directory read this session and generation
+	int mountEvents;			// of the link's mount log, already applied
+
+	tcacheentry_t &entry(quint8 drive, quint16 track) const { return entries[drive * header->trackMax + track]; }
+	quint8 *data(quint8 drive, quint16 track) const { return tracks + ((qint64) drive * header->trackMax + track) * header->trackLen; }
+	bool isHeld(FDCLink *link, quint8 drive, quint16 track) const;
+	int check(FDCLink *link, quint8 drive, quint8 *buf, int *how, FDCCancel *cancel);
+	void newGeneration(quint8 drive);
+	void followMounts(const FDCMountWatch &mounts);
+};
+
+int runCacheFill(const tbenchopts_t &opts);
+
+#endif
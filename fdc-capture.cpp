@@ -0,0 +1,98 @@
+/**********************************************************************************
+*
+*  Transaction capture files for the FDC+ Serial Drive Simulator
+*
+*  FDCLink writes a record per transaction with the time of every phase, so
+*  a session can be replayed or modelled offline (see fdc-model.cpp).
+*
+***********************************************************************************/
+
+#include <string.h>
+
+#include "fdc-capture.h"
+#include "fdc-metrics.h"
+
+FDCCapture::FDCCapture()
+{
+	memset(&hdr, 0, sizeof(hdr));
+}
+
+FDCCapture::~FDCCapture()
+{
+	close();
+}
+
+bool FDCCapture::create(const QString &fileName, const QString &transport, const QString &port, quint32 baud)
+{
+	close();
+
+	file.setFileName(fileName);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CAPTURE_VERSION;
+	hdr.recordSize = sizeof(tcaprecord_t);
+	hdr.baud = baud;
+	hdr.started = fdcNow();
+	strncpy(hdr.transport, transport.toLocal8Bit().constData(), sizeof(hdr.transport) - 1);
+	strncpy(hdr.port, port.toLocal8Bit().constData(), sizeof(hdr.port) - 1);
+
+	if (file.write((const char *) &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool FDCCapture::open(const QString &fileName)
+{
+	close();
+
+	file.setFileName(fileName);
+
+	if (!file.open(QIODevice::ReadOnly)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	if (file.read((char *) &hdr, sizeof(hdr)) != sizeof(hdr) || memcmp(hdr.magic, CAPTURE_MAGIC, sizeof(hdr.magic))) {
+		lastError = QString("%1: not a capture file").arg(fileName);
+		close();
+		return false;
+	}
+
+	if (hdr.version != CAPTURE_VERSION || hdr.recordSize != sizeof(tcaprecord_t)) {
+		lastError = QString("%1: unsupported capture version %2").arg(fileName).arg(hdr.version);
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void FDCCapture::close()
+{
+	if (file.isOpen()) {
+		file.close();
+	}
+}
+
+bool FDCCapture::write(const tcaprecord_t &rec)
+{
+	return (file.write((const char *) &rec, sizeof(rec)) == sizeof(rec));
+}
+
+//
+// Next record, false at the end of the file
+//
+bool FDCCapture::read(tcaprecord_t *rec)
+{
+	return (file.read((char *) rec, sizeof(*rec)) == sizeof(*rec));
+}
@@ -0,0 +1,70 @@
+#ifndef FDCCAPTURE_H
+#define FDCCAPTURE_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QFile>
+
+#define CAPTURE_MAGIC		"FDCCAPT"
+#define CAPTURE_VERSION		1
+
+//
+// Capture file: one header then one fixed size record per transaction, in
+// host (little endian) byte order like the protocol messages. Times are
+// fdcNow() nanoseconds; 0 means the transaction never got that far.
+//
+typedef struct TCAPHEADER {
+	char magic[8];				// CAPTURE_MAGIC
+	quint32 version;
+	quint32 recordSize;			// sizeof(tcaprecord_t)
+	quint32 baud;
+	quint32 reserved;
+	qint64 started;				// fdcNow() when the capture began
+	char transport[32];			// FDCSerial::name()
+	char port[64];
+} tcapheader_t;
+
+typedef struct TCAPRECORD {
+	quint8 cmd;				// CMD_STAT, CMD_READ or CMD_WRIT
+	quint8 drive;
+	quint16 track;
+	quint16 length;				// track length (READ/WRIT)
+	quint16 result;				// LINK_ code
+	quint16 rcode;				// response code
+	quint16 rdata;				// response data
+	quint32 reserved;
+	qint64 tQueued;				// command handed to the transport
+	qint64 tSent;				// command on the wire
+	qint64 tFirst;				// first byte of the response (or track)
+	qint64 tResp;				// response (or track) complete
+	qint64 tData;				// WRIT track on the wire
+	qint64 tWsta;				// first byte of the WSTA response
+	qint64 tDone;				// transaction complete
+} tcaprecord_t;
+
+//
+// Writes or reads a capture file
+//
+class FDCCapture
+{
+public:
+	FDCCapture();
+	~FDCCapture();
+
+	bool create(const QString &fileName, const QString &transport, const QString &port, quint32 baud);
+	bool open(const QString &fileName);
+	void close(void);
+	QString errorString(void) const { return lastError; }
+
+	bool write(const tcaprecord_t &rec);
+	bool read(tcaprecord_t *rec);
+
+	const tcapheader_t &header(void) const { return hdr; }
+
+private:
+	QFile file;
+	tcapheader_t hdr;
+	QString lastError;
+};
+
+#endif
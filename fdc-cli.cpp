@@ -0,0 +1,444 @@
+/**********************************************************************************
+*
+*  Headless command line front end for the FDC+ Serial Drive Simulator
+*
+*  Any of the commands below runs without creating the dialog (and without
+*  a display). Options not recognized here are left to QApplication.
+*
+***********************************************************************************/
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QFileInfo>
+
+#include <string.h>
+
+#include "fdc-cli.h"
+#include "fdc-bench.h"
+#include "fdc-link.h"
+#include "fdc-monitor.h"
+#include "fdc-model.h"
+#include "fdc-clock.h"
+#include "fdc-store.h"
+#include "fdc-memory.h"
+#include "fdc-mount.h"
+#include "fdc-boot.h"
+#include "fdc-stress.h"
+#include "fdc-feed.h"
+#include "fdc-writeback.h"
+#include "fdc-cache.h"
+#include "fdc-import.h"
+#include "fdc-arrow.h"
+#include "fdc-top.h"
+#include "fdc-merkle.h"
+#include "fdc-startup.h"
+#ifdef Q_OS_LINUX
+#include "fdc-workload.h"
+#include "fdc-knee.h"
+#include "fdc-open.h"
+#endif
+
+static const char *headlessCommands[] = {
+	"--bench-serial",
+	"--workload",
+	"--knee",
+	"--open-loop",
+	"--monitor",
+	"--top",
+	"--bench-cache",
+	"--model",
+	"--clock-sync",
+	"--clock-fit",
+	"--bench-fingerprint",
+	"--bench-hugepages",
+	"--mount-probe",
+	"--bench-writ",
+	"--boot",
+	"--stress",
+	"--tail",
+	"--edit",
+	"--cache-fill",
+	"--import",
+	"--export",
+	"--merkle-index",
+	"--merkle-diff",
+	"--merkle-sync",
+	"--merkle-verify",
+	NULL
+};
+
+bool cliHeadless(int argc, char **argv)
+{
+	size_t len;
+	int i, c;
+
+	// --name or --name=value, as QCommandLineParser takes both
+	for (i = 1; i < argc; i++) {
+		for (c = 0; headlessCommands[c] != NULL; c++) {
+			len = strlen(headlessCommands[c]);
+
+			if (!strncmp(argv[i], headlessCommands[c], len) && (argv[i][len] == '\0' || argv[i][len] == '=')) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+int cliMain(int argc, char **argv)
+{
+	QCoreApplication app(argc, argv);
+	QCommandLineParser parser;
+	QTextStream err(stderr);
+	tbenchopts_t opts;
+	QString error;
+
+	FDCStartup::mark("QCoreApplication");
+
+	QCommandLineOption benchSerialOption("bench-serial", "Compare QSerialPort and termios/epoll READ cost per track.");
+	QCommandLineOption benchCacheOption("bench-cache", "Compare cold and warm READ latency and infer the server's cache size.");
+	QCommandLineOption benchFingerprintOption("bench-fingerprint", "Time fingerprinting a 16 drive library with each CRC32C implementation.");
+	QCommandLineOption benchHugePagesOption("bench-hugepages", "Compare bulk verify and diff of a resident track store on base and huge pages.");
+	QCommandLineOption benchWritOption("bench-writ", "Write bursts of tracks back unchanged and break each WRIT into ack, data and commit.");
+	QCommandLineOption bootOption("boot", "Time a CP/M cold boot from the drive, as an Altair with an FDC+ would do it.");
+	QCommandLineOption stressOption("stress", "Random READs and WRITs on every mounted drive, checked against a shadow copy. Writes the disks, then restores them.");
+	QCommandLineOption editOption("edit", "Edit bytes of tracks on --drive and write each track back once, e.g. 2:s3+7=e5e5,2:0x40=00ff.", "edits");
+	QCommandLineOption cacheFillOption("cache-fill", "Read every track of --drive through the --track-cache and show what came from the file.");
+	QCommandLineOption importOption("import", "Convert logic analyzer decodes of the FDC's TX and RX lines (CSV or binary, comma separated) to a capture in --output.", "files");
+	QCommandLineOption merkleIndexOption("merkle-index", "Index disk images (comma separated files or directories) that changed since they were last indexed.", "images");
+	QCommandLineOption merkleDiffOption("merkle-diff", "Compare two images or directories of images by their indexes, e.g. disks,backup/disks.", "images");
+	QCommandLineOption merkleSyncOption("merkle-sync", "Like --merkle-diff, then copy the tracks that differ from the first to the second.", "images");
+	QCommandLineOption merkleVerifyOption("merkle-verify", "Compare the disk on --drive with an image's index.", "image");
+	QCommandLineOption exportOption("export", "Write the transactions of captures (comma separated) to --output as an Arrow IPC file.", "files");
+	QCommandLineOption modelOption("model", "Predict a captured session at other baud rates.", "file");
+	QCommandLineOption clockSyncOption("clock-sync", "Send numbered STATs at random intervals to a capture for --clock-fit.");
+	QCommandLineOption clockFitOption("clock-fit", "Fit the server's clock to a --clock-sync capture and merge its log.");
+	QCommandLineOption mountProbeOption("mount-probe", "Time mounts and unmounts until the STAT mount mask shows them.");
+	QCommandLineOption workloadOption("workload", "Run coroutine READ workflows on the event engine.");
+	QCommandLineOption openLoopOption("open-loop", "Send STATs and READs on a fixed schedule and time them from when they were due.");
+	QCommandLineOption kneeOption("knee", "Ramp offered load until latency breaks --slo: stat, read, links or all.", "mode");
+	QCommandLineOption monitorOption("monitor", "Print the metrics published in a shared memory segment.", "name");
+	QCommandLineOption topOption("top", "Live dashboard on the terminal of the metrics published in a shared memory segment.", "name");
+	QCommandLineOption tailOption("tail", "Print the transactions published to a live feed as they happen.", "name");
+	QCommandLineOption portOption("port", "Serial port name (comma separated list for --workload, --knee and --open-loop).", "port");
+	QCommandLineOption baudOption("baud", "Baud rate (default 403200).", "baud", "403200");
+	QCommandLineOption backendOption("backend", "Serial backend: qt or posix (default both).", "backend");
+	QCommandLineOption driveOption("drive", "Drive number (default 0).", "drive", "0");
+	QCommandLineOption diskOption("disk", "Disk type: 8 or 5 (default 8).", "disk", "8");
+	QCommandLineOption tracksOption("tracks", "Number of tracks (default all).", "tracks");
+	QCommandLineOption passesOption("passes", "Passes over the tracks, or boots for --boot (default 1).", "passes", "1");
+	QCommandLineOption threadsOption("threads", "Engine threads for --workload, --knee and --open-loop (default 1).", "threads", "1");
+	QCommandLineOption workflowsOption("workflows", "Concurrent workflows for --workload (default 1).", "workflows", "1");
+	QCommandLineOption deadlineOption("deadline", "Deadline per transaction in ms for --workload, --knee and --open-loop (default protocol timeouts).", "ms", "0");
+	QCommandLineOption feedOption("feed", "Publish every transaction and its track data to this shared memory feed (--bench-serial, --boot, --stress).", "name");
+	QCommandLineOption trackCacheOption("track-cache", "Keep tracks read in a cache file in this directory across sessions (--edit, --cache-fill, --merkle-verify).", "dir");
+	QCommandLineOption serverIdOption("server-id", "Names the server for --track-cache (default the port name, as the dialog lists it).", "name");
+	QCommandLineOption shmOption("shm", "Publish live metrics in this shared memory segment.", "name");
+	QCommandLineOption intervalOption("interval", "Repeat --monitor every ms (default once), redraw --top every ms (default 500, at least 100), STAT every ms for --mount-probe (default 10), or poll a --tail every ms (default 1).", "ms", "0");
+	QCommandLineOption sweepOption("sweep", "Largest working set in tracks for --bench-cache (default all mounted).", "tracks", "0");
+	QCommandLineOption captureOption("capture", "Record every transaction of --bench-serial, --bench-cache or --clock-sync to a file.", "file");
+	QCommandLineOption modelBaudOption("model-baud", "Baud rates for --model (default 230400,403200,460800).", "bauds", "230400,403200,460800");
+	QCommandLineOption modelOverheadOption("model-overhead", "Transport overhead per transaction in us for --model (default as captured).", "us", "-1");
+	QCommandLineOption statsOption("stats", "STATs sent by --clock-sync (default 100).", "count", "100");
+	QCommandLineOption serverLogOption("server-log", "Server log of STAT arrivals for --clock-fit.", "file");
+	QCommandLineOption outputOption("output", "Write the server log on the simulator's clock for --clock-fit, the capture made by --import, or the Arrow file made by --export.", "file");
+	QCommandLineOption disksOption("disks", "Disks held in the track store (default 256).", "disks", "256");
+	QCommandLineOption pagesOption("pages", "Track store pages: normal, thp or hugetlb, for --bench-hugepages (default each), --stress and --edit (default normal).", "pages");
+	QCommandLineOption memLimitOption("mem-limit", "Memory budgets, e.g. store=256M,engine=64M,sessions=1M,analysis=32M.", "budgets");
+	QCommandLineOption mountHookOption("mount-hook", "Command run as '<command> mount|unmount <drive>' by --mount-probe (default watch only).", "command");
+	QCommandLineOption burstOption("burst", "WRIT burst lengths for --bench-writ (default 1,4,16).", "tracks", "1,4,16");
+	QCommandLineOption opsOption("ops", "Transactions in a --stress run (default 10000).", "count", "10000");
+	QCommandLineOption writesOption("writes", "Percentage of --stress transactions that are WRITs (default 50).", "percent", "50");
+	QCommandLineOption seedOption("seed", "Repeat the --stress run with this seed (default a new one).", "seed", "0");
+	QCommandLineOption statRateOption("stat-rate", "STATs per second per link for --open-loop and the first --knee step (default 10).", "rate", "10");
+	QCommandLineOption readRateOption("read-rate", "READs per second per link for --open-loop and the first --knee step (default 1).", "rate", "1");
+	QCommandLineOption stepsOption("steps", "Steps in a --knee ramp, step n offering n times the first (default 10).", "steps", "10");
+	QCommandLineOption stepTimeOption("step-time", "Length of each --knee step in ms (default 5000).", "ms", "5000");
+	QCommandLineOption sloOption("slo", "Latency objectives for --knee, command:percentile:ms (default " KNEE_SLO ").", "objectives", KNEE_SLO);
+	QCommandLineOption durationOption("duration", "Length of the --open-loop schedule in ms (default 10000).", "ms", "10000");
+	QCommandLineOption startupProfileOption("startup-profile", "Print how long each phase of startup took, up to the first command sent.");
+	QCommandLineOption outqOption("outq-limit", "Bytes allowed in the output queue, 0 for no limit (default 512).", "bytes", QString::number(OUTQ_LIMIT));
+
+	parser.setApplicationDescription("FDC+ Serial Drive Simulator");
+	parser.addHelpOption();
+	parser.addOption(benchSerialOption);
+	parser.addOption(benchCacheOption);
+	parser.addOption(benchFingerprintOption);
+	parser.addOption(benchHugePagesOption);
+	parser.addOption(benchWritOption);
+	parser.addOption(bootOption);
+	parser.addOption(stressOption);
+	parser.addOption(editOption);
+	parser.addOption(cacheFillOption);
+	parser.addOption(importOption);
+	parser.addOption(exportOption);
+	parser.addOption(merkleIndexOption);
+	parser.addOption(merkleDiffOption);
+	parser.addOption(merkleSyncOption);
+	parser.addOption(merkleVerifyOption);
+	parser.addOption(modelOption);
+	parser.addOption(clockSyncOption);
+	parser.addOption(clockFitOption);
+	parser.addOption(mountProbeOption);
+	parser.addOption(workloadOption);
+	parser.addOption(kneeOption);
+	parser.addOption(openLoopOption);
+	parser.addOption(monitorOption);
+	parser.addOption(topOption);
+	parser.addOption(tailOption);
+	parser.addOption(portOption);
+	parser.addOption(baudOption);
+	parser.addOption(backendOption);
+	parser.addOption(driveOption);
+	parser.addOption(diskOption);
+	parser.addOption(tracksOption);
+	parser.addOption(passesOption);
+	parser.addOption(outqOption);
+	parser.addOption(threadsOption);
+	parser.addOption(workflowsOption);
+	parser.addOption(deadlineOption);
+	parser.addOption(shmOption);
+	parser.addOption(feedOption);
+	parser.addOption(trackCacheOption);
+	parser.addOption(serverIdOption);
+	parser.addOption(intervalOption);
+	parser.addOption(sweepOption);
+	parser.addOption(captureOption);
+	parser.addOption(modelBaudOption);
+	parser.addOption(modelOverheadOption);
+	parser.addOption(statsOption);
+	parser.addOption(serverLogOption);
+	parser.addOption(outputOption);
+	parser.addOption(disksOption);
+	parser.addOption(pagesOption);
+	parser.addOption(memLimitOption);
+	parser.addOption(mountHookOption);
+	parser.addOption(burstOption);
+	parser.addOption(opsOption);
+	parser.addOption(writesOption);
+	parser.addOption(seedOption);
+	parser.addOption(statRateOption);
+	parser.addOption(readRateOption);
+	parser.addOption(stepsOption);
+	parser.addOption(stepTimeOption);
+	parser.addOption(sloOption);
+	parser.addOption(durationOption);
+	parser.addOption(startupProfileOption);
+	parser.process(app);
+
+	opts.ports = parser.value(portOption).split(',');
+	opts.portName = opts.ports.value(0);
+	opts.baudRate = parser.value(baudOption).toUInt();
+	opts.drive = parser.value(driveOption).toUInt();
+	opts.passes = qMax(1, parser.value(passesOption).toInt());
+	opts.outQueueLimit = qMax((qint64) 0, parser.value(outqOption).toLongLong());
+	opts.threads = qMax(1, parser.value(threadsOption).toInt());
+	opts.workflows = qMax(1, parser.value(workflowsOption).toInt());
+	opts.deadline = qMax(0, parser.value(deadlineOption).toInt());
+	opts.shmName = parser.value(shmOption);
+	opts.feedName = parser.value(feedOption);
+	opts.cacheDir = parser.value(trackCacheOption);
+	opts.serverId = (parser.isSet(serverIdOption)) ? parser.value(serverIdOption) : QFileInfo(opts.portName).fileName();
+	opts.interval = qMax(0, parser.value(intervalOption).toInt());
+	opts.sweep = qMax(0, parser.value(sweepOption).toInt());
+	opts.captureFile = parser.value(captureOption);
+	opts.modelOverhead = parser.value(modelOverheadOption).toInt();
+	opts.stats = qMax(3, parser.value(statsOption).toInt());
+	opts.serverLog = parser.value(serverLogOption);
+	opts.outputFile = parser.value(outputOption);
+	opts.disks = qMax(1, parser.value(disksOption).toInt());
+	opts.mountHook = parser.value(mountHookOption);
+	opts.ops = qMax((qint64) 1, parser.value(opsOption).toLongLong());
+	opts.writePercent = qBound(0, parser.value(writesOption).toInt(), 100);
+	opts.seed = parser.value(seedOption).toUInt();
+	opts.statRate = qMax(0.0, parser.value(statRateOption).toDouble());
+	opts.readRate = qMax(0.0, parser.value(readRateOption).toDouble());
+	opts.steps = qMax(1, parser.value(stepsOption).toInt());
+	opts.stepTime = qMax(100, parser.value(stepTimeOption).toInt());
+	opts.slo = parser.value(sloOption);
+	opts.duration = qMax(1, parser.value(durationOption).toInt());
+	opts.pages = (parser.isSet(pagesOption)) ? FDCTrackStore::pagesFromName(parser.value(pagesOption)) : -1;
+
+	for (const QString &b : parser.value(modelBaudOption).split(',')) {
+		opts.modelBauds.append(b.toUInt());
+	}
+
+	for (const QString &b : parser.value(burstOption).split(',')) {
+		opts.bursts.append(b.toInt());
+	}
+
+	if (parser.value(diskOption) == "5") {
+		opts.trackMax = TRACK_MAX_5;
+		opts.trackLen = TRACK_LEN_5;
+	}
+	else {
+		opts.trackMax = TRACK_MAX_8;
+		opts.trackLen = TRACK_LEN_8;
+	}
+
+	if (parser.isSet(tracksOption)) {
+		opts.trackMax = qBound(1, parser.value(tracksOption).toInt(), (int) opts.trackMax);
+	}
+
+	if (!parser.isSet(backendOption)) {
+		opts.backend = -1;
+	}
+	else if (parser.value(backendOption) == "posix") {
+		opts.backend = SERIAL_BACKEND_POSIX;
+	}
+	else {
+		opts.backend = SERIAL_BACKEND_QT;
+	}
+
+	FDCStartup::mark("options");
+
+	// Before any command, so every one of them runs under the limits
+	if (parser.isSet(memLimitOption) && !FDCMemory::setLimits(parser.value(memLimitOption), &error)) {
+		err << error << "\n";
+		return 2;
+	}
+
+	if (parser.isSet(importOption)) {
+		opts.importFiles = parser.value(importOption).split(',');
+
+		if (opts.outputFile.isEmpty()) {
+			err << "--import needs --output\n";
+			return 2;
+		}
+
+		return runImport(opts);
+	}
+
+	if (parser.isSet(exportOption)) {
+		opts.exportFiles = parser.value(exportOption).split(',');
+
+		if (opts.outputFile.isEmpty()) {
+			err << "--export needs --output\n";
+			return 2;
+		}
+
+		return runExport(opts);
+	}
+
+	if (parser.isSet(merkleIndexOption)) {
+		opts.merkleFiles = parser.value(merkleIndexOption).split(',');
+		return runMerkleIndex(opts);
+	}
+
+	if (parser.isSet(merkleDiffOption) || parser.isSet(merkleSyncOption)) {
+		opts.merkleSync = parser.isSet(merkleSyncOption);
+		opts.merkleFiles = parser.value((opts.merkleSync) ? merkleSyncOption : merkleDiffOption).split(',');
+		return runMerkleDiff(opts);
+	}
+
+	if (parser.isSet(modelOption)) {
+		opts.modelFile = parser.value(modelOption);
+		return runModel(opts);
+	}
+
+	if (parser.isSet(pagesOption) && opts.pages == -1) {
+		err << "--pages must be normal, thp or hugetlb\n";
+		return 2;
+	}
+
+	if (parser.isSet(benchHugePagesOption)) {
+		return benchHugePages(opts);
+	}
+
+	if (parser.isSet(benchFingerprintOption)) {
+		return benchFingerprint(opts);
+	}
+
+	if (parser.isSet(clockFitOption)) {
+		return clockFit(opts);
+	}
+
+	if (parser.isSet(monitorOption)) {
+		opts.shmName = parser.value(monitorOption);
+		return runMonitor(opts);
+	}
+
+	if (parser.isSet(topOption)) {
+		opts.shmName = parser.value(topOption);
+		return runTop(opts);
+	}
+
+	if (parser.isSet(tailOption)) {
+		opts.feedName = parser.value(tailOption);
+		return runTail(opts);
+	}
+
+	if (opts.portName.isEmpty()) {
+		err << "--port is required\n";
+		return 2;
+	}
+
+	if (opts.drive >= MAX_DRIVE) {
+		err << "Invalid drive number\n";
+		return 2;
+	}
+
+	if (parser.isSet(benchSerialOption)) {
+		return benchSerial(opts);
+	}
+
+	if (parser.isSet(benchCacheOption)) {
+		return benchCache(opts);
+	}
+
+	if (parser.isSet(benchWritOption)) {
+		return benchWrit(opts);
+	}
+
+	if (parser.isSet(bootOption)) {
+		return bootProfile(opts);
+	}
+
+	if (parser.isSet(stressOption)) {
+		return runStress(opts);
+	}
+
+	if (parser.isSet(editOption)) {
+		opts.edits = parser.value(editOption);
+		return runEdit(opts);
+	}
+
+	if (parser.isSet(cacheFillOption)) {
+		return runCacheFill(opts);
+	}
+
+	if (parser.isSet(merkleVerifyOption)) {
+		opts.merkleFiles = parser.value(merkleVerifyOption).split(',');
+		return runMerkleVerify(opts);
+	}
+
+	if (parser.isSet(clockSyncOption)) {
+		return clockSync(opts);
+	}
+
+	if (parser.isSet(mountProbeOption)) {
+		return mountProbe(opts);
+	}
+
+#ifdef Q_OS_LINUX
+	if (parser.isSet(workloadOption)) {
+		return runWorkload(opts);
+	}
+
+	if (parser.isSet(kneeOption)) {
+		if ((opts.kneeMode = kneeModeFromName(parser.value(kneeOption))) == -1) {
+			err << "--knee must be stat, read, links or all\n";
+			return 2;
+		}
+		return findKnee(opts);
+	}
+
+	if (parser.isSet(openLoopOption)) {
+		return runOpenLoop(opts);
+	}
+#endif
+
+	parser.showHelp(2);
+}
@@ -0,0 +1,7 @@
+#ifndef FDCCLI_H
+#define FDCCLI_H
+
+bool cliHeadless(int argc, char **argv);
+int cliMain(int argc, char **argv);
+
+#endif
@@ -0,0 +1,560 @@
+/**********************************************************************************
+*
+*  Client/server clock alignment for the FDC+ Serial Drive Simulator
+*
+*  --clock-sync sends STATs at random intervals and captures them. param2
+*  of a STAT is the FDC's current track, so the STATs are numbered with it
+*  modulo the number of tracks, which keeps every one a valid track:
+*
+*      fdc-sim-gui --clock-sync --port ttyUSB0 --stats 300 --capture sync.cap
+*
+*  --clock-fit then pairs them with the server's log of STAT arrivals, by
+*  the echoed number if the server logs param2 and by their timing pattern
+*  if it doesn't, fits offset and drift, and rewrites the log onto the
+*  simulator's clock:
+*
+*      fdc-sim-gui --clock-fit --capture sync.cap --server-log server.log --output merged.log
+*
+*  Server log lines start with a timestamp in seconds. A line is a STAT if
+*  it has a STAT token, and if the second token after it is hex it is taken
+*  as param2, e.g.
+*
+*      1203.037269 STAT 00ff 0012
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QFile>
+#include <QThread>
+#include <QRandomGenerator>
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#include "fdc-clock.h"
+#include "fdc-capture.h"
+#include "fdc-link.h"
+#include "fdc-memory.h"
+
+FDCClock::FDCClock()
+{
+	droppedStats = 0;
+	memset(&model, 0, sizeof(model));
+}
+
+FDCClock::~FDCClock()
+{
+	clear();
+}
+
+void FDCClock::clear()
+{
+	FDCMemory::release(MEM_ANALYSIS, samples.size() * sizeof(tclocksample_t) + lines.size() * sizeof(tserverline_t));
+	samples.clear();
+	lines.clear();
+	droppedStats = 0;
+}
+
+//
+// Seconds with up to nine decimals to ns, without going through a double
+//
+qint64 FDCClock::parseSeconds(const QString &s, bool *ok)
+{
+	QStringList parts;
+	QString frac;
+	qint64 sec, ns;
+	bool ok2;
+
+	parts = s.split('.');
+	sec = parts[0].toLongLong(ok);
+	ns = 0;
+
+	if (*ok && parts.size() == 2) {
+		frac = (parts[1] + "000000000").left(9);
+		ns = frac.toLongLong(&ok2);
+		*ok = ok2;
+	}
+	else if (parts.size() > 2) {
+		*ok = false;
+	}
+
+	return sec * 1000000000LL + ns;
+}
+
+bool FDCClock::loadCapture(const QString &fileName)
+{
+	FDCCapture capture;
+	tcaprecord_t rec;
+	tclocksample_t sample;
+
+	if (!capture.open(fileName)) {
+		lastError = capture.errorString();
+		return false;
+	}
+
+	FDCMemory::release(MEM_ANALYSIS, samples.size() * sizeof(tclocksample_t));
+	samples.clear();
+
+	while (capture.read(&rec)) {
+		if (rec.cmd == CMD_STAT && rec.result == LINK_OK && rec.tFirst) {
+			if (!FDCMemory::reserve(MEM_ANALYSIS, sizeof(sample))) {
+				droppedStats++;
+				continue;
+			}
+			sample.tSent = rec.tSent;
+			sample.tFirst = rec.tFirst;
+			sample.seq = rec.track;			// STAT param2
+			sample.server = 0;
+			samples.append(sample);
+		}
+	}
+
+	if (samples.size() < 3) {
+		lastError = QString("%1: fewer than 3 STATs").arg(fileName);
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Timestamp, and whether the line is a STAT and with what param2
+//
+void FDCClock::parseLine(const QString &text, tserverline_t *line)
+{
+	QStringList tokens;
+	bool ok;
+	int i;
+
+	tokens = text.simplified().split(' ');
+
+	line->t = parseSeconds(tokens[0], &ok);
+	if (!ok) {
+		line->t = -1;
+	}
+
+	line->stat = false;
+	line->seq = -1;
+
+	for (i = 1; line->t != -1 && i < tokens.size(); i++) {
+		if (tokens[i] == "STAT") {
+			line->stat = true;
+			if (i + 2 < tokens.size()) {
+				line->seq = tokens[i + 2].toUInt(&ok, 16);
+				if (!ok) {
+					line->seq = -1;
+				}
+			}
+			break;
+		}
+	}
+}
+
+//
+// Keep the logged STATs; everything else is only needed when merging
+//
+bool FDCClock::loadServerLog(const QString &fileName)
+{
+	QFile file(fileName);
+	tserverline_t line;
+
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	QTextStream in(&file);
+
+	FDCMemory::release(MEM_ANALYSIS, lines.size() * sizeof(tserverline_t));
+	lines.clear();
+
+	while (!in.atEnd()) {
+		parseLine(in.readLine(), &line);
+
+		if (!line.stat) {
+			continue;
+		}
+
+		if (!FDCMemory::reserve(MEM_ANALYSIS, sizeof(line))) {
+			droppedStats++;
+			continue;
+		}
+
+		lines.append(line);
+	}
+
+	return true;
+}
+
+//
+// Pair samples with logged STATs carrying the same param2, in order and at
+// most CLOCK_ECHO_WINDOW lines ahead. Numbers repeat every trackMax STATs,
+// so a sample whose STAT is missing from the log stays unpaired instead of
+// pairing with the same number a cycle later. The first may be anywhere.
+//
+bool FDCClock::matchEcho()
+{
+	int s, l, next, matched;
+
+	matched = 0;
+	next = 0;
+
+	for (s = 0; s < samples.size(); s++) {
+		for (l = next; l < lines.size() && (!matched || l < next + CLOCK_ECHO_WINDOW); l++) {
+			if (lines[l].stat && lines[l].seq == samples[s].seq) {
+				samples[s].server = lines[l].t;
+				next = l + 1;
+				matched++;
+				break;
+			}
+		}
+	}
+
+	// A log cut short by the memory budget can only match so many
+	return (matched >= 3 && matched >= qMin(samples.size(), lines.size()) / 2);
+}
+
+//
+// No echo: try pairing each of the first few samples with every logged STAT
+// and keep the offset under which the most of the first CLOCK_PATTERN_LEN
+// samples land within CLOCK_MATCH_WINDOW of a logged STAT. Random gaps
+// between the STATs make the right offset stand out.
+//
+bool FDCClock::matchPattern()
+{
+	QVector<qint64> stats;
+	qint64 offset, best;
+	int i, j, k, n, score, bestScore;
+
+	for (const tserverline_t &line : lines) {
+		if (line.stat) {
+			stats.append(line.t);
+		}
+	}
+
+	std::sort(stats.begin(), stats.end());
+
+	if (stats.size() < 3) {
+		return false;
+	}
+
+	n = qMin(samples.size(), CLOCK_PATTERN_LEN);
+	best = 0;
+	bestScore = 0;
+
+	for (i = 0; i < qMin(3, n); i++) {
+		for (j = 0; j < stats.size(); j++) {
+			offset = stats[j] - samples[i].tSent;
+
+			for (score = 0, k = 0; k < n; k++) {
+				auto it = std::lower_bound(stats.begin(), stats.end(), samples[k].tSent + offset - CLOCK_MATCH_WINDOW);
+				if (it != stats.end() && *it <= samples[k].tSent + offset + CLOCK_MATCH_WINDOW) {
+					score++;
+				}
+			}
+
+			if (score > bestScore) {
+				bestScore = score;
+				best = offset;
+			}
+		}
+	}
+
+	if (bestScore < 3 || bestScore < qMin(n, (int) stats.size()) / 2) {
+		return false;
+	}
+
+	model.t0 = samples[0].tSent;
+	model.offset = best;
+	model.drift = 0;
+
+	matchModel();
+
+	return true;
+}
+
+//
+// Pair every sample with the logged STAT nearest to where the current model
+// puts it, if within CLOCK_MATCH_WINDOW
+//
+void FDCClock::matchModel()
+{
+	QVector<qint64> stats;
+	qint64 expect;
+
+	for (const tserverline_t &line : lines) {
+		if (line.stat) {
+			stats.append(line.t);
+		}
+	}
+
+	std::sort(stats.begin(), stats.end());
+
+	for (tclocksample_t &sample : samples) {
+		expect = sample.tSent + model.offset + (qint64) (model.drift * (sample.tSent - model.t0));
+		sample.server = 0;
+
+		auto it = std::lower_bound(stats.begin(), stats.end(), expect - CLOCK_MATCH_WINDOW);
+		if (it == stats.end() || *it > expect + CLOCK_MATCH_WINDOW) {
+			continue;
+		}
+		if (it + 1 != stats.end() && *(it + 1) <= expect + CLOCK_MATCH_WINDOW && qAbs(*(it + 1) - expect) < qAbs(*it - expect)) {
+			it++;
+		}
+
+		sample.server = *it;
+	}
+}
+
+//
+// Fit server - client against client time. The server logs a STAT somewhere
+// between tSent and tFirst, so the midpoint is used and, with tightOnly, only
+// samples whose round trip is no worse than the median. Points further than
+// three times the rms from the first fit are dropped and it is fitted again.
+//
+bool FDCClock::leastSquares(bool tightOnly)
+{
+	QVector<qint64> rtts;
+	QVector<double> xs, ys;
+	qint64 mid, y0, limit;
+	double sx, sy, sxx, sxy, n, a, b, r, rms;
+	int pass, i;
+
+	for (const tclocksample_t &sample : samples) {
+		if (sample.server) {
+			rtts.append(sample.tFirst - sample.tSent);
+		}
+	}
+
+	if (rtts.size() < 3) {
+		return false;
+	}
+
+	std::sort(rtts.begin(), rtts.end());
+	limit = (tightOnly) ? rtts[rtts.size() / 2] : rtts.last();
+
+	model.matched = rtts.size();
+	model.bound = rtts[0] / 2;
+	model.t0 = 0;
+	y0 = 0;
+
+	for (const tclocksample_t &sample : samples) {
+		if (!sample.server || sample.tFirst - sample.tSent > limit) {
+			continue;
+		}
+
+		mid = sample.tSent + (sample.tFirst - sample.tSent) / 2;
+
+		// Keep the doubles small: relative to the first point
+		if (xs.isEmpty()) {
+			model.t0 = mid;
+			y0 = sample.server - mid;
+		}
+
+		xs.append(mid - model.t0);
+		ys.append(sample.server - mid - y0);
+	}
+
+	a = 0;
+	b = 0;
+	rms = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		sx = sy = sxx = sxy = n = 0;
+
+		for (i = 0; i < xs.size(); i++) {
+			if (pass && fabs(ys[i] - a - b * xs[i]) > 3 * rms) {
+				continue;
+			}
+			sx += xs[i];
+			sy += ys[i];
+			sxx += xs[i] * xs[i];
+			sxy += xs[i] * ys[i];
+			n++;
+		}
+
+		if (n < 2) {
+			break;
+		}
+
+		b = (n * sxx - sx * sx != 0) ? (n * sxy - sx * sy) / (n * sxx - sx * sx) : 0;
+		a = (sy - b * sx) / n;
+
+		for (rms = 0, i = 0; i < xs.size(); i++) {
+			r = ys[i] - a - b * xs[i];
+			rms += r * r;
+		}
+		rms = sqrt(rms / xs.size());
+
+		model.used = n;
+	}
+
+	model.offset = y0 + (qint64) llround(a);
+	model.drift = b;
+	model.rms = rms;
+
+	return true;
+}
+
+bool FDCClock::fit(tclockfit_t *result)
+{
+	memset(&model, 0, sizeof(model));
+
+	model.echo = matchEcho();
+
+	if (!model.echo) {
+		if (!matchPattern()) {
+			lastError = "Could not match the capture's STATs to the server log";
+			return false;
+		}
+		leastSquares(false);
+		matchModel();
+	}
+
+	if (!leastSquares(true)) {
+		lastError = "Too few STATs matched";
+		return false;
+	}
+
+	*result = model;
+
+	return true;
+}
+
+//
+// Server clock to simulator clock under the fitted model
+//
+qint64 FDCClock::toClient(qint64 server) const
+{
+	return model.t0 + (qint64) llround((server - model.t0 - model.offset) / (1.0 + model.drift));
+}
+
+//
+// Copy the log to outName with each line prefixed by its time on the
+// simulator's clock, or - if it has no timestamp
+//
+bool FDCClock::merge(const QString &logName, const QString &outName, qint64 *written)
+{
+	QFile logFile(logName), outFile(outName);
+	tserverline_t line;
+	QString text;
+
+	if (!logFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		lastError = QString("%1: %2").arg(logName).arg(logFile.errorString());
+		return false;
+	}
+
+	if (!outFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+		lastError = QString("%1: %2").arg(outName).arg(outFile.errorString());
+		return false;
+	}
+
+	QTextStream in(&logFile);
+	QTextStream out(&outFile);
+
+	*written = 0;
+
+	while (!in.atEnd()) {
+		text = in.readLine();
+		parseLine(text, &line);
+
+		if (line.t == -1) {
+			out << "-\t" << text << "\n";
+		}
+		else {
+			out << QString("%1\t").arg(toClient(line.t) / 1e9, 0, 'f', 6) << text << "\n";
+		}
+
+		(*written)++;
+	}
+
+	return true;
+}
+
+//
+// STATs at random 10 to 100 ms intervals, param2 counting 0 to trackMax - 1
+// and round again, always a track the drive has
+//
+int clockSync(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCCapture capture;
+	QString fileName;
+	int i, errors;
+
+	fileName = (opts.captureFile.isEmpty()) ? QString("clock-sync.cap") : opts.captureFile;
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (!capture.create(fileName, link.serial()->name(), opts.portName, opts.baudRate)) {
+		out << capture.errorString() << "\n";
+		return 1;
+	}
+
+	link.setCapture(&capture);
+
+	for (errors = 0, i = 0; i < opts.stats; i++) {
+		if (link.stat(opts.drive, i % opts.trackMax) != LINK_OK) {
+			errors++;
+		}
+		QThread::msleep(QRandomGenerator::global()->bounded(10, 100));
+	}
+
+	link.setCapture(NULL);
+	link.close();
+
+	out << QString("%1 STATs (%2 failed) captured to %3, fit with --clock-fit --capture %3 --server-log <log>\n")
+		.arg(opts.stats).arg(errors).arg(fileName);
+
+	return (errors == opts.stats) ? 1 : 0;
+}
+
+int clockFit(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCClock clock;
+	tclockfit_t fit;
+	qint64 written;
+
+	if (opts.captureFile.isEmpty() || opts.serverLog.isEmpty()) {
+		out << "--clock-fit needs --capture and --server-log\n";
+		return 2;
+	}
+
+	if (!clock.loadCapture(opts.captureFile) || !clock.loadServerLog(opts.serverLog)) {
+		out << clock.errorString() << "\n";
+		return 1;
+	}
+
+	if (clock.dropped()) {
+		out << QString("%1 STATs over the analysis memory budget were left out\n").arg(clock.dropped());
+	}
+
+	if (!clock.fit(&fit)) {
+		out << clock.errorString() << "\n";
+		return 1;
+	}
+
+	out << QString("%1 STATs matched by %2, %3 used\n").arg(fit.matched).arg((fit.echo) ? "sequence echo" : "timing pattern").arg(fit.used);
+	out << QString("offset %1 s at simulator time %2 s\n").arg(fit.offset / 1e9, 0, 'f', 6).arg(fit.t0 / 1e9, 0, 'f', 6);
+	out << QString("drift %1 ppm\n").arg(fit.drift * 1e6, 0, 'f', 3);
+	out << QString("residual rms %1 ms, round trip bound +/- %2 ms\n").arg(fit.rms / 1e6, 0, 'f', 3).arg(fit.bound / 1e6, 0, 'f', 3);
+
+	if (opts.outputFile.isEmpty()) {
+		return 0;
+	}
+
+	if (!clock.merge(opts.serverLog, opts.outputFile, &written)) {
+		out << clock.errorString() << "\n";
+		return 1;
+	}
+
+	out << QString("%1 server log lines written to %2\n").arg(written).arg(opts.outputFile);
+
+	return 0;
+}
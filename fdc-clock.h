@@ -0,0 +1,89 @@
+#ifndef FDCCLOCK_H
+#define FDCCLOCK_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "fdc-bench.h"
+
+#define CLOCK_MATCH_WINDOW	2000000			// ns, STAT pattern match tolerance
+#define CLOCK_PATTERN_LEN	200			// STATs used for the coarse pattern match
+#define CLOCK_ECHO_WINDOW	16			// logged STATs searched ahead for a sample's number
+
+//
+// One STAT as seen by each side. The server logs it somewhere between the
+// command leaving the wire (tSent) and its response arriving (tFirst).
+//
+typedef struct TCLOCKSAMPLE {
+	qint64 tSent;				// simulator clock
+	qint64 tFirst;				// simulator clock
+	quint16 seq;				// STAT param2
+	qint64 server;				// server clock, 0 if unmatched
+} tclocksample_t;
+
+typedef struct TSERVERLINE {
+	qint64 t;				// server clock ns, -1 if no timestamp
+	bool stat;
+	int seq;				// param2 if logged, -1 if not
+} tserverline_t;
+
+//
+// server = client + offset + drift * (client - t0)
+//
+typedef struct TCLOCKFIT {
+	int matched;				// STATs paired with a log line
+	int used;				// of which tight enough to fit
+	bool echo;				// paired by param2 sequence echo
+	qint64 t0;				// simulator clock reference point
+	qint64 offset;				// ns at t0
+	double drift;				// server ns per simulator ns, less one
+	double rms;				// ns, residual of the fit
+	qint64 bound;				// ns, half the tightest round trip
+} tclockfit_t;
+
+//
+// Estimates the offset and drift of a server's clock from the STATs in a
+// capture and the server's log of their arrival, then maps log lines onto
+// the simulator's clock. Only the STATs are held in memory, against the
+// MEM_ANALYSIS budget; past it the rest are dropped and the fit uses what
+// fits. Merging streams the log a second time.
+//
+class FDCClock
+{
+public:
+	FDCClock();
+	~FDCClock();
+
+	bool loadCapture(const QString &fileName);
+	bool loadServerLog(const QString &fileName);
+	QString errorString(void) const { return lastError; }
+
+	bool fit(tclockfit_t *result);
+	qint64 toClient(qint64 server) const;
+	bool merge(const QString &logName, const QString &outName, qint64 *written);
+	qint64 dropped(void) const { return droppedStats; }
+
+	static qint64 parseSeconds(const QString &s, bool *ok);
+	static void parseLine(const QString &text, tserverline_t *line);
+
+private:
+	QVector<tclocksample_t> samples;
+	QVector<tserverline_t> lines;
+	tclockfit_t model;
+	qint64 droppedStats;
+	QString lastError;
+
+	void clear(void);
+
+	bool matchEcho(void);
+	bool matchPattern(void);
+	void matchModel(void);
+	bool leastSquares(bool tightOnly);
+};
+
+int clockSync(const tbenchopts_t &opts);
+int clockFit(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,935 @@
+/**********************************************************************************
+*
+*  Event driven protocol engine and coroutine client API
+*
+*  Each FDCEngine runs an epoll loop on one thread and drives any number of
+*  FDCClient links as non-blocking state machines. Workloads are written as
+*  straight-line coroutines:
+*
+*      FDCTask boot(FDCClient *client)
+*      {
+*          quint8 buf[TRACKBUF_LEN_CRC];
+*          tresult_t r;
+*
+*          r = co_await client->stat();
+*          r = co_await client->read(0, 0, buf);
+*      }
+*
+*      engine->spawn(boot(client));
+*
+*  and thousands of them can share a handful of engine threads. Every await
+*  carries its own absolute deadline (by default the response timeout plus
+*  the wire time of the transfer) and optionally a cancellation token. An
+*  abandoned transaction is settled with the server before the next command
+*  goes out, as FDCLink does.
+*
+***********************************************************************************/
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include <future>
+#include <algorithm>
+
+#include "fdc-engine.h"
+#include "fdc-startup.h"
+
+/*
+** Awaitable
+*/
+
+FDCAwaitable::FDCAwaitable(FDCClient *client, int cmd, quint16 param1, quint16 param2, quint8 *buf, quint16 length, qint64 deadline, FDCCancel *cancel)
+{
+	req = trequest_t();
+
+	this->client = client;
+
+	req.cmd = cmd;
+	req.param1 = param1;
+	req.param2 = param2;
+	req.buf = buf;
+	req.length = length;
+	req.drive = (cmd == CMD_STAT) ? (param1 & 0xff) : (param1 >> 12);
+	req.track = (cmd == CMD_STAT) ? param2 : (param1 & 0x0fff);
+	req.tQueued = fdcNow();
+	req.cancel = cancel;
+
+	if (deadline == 0) {
+		deadline = req.tQueued + RESPONSE_TIMEOUT * 1000000LL + client->wireTime((cmd == CMD_STAT) ? CMDBUF_SIZE * 2 : CMDBUF_SIZE * 3 + length + 2);
+	}
+
+	req.deadline = deadline;
+}
+
+void FDCAwaitable::await_suspend(std::coroutine_handle<> handle)
+{
+	req.handle = handle;
+
+	client->submit(&req);
+}
+
+/*
+** Sleep
+*/
+
+static bool timerLater(const ttimer_t &a, const ttimer_t &b)
+{
+	return a.until > b.until;
+}
+
+//
+// Always called on the engine thread, by the coroutine being suspended
+//
+void FDCSleep::await_suspend(std::coroutine_handle<> handle)
+{
+	engine->timers.push_back({ until, handle });
+	std::push_heap(engine->timers.begin(), engine->timers.end(), timerLater);
+}
+
+/*
+** Task
+*/
+
+FDCTask::promise_type::~promise_type()
+{
+	if (engine != nullptr) {
+		engine->liveTasks--;
+	}
+}
+
+/*
+** Client
+*/
+
+FDCClient::FDCClient(FDCEngine *engine)
+{
+	eng = engine;
+	port = NULL;
+	fd = -1;
+	wantWrite = false;
+	active = NULL;
+	head = NULL;
+	tail = NULL;
+	memset(&resync, 0, sizeof(resync));
+	shm = NULL;
+	shmSlot = -1;
+	accounted = false;
+}
+
+FDCClient::~FDCClient()
+{
+	close();
+
+	if (accounted) {
+		FDCMemory::release(MEM_SESSIONS, sizeof(*this));
+	}
+}
+
+bool FDCClient::open(const QString &portName, quint32 baudRate)
+{
+	FDCPosixSerial *posix;
+
+	close();
+
+	name = portName;
+
+	if (!accounted && !(accounted = FDCMemory::reserve(MEM_SESSIONS, sizeof(*this)))) {
+		lastError = QString("%1: session memory budget exhausted").arg(portName);
+		return false;
+	}
+
+	posix = new FDCPosixSerial;
+	port = posix;
+
+	if (!posix->open(portName, baudRate)) {
+		lastError = posix->errorString();
+		close();
+		return false;
+	}
+
+	fd = posix->handle();
+
+	if (!eng->addClient(this)) {
+		lastError = QString("epoll_ctl: %1").arg(strerror(errno));
+		close();
+		return false;
+	}
+
+	FDCStartup::mark("port open");
+
+	return true;
+}
+
+//
+// Requests still queued complete with LINK_NOT_OPEN. Call from the engine
+// thread, or from any thread once no coroutine is using the client.
+//
+void FDCClient::close()
+{
+	trequest_t *req;
+
+	if (fd != -1) {
+		eng->removeClient(this);
+		fd = -1;
+	}
+
+	if (active != NULL) {
+		active->next = head;
+		head = active;
+		active = NULL;
+	}
+
+	while ((req = head) != NULL) {
+		head = req->next;
+		req->result.result = LINK_NOT_OPEN;
+		eng->ready.push_back(req->handle);
+	}
+
+	tail = NULL;
+	memset(&resync, 0, sizeof(resync));
+
+	delete port;
+	port = NULL;
+}
+
+//
+// Publish metrics to shm as transactions complete. The slot is only ever
+// written from the engine thread.
+//
+void FDCClient::setShm(FDCShm *shm)
+{
+	this->shm = shm;
+	shmSlot = (shm != NULL) ? shm->addLink(name) : -1;
+
+	if (shm != NULL) {
+		shm->publish(shmSlot, metrics);
+	}
+}
+
+FDCAwaitable FDCClient::stat(quint16 param1, quint16 param2, qint64 deadline, FDCCancel *cancel)
+{
+	return FDCAwaitable(this, CMD_STAT, param1, param2, NULL, 0, deadline, cancel);
+}
+
+FDCAwaitable FDCClient::read(quint8 drive, quint16 track, quint8 *buf, quint16 length, qint64 deadline, FDCCancel *cancel)
+{
+	return FDCAwaitable(this, CMD_READ, track | (drive << 12), length, buf, length, deadline, cancel);
+}
+
+FDCAwaitable FDCClient::write(quint8 drive, quint16 track, quint8 *buf, quint16 length, qint64 deadline, FDCCancel *cancel)
+{
+	return FDCAwaitable(this, CMD_WRIT, track | (drive << 12), length, buf, length, deadline, cancel);
+}
+
+qint64 FDCClient::wireTime(qint64 bytes) const
+{
+	return (port != NULL && port->baud()) ? bytes * 10 * 1000000000LL / port->baud() : 0;
+}
+
+//
+// Queue a request. Engine thread only.
+//
+void FDCClient::submit(trequest_t *req)
+{
+	if (fd == -1) {
+		req->result.result = LINK_NOT_OPEN;
+		eng->ready.push_back(req->handle);
+		return;
+	}
+
+	req->next = NULL;
+
+	if (active == NULL) {
+		start(req);
+		service();
+	}
+	else if (tail == NULL) {
+		head = tail = req;
+	}
+	else {
+		tail->next = req;
+		tail = req;
+	}
+}
+
+//
+// Make req the active request with its command ready to go out
+//
+void FDCClient::start(trequest_t *req)
+{
+	static const char *commands[CMD_COUNT] = { "STAT", "READ", "WRIT" };
+
+	FDCStartup::ready();
+
+	active = req;
+
+	memcpy(req->cmdBuf.command, commands[req->cmd], sizeof(req->cmdBuf.command));
+	req->cmdBuf.param1 = req->param1;
+	req->cmdBuf.param2 = req->param2;
+	req->cmdBuf.checksum = FDCLink::calcChecksum(req->cmdBuf.asBytes, COMMAND_LENGTH);
+
+	req->phase = PHASE_SEND_CMD;
+	req->txBuf = req->cmdBuf.asBytes;
+	req->txLen = CMDBUF_SIZE;
+	req->txOff = 0;
+}
+
+//
+// Move the active request along as far as the port allows without blocking
+//
+void FDCClient::service()
+{
+	quint8 discard[256];
+	trequest_t *req;
+	ssize_t n;
+	qint64 data;
+	int queued;
+
+	while ((req = active) != NULL) {
+		if (req->phase == PHASE_SEND_CMD && req->txOff == 0 && !catchUp()) {
+			return;
+		}
+
+		if (req->phase == PHASE_SEND_CMD || req->phase == PHASE_SEND_DATA) {
+			n = ::write(fd, req->txBuf + req->txOff, req->txLen - req->txOff);
+
+			if (n == -1 && (errno == EAGAIN || errno == EINTR)) {
+				setWantWrite(true);
+				return;
+			}
+			if (n == -1) {
+				complete(req, LINK_IO_ERROR);
+				continue;
+			}
+
+			req->txOff += n;
+
+			if (req->txOff < req->txLen) {
+				continue;
+			}
+
+			setWantWrite(false);
+			metrics.bytesOut += req->txLen;
+
+			// The last byte reaches the wire once the output queue empties
+			queued = 0;
+			ioctl(fd, TIOCOUTQ, &queued);
+
+			if (req->phase == PHASE_SEND_CMD) {
+				req->tSent = fdcNow() + wireTime(queued);
+			}
+
+			req->rxOff = 0;
+
+			if (req->cmd == CMD_READ) {
+				req->phase = PHASE_RECV_DATA;
+				req->rxBuf = req->buf;
+				req->rxLen = req->length + 2;
+				req->print.reset();
+				req->sum = 0;
+			}
+			else {
+				req->phase = (req->phase == PHASE_SEND_DATA) ? PHASE_RECV_WSTA : PHASE_RECV_RESP;
+				req->rxBuf = req->response.asBytes;
+				req->rxLen = CMDBUF_SIZE;
+			}
+
+			continue;
+		}
+
+		n = ::read(fd, req->rxBuf + req->rxOff, req->rxLen - req->rxOff);
+
+		// VMIN = VTIME = 0, an empty tty reads as 0 rather than EAGAIN
+		if (n == 0 || (n == -1 && (errno == EAGAIN || errno == EINTR))) {
+			return;
+		}
+		if (n == -1) {
+			complete(req, LINK_IO_ERROR);
+			continue;
+		}
+
+		// Track data is summed and fingerprinted while it is still in cache
+		if (req->phase == PHASE_RECV_DATA && req->rxOff < req->length) {
+			data = qMin((qint64) n, req->length - req->rxOff);
+			req->print.update(req->rxBuf + req->rxOff, data);
+			req->sum += FDCLink::calcChecksum(req->rxBuf + req->rxOff, data);
+		}
+
+		req->rxOff += n;
+		metrics.bytesIn += n;
+
+		if (req->rxOff < req->rxLen) {
+			continue;
+		}
+
+		switch (req->phase) {
+			case PHASE_RECV_DATA:
+				req->result.print = req->print.result();
+
+				if (req->sum != (req->buf[req->length] | (req->buf[req->length+1] << 8))) {
+					complete(req, LINK_CHECKSUM_ERR);
+				}
+				else {
+					complete(req, LINK_OK);
+				}
+				break;
+
+			case PHASE_RECV_RESP:
+				req->result.rcode = req->response.rcode;
+				req->result.rdata = req->response.rdata;
+
+				if (memcmp(req->response.command, req->cmdBuf.command, sizeof(req->response.command))) {
+					complete(req, LINK_BAD_RESPONSE);
+				}
+				else if (req->cmd == CMD_STAT || req->response.rcode != STAT_OK) {
+					complete(req, LINK_OK);
+				}
+				else {
+					quint16 checksum = FDCLink::calcChecksum(req->buf, req->length);
+
+					req->buf[req->length] = checksum & 0x00ff;
+					req->buf[req->length+1] = (checksum >> 8) & 0x00ff;
+
+					req->phase = PHASE_SEND_DATA;
+					req->txBuf = req->buf;
+					req->txLen = req->length + 2;
+					req->txOff = 0;
+				}
+				break;
+
+			case PHASE_RECV_WSTA:
+				req->result.rcode = req->response.rcode;
+				req->result.rdata = req->response.rdata;
+				complete(req, memcmp(req->response.command, "WSTA", 4) ? LINK_BAD_RESPONSE : LINK_OK);
+				break;
+		}
+	}
+
+	// Nothing outstanding, throw away anything the server sends unasked
+	while ((n = ::read(fd, discard, (resync.discard) ? qMin(resync.discard, (qint64) sizeof(discard)) : sizeof(discard))) > 0) {
+		FDCLink::absorb(&resync, discard, n);
+		metrics.resyncDiscard += n;
+	}
+}
+
+//
+// Settle what an abandoned transaction left behind before the next command
+// goes out. Returns false while still padding or waiting for owed bytes.
+//
+bool FDCClient::catchUp()
+{
+	quint8 scratch[256];
+	tresync_t peek;
+	ssize_t n;
+	int count, queued;
+
+	if (!resync.padRemaining && !resync.discard) {
+		return true;
+	}
+
+	do {
+		while (resync.padRemaining) {
+			peek = resync;
+			count = FDCLink::padBytes(&peek, scratch, sizeof(scratch));
+
+			if ((n = ::write(fd, scratch, count)) <= 0) {
+				setWantWrite(true);
+				return false;
+			}
+
+			FDCLink::padBytes(&resync, scratch, n);
+			metrics.bytesOut += n;
+
+			if (!resync.padRemaining) {
+				queued = 0;
+				ioctl(fd, TIOCOUTQ, &queued);
+				resync.until = qMax(resync.until, fdcNow() + RESPONSE_TIMEOUT * 1000000LL + wireTime(queued + resync.discard));
+			}
+		}
+
+		setWantWrite(false);
+
+		while (resync.discard > 0) {
+			if ((n = ::read(fd, scratch, qMin(resync.discard, (qint64) sizeof(scratch)))) > 0) {
+				metrics.bytesIn += n;
+				metrics.resyncDiscard += n;
+				FDCLink::absorb(&resync, scratch, n);
+				continue;
+			}
+
+			if (fdcNow() < resync.until) {
+				return false;
+			}
+
+			break;
+		}
+	} while (resync.padRemaining);
+
+	ioctl(fd, TCFLSH, TCIFLUSH);
+
+	metrics.resyncs++;
+	memset(&resync, 0, sizeof(resync));
+
+	return true;
+}
+
+//
+// Work out what the server is still owed or owes for a request given up on
+// part way
+//
+void FDCClient::abandon(trequest_t *req)
+{
+	quint32 baud;
+
+	baud = (port != NULL) ? port->baud() : 0;
+
+	switch (req->phase) {
+		case PHASE_SEND_CMD:
+		case PHASE_SEND_DATA:
+			// A command not yet started leaves any earlier resync in place
+			if (req->txOff) {
+				FDCLink::abandon(&resync, req->txBuf, req->txLen, req->txOff, CMDBUF_SIZE, baud);
+			}
+			break;
+
+		case PHASE_RECV_RESP:
+		case PHASE_RECV_DATA:
+		case PHASE_RECV_WSTA:
+			FDCLink::abandon(&resync, NULL, 0, 0, req->rxLen - req->rxOff, baud);
+			if (req->phase == PHASE_RECV_RESP && req->cmd == CMD_WRIT) {
+				FDCLink::abandonWrit(&resync, req->response.asBytes, req->rxOff, req->length);
+			}
+			break;
+	}
+}
+
+void FDCClient::complete(trequest_t *req, int result)
+{
+	qint64 now;
+
+	now = fdcNow();
+
+	req->phase = PHASE_IDLE;
+	req->result.result = result;
+	req->result.latency = (req->tSent) ? now - req->tSent : 0;
+
+	metrics.commands[req->cmd]++;
+
+	if (result == LINK_OK) {
+		metrics.latency[req->cmd].record(req->result.latency);
+
+		if (req->cmd == CMD_STAT) {
+			mounts.update(req->result.rdata, req->tSent, now);
+		}
+	}
+	else if (result == LINK_TIMEOUT) {
+		metrics.timeouts[req->cmd]++;
+	}
+	else if (result == LINK_CANCELLED) {
+		metrics.cancels[req->cmd]++;
+	}
+	else {
+		metrics.errors[req->cmd]++;
+	}
+
+	if (shm != NULL) {
+		shm->publish(shmSlot, metrics, mounts, req->cmd, req->drive, req->track, result);
+	}
+
+	setWantWrite(false);
+	eng->ready.push_back(req->handle);
+
+	active = head;
+
+	if (head != NULL) {
+		if ((head = head->next) == NULL) {
+			tail = NULL;
+		}
+
+		active->next = NULL;
+		start(active);
+	}
+}
+
+//
+// LINK_CANCELLED or LINK_TIMEOUT if req should stop now, otherwise LINK_OK
+//
+int FDCClient::expired(const trequest_t *req, qint64 now) const
+{
+	if (req->cancel != NULL && req->cancel->isCancelled()) {
+		return LINK_CANCELLED;
+	}
+
+	return (req->deadline <= now) ? LINK_TIMEOUT : LINK_OK;
+}
+
+//
+// Fail requests that were cancelled or whose deadline has passed. If the
+// active request was under way the link is resynchronised before the next
+// command, so a late response can't be taken for the reply to it.
+//
+void FDCClient::expire(qint64 now)
+{
+	trequest_t *req, *prev, *next;
+	int r;
+
+	for (prev = NULL, req = head; req != NULL; req = next) {
+		next = req->next;
+
+		if ((r = expired(req, now)) != LINK_OK) {
+			if (prev == NULL) {
+				head = next;
+			}
+			else {
+				prev->next = next;
+			}
+			if (tail == req) {
+				tail = prev;
+			}
+
+			req->result.result = r;
+			metrics.commands[req->cmd]++;
+			if (r == LINK_TIMEOUT) {
+				metrics.timeouts[req->cmd]++;
+			}
+			else {
+				metrics.cancels[req->cmd]++;
+			}
+			if (shm != NULL) {
+				shm->publish(shmSlot, metrics);
+			}
+			eng->ready.push_back(req->handle);
+		}
+		else {
+			prev = req;
+		}
+	}
+
+	if (active != NULL && (r = expired(active, now)) != LINK_OK) {
+		abandon(active);
+		complete(active, r);
+		service();
+	}
+	else if (active != NULL && !resync.padRemaining && resync.discard && resync.until <= now) {
+		// Owed bytes that never came: no event will say so, give up on them
+		// and send the next command
+		service();
+	}
+}
+
+void FDCClient::setWantWrite(bool want)
+{
+	struct epoll_event ev;
+
+	if (want == wantWrite || fd == -1) {
+		return;
+	}
+
+	wantWrite = want;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (want) ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+	ev.data.ptr = this;
+
+	epoll_ctl(eng->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/*
+** Engine
+*/
+
+FDCEngine::FDCEngine()
+{
+	struct epoll_event ev;
+
+	running = false;
+	liveTasks = 0;
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+
+	epoll_ctl(epfd, EPOLL_CTL_ADD, evfd, &ev);
+}
+
+FDCEngine::~FDCEngine()
+{
+	stop();
+
+	::close(evfd);
+	::close(epfd);
+}
+
+void FDCEngine::start()
+{
+	running = true;
+	thread = std::thread([this]() { run(); });
+}
+
+void FDCEngine::stop()
+{
+	running = false;
+	wake();
+
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+void FDCEngine::post(std::function<void()> fn)
+{
+	{
+		std::lock_guard<std::mutex> lock(postLock);
+		posted.push_back(std::move(fn));
+	}
+
+	wake();
+}
+
+//
+// False if the task's frame didn't fit the engine memory budget
+//
+bool FDCEngine::spawn(FDCTask task)
+{
+	if (!task.handle) {
+		return false;
+	}
+
+	task.handle.promise().engine = this;
+	liveTasks++;
+
+	post([task]() { task.handle.resume(); });
+
+	return true;
+}
+
+void FDCEngine::wake()
+{
+	quint64 one = 1;
+
+	if (::write(evfd, &one, sizeof(one)) == -1) {
+		// Counter saturated, a wakeup is already pending
+	}
+}
+
+void FDCEngine::runPosted()
+{
+	std::vector<std::function<void()>> fns;
+	quint64 count;
+
+	if (::read(evfd, &count, sizeof(count)) == -1) {
+		// Nothing pending
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(postLock);
+		fns.swap(posted);
+	}
+
+	for (auto &fn : fns) {
+		fn();
+	}
+}
+
+int FDCEngine::nextTimeout()
+{
+	qint64 deadline, now, msecs;
+	trequest_t *req;
+	bool cancellable;
+
+	if (!ready.empty()) {
+		return 0;
+	}
+
+	deadline = 0;
+	cancellable = false;
+
+	for (FDCClient *client : clients) {
+		if (client->active != NULL) {
+			if (deadline == 0 || client->active->deadline < deadline) {
+				deadline = client->active->deadline;
+			}
+			// Waiting on bytes owed from an abandoned transaction
+			if (client->resync.discard && (deadline == 0 || client->resync.until < deadline)) {
+				deadline = client->resync.until;
+			}
+			cancellable |= (client->active->cancel != NULL);
+		}
+		for (req = client->head; req != NULL; req = req->next) {
+			if (deadline == 0 || req->deadline < deadline) {
+				deadline = req->deadline;
+			}
+			cancellable |= (req->cancel != NULL);
+		}
+	}
+
+	if (!timers.empty() && (deadline == 0 || timers.front().until < deadline)) {
+		deadline = timers.front().until;
+	}
+
+	if (deadline == 0) {
+		return -1;
+	}
+
+	now = fdcNow();
+	msecs = (deadline <= now) ? 0 : (deadline - now + 999999) / 1000000;
+
+	// Tokens are polled, cancel() may come from any thread
+	if (cancellable) {
+		msecs = qMin(msecs, (qint64) CANCEL_POLL);
+	}
+
+	return (int) msecs;
+}
+
+void FDCEngine::run()
+{
+	struct epoll_event events[64];
+	std::vector<std::coroutine_handle<>> resume;
+	qint64 now;
+	int n, i;
+
+	// running was set by start(), so a stop() before the thread gets here
+	// isn't lost
+	owner = std::this_thread::get_id();
+
+	while (running) {
+		n = epoll_wait(epfd, events, 64, nextTimeout());
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL) {
+				runPosted();
+			}
+			else {
+				((FDCClient *) events[i].data.ptr)->service();
+			}
+		}
+
+		now = fdcNow();
+
+		for (FDCClient *client : clients) {
+			client->expire(now);
+		}
+
+		fireTimers(now);
+
+		// Resume after all state changes so coroutines can submit freely
+		while (!ready.empty()) {
+			resume.swap(ready);
+			for (auto h : resume) {
+				h.resume();
+			}
+			resume.clear();
+		}
+	}
+}
+
+//
+// Sleepers due by now are resumed with the rest
+//
+void FDCEngine::fireTimers(qint64 now)
+{
+	while (!timers.empty() && timers.front().until <= now) {
+		ready.push_back(timers.front().handle);
+		std::pop_heap(timers.begin(), timers.end(), timerLater);
+		timers.pop_back();
+	}
+}
+
+//
+// Run fn on the engine thread and wait for it, or run it directly when
+// already there or when the loop isn't running.
+//
+void FDCEngine::call(std::function<void()> fn)
+{
+	std::promise<void> done;
+
+	if (!running || std::this_thread::get_id() == owner) {
+		fn();
+		return;
+	}
+
+	post([&]() { fn(); done.set_value(); });
+	done.get_future().wait();
+}
+
+bool FDCEngine::addClient(FDCClient *client)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = client;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, client->fd, &ev) == -1) {
+		return false;
+	}
+
+	call([this, client]() { clients.push_back(client); });
+
+	return true;
+}
+
+void FDCEngine::removeClient(FDCClient *client)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, client->fd, NULL);
+
+	call([this, client]() {
+		unsigned i;
+
+		for (i = 0; i < clients.size(); i++) {
+			if (clients[i] == client) {
+				clients.erase(clients.begin() + i);
+				break;
+			}
+		}
+	});
+}
+
+/*
+** Engine pool
+*/
+
+FDCEnginePool::FDCEnginePool(int threads)
+{
+	int i;
+
+	rr = 0;
+
+	for (i = 0; i < qMax(1, threads); i++) {
+		engines.push_back(new FDCEngine);
+		engines.back()->start();
+	}
+}
+
+FDCEnginePool::~FDCEnginePool()
+{
+	for (FDCEngine *engine : engines) {
+		delete engine;
+	}
+}
+
+FDCEngine *FDCEnginePool::next()
+{
+	return engines[rr++ % engines.size()];
+}
+
+//
+// Block until every spawned task on every engine has returned
+//
+void FDCEnginePool::wait()
+{
+	for (FDCEngine *engine : engines) {
+		while (!engine->idle()) {
+			usleep(1000);
+		}
+	}
+}
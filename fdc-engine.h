@@ -0,0 +1,257 @@
+#ifndef FDCENGINE_H
+#define FDCENGINE_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <coroutine>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+#include "fdc-link.h"
+#include "fdc-memory.h"
+
+#define PHASE_IDLE		0
+#define PHASE_SEND_CMD		1			// command going out
+#define PHASE_RECV_RESP		2			// waiting for STAT/WRIT response
+#define PHASE_RECV_DATA		3			// receiving READ track data
+#define PHASE_SEND_DATA		4			// sending WRIT track data
+#define PHASE_RECV_WSTA		5			// waiting for WSTA response
+
+class FDCEngine;
+class FDCClient;
+
+typedef struct TRESULT {
+	int result;				// LINK_ code
+	quint16 rcode;				// response code (WRIT/WSTA)
+	quint16 rdata;				// response data (STAT mount mask)
+	qint64 latency;				// ns, command on wire to done
+	tfingerprint_t print;			// READ track data
+} tresult_t;
+
+//
+// One protocol transaction in flight or queued on a client. Lives in the
+// awaiting coroutine's frame for the duration of the co_await.
+//
+typedef struct TREQUEST {
+	int cmd;
+	quint8 drive;
+	quint16 track;
+	quint16 param1;
+	quint16 param2;
+	quint8 *buf;
+	quint16 length;
+	qint64 deadline;			// absolute, fdcNow() ns
+	FDCCancel *cancel;			// NULL if not cancellable
+	int phase;
+	tcommand_t cmdBuf;
+	tcommand_t response;
+	const quint8 *txBuf;
+	qint64 txLen;
+	qint64 txOff;
+	quint8 *rxBuf;
+	qint64 rxLen;
+	qint64 rxOff;
+	FDCFingerprint print;			// READ data so far
+	quint16 sum;				// READ checksum so far
+	tresult_t result;
+	qint64 tQueued;
+	qint64 tSent;
+	std::coroutine_handle<> handle;
+	struct TREQUEST *next;
+} trequest_t;
+
+//
+// co_await client.read(...) and friends return one of these. The request is
+// handed to the client's engine when the coroutine suspends and the result
+// is returned when the engine resumes it.
+//
+class FDCAwaitable
+{
+public:
+	FDCAwaitable(FDCClient *client, int cmd, quint16 param1, quint16 param2, quint8 *buf, quint16 length, qint64 deadline, FDCCancel *cancel);
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	tresult_t await_resume() const noexcept { return req.result; }
+
+private:
+	FDCClient *client;
+	trequest_t req;
+};
+
+//
+// co_await engine->sleepUntil(t) resumes the coroutine on its own engine at
+// t (fdcNow() ns) or just after, so load can be paced without a thread or
+// a timer per workflow.
+//
+class FDCSleep
+{
+public:
+	FDCSleep(FDCEngine *engine, qint64 until) { this->engine = engine; this->until = until; }
+
+	bool await_ready() const noexcept { return until <= fdcNow(); }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() const noexcept {}
+
+private:
+	FDCEngine *engine;
+	qint64 until;
+};
+
+typedef struct TTIMER {
+	qint64 until;				// fdcNow() ns
+	std::coroutine_handle<> handle;
+} ttimer_t;
+
+//
+// Fire and forget coroutine. Starts when spawned on an engine and frees
+// itself when it returns. Frames come out of the engine memory budget; a
+// task that doesn't fit has no handle and spawn() refuses it.
+//
+class FDCTask
+{
+public:
+	struct promise_type {
+		FDCEngine *engine = nullptr;
+
+		FDCTask get_return_object() { return FDCTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		static FDCTask get_return_object_on_allocation_failure() { return FDCTask(std::coroutine_handle<promise_type>()); }
+		static void *operator new(size_t size) noexcept { return FDCMemory::alloc(MEM_ENGINE, size); }
+		static void operator delete(void *p, size_t size) { FDCMemory::free(MEM_ENGINE, p, size); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+		~promise_type();
+	};
+
+	explicit FDCTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+//
+// Non-blocking FDC link driven by an engine. Transactions are queued in
+// order; only one is on the wire at a time, as with a real FDC. A deadline
+// of 0 allows the response timeout plus the wire time of the transfer.
+//
+class FDCClient
+{
+public:
+	FDCClient(FDCEngine *engine);
+	~FDCClient();
+
+	bool open(const QString &portName, quint32 baudRate);
+	void close(void);
+	QString errorString(void) const { return lastError; }
+	FDCEngine *engine(void) const { return eng; }
+	QString portName(void) const { return name; }
+
+	FDCAwaitable stat(quint16 param1 = 0x00ff, quint16 param2 = 0, qint64 deadline = 0, FDCCancel *cancel = NULL);
+	FDCAwaitable read(quint8 drive, quint16 track, quint8 *buf, quint16 length = TRACK_LEN_8, qint64 deadline = 0, FDCCancel *cancel = NULL);
+	FDCAwaitable write(quint8 drive, quint16 track, quint8 *buf, quint16 length = TRACK_LEN_8, qint64 deadline = 0, FDCCancel *cancel = NULL);
+
+	void setShm(FDCShm *shm);
+
+	FDCMetrics metrics;
+	FDCMountWatch mounts;
+
+private:
+	friend class FDCEngine;
+	friend class FDCAwaitable;
+
+	FDCEngine *eng;
+	FDCSerial *port;
+	int fd;
+	QString name;
+	QString lastError;
+	bool wantWrite;
+	trequest_t *active;
+	trequest_t *head;
+	trequest_t *tail;
+	tresync_t resync;
+	FDCShm *shm;
+	int shmSlot;
+	bool accounted;
+
+	void submit(trequest_t *req);
+	void start(trequest_t *req);
+	void service(void);
+	bool catchUp(void);
+	void abandon(trequest_t *req);
+	void complete(trequest_t *req, int result);
+	void expire(qint64 now);
+	int expired(const trequest_t *req, qint64 now) const;
+	void setWantWrite(bool want);
+	qint64 wireTime(qint64 bytes) const;
+};
+
+//
+// Single threaded epoll loop. Everything belonging to an engine (its clients,
+// their requests and the coroutines awaiting them) runs on the engine thread;
+// post() and spawn() may be called from any thread.
+//
+class FDCEngine
+{
+public:
+	FDCEngine();
+	~FDCEngine();
+
+	void start(void);
+	void stop(void);
+	void run(void);
+	void post(std::function<void()> fn);
+	bool spawn(FDCTask task);
+	FDCSleep sleepUntil(qint64 until) { return FDCSleep(this, until); }
+	bool idle(void) const { return liveTasks == 0; }
+
+private:
+	friend class FDCClient;
+	friend struct FDCTask::promise_type;
+	friend class FDCSleep;
+
+	int epfd;
+	int evfd;
+	std::thread thread;
+	std::thread::id owner;
+	std::mutex postLock;
+	std::vector<std::function<void()>> posted;
+	std::vector<FDCClient *> clients;
+	std::vector<std::coroutine_handle<>> ready;
+	std::vector<ttimer_t> timers;		// min heap on until
+	std::atomic<bool> running;
+	std::atomic<int> liveTasks;
+
+	bool addClient(FDCClient *client);
+	void removeClient(FDCClient *client);
+	void wake(void);
+	void call(std::function<void()> fn);
+	void runPosted(void);
+	int nextTimeout(void);
+	void fireTimers(qint64 now);
+};
+
+//
+// A few engines, each on its own thread. Clients are spread round robin.
+//
+class FDCEnginePool
+{
+public:
+	FDCEnginePool(int threads);
+	~FDCEnginePool();
+
+	FDCEngine *next(void);
+	int size(void) const { return (int) engines.size(); }
+	FDCEngine *engine(int n) const { return engines[n]; }
+	void wait(void);
+
+private:
+	std::vector<FDCEngine *> engines;
+	int rr;
+};
+
+#endif
@@ -0,0 +1,383 @@
+/**********************************************************************************
+*
+*  Live transaction feed for the FDC+ Serial Drive Simulator
+*
+*  Run with --feed (or FDC_FEED set for the dialog) and every transaction,
+*  with its track data, is published to a ring in /dev/shm as it completes.
+*  Analysers attach without the link noticing:
+*
+*      fdc-sim-gui --stress --port ttyUSB0 --feed /fdc-lab1-feed
+*      fdc-sim-gui --tail /fdc-lab1-feed
+*
+*  Readers never write to the segment, so however many there are and however
+*  slow, the link runs as fast as it would without them; a reader that falls
+*  a ring behind loses the frames it missed and is told how many.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QThread>
+
+#include <string.h>
+#include <signal.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "fdc-feed.h"
+#include "fdc-link.h"
+#include "fdc-memory.h"
+
+static_assert(std::atomic<quint64>::is_always_lock_free, "feed needs lock free counters");
+static_assert((FEED_RECORDS & (FEED_RECORDS - 1)) == 0, "FEED_RECORDS must be a power of two");
+static_assert((FEED_PAYLOAD & (FEED_PAYLOAD - 1)) == 0, "FEED_PAYLOAD must be a power of two");
+
+FDCFeed::FDCFeed()
+{
+	header = NULL;
+	records = NULL;
+	ring = NULL;
+	size = 0;
+	owner = false;
+}
+
+FDCFeed::~FDCFeed()
+{
+	close();
+}
+
+bool FDCFeed::create(const QString &name, const QString &transport, const QString &port, quint32 baud)
+{
+	QByteArray s;
+
+	if (!map(name, true)) {
+		return false;
+	}
+
+	s = transport.toLocal8Bit();
+	strncpy(header->transport, s.constData(), sizeof(header->transport) - 1);
+	s = port.toLocal8Bit();
+	strncpy(header->port, s.constData(), sizeof(header->port) - 1);
+	header->baud = baud;
+
+	// Magic last so readers never see a half made header
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = FEED_MAGIC;
+
+	return true;
+}
+
+bool FDCFeed::attach(const QString &name)
+{
+	return map(name, false);
+}
+
+bool FDCFeed::map(const QString &name, bool create)
+{
+#ifdef Q_OS_UNIX
+	struct stat st;
+	void *p;
+	int fd;
+
+	close();
+
+	feedName = (name.startsWith('/')) ? name : "/" + name;
+	size = sizeof(tfeedheader_t) + FEED_RECORDS * sizeof(tfeedrecord_t) + FEED_PAYLOAD;
+
+	if (create && !FDCMemory::reserve(MEM_SESSIONS, size)) {
+		lastError = QString("%1: over the sessions memory budget").arg(feedName);
+		return false;
+	}
+
+	if ((fd = shm_open(feedName.toLocal8Bit().constData(), (create) ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644)) == -1) {
+		lastError = QString("%1: %2").arg(feedName).arg(strerror(errno));
+		if (create) {
+			FDCMemory::release(MEM_SESSIONS, size);
+		}
+		return false;
+	}
+
+	if (create && ftruncate(fd, size) == -1) {
+		lastError = QString("%1: %2").arg(feedName).arg(strerror(errno));
+		::close(fd);
+		shm_unlink(feedName.toLocal8Bit().constData());
+		FDCMemory::release(MEM_SESSIONS, size);
+		return false;
+	}
+
+	if (!create && (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(tfeedheader_t))) {
+		lastError = QString("%1: not a feed segment").arg(feedName);
+		::close(fd);
+		return false;
+	}
+
+	if (!create) {
+		size = st.st_size;
+	}
+
+	p = mmap(NULL, size, (create) ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED) {
+		lastError = QString("%1: %2").arg(feedName).arg(strerror(errno));
+		if (create) {
+			shm_unlink(feedName.toLocal8Bit().constData());
+			FDCMemory::release(MEM_SESSIONS, size);
+		}
+		return false;
+	}
+
+	header = (tfeedheader_t *) p;
+	owner = create;
+
+	if (create) {
+		// Zero filled by ftruncate
+		header->version = FEED_VERSION;
+		header->headerSize = sizeof(tfeedheader_t);
+		header->recordSize = sizeof(tfeedrecord_t);
+		header->records = FEED_RECORDS;
+		header->payloadSize = FEED_PAYLOAD;
+		header->pid = getpid();
+		header->started = fdcNow();
+	}
+	else if (header->magic != FEED_MAGIC || header->version != FEED_VERSION
+		|| header->headerSize != sizeof(tfeedheader_t) || header->recordSize != sizeof(tfeedrecord_t)
+		|| (header->records & (header->records - 1)) || (header->payloadSize & (header->payloadSize - 1))
+		|| size < sizeof(tfeedheader_t) + header->records * sizeof(tfeedrecord_t) + header->payloadSize) {
+		lastError = QString("%1: unsupported feed segment version").arg(feedName);
+		close();
+		return false;
+	}
+
+	records = (tfeedrecord_t *) ((char *) p + sizeof(tfeedheader_t));
+	ring = (quint8 *) records + header->records * sizeof(tfeedrecord_t);
+
+	return true;
+#else
+	Q_UNUSED(name);
+	Q_UNUSED(create);
+	lastError = QString("Shared memory not supported");
+	return false;
+#endif
+}
+
+void FDCFeed::close()
+{
+#ifdef Q_OS_UNIX
+	if (header != NULL) {
+		munmap(header, size);
+		if (owner) {
+			shm_unlink(feedName.toLocal8Bit().constData());
+			FDCMemory::release(MEM_SESSIONS, size);
+		}
+	}
+#endif
+
+	header = NULL;
+	records = NULL;
+	ring = NULL;
+	owner = false;
+}
+
+//
+// Append one transaction. Track data goes in the payload ring in one piece,
+// skipping the tail end of the ring if it won't fit there.
+//
+void FDCFeed::publish(const tcaprecord_t &rec, const tfingerprint_t &print, const quint8 *data, quint32 length)
+{
+	tfeedrecord_t *r;
+	quint64 n, pos;
+
+	if (!owner) {
+		return;
+	}
+
+	n = header->head.load(std::memory_order_relaxed);
+	r = &records[n & (header->records - 1)];
+
+	r->seq.store(2 * n + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	r->frame.rec = rec;
+	r->frame.print = print;
+	r->frame.payloadPos = 0;
+	r->frame.payloadLen = 0;
+
+	if (data != NULL && length && length <= header->payloadSize) {
+		pos = header->payloadEnd.load(std::memory_order_relaxed);
+
+		if ((pos & (header->payloadSize - 1)) + length > header->payloadSize) {
+			pos = (pos + header->payloadSize - 1) & ~(header->payloadSize - 1);
+		}
+
+		// Claim the bytes before overwriting them, so readers of what was
+		// there find out
+		header->payloadEnd.store(pos + length, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		memcpy(ring + (pos & (header->payloadSize - 1)), data, length);
+
+		r->frame.payloadPos = pos;
+		r->frame.payloadLen = length;
+	}
+
+	r->seq.store(2 * n + 2, std::memory_order_release);
+	header->head.store(n + 1, std::memory_order_release);
+}
+
+//
+// Copy frame index out of the ring. A record that stays mid update for
+// FEED_READ_TRIES reads (a writer that died while copying) is reported as
+// not published yet.
+//
+int FDCFeed::read(quint64 index, tfeedframe_t *frame) const
+{
+	const tfeedrecord_t *r;
+	quint64 before, after;
+	int tries;
+
+	r = &records[index & (header->records - 1)];
+
+	for (tries = 0; tries < FEED_READ_TRIES; tries++) {
+		before = r->seq.load(std::memory_order_acquire);
+
+		if (before < 2 * index + 1) {
+			return FEED_NOT_YET;
+		}
+
+		if (before > 2 * index + 2) {
+			return FEED_OVERRUN;
+		}
+
+		if (before & 1) {
+			// Writer mid update, normally only for a copy's time
+			continue;
+		}
+
+		*frame = r->frame;
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		after = r->seq.load(std::memory_order_relaxed);
+
+		if (after == before) {
+			return FEED_OK;
+		}
+	}
+
+	return FEED_NOT_YET;
+}
+
+const quint8 *FDCFeed::payload(const tfeedframe_t &frame) const
+{
+	return (frame.payloadLen) ? ring + (frame.payloadPos & (header->payloadSize - 1)) : NULL;
+}
+
+//
+// After using payload() in place: false if the writer may have overwritten
+// any of it meanwhile, and what was read must be thrown away
+//
+bool FDCFeed::payloadValid(const tfeedframe_t &frame) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	return header->payloadEnd.load(std::memory_order_relaxed) - frame.payloadPos <= header->payloadSize;
+}
+
+// Ctrl-C ends a tail
+static std::atomic<bool> interrupted;
+
+static void interruptHandler(int)
+{
+	interrupted = true;
+}
+
+//
+// Print frames as they are published, checking each READ's track in place
+// against its fingerprint
+//
+int runTail(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCFeed feed;
+	tfeedframe_t frame;
+	struct sigaction sa, oldSa;
+	quint64 next, frames, dropped, torn, mismatched;
+	tfingerprint_t print;
+	int r;
+
+	if (!feed.attach(opts.feedName)) {
+		out << feed.errorString() << "\n";
+		return 1;
+	}
+
+	out << QString("%1: pid %2, %3 on %4 at %5 baud\n")
+		.arg(feed.name()).arg(feed.info().pid)
+		.arg(QString::fromLocal8Bit(feed.info().transport, strnlen(feed.info().transport, sizeof(feed.info().transport))))
+		.arg(QString::fromLocal8Bit(feed.info().port, strnlen(feed.info().port, sizeof(feed.info().port))))
+		.arg(feed.info().baud);
+	out.flush();
+
+	interrupted = false;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldSa);
+
+	next = feed.head();
+	frames = dropped = torn = mismatched = 0;
+
+	while (!interrupted) {
+		if ((r = feed.read(next, &frame)) == FEED_NOT_YET) {
+			QThread::msleep((opts.interval > 0) ? opts.interval : 1);
+			continue;
+		}
+
+		if (r == FEED_OVERRUN) {
+			// Fell a ring behind: start again from the oldest frame still there
+			dropped += feed.head() - feed.info().records + 1 - next;
+			next = feed.head() - feed.info().records + 1;
+			continue;
+		}
+
+		next++;
+		frames++;
+
+		out << QString("%1 %2 drive %3 track %4 %5 %6 ms")
+			.arg((frame.rec.tQueued - feed.info().started) / 1e9, 12, 'f', 6)
+			.arg(FDCMetrics::commandName(frame.rec.cmd), -4)
+			.arg(frame.rec.drive).arg(frame.rec.track, 2)
+			.arg((frame.rec.result == LINK_OK) ? "OK" : "FAILED", -6)
+			.arg((frame.rec.tDone - frame.rec.tSent) / 1e6, 0, 'f', 2);
+
+		if (frame.payloadLen) {
+			print = FDCFingerprint::of(feed.payload(frame), frame.payloadLen);
+
+			if (!feed.payloadValid(frame)) {
+				out << " (track overwritten before it was read)";
+				torn++;
+			}
+			else {
+				out << QString(" crc %1").arg(print.crc, 8, 16, QChar('0'));
+
+				if (frame.rec.cmd == CMD_READ && frame.print.length && print != frame.print) {
+					out << " MISMATCH";
+					mismatched++;
+				}
+			}
+		}
+
+		out << "\n";
+		out.flush();
+	}
+
+	sigaction(SIGINT, &oldSa, NULL);
+
+	out << QString("%1 frames, %2 dropped, %3 tracks overwritten before they were read, %4 mismatched\n")
+		.arg(frames).arg(dropped).arg(torn).arg(mismatched);
+
+	return (mismatched) ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+#ifndef FDCFEED_H
+#define FDCFEED_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <atomic>
+
+#include "fdc-capture.h"
+#include "fdc-fingerprint.h"
+#include "fdc-bench.h"
+
+#define FEED_MAGIC		0x46434446		// "FDCF"
+#define FEED_VERSION		1			// bump on any layout change
+#define FEED_RECORDS		4096			// frames in the ring, power of two
+#define FEED_PAYLOAD		(16 * 1024 * 1024)	// track data ring, power of two
+#define FEED_READ_TRIES		100000			// reads of a record mid update before giving up
+
+#define FEED_OK			0
+#define FEED_NOT_YET		1			// not published yet
+#define FEED_OVERRUN		2			// overwritten before it was read
+
+//
+// Segment layout: header, FEED_RECORDS records, then the payload ring. A
+// reader must check magic, version and the sizes before trusting anything
+// else. head counts frames published; payloadEnd is the absolute end of
+// the payload bytes the writer has claimed, which may already be changing.
+//
+typedef struct TFEEDHEADER {
+	quint32 magic;
+	quint16 version;
+	quint16 headerSize;			// sizeof(tfeedheader_t)
+	quint32 recordSize;			// sizeof(tfeedrecord_t)
+	quint32 records;
+	quint64 payloadSize;
+	qint64 pid;				// publishing process
+	qint64 started;				// fdcNow() when created
+	quint32 baud;
+	quint32 reserved;
+	char transport[32];			// FDCSerial::name()
+	char port[64];
+	std::atomic<quint64> head;
+	std::atomic<quint64> payloadEnd;
+} tfeedheader_t;
+
+//
+// One decoded transaction. Its track data, if any, stays in the payload
+// ring at payloadPos (absolute, modulo the ring size).
+//
+typedef struct TFEEDFRAME {
+	tcaprecord_t rec;
+	tfingerprint_t print;			// READ track as received, zero otherwise
+	quint64 payloadPos;
+	quint32 payloadLen;			// 0 for none
+	quint32 reserved;
+} tfeedframe_t;
+
+//
+// seq is 2n + 1 while frame n is being written and 2n + 2 once it is
+// complete, so a reader knows both whether it is torn and whether it is
+// still the frame it asked for.
+//
+typedef struct TFEEDRECORD {
+	std::atomic<quint64> seq;
+	tfeedframe_t frame;
+} tfeedrecord_t;
+
+//
+// Live transaction feed in a POSIX shared memory segment. One link writes
+// it and never waits; any number of readers map it read only and tail it.
+// A frame is copied out (it is small), track data is read in place and
+// checked afterwards, and a reader that falls more than a ring behind
+// finds its frames overwritten and skips ahead, losing them.
+//
+class FDCFeed
+{
+public:
+	FDCFeed();
+	~FDCFeed();
+
+	bool create(const QString &name, const QString &transport, const QString &port, quint32 baud);
+	bool attach(const QString &name);
+	void close(void);
+	bool isOpen(void) const { return header != NULL; }
+	QString errorString(void) const { return lastError; }
+	QString name(void) const { return feedName; }
+
+	void publish(const tcaprecord_t &rec, const tfingerprint_t &print, const quint8 *data, quint32 length);
+
+	const tfeedheader_t &info(void) const { return *header; }
+	quint64 head(void) const { return header->head.load(std::memory_order_acquire); }
+	int read(quint64 index, tfeedframe_t *frame) const;
+	const quint8 *payload(const tfeedframe_t &frame) const;
+	bool payloadValid(const tfeedframe_t &frame) const;
+
+private:
+	tfeedheader_t *header;
+	tfeedrecord_t *records;
+	quint8 *ring;
+	size_t size;
+	bool owner;
+	QString feedName;
+	QString lastError;
+
+	bool map(const QString &name, bool create);
+};
+
+int runTail(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,384 @@
+/**********************************************************************************
+*
+*  Track fingerprints for the FDC+ Serial Drive Simulator
+*
+*  CRC32C runs on the SSE4.2 CRC32 instruction on x86-64 and the ARMv8 CRC32
+*  extension on 64 bit ARM, checked for once at startup, and falls back to a
+*  slicing by 8 table elsewhere. The 64 bit hash is XXH64, which needs nothing
+*  beyond 64 bit multiplies to run at several bytes per cycle.
+*
+*  Both are streaming so the link can fingerprint a track piece by piece as
+*  it comes off the port, while the piece is still in cache.
+*
+***********************************************************************************/
+
+#include "fdc-fingerprint.h"
+
+#include <QtEndian>
+
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+
+#if defined(Q_PROCESSOR_X86_64) && defined(Q_CC_GNU)
+#include <nmmintrin.h>
+#define CRC_HW_X86
+#elif defined(Q_PROCESSOR_ARM_64) && defined(Q_CC_GNU) && defined(Q_OS_LINUX)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC_HW_ARM
+#endif
+
+#define CRC32C_POLY		0x82f63b78		// reflected Castagnoli polynomial
+
+#define XXH_PRIME1		0x9e3779b185ebca87ULL
+#define XXH_PRIME2		0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME3		0x165667b19e3779f9ULL
+#define XXH_PRIME4		0x85ebca77c2b2ae63ULL
+#define XXH_PRIME5		0x27d4eb2f165667c5ULL
+
+typedef quint32 (*tcrcfunc_t)(quint32 crc, const quint8 *data, qint64 length);
+
+static quint32 crcTable[8][256];
+
+static inline quint64 rotl64(quint64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 load64(const quint8 *p)
+{
+	quint64 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return qFromLittleEndian(v);
+}
+
+static inline quint32 load32(const quint8 *p)
+{
+	quint32 v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return qFromLittleEndian(v);
+}
+
+//
+// Software CRC32C, eight bytes per step
+//
+static void crcInitTable()
+{
+	quint32 c;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++) {
+			c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		}
+		crcTable[0][i] = c;
+	}
+
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			crcTable[j][i] = (crcTable[j - 1][i] >> 8) ^ crcTable[0][crcTable[j - 1][i] & 0xff];
+		}
+	}
+}
+
+static quint32 crcTableUpdate(quint32 crc, const quint8 *data, qint64 length)
+{
+	quint32 lo, hi;
+
+	while (length >= 8) {
+		lo = load32(data) ^ crc;
+		hi = load32(data + 4);
+		crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^ crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24]
+			^ crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^ crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = (crc >> 8) ^ crcTable[0][(crc ^ *data++) & 0xff];
+	}
+
+	return crc;
+}
+
+#if defined(CRC_HW_X86)
+__attribute__((target("sse4.2")))
+static quint32 crcHwUpdate(quint32 crc, const quint8 *data, qint64 length)
+{
+	quint64 c;
+
+	c = crc;
+
+	while (length >= 8) {
+		c = _mm_crc32_u64(c, load64(data));
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		c = _mm_crc32_u8((quint32) c, *data++);
+	}
+
+	return (quint32) c;
+}
+
+static bool crcHwAvailable()
+{
+	return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(CRC_HW_ARM)
+__attribute__((target("+crc")))
+static quint32 crcHwUpdate(quint32 crc, const quint8 *data, qint64 length)
+{
+	while (length >= 8) {
+		crc = __crc32cd(crc, load64(data));
+		data += 8;
+		length -= 8;
+	}
+
+	while (length--) {
+		crc = __crc32cb(crc, *data++);
+	}
+
+	return crc;
+}
+
+static bool crcHwAvailable()
+{
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+#else
+static bool crcHwAvailable()
+{
+	return false;
+}
+#endif
+
+//
+// Pick the fastest CRC, on first use rather than before main()
+//
+static tcrcfunc_t crcSelect()
+{
+	crcInitTable();
+
+#if defined(CRC_HW_X86) || defined(CRC_HW_ARM)
+	if (crcHwAvailable()) {
+		return crcHwUpdate;
+	}
+#endif
+
+	return crcTableUpdate;
+}
+
+static quint32 crcFirstUpdate(quint32 crc, const quint8 *data, qint64 length);
+
+static std::atomic<tcrcfunc_t> crcUpdate(crcFirstUpdate);
+static std::once_flag crcOnce;
+
+static void crcInit()
+{
+	std::call_once(crcOnce, []() { crcUpdate = crcSelect(); });
+}
+
+static quint32 crcFirstUpdate(quint32 crc, const quint8 *data, qint64 length)
+{
+	crcInit();
+
+	return crcUpdate.load()(crc, data, length);
+}
+
+static inline quint64 xxhRound(quint64 acc, quint64 input)
+{
+	acc += input * XXH_PRIME2;
+	acc = rotl64(acc, 31);
+
+	return acc * XXH_PRIME1;
+}
+
+static inline quint64 xxhMerge(quint64 h, quint64 acc)
+{
+	h ^= xxhRound(0, acc);
+
+	return h * XXH_PRIME1 + XXH_PRIME4;
+}
+
+void FDCFingerprint::reset()
+{
+	crc = 0xffffffff;
+	acc[0] = XXH_PRIME1 + XXH_PRIME2;
+	acc[1] = XXH_PRIME2;
+	acc[2] = 0;
+	acc[3] = 0 - XXH_PRIME1;
+	pendingLen = 0;
+	total = 0;
+}
+
+void FDCFingerprint::update(const quint8 *data, qint64 length)
+{
+	int n;
+
+	if (length <= 0) {
+		return;
+	}
+
+	crc = crcUpdate.load(std::memory_order_acquire)(crc, data, length);
+	total += length;
+
+	// Top up a partial stripe from the last piece first
+	if (pendingLen) {
+		n = qMin((qint64) (32 - pendingLen), length);
+		memcpy(&pending[pendingLen], data, n);
+		pendingLen += n;
+		data += n;
+		length -= n;
+
+		if (pendingLen < 32) {
+			return;
+		}
+
+		acc[0] = xxhRound(acc[0], load64(pending));
+		acc[1] = xxhRound(acc[1], load64(pending + 8));
+		acc[2] = xxhRound(acc[2], load64(pending + 16));
+		acc[3] = xxhRound(acc[3], load64(pending + 24));
+		pendingLen = 0;
+	}
+
+	while (length >= 32) {
+		acc[0] = xxhRound(acc[0], load64(data));
+		acc[1] = xxhRound(acc[1], load64(data + 8));
+		acc[2] = xxhRound(acc[2], load64(data + 16));
+		acc[3] = xxhRound(acc[3], load64(data + 24));
+		data += 32;
+		length -= 32;
+	}
+
+	if (length) {
+		memcpy(pending, data, length);
+		pendingLen = length;
+	}
+}
+
+tfingerprint_t FDCFingerprint::result() const
+{
+	tfingerprint_t print;
+	const quint8 *p;
+	quint64 h;
+	int n;
+
+	if (total >= 32) {
+		h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+		h = xxhMerge(h, acc[0]);
+		h = xxhMerge(h, acc[1]);
+		h = xxhMerge(h, acc[2]);
+		h = xxhMerge(h, acc[3]);
+	}
+	else {
+		h = XXH_PRIME5;
+	}
+
+	h += (quint64) total;
+
+	for (p = pending, n = pendingLen; n >= 8; p += 8, n -= 8) {
+		h ^= xxhRound(0, load64(p));
+		h = rotl64(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+
+	if (n >= 4) {
+		h ^= (quint64) load32(p) * XXH_PRIME1;
+		h = rotl64(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+		n -= 4;
+	}
+
+	while (n--) {
+		h ^= *p++ * XXH_PRIME5;
+		h = rotl64(h, 11) * XXH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+
+	print.crc = ~crc;
+	print.length = total;
+	print.hash = h;
+
+	return print;
+}
+
+tfingerprint_t FDCFingerprint::of(const quint8 *data, qint64 length)
+{
+	FDCFingerprint fp;
+
+	fp.update(data, length);
+
+	return fp.result();
+}
+
+//
+// zlib style: pass 0 to start, the previous result to continue
+//
+quint32 FDCFingerprint::crc32c(quint32 crc, const quint8 *data, qint64 length)
+{
+	return ~crcUpdate.load(std::memory_order_acquire)(~crc, data, length);
+}
+
+quint64 FDCFingerprint::hash64(const quint8 *data, qint64 length)
+{
+	return of(data, length).hash;
+}
+
+//
+// Force the table or the instructions, for benchmarks. False if the CPU
+// can't do what is asked.
+//
+bool FDCFingerprint::setImplementation(int impl)
+{
+	crcInit();
+
+	if (impl == CRC_IMPL_TABLE) {
+		crcUpdate = crcTableUpdate;
+		return true;
+	}
+
+#if defined(CRC_HW_X86) || defined(CRC_HW_ARM)
+	if (impl == CRC_IMPL_HW && crcHwAvailable()) {
+		crcUpdate = crcHwUpdate;
+		return true;
+	}
+#endif
+
+	return false;
+}
+
+int FDCFingerprint::implementation()
+{
+	crcInit();
+
+	return (crcUpdate == crcTableUpdate) ? CRC_IMPL_TABLE : CRC_IMPL_HW;
+}
+
+const char *FDCFingerprint::implementationName()
+{
+	crcInit();
+
+	if (crcUpdate == crcTableUpdate) {
+		return "table";
+	}
+
+#if defined(CRC_HW_X86)
+	return "sse4.2";
+#else
+	return "armv8-crc";
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef FDCFINGERPRINT_H
+#define FDCFINGERPRINT_H
+
+#include <QtGlobal>
+
+#define CRC_IMPL_TABLE		0			// slicing by 8, any CPU
+#define CRC_IMPL_HW		1			// SSE4.2 or ARMv8 CRC32 instructions
+
+//
+// Track fingerprint: two independent checks so a collision in one is caught
+// by the other. Equal fingerprints and lengths mean equal tracks for any
+// practical purpose; neither is meant to resist a deliberate collision.
+//
+typedef struct TFINGERPRINT {
+	quint32 crc;				// CRC32C (Castagnoli)
+	quint32 length;				// bytes fingerprinted
+	quint64 hash;				// XXH64, seed 0
+} tfingerprint_t;
+
+static inline bool operator==(const tfingerprint_t &a, const tfingerprint_t &b)
+{
+	return a.crc == b.crc && a.length == b.length && a.hash == b.hash;
+}
+
+static inline bool operator!=(const tfingerprint_t &a, const tfingerprint_t &b)
+{
+	return !(a == b);
+}
+
+//
+// Streaming fingerprint. Feed it the track in whatever pieces arrive from the
+// port and the result is the same as fingerprinting the whole track at once.
+// The CRC uses the CPU's CRC32C instructions when it has them, chosen on
+// first use.
+//
+class FDCFingerprint
+{
+public:
+	FDCFingerprint() { reset(); }
+
+	void reset(void);
+	void update(const quint8 *data, qint64 length);
+	tfingerprint_t result(void) const;
+
+	static tfingerprint_t of(const quint8 *data, qint64 length);
+	static quint32 crc32c(quint32 crc, const quint8 *data, qint64 length);
+	static quint64 hash64(const quint8 *data, qint64 length);
+
+	static bool setImplementation(int impl);
+	static int implementation(void);
+	static const char *implementationName(void);
+
+private:
+	quint32 crc;				// running, not yet inverted
+	quint64 acc[4];				// XXH64 lanes
+	quint8 pending[32];			// XXH64 partial stripe
+	int pendingLen;
+	qint64 total;
+};
+
+#endif
@@ -0,0 +1,609 @@
+/**********************************************************************************
+*
+*  Logic analyzer import for the FDC+ Serial Drive Simulator
+*
+*  Turns an analyzer's async serial decode of a real FDC+ line into a
+*  capture file, so --model and anything else that reads captures works on
+*  hardware timing:
+*
+*      fdc-sim-gui --import fdc.csv --output fdc.cap
+*      fdc-sim-gui --import tx.csv,rx.csv --output fdc.cap
+*      fdc-sim-gui --model fdc.cap
+*
+*  CSV exports are read by their header: a time column ("start_time",
+*  "Time [s]", "Time [us]", ...), a data or value column (hex, decimal,
+*  binary or a character) and, if both lines are in one file, a name or
+*  channel column. Rows of another type than data are skipped. Anything not
+*  ending in .csv is read as binary records (tlarecord_t). Which line is
+*  which is worked out from what is on it: the FDC's side carries commands.
+*
+*  Every time in the capture is from the line itself. A command is queued
+*  at its first start bit and sent at its last stop bit; a response is
+*  first seen when its first byte is complete. The inter-command gaps are
+*  the FDC's own.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QMap>
+
+#include <algorithm>
+
+#include <string.h>
+#include <limits.h>
+
+#include "fdc-import.h"
+#include "fdc-capture.h"
+#include "fdc-link.h"
+#include "fdc-memory.h"
+
+typedef QMap<QString, QVector<tlabyte_t>> tlachannels_t;
+
+static const quint32 standardBauds[] = { 9600, 19200, 38400, 57600, 115200, 230400, 403200, 460800, 921600, 0 };
+
+//
+// Fields of one CSV line, quotes removed
+//
+static QStringList csvFields(const QString &line)
+{
+	QStringList fields;
+	QString field;
+	bool quoted;
+	int i;
+
+	for (quoted = false, i = 0; i < line.size(); i++) {
+		if (line[i] == '"') {
+			if (quoted && i + 1 < line.size() && line[i + 1] == '"') {
+				field += '"';
+				i++;
+			}
+			else {
+				quoted = !quoted;
+			}
+		}
+		else if (line[i] == ',' && !quoted) {
+			fields.append(field.trimmed());
+			field.clear();
+		}
+		else {
+			field += line[i];
+		}
+	}
+
+	fields.append(field.trimmed());
+
+	return fields;
+}
+
+//
+// A byte as the decoder shows it in whatever radix it was set to
+//
+static bool byteValue(QString s, quint8 *value)
+{
+	uint v;
+	bool ok;
+
+	if (s.size() == 3 && s.startsWith('\'') && s.endsWith('\'')) {
+		s = s.mid(1, 1);
+	}
+
+	if (s.startsWith("0x") || s.startsWith("0X")) {
+		v = s.mid(2).toUInt(&ok, 16);
+	}
+	else if (s.startsWith("0b") || s.startsWith("0B")) {
+		v = s.mid(2).toUInt(&ok, 2);
+	}
+	else if (s.size() == 1 && !s[0].isDigit()) {
+		v = s[0].toLatin1();
+		ok = true;
+	}
+	else {
+		v = s.toUInt(&ok, 10);
+	}
+
+	*value = v;
+
+	return ok && v <= 0xff;
+}
+
+//
+// Add a decoded byte to its channel, against the MEM_ANALYSIS budget.
+// reserved counts what has been taken, for runImport() to give back.
+//
+static bool keep(tlachannels_t *channels, const QString &name, const tlabyte_t &b, qint64 *reserved, const QString &fileName, QString *error)
+{
+	if (!FDCMemory::reserve(MEM_ANALYSIS, sizeof(b))) {
+		*error = QString("%1: analysis memory budget reached after %2 bytes, raise --mem-limit analysis")
+			.arg(fileName).arg(*reserved / (qint64) sizeof(b));
+		return false;
+	}
+
+	*reserved += sizeof(b);
+	(*channels)[name].append(b);
+
+	return true;
+}
+
+static bool loadCsv(const QString &fileName, tlachannels_t *channels, qint64 *reserved, QString *error)
+{
+	QFile file(fileName);
+	QStringList fields;
+	QString line, h, name;
+	tlabyte_t b;
+	double scale;
+	int timeCol, dataCol, nameCol, typeCol, errorCol, n;
+	bool ok;
+
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		*error = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	timeCol = dataCol = nameCol = typeCol = errorCol = -1;
+	scale = 1e9;
+
+	fields = csvFields(QString::fromUtf8(file.readLine()).trimmed());
+
+	for (n = 0; n < fields.size(); n++) {
+		h = fields[n].toLower();
+
+		if (timeCol == -1 && h.contains("time")) {
+			timeCol = n;
+			scale = (h.contains("[ms]")) ? 1e6 : (h.contains("[us]") || h.contains("[µs]")) ? 1e3 : (h.contains("[ns]")) ? 1.0 : 1e9;
+		}
+		else if (dataCol == -1 && (h == "data" || h.startsWith("value"))) {
+			dataCol = n;
+		}
+		else if (nameCol == -1 && (h == "name" || h == "channel" || h.startsWith("analyzer"))) {
+			nameCol = n;
+		}
+		else if (typeCol == -1 && h == "type") {
+			typeCol = n;
+		}
+		else if (errorCol == -1 && h.contains("error")) {
+			errorCol = n;
+		}
+	}
+
+	if (timeCol == -1 || dataCol == -1) {
+		*error = QString("%1: no time and data columns in the header").arg(fileName);
+		return false;
+	}
+
+	for (n = 2; !(line = QString::fromUtf8(file.readLine())).isEmpty(); n++) {
+		fields = csvFields(line.trimmed());
+
+		if (fields.size() <= qMax(timeCol, dataCol) || fields[dataCol].isEmpty()) {
+			continue;
+		}
+
+		if (typeCol != -1 && typeCol < fields.size() && fields[typeCol] != "data") {
+			continue;
+		}
+
+		b.t = qRound64(fields[timeCol].toDouble(&ok) * scale);
+
+		if (!ok || !byteValue(fields[dataCol], &b.value)) {
+			*error = QString("%1:%2: can't read the time or byte").arg(fileName).arg(n);
+			return false;
+		}
+
+		b.error = (errorCol != -1 && errorCol < fields.size() && !fields[errorCol].isEmpty()
+			&& fields[errorCol] != "0" && fields[errorCol].toLower() != "false");
+
+		name = QFileInfo(fileName).fileName();
+		if (nameCol != -1 && nameCol < fields.size()) {
+			name += ":" + fields[nameCol];
+		}
+
+		if (!keep(channels, name, b, reserved, fileName, error)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool loadBinary(const QString &fileName, tlachannels_t *channels, qint64 *reserved, QString *error)
+{
+	QFile file(fileName);
+	tlarecord_t rec;
+	tlabyte_t b;
+
+	if (!file.open(QIODevice::ReadOnly)) {
+		*error = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	if (file.size() % IMPORT_RECORD_LEN) {
+		*error = QString("%1: not a whole number of %2 byte records").arg(fileName).arg(IMPORT_RECORD_LEN);
+		return false;
+	}
+
+	while (file.read((char *) &rec, sizeof(rec)) == sizeof(rec)) {
+		b.t = rec.t;
+		b.value = rec.value;
+		b.error = (rec.flags & 0x03) != 0;
+
+		if (!keep(channels, QString("%1:%2").arg(QFileInfo(fileName).fileName()).arg(rec.channel), b, reserved, fileName, error)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//
+// A valid command frame starts at bytes[i]: known name, good checksum
+//
+static int commandAt(const QVector<tlabyte_t> &bytes, int i, tcommand_t *frame)
+{
+	static const char *commands[CMD_COUNT] = { "STAT", "READ", "WRIT" };
+	int k, cmd;
+
+	if (i + CMDBUF_SIZE > bytes.size()) {
+		return -1;
+	}
+
+	for (k = 0; k < CMDBUF_SIZE; k++) {
+		frame->asBytes[k] = bytes[i + k].value;
+	}
+
+	for (cmd = 0; cmd < CMD_COUNT; cmd++) {
+		if (!memcmp(frame->command, commands[cmd], sizeof(frame->command))) {
+			break;
+		}
+	}
+
+	if (cmd == CMD_COUNT || FDCLink::calcChecksum(frame->asBytes, COMMAND_LENGTH) != frame->checksum) {
+		return -1;
+	}
+
+	return cmd;
+}
+
+static int countCommands(const QVector<tlabyte_t> &bytes)
+{
+	tcommand_t frame;
+	int i, n;
+
+	for (n = 0, i = 0; i < bytes.size(); ) {
+		if (commandAt(bytes, i, &frame) != -1) {
+			n++;
+			i += CMDBUF_SIZE;
+		}
+		else {
+			i++;
+		}
+	}
+
+	return n;
+}
+
+//
+// Byte time from the densest spacing on the line (track data goes back to
+// back), snapped to a standard rate when it is close to one
+//
+static quint32 inferBaud(const QVector<tlabyte_t> &tx, const QVector<tlabyte_t> &rx)
+{
+	QVector<qint64> deltas;
+	qint64 byteNs;
+	quint32 baud;
+	int i;
+
+	for (i = 1; i < rx.size(); i++) {
+		if (rx[i].t > rx[i - 1].t) {
+			deltas.append(rx[i].t - rx[i - 1].t);
+		}
+	}
+	for (i = 1; i < tx.size(); i++) {
+		if (tx[i].t > tx[i - 1].t) {
+			deltas.append(tx[i].t - tx[i - 1].t);
+		}
+	}
+
+	if (deltas.size() < 100) {
+		return 0;
+	}
+
+	std::sort(deltas.begin(), deltas.end());
+	byteNs = deltas[deltas.size() / 20];
+	baud = (quint32) (10e9 / byteNs);
+
+	for (i = 0; standardBauds[i]; i++) {
+		if (qAbs((qint64) baud - standardBauds[i]) * 100 <= (qint64) standardBauds[i] * IMPORT_BAUD_SLACK) {
+			return standardBauds[i];
+		}
+	}
+
+	return baud;
+}
+
+//
+// Up to want RX bytes from j that arrived before end
+//
+static int takeRx(const QVector<tlabyte_t> &rx, int j, qint64 end, int want)
+{
+	int n;
+
+	for (n = 0; n < want && j + n < rx.size() && rx[j + n].t < end; n++) {
+	}
+
+	return n;
+}
+
+//
+// A 10 byte response at rx[j]: LINK_ code, with rcode and rdata filled in
+//
+static int response(const QVector<tlabyte_t> &rx, int j, int n, const char *expect, tcaprecord_t *rec)
+{
+	tcommand_t frame;
+	int k;
+
+	if (n < CMDBUF_SIZE) {
+		return LINK_TIMEOUT;
+	}
+
+	for (k = 0; k < CMDBUF_SIZE; k++) {
+		frame.asBytes[k] = rx[j + k].value;
+	}
+
+	rec->rcode = frame.rcode;
+	rec->rdata = frame.rdata;
+
+	if (memcmp(frame.command, expect, sizeof(frame.command)) || FDCLink::calcChecksum(frame.asBytes, COMMAND_LENGTH) != frame.checksum) {
+		return LINK_BAD_RESPONSE;
+	}
+
+	return LINK_OK;
+}
+
+static int import(const tbenchopts_t &opts, qint64 *reserved)
+{
+	QTextStream out(stdout);
+	tlachannels_t channels;
+	QVector<tlabyte_t> tx, rx;
+	QString error, txName, rxName;
+	FDCCapture capture;
+	FDCHistogram turnaround[CMD_COUNT], gap[CMD_COUNT];
+	quint64 count[CMD_COUNT], failed[CMD_COUNT];
+	quint64 noise, stray, flagged;
+	tcaprecord_t rec;
+	tcommand_t frame;
+	qint64 byteNs, base, end, prevDone;
+	quint32 baud;
+	quint16 sum;
+	int i, j, k, n, cmd, want;
+
+	for (const QString &fileName : opts.importFiles) {
+		if (!((fileName.endsWith(".csv", Qt::CaseInsensitive)) ? loadCsv(fileName, &channels, reserved, &error) : loadBinary(fileName, &channels, reserved, &error))) {
+			out << error << "\n";
+			return 1;
+		}
+	}
+
+	if (channels.size() != 2) {
+		out << QString("Need the FDC's TX and RX lines, found %1 channels:").arg(channels.size());
+		for (const QString &name : channels.keys()) {
+			out << " " << name;
+		}
+		out << "\n";
+		return 1;
+	}
+
+	// The FDC's side is the one with commands on it
+	txName = channels.firstKey();
+	rxName = channels.lastKey();
+
+	if (countCommands(channels[rxName]) > countCommands(channels[txName])) {
+		qSwap(txName, rxName);
+	}
+
+	// Taken out of the map, so sorting them doesn't copy
+	tx = channels.take(txName);
+	rx = channels.take(rxName);
+
+	auto byTime = [](const tlabyte_t &a, const tlabyte_t &b) { return a.t < b.t; };
+	std::stable_sort(tx.begin(), tx.end(), byTime);
+	std::stable_sort(rx.begin(), rx.end(), byTime);
+
+	if (tx.isEmpty()) {
+		out << "Nothing on the FDC's line\n";
+		return 1;
+	}
+
+	if (!(baud = inferBaud(tx, rx))) {
+		baud = opts.baudRate;
+	}
+
+	byteNs = 10000000000LL / baud;
+
+	// Analyzer time zero is the trigger and may be well into the capture;
+	// start at 1 ms so 0 can still mean never
+	base = tx[0].t - 1000000;
+	if (!rx.isEmpty()) {
+		base = qMin(base, rx[0].t - 1000000);
+	}
+	for (tlabyte_t &b : tx) {
+		b.t -= base;
+	}
+	for (tlabyte_t &b : rx) {
+		b.t -= base;
+	}
+
+	if (!capture.create(opts.outputFile, "logic analyzer", opts.importFiles.join(','), baud)) {
+		out << capture.errorString() << "\n";
+		return 1;
+	}
+
+	memset(count, 0, sizeof(count));
+	memset(failed, 0, sizeof(failed));
+	noise = stray = flagged = 0;
+	prevDone = 0;
+
+	for (i = 0, j = 0; i < tx.size(); ) {
+		if ((cmd = commandAt(tx, i, &frame)) == -1) {
+			noise++;
+			i++;
+			continue;
+		}
+
+		memset(&rec, 0, sizeof(rec));
+		rec.cmd = cmd;
+		rec.drive = (cmd == CMD_STAT) ? frame.param1 & 0xff : frame.param1 >> 12;
+		rec.track = (cmd == CMD_STAT) ? frame.param2 : frame.param1 & 0x0fff;
+		rec.length = (cmd == CMD_STAT) ? 0 : frame.param2;
+		rec.tQueued = tx[i].t;
+		rec.tSent = tx[i + CMDBUF_SIZE - 1].t + byteNs;
+
+		for (k = i; k < i + CMDBUF_SIZE; k++) {
+			flagged += tx[k].error;
+		}
+
+		i += CMDBUF_SIZE;
+
+		// Whatever came from the server before the command started was for
+		// nobody
+		while (j < rx.size() && rx[j].t < rec.tQueued) {
+			stray++;
+			j++;
+		}
+
+		// The response is what arrives before the FDC sends again
+		end = (i < tx.size()) ? tx[i].t : LLONG_MAX;
+		want = (cmd == CMD_READ) ? rec.length + 2 : CMDBUF_SIZE;
+		n = takeRx(rx, j, end, want);
+
+		rec.tDone = rec.tSent;
+
+		if (n) {
+			rec.tFirst = rx[j].t + byteNs;
+			rec.tResp = rx[j + n - 1].t + byteNs;
+			rec.tDone = rec.tResp;
+		}
+
+		if (cmd == CMD_READ) {
+			for (sum = 0, k = j; k < j + n - 2; k++) {
+				sum += rx[k].value;
+			}
+
+			if (n == 0) {
+				rec.result = LINK_TIMEOUT;
+			}
+			else if (n < want) {
+				rec.result = LINK_SHORT_TRACK;
+			}
+			else if (sum != (rx[j + n - 2].value | (rx[j + n - 1].value << 8))) {
+				rec.result = LINK_CHECKSUM_ERR;
+			}
+			else {
+				rec.result = LINK_OK;
+			}
+		}
+		else {
+			rec.result = response(rx, j, n, (cmd == CMD_STAT) ? "STAT" : "WRIT", &rec);
+		}
+
+		for (k = j; k < j + n; k++) {
+			flagged += rx[k].error;
+		}
+
+		j += n;
+
+		// An accepted WRIT carries the track out, then the WSTA comes back
+		if (cmd == CMD_WRIT && rec.result == LINK_OK && rec.rcode == STAT_OK) {
+			if (i + rec.length + 2 > tx.size()) {
+				rec.result = LINK_TIMEOUT;
+				i = tx.size();
+			}
+			else {
+				rec.tData = tx[i + rec.length + 1].t + byteNs;
+				rec.tDone = rec.tData;
+				i += rec.length + 2;
+
+				end = (i < tx.size()) ? tx[i].t : LLONG_MAX;
+				n = takeRx(rx, j, end, CMDBUF_SIZE);
+
+				if (n) {
+					rec.tWsta = rx[j].t + byteNs;
+					rec.tDone = rx[j + n - 1].t + byteNs;
+				}
+
+				rec.result = response(rx, j, n, "WSTA", &rec);
+				j += n;
+			}
+		}
+
+		// Left over before the next command: more than was asked for
+		while (j < rx.size() && rx[j].t < end) {
+			stray++;
+			j++;
+		}
+
+		if (!capture.write(rec)) {
+			out << QString("%1: write failed\n").arg(opts.outputFile);
+			return 1;
+		}
+
+		count[cmd]++;
+
+		if (rec.result != LINK_OK) {
+			failed[cmd]++;
+		}
+		else {
+			turnaround[cmd].record(qMax((qint64) 0, rec.tFirst - byteNs - rec.tSent));
+		}
+
+		if (prevDone) {
+			gap[cmd].record(qMax((qint64) 0, rec.tQueued - prevDone));
+		}
+		prevDone = rec.tDone;
+	}
+
+	stray += rx.size() - j;
+
+	out << QString("FDC %1, %2 bytes; server %3, %4 bytes; %5 baud\n")
+		.arg(txName).arg(tx.size()).arg(rxName).arg(rx.size()).arg(baud);
+
+	out << QString("%1 %2 %3 | %4 %5 | %6 %7 %8\n")
+		.arg("", 4).arg("count", 8).arg("failed", 6)
+		.arg("server p50", 10).arg("p99", 8)
+		.arg("gap p50", 8).arg("p99", 8).arg("max", 8);
+
+	for (cmd = 0; cmd < CMD_COUNT; cmd++) {
+		if (count[cmd]) {
+			out << QString("%1 %2 %3 | %4 %5 | %6 %7 %8\n")
+				.arg(FDCMetrics::commandName(cmd), 4).arg(count[cmd], 8).arg(failed[cmd], 6)
+				.arg(turnaround[cmd].percentile(0.50) / 1e6, 10, 'f', 3).arg(turnaround[cmd].percentile(0.99) / 1e6, 8, 'f', 3)
+				.arg(gap[cmd].percentile(0.50) / 1e6, 8, 'f', 3).arg(gap[cmd].percentile(0.99) / 1e6, 8, 'f', 3)
+				.arg(gap[cmd].max() / 1e6, 8, 'f', 3);
+		}
+	}
+
+	if (noise || stray || flagged) {
+		out << QString("%1 FDC bytes outside a command, %2 server bytes nobody asked for, %3 bytes flagged by the decoder\n")
+			.arg(noise).arg(stray).arg(flagged);
+	}
+
+	out << QString("Wrote %1 transactions to %2\n").arg(count[CMD_STAT] + count[CMD_READ] + count[CMD_WRIT]).arg(opts.outputFile);
+
+	return 0;
+}
+
+//
+// The decoded bytes count against MEM_ANALYSIS while the capture is made
+//
+int runImport(const tbenchopts_t &opts)
+{
+	qint64 reserved;
+	int r;
+
+	reserved = 0;
+	r = import(opts, &reserved);
+	FDCMemory::release(MEM_ANALYSIS, reserved);
+
+	return r;
+}
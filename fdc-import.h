@@ -0,0 +1,36 @@
+#ifndef FDCIMPORT_H
+#define FDCIMPORT_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+
+#include "fdc-bench.h"
+
+#define IMPORT_BAUD_SLACK	3			// percent an inferred baud may be off a standard one
+#define IMPORT_RECORD_LEN	16			// bytes per binary record
+
+//
+// One byte decoded by the analyzer's async serial decoder
+//
+typedef struct TLABYTE {
+	qint64 t;				// ns, start bit
+	quint8 value;
+	bool error;				// framing or parity error flagged
+} tlabyte_t;
+
+//
+// Binary export, one IMPORT_RECORD_LEN byte record per decoded byte in
+// little endian order, as written by the scripts that drive our analyzers
+//
+typedef struct TLARECORD {
+	qint64 t;				// ns, start bit
+	quint8 channel;				// any two distinct values, told apart by content
+	quint8 value;
+	quint8 flags;				// bit 0 framing error, bit 1 parity error
+	quint8 reserved[5];
+} tlarecord_t;
+
+int runImport(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,367 @@
+/**********************************************************************************
+*
+*  Capacity knee finder for the FDC+ Serial Drive Simulator
+*
+*  Offers a server more load step by step, STATs and READs paced at a fixed
+*  rate on each link, until latency breaks a service level objective, and
+*  reports the last step that held it:
+*
+*      fdc-sim-gui --knee stat --port ttyUSB0 --stat-rate 20 --steps 10
+*      fdc-sim-gui --knee links --port ttyUSB0,ttyUSB1,ttyUSB2,ttyUSB3 --slo stat:p99:50,read:p999:1000
+*
+*  Step n offers n times the base rate (stat, read, all) and n links (links,
+*  all, up to the --port list). A step holds if every objective is met, no
+*  transaction failed and at least KNEE_CARRIED percent of the offered load
+*  was carried: a server that can't keep up shows it in throughput first.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+
+#include <vector>
+
+#include <signal.h>
+#include <string.h>
+
+#include "fdc-knee.h"
+#include "fdc-engine.h"
+
+static const char *modeNames[] = { "stat", "read", "links", "all", NULL };
+
+// Ctrl-C ends the step in progress and the ramp
+static FDCCancel interrupted;
+
+static void interruptHandler(int)
+{
+	interrupted.cancel();
+}
+
+int kneeModeFromName(const QString &name)
+{
+	int mode;
+
+	for (mode = 0; modeNames[mode] != NULL; mode++) {
+		if (name == modeNames[mode]) {
+			return mode;
+		}
+	}
+
+	return -1;
+}
+
+//
+// "stat:p99:50,read:p999:1000": command, percentile, limit in ms
+//
+bool kneeParseSlo(const QString &spec, QVector<tkneeslo_t> *slos, QString *error)
+{
+	QStringList parts;
+	tkneeslo_t slo;
+	double limit;
+	bool ok;
+
+	slos->clear();
+
+	for (const QString &item : spec.split(',')) {
+		parts = item.trimmed().split(':');
+
+		if (parts.size() != 3 || (parts[0] != "stat" && parts[0] != "read")) {
+			*error = QString("%1: expected stat or read:pNN:ms").arg(item);
+			return false;
+		}
+
+		slo.cmd = (parts[0] == "stat") ? CMD_STAT : CMD_READ;
+
+		// p99 is 0.99, p999 and p99.9 are 0.999
+		if (parts[1].contains('.')) {
+			slo.quantile = parts[1].mid(1).toDouble(&ok) / 100.0;
+		}
+		else {
+			slo.quantile = ("0." + parts[1].mid(1)).toDouble(&ok);
+		}
+
+		if (!parts[1].startsWith('p') || parts[1].size() < 2 || !ok || slo.quantile <= 0.0 || slo.quantile >= 1.0) {
+			*error = QString("%1: bad percentile").arg(item);
+			return false;
+		}
+
+		limit = parts[2].toDouble(&ok);
+
+		if (!ok || limit <= 0.0) {
+			*error = QString("%1: bad limit").arg(item);
+			return false;
+		}
+
+		slo.limit = limit * 1000000LL;
+		slos->append(slo);
+	}
+
+	return true;
+}
+
+//
+// One command at rate per second on one link until end. Sends are kept
+// to the schedule, not to the last response, so a stream that falls behind
+// sends back to back and its carried rate shows it.
+//
+static FDCTask paced(FDCClient *client, const tbenchopts_t *opts, int cmd, double rate, qint64 first, qint64 end, tkneestream_t *stream)
+{
+	quint8 buf[TRACKBUF_LEN_CRC];
+	tresult_t r;
+	qint64 next, period, deadline;
+	quint16 track;
+
+	period = 1e9 / rate;
+	track = 0;
+
+	for (next = first; next < end && !interrupted.isCancelled(); next += period) {
+		co_await client->engine()->sleepUntil(next);
+
+		deadline = (opts->deadline) ? fdcDeadline(opts->deadline) : 0;
+
+		if (cmd == CMD_STAT) {
+			r = co_await client->stat(opts->drive, track, deadline, &interrupted);
+		}
+		else {
+			r = co_await client->read(opts->drive, track, buf, opts->trackLen, deadline, &interrupted);
+			track = (track + 1) % opts->trackMax;
+		}
+
+		if (r.result == LINK_CANCELLED) {
+			co_return;
+		}
+
+		stream->sent++;
+
+		if (r.result != LINK_OK) {
+			stream->failed++;
+			continue;
+		}
+
+		// From the wire, as FDCMetrics: a STAT queued behind this link's own
+		// READ is the link's limit, not the server's, and shows as rate
+		stream->latency.record(r.latency);
+	}
+}
+
+//
+// Offer the step's load to its links for opts.stepTime ms
+//
+static void runStep(FDCEnginePool &pool, const std::vector<FDCClient *> &clients, const tbenchopts_t &opts, tkneestep_t *step)
+{
+	std::vector<tkneestream_t> streams;
+	qint64 start, end, elapsed;
+	int c, cmd;
+
+	streams.resize(step->links * CMD_COUNT);
+
+	for (tkneestream_t &s : streams) {
+		s.latency.reset();
+		s.sent = 0;
+		s.failed = 0;
+	}
+
+	start = fdcNow() + KNEE_SETTLE * 1000000LL;
+	end = start + opts.stepTime * 1000000LL;
+
+	for (c = 0; c < step->links; c++) {
+		for (cmd = CMD_STAT; cmd <= CMD_READ; cmd++) {
+			if (step->rate[cmd] > 0.0) {
+				// Links start spread over a period so they don't all send at once
+				clients[c]->engine()->spawn(paced(clients[c], &opts, cmd, step->rate[cmd],
+					start + (qint64) (1e9 / step->rate[cmd] * c / step->links), end, &streams[c * CMD_COUNT + cmd]));
+			}
+		}
+	}
+
+	pool.wait();
+
+	elapsed = qMax(fdcNow(), end) - start;
+
+	for (cmd = 0; cmd < CMD_COUNT; cmd++) {
+		step->latency[cmd].reset();
+		step->carried[cmd] = 0.0;
+	}
+
+	step->failed = 0;
+
+	for (c = 0; c < step->links; c++) {
+		for (cmd = CMD_STAT; cmd <= CMD_READ; cmd++) {
+			tkneestream_t &s = streams[c * CMD_COUNT + cmd];
+
+			step->latency[cmd].add(s.latency);
+			step->carried[cmd] += s.sent * 1e9 / elapsed;
+			step->failed += s.failed;
+		}
+	}
+}
+
+//
+// Objectives met, nothing failed and the offered load carried
+//
+static bool judge(const tkneestep_t &step, const QVector<tkneeslo_t> &slos)
+{
+	int cmd;
+
+	if (step.failed) {
+		return false;
+	}
+
+	for (cmd = CMD_STAT; cmd <= CMD_READ; cmd++) {
+		if (step.carried[cmd] * 100.0 < step.rate[cmd] * step.links * KNEE_CARRIED) {
+			return false;
+		}
+	}
+
+	for (const tkneeslo_t &slo : slos) {
+		if (step.latency[slo.cmd].count() && step.latency[slo.cmd].percentile(slo.quantile) > slo.limit) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static QString stepLoad(const tkneestep_t &step)
+{
+	return QString("%1 link%2, %3 STAT/s %4 READ/s per link")
+		.arg(step.links).arg((step.links == 1) ? "" : "s")
+		.arg(step.rate[CMD_STAT], 0, 'f', 1).arg(step.rate[CMD_READ], 0, 'f', 1);
+}
+
+int findKnee(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	QVector<tkneeslo_t> slos;
+	QVector<tkneestep_t> steps;
+	std::vector<FDCClient *> clients;
+	FDCEnginePool pool(opts.threads);
+	FDCClient *client;
+	struct sigaction sa, oldSa;
+	tkneestep_t step;
+	QString error;
+	int n, k, cmd, count, best;
+
+	if (!kneeParseSlo(opts.slo, &slos, &error)) {
+		out << error << "\n";
+		return 2;
+	}
+
+	for (const QString &port : opts.ports) {
+		client = new FDCClient(pool.next());
+
+		if (!client->open(port, opts.baudRate)) {
+			out << client->errorString() << "\n";
+			delete client;
+			continue;
+		}
+
+		clients.push_back(client);
+	}
+
+	if (clients.empty()) {
+		return 1;
+	}
+
+	count = (opts.kneeMode == KNEE_MODE_LINKS) ? (int) clients.size() : opts.steps;
+
+	out << QString("Ramping %1 over %2 steps of %3 s on %4 link%5, objectives")
+		.arg(modeNames[opts.kneeMode]).arg(count).arg(opts.stepTime / 1000.0, 0, 'f', 1)
+		.arg(clients.size()).arg((clients.size() == 1) ? "" : "s");
+	for (const tkneeslo_t &slo : slos) {
+		out << QString(" %1 p%2 < %3 ms").arg(FDCMetrics::commandName(slo.cmd))
+			.arg(slo.quantile * 100.0).arg(slo.limit / 1e6);
+	}
+	out << "\n\n";
+
+	out << QString("%1 %2 %3 %4 ").arg("step", 4).arg("links", 5).arg("STAT/s", 7).arg("READ/s", 7);
+	out << QString(" %1 %2 %3 %4").arg("STAT/s", 7).arg("p50", 7).arg("p99", 7).arg("p999", 7);
+	out << QString(" %1 %2 %3 %4").arg("READ/s", 7).arg("p50", 7).arg("p99", 7).arg("p999", 7);
+	out << QString(" %1  %2\n").arg("failed", 6).arg("SLO");
+	out.flush();
+
+	interrupted.reset();
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldSa);
+
+	best = -1;
+
+	for (n = 0; n < count && !interrupted.isCancelled(); n++) {
+		k = n + 1;
+
+		step.links = (opts.kneeMode == KNEE_MODE_LINKS || opts.kneeMode == KNEE_MODE_ALL) ? qMin(k, (int) clients.size()) : (int) clients.size();
+		step.rate[CMD_STAT] = (opts.kneeMode == KNEE_MODE_READ) ? 0.0 : opts.statRate;
+		step.rate[CMD_READ] = (opts.kneeMode == KNEE_MODE_STAT) ? 0.0 : opts.readRate;
+		step.rate[CMD_WRIT] = 0.0;
+
+		if (opts.kneeMode != KNEE_MODE_LINKS) {
+			step.rate[CMD_STAT] *= k;
+			step.rate[CMD_READ] *= k;
+		}
+
+		runStep(pool, clients, opts, &step);
+
+		// A step cut short says nothing
+		if (interrupted.isCancelled()) {
+			break;
+		}
+
+		step.met = judge(step, slos);
+		steps.append(step);
+
+		out << QString("%1 %2 %3 %4 ").arg(k, 4).arg(step.links, 5)
+			.arg(step.rate[CMD_STAT], 7, 'f', 1).arg(step.rate[CMD_READ], 7, 'f', 1);
+
+		for (cmd = CMD_STAT; cmd <= CMD_READ; cmd++) {
+			out << QString(" %1 %2 %3 %4").arg(step.carried[cmd], 7, 'f', 1)
+				.arg(step.latency[cmd].percentile(0.50) / 1e6, 7, 'f', 2)
+				.arg(step.latency[cmd].percentile(0.99) / 1e6, 7, 'f', 2)
+				.arg(step.latency[cmd].percentile(0.999) / 1e6, 7, 'f', 2);
+		}
+
+		out << QString(" %1  %2\n").arg(step.failed, 6).arg((step.met) ? "met" : "BROKEN");
+		out.flush();
+
+		// Past the knee latency only climbs; no need to push the server further
+		if (!step.met) {
+			break;
+		}
+
+		best = n;
+	}
+
+	sigaction(SIGINT, &oldSa, NULL);
+
+	for (FDCClient *c : clients) {
+		delete c;
+	}
+
+	out << "\n";
+
+	if (interrupted.isCancelled()) {
+		out << "Interrupted\n";
+	}
+
+	if (best == -1 && steps.isEmpty()) {
+		return 1;
+	}
+
+	if (best == -1) {
+		out << QString("No sustainable load: the first step, %1, broke the objectives\n").arg(stepLoad(steps[0]));
+		return 1;
+	}
+
+	out << QString("Capacity: %1 (%2 STAT/s, %3 READ/s in all)\n").arg(stepLoad(steps[best]))
+		.arg(steps[best].rate[CMD_STAT] * steps[best].links, 0, 'f', 1)
+		.arg(steps[best].rate[CMD_READ] * steps[best].links, 0, 'f', 1);
+
+	if (best == steps.size() - 1 && !interrupted.isCancelled()) {
+		out << QString("Every step met the objectives; the knee is further out, try more %1\n")
+			.arg((opts.kneeMode == KNEE_MODE_LINKS) ? "links" : "--steps");
+	}
+	else if (!steps.last().met) {
+		out << QString("Broken at %1\n").arg(stepLoad(steps.last()));
+	}
+
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FDCKNEE_H
+#define FDCKNEE_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QVector>
+
+#include "fdc-bench.h"
+#include "fdc-metrics.h"
+
+#define KNEE_MODE_STAT		0			// ramp STATs per link
+#define KNEE_MODE_READ		1			// ramp READs per link
+#define KNEE_MODE_LINKS		2			// add a link per step
+#define KNEE_MODE_ALL		3			// all three together
+
+#define KNEE_CARRIED		95			// percent of the offered load a step must carry
+#define KNEE_SETTLE		20			// ms from spawning a step to its first send
+#define KNEE_SLO		"stat:p99:50,read:p99:1000"
+
+//
+// One latency objective, e.g. STAT p99 under 50 ms
+//
+typedef struct TKNEESLO {
+	int cmd;				// CMD_STAT or CMD_READ
+	double quantile;			// 0.99 for p99
+	qint64 limit;				// ns
+} tkneeslo_t;
+
+//
+// What one paced stream of one command on one link saw in a step. Only the
+// stream's coroutine touches it until the step is over.
+//
+typedef struct TKNEESTREAM {
+	FDCHistogram latency;			// ns, command on wire to done
+	quint64 sent;
+	quint64 failed;
+} tkneestream_t;
+
+//
+// One step of the ramp, per link rates
+//
+typedef struct TKNEESTEP {
+	int links;
+	double rate[CMD_COUNT];			// offered, per second per link
+	double carried[CMD_COUNT];		// achieved, per second over all links
+	FDCHistogram latency[CMD_COUNT];
+	quint64 failed;
+	bool met;
+} tkneestep_t;
+
+int kneeModeFromName(const QString &name);
+bool kneeParseSlo(const QString &spec, QVector<tkneeslo_t> *slos, QString *error);
+int findKnee(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,702 @@
+/**********************************************************************************
+*
+*  FDC+ serial drive protocol engine
+*
+*  Issues STAT, READ and WRIT transactions over an FDCSerial transport. See
+*  fdc-sim-gui.cpp for a description of the protocol.
+*
+***********************************************************************************/
+
+#include <string.h>
+
+#include "fdc-link.h"
+#include "fdc-startup.h"
+
+FDCLink::FDCLink()
+{
+	port = NULL;
+	expect = "";
+	received = 0;
+	outQueueLimit = OUTQ_LIMIT;
+	deadline = 0;
+	cancel = NULL;
+	shm = NULL;
+	shmSlot = -1;
+	capture = NULL;
+	feed = NULL;
+	payload = NULL;
+	rxFirst = 0;
+	rxPrintLen = 0;
+	rxSum = 0;
+	accounted = false;
+	memset(&resync, 0, sizeof(resync));
+	memset(&response, 0, sizeof(response));
+	memset(&last, 0, sizeof(last));
+}
+
+FDCLink::~FDCLink()
+{
+	close();
+	delete port;
+
+	if (accounted) {
+		FDCMemory::release(MEM_SESSIONS, sizeof(*this));
+	}
+}
+
+bool FDCLink::open(const QString &portName, quint32 baudRate, int backend)
+{
+	close();
+	delete port;
+	port = NULL;
+
+	if (!accounted && !(accounted = FDCMemory::reserve(MEM_SESSIONS, sizeof(*this)))) {
+		lastError = QString("%1: session memory budget exhausted").arg(portName);
+		return false;
+	}
+
+	lastError.clear();
+	port = FDCSerial::create(backend);
+
+	if (!port->open(portName, baudRate)) {
+		return false;
+	}
+
+	FDCStartup::mark("port open");
+
+	return true;
+}
+
+void FDCLink::close()
+{
+	// Nothing is owed to a server on a closed line
+	memset(&resync, 0, sizeof(resync));
+
+	if (port != NULL) {
+		port->close();
+	}
+}
+
+bool FDCLink::isOpen() const
+{
+	return (port != NULL && port->isOpen());
+}
+
+//
+// Publish metrics to shm after every transaction
+//
+void FDCLink::setShm(FDCShm *shm, const QString &linkName)
+{
+	this->shm = shm;
+	shmSlot = (shm != NULL) ? shm->addLink(linkName) : -1;
+
+	if (shm != NULL) {
+		shm->publish(shmSlot, metrics);
+	}
+}
+
+QString FDCLink::errorString() const
+{
+	return (port != NULL) ? port->errorString() : lastError;
+}
+
+int FDCLink::stat(quint16 param1, quint16 param2, qint64 deadline, FDCCancel *cancel)
+{
+	int r;
+
+	begin(CMD_STAT, param1 & 0xff, param2, 0, deadline, cancel);
+	payload = NULL;
+
+	if ((r = sendCommand("STAT", param1, param2, CMDBUF_SIZE)) != LINK_OK) {
+		return finish(r);
+	}
+
+	if ((r = recvResponse("STAT", RESPONSE_TIMEOUT)) == LINK_OK) {
+		mounts.update(response.rdata, last.tSent, last.tFirst);
+	}
+
+	return finish(r);
+}
+
+int FDCLink::read(quint8 drive, quint16 track, quint16 length, quint8 *buf, qint64 deadline, FDCCancel *cancel)
+{
+	int r;
+
+	begin(CMD_READ, drive, track, length, deadline, cancel);
+	payload = buf;
+
+	if ((r = sendCommand("READ", track | (drive << 12), length, length + 2)) != LINK_OK) {
+		return finish(r);
+	}
+
+	expect = "READ";
+
+	// Track data followed by 16 bit checksum, ends on an idle gap. The data
+	// is summed and fingerprinted as it arrives.
+	rxPrintLen = length;
+	r = receive(buf, length + 2, TRACK_GAP_TIMEOUT, &received);
+	rxPrintLen = 0;
+
+	last.tFirst = rxFirst;
+	last.tResp = fdcNow();
+
+	if (r == LINK_SHORT_TRACK && !received) {
+		r = LINK_TIMEOUT;
+	}
+
+	if (r != LINK_OK) {
+		return finish(r);
+	}
+
+	last.print = rxPrint.result();
+
+	if (rxSum != (buf[length] | (buf[length+1] << 8))) {
+		return finish(LINK_CHECKSUM_ERR);
+	}
+
+	return finish(LINK_OK);
+}
+
+int FDCLink::writ(quint8 drive, quint16 track, quint16 length, quint8 *buf, qint64 deadline, FDCCancel *cancel)
+{
+	return writSummed(drive, track, length, buf, calcChecksum(buf, length), deadline, cancel);
+}
+
+//
+// WRIT with the track checksum already known, e.g. kept up to date by
+// FDCWriteBack as the track was edited
+//
+int FDCLink::writSummed(quint8 drive, quint16 track, quint16 length, quint8 *buf, quint16 checksum, qint64 deadline, FDCCancel *cancel)
+{
+	int r;
+
+	begin(CMD_WRIT, drive, track, length, deadline, cancel);
+	payload = buf;
+
+	// Given up on with the WRIT response owed, the server may still be
+	// waiting for the track
+	if ((r = sendCommand("WRIT", track | (drive << 12), length, CMDBUF_SIZE)) != LINK_OK) {
+		if (resync.discard) {
+			abandonWrit(&resync, response.asBytes, 0, length);
+		}
+		return finish(r);
+	}
+
+	// Wait for WRIT response
+	if ((r = recvResponse("WRIT", RESPONSE_TIMEOUT)) != LINK_OK || response.rcode != STAT_OK) {
+		if (resync.discard) {
+			abandonWrit(&resync, response.asBytes, CMDBUF_SIZE - resync.discard, length);
+		}
+		return finish(r);
+	}
+
+	buf[length] = checksum & 0x00ff;                 // LSB of checksum
+	buf[length+1] = (checksum >> 8) & 0x00ff;        // MSB of checksum
+
+	if ((r = send(buf, length + 2, CMDBUF_SIZE)) != LINK_OK) {
+		return finish(r);
+	}
+
+	last.tData = fdcNow();
+
+	// Wait for WSTA response
+	return finish(recvResponse("WSTA", RESPONSE_TIMEOUT));
+}
+
+void FDCLink::begin(int cmd, quint8 drive, quint16 track, quint16 length, qint64 deadline, FDCCancel *cancel)
+{
+	FDCStartup::ready();
+
+	this->deadline = deadline;
+	this->cancel = cancel;
+
+	last.cmd = cmd;
+	last.drive = drive;
+	last.track = track;
+	last.length = length;
+	last.result = LINK_OK;
+	last.tQueued = fdcNow();
+	last.tSent = last.tQueued;
+	last.tFirst = 0;
+	last.tResp = 0;
+	last.tData = 0;
+	last.tWsta = 0;
+	last.tDone = last.tQueued;
+	memset(&last.print, 0, sizeof(last.print));
+
+	rxPrint.reset();
+	rxPrintLen = 0;
+	rxSum = 0;
+
+	catchUp();
+}
+
+int FDCLink::finish(int result)
+{
+	tcaprecord_t rec;
+
+	last.tDone = fdcNow();
+	last.result = result;
+
+	if (result == LINK_NOT_OPEN) {
+		return result;
+	}
+
+	metrics.commands[last.cmd]++;
+
+	if (result == LINK_OK) {
+		metrics.latency[last.cmd].record(last.tDone - last.tSent);
+
+		if (last.cmd == CMD_WRIT) {
+			writs.record(last.drive, last.tSent, last.tResp, last.tData, last.tWsta, last.tDone);
+		}
+	}
+	else if (result == LINK_TIMEOUT) {
+		metrics.timeouts[last.cmd]++;
+	}
+	else if (result == LINK_CANCELLED) {
+		metrics.cancels[last.cmd]++;
+	}
+	else {
+		metrics.errors[last.cmd]++;
+	}
+
+	sampleQueues();
+
+	if (shm != NULL) {
+		shm->publish(shmSlot, metrics, mounts, last.cmd, last.drive, last.track, result);
+	}
+
+	if (capture != NULL || feed != NULL) {
+		memset(&rec, 0, sizeof(rec));
+		rec.cmd = last.cmd;
+		rec.drive = last.drive;
+		rec.track = last.track;
+		rec.length = last.length;
+		rec.result = result;
+		rec.rcode = response.rcode;
+		rec.rdata = response.rdata;
+		rec.tQueued = last.tQueued;
+		rec.tSent = last.tSent;
+		rec.tFirst = last.tFirst;
+		rec.tResp = last.tResp;
+		rec.tData = last.tData;
+		rec.tWsta = last.tWsta;
+		rec.tDone = last.tDone;
+
+		if (capture != NULL) {
+			capture->write(rec);
+		}
+
+		// READ data as far as it arrived, WRIT data once it was sent
+		if (feed != NULL) {
+			feed->publish(rec, last.print, payload, (last.cmd == CMD_READ) ? qBound((qint64) 0, received, (qint64) last.length) : (last.tData) ? last.length : 0);
+		}
+	}
+
+	return result;
+}
+
+//
+// LINK_CANCELLED or LINK_TIMEOUT once the transaction's token or deadline
+// says to stop
+//
+int FDCLink::check()
+{
+	if (cancel != NULL && cancel->isCancelled()) {
+		return LINK_CANCELLED;
+	}
+
+	if (deadline && fdcNow() >= deadline) {
+		return LINK_TIMEOUT;
+	}
+
+	return LINK_OK;
+}
+
+//
+// How long to block before looking at the token, deadline or poll hook again
+//
+int FDCLink::slice(qint64 until) const
+{
+	qint64 msecs;
+
+	if (deadline && deadline < until) {
+		until = deadline;
+	}
+
+	msecs = qMax((qint64) 0, (until - fdcNow() + 999999) / 1000000);
+
+	if (cancel != NULL || pollHook) {
+		msecs = qMin(msecs, (qint64) CANCEL_POLL);
+	}
+
+	return msecs;
+}
+
+//
+// Settle what an abandoned transaction left behind: finish the frame the
+// server is still reading and throw away the response it is still sending.
+// Whatever else is in the input queue by then is stale too.
+//
+void FDCLink::catchUp()
+{
+	quint8 scratch[256];
+	qint64 n, now;
+
+	if (!isOpen() || (!resync.padRemaining && !resync.discard)) {
+		return;
+	}
+
+	do {
+		if (resync.padRemaining) {
+			while ((n = padBytes(&resync, scratch, sizeof(scratch))) > 0) {
+				if (port->write(scratch, n) != n) {
+					break;
+				}
+				metrics.bytesOut += n;
+			}
+
+			port->waitOutQueue(0, RESPONSE_TIMEOUT);
+			resync.until = qMax(resync.until, fdcNow() + RESPONSE_TIMEOUT * 1000000LL);
+		}
+
+		while (resync.discard > 0 && (now = fdcNow()) < resync.until) {
+			if ((n = port->read(scratch, qMin(resync.discard, (qint64) sizeof(scratch)), (resync.until - now + 999999) / 1000000)) <= 0) {
+				break;
+			}
+			metrics.bytesIn += n;
+			metrics.resyncDiscard += n;
+			absorb(&resync, scratch, n);
+		}
+	} while (resync.padRemaining);
+
+	metrics.resyncDiscard += port->inQueue();
+	port->clear();
+
+	metrics.resyncs++;
+	memset(&resync, 0, sizeof(resync));
+}
+
+//
+// Wait for the output queue to drain to limit bytes
+//
+int FDCLink::waitOut(qint64 limit, qint64 until)
+{
+	int r;
+
+	while (!port->waitOutQueue(limit, slice(until))) {
+		if ((r = check()) != LINK_OK) {
+			return r;
+		}
+
+		if (fdcNow() >= until) {
+			return LINK_TIMEOUT;
+		}
+
+		if (pollHook) {
+			pollHook();
+		}
+	}
+
+	return LINK_OK;
+}
+
+//
+// Write a frame through the bounded output queue and wait until the last
+// byte is on the wire. Allows for the wire time of the data plus the normal
+// response timeout. reply is what the server sends back for the frame; if
+// the frame is abandoned the link is resynchronised before the next command.
+//
+int FDCLink::send(const quint8 *data, qint64 length, qint64 reply)
+{
+	qint64 offset, chunk, t, until, n;
+	int r;
+
+	t = fdcNow();
+	until = t + (RESPONSE_TIMEOUT + ((port->baud()) ? length * 10 * 1000 / port->baud() : 0)) * 1000000LL;
+
+	for (offset = 0; offset < length; offset += chunk) {
+		chunk = (outQueueLimit > 0) ? qMin(length - offset, outQueueLimit) : length - offset;
+
+		if ((r = check()) != LINK_OK) {
+			abandon(&resync, data, length, offset, reply, port->baud());
+			return r;
+		}
+
+		if (outQueueLimit > 0 && port->outQueue() + chunk > outQueueLimit) {
+			metrics.throttled++;
+			if ((r = waitOut(outQueueLimit - chunk, until)) != LINK_OK) {
+				abandon(&resync, data, length, offset, reply, port->baud());
+				return r;
+			}
+		}
+
+		if ((n = port->write(data + offset, chunk)) != chunk) {
+			// Part of the frame may be out: pad it before the next command
+			abandon(&resync, data, length, offset + qMax((qint64) 0, n), reply, port->baud());
+			return LINK_IO_ERROR;
+		}
+
+		sampleQueues();
+	}
+
+	if ((r = waitOut(0, until)) != LINK_OK) {
+		abandon(&resync, data, length, length, reply, port->baud());
+		return r;
+	}
+
+	metrics.queueDelay.record(fdcNow() - t);
+	metrics.bytesOut += length;
+
+	return LINK_OK;
+}
+
+//
+// Read length bytes. Gives up with LINK_SHORT_TRACK after gap ms without
+// data, or on the transaction's deadline or token, in which case the rest of
+// the data is discarded before the next command.
+//
+int FDCLink::receive(quint8 *buf, qint64 length, int gap, qint64 *count)
+{
+	qint64 n, idle;
+	int r;
+
+	r = LINK_OK;
+	rxFirst = 0;
+	*count = 0;
+	idle = fdcNow() + gap * 1000000LL;
+
+	while (*count < length) {
+		if ((r = check()) != LINK_OK) {
+			abandon(&resync, NULL, 0, 0, length - *count, port->baud());
+			break;
+		}
+
+		if (fdcNow() >= idle) {
+			r = LINK_SHORT_TRACK;
+			break;
+		}
+
+		if ((n = port->read(&buf[*count], length - *count, slice(idle))) == -1) {
+			r = LINK_IO_ERROR;
+			break;
+		}
+
+		if (n) {
+			if (!*count) {
+				rxFirst = fdcNow();
+			}
+			digest(&buf[*count], *count, n);
+			*count += n;
+			idle = fdcNow() + gap * 1000000LL;
+		}
+
+		if (pollHook) {
+			pollHook();
+		}
+	}
+
+	metrics.bytesIn += *count;
+
+	return (*count < length) ? r : LINK_OK;
+}
+
+//
+// Sum and fingerprint the track data in n bytes just received at offset,
+// leaving out the checksum that follows it
+//
+void FDCLink::digest(const quint8 *data, qint64 offset, qint64 n)
+{
+	n = qMin(n, rxPrintLen - offset);
+
+	if (n > 0) {
+		rxPrint.update(data, n);
+		rxSum += calcChecksum(data, n);
+	}
+}
+
+void FDCLink::sampleQueues()
+{
+	if (!isOpen()) {
+		return;
+	}
+
+	metrics.outQueue.record(port->outQueue());
+	metrics.inQueue.record(port->inQueue());
+	metrics.userQueueMax = qMax(metrics.userQueueMax, port->userQueue());
+}
+
+int FDCLink::sendCommand(const char *command, quint16 param1, quint16 param2, qint64 reply)
+{
+	int r;
+
+	if (!isOpen()) {
+		return LINK_NOT_OPEN;
+	}
+
+	memcpy(cmdBuf.command, command, sizeof(cmdBuf.command));
+	cmdBuf.param1 = param1;
+	cmdBuf.param2 = param2;
+	cmdBuf.checksum = calcChecksum(cmdBuf.asBytes, COMMAND_LENGTH);
+
+	expect = command;
+	received = 0;
+
+	last.tQueued = fdcNow();
+
+	if ((r = send(cmdBuf.asBytes, CMDBUF_SIZE, reply)) != LINK_OK) {
+		return r;
+	}
+
+	last.tSent = fdcNow();
+
+	return LINK_OK;
+}
+
+int FDCLink::recvResponse(const char *command, int msecs)
+{
+	qint64 n;
+	int r;
+
+	expect = command;
+
+	r = receive(response.asBytes, CMDBUF_SIZE, msecs, &n);
+
+	if (!strcmp(command, "WSTA")) {
+		last.tWsta = rxFirst;
+	}
+	else {
+		last.tFirst = rxFirst;
+		last.tResp = fdcNow();
+	}
+
+	if (r != LINK_OK) {
+		return (r == LINK_SHORT_TRACK) ? LINK_TIMEOUT : r;
+	}
+
+	if (memcmp(response.command, command, sizeof(response.command))) {
+		return LINK_BAD_RESPONSE;
+	}
+
+	return LINK_OK;
+}
+
+//
+// Record what is owed after giving up on a frame of frameLen bytes (data and
+// 16 bit checksum) of which sent have gone out. A frame not yet started owes
+// nothing. A partly sent one is finished with zeros and a checksum that
+// cannot match; the server ignores such a command and answers such track
+// data with WSTA. A frame sent in full owes its reply.
+//
+void FDCLink::abandon(tresync_t *rs, const quint8 *frame, qint64 frameLen, qint64 sent, qint64 reply, quint32 baud)
+{
+	qint64 dataLen;
+
+	memset(rs, 0, sizeof(*rs));
+
+	if (frame != NULL && sent == 0) {
+		return;
+	}
+
+	dataLen = frameLen - 2;
+
+	if (frame != NULL && sent < frameLen) {
+		rs->padRemaining = frameLen - sent;
+		rs->padZeros = qMax((qint64) 0, dataLen - sent);
+		rs->padChecksum = calcChecksum(frame, qMin(sent, dataLen)) ^ 0xffff;
+		rs->padChecksumSent = qMax((qint64) 0, sent - dataLen);
+		reply = (dataLen == COMMAND_LENGTH) ? 0 : CMDBUF_SIZE;
+	}
+
+	rs->discard = reply;
+	rs->until = fdcNow() + RESPONSE_TIMEOUT * 1000000LL;
+
+	if (baud) {
+		rs->until += (rs->padRemaining + rs->discard) * 10 * 1000000000LL / baud;
+	}
+}
+
+//
+// The WRIT command went out but its response had count bytes when given up
+// on. The rest still has to be read to know whether track data is owed.
+//
+void FDCLink::abandonWrit(tresync_t *rs, const quint8 *received, int count, quint16 length)
+{
+	rs->writLength = length;
+	memcpy(rs->writReply.asBytes, received, count);
+}
+
+//
+// Account for n owed response bytes. Once a pending WRIT reply is complete
+// and says OK, the server is owed a track it will reject with WSTA.
+//
+void FDCLink::absorb(tresync_t *rs, const quint8 *data, qint64 n)
+{
+	if (rs->writLength && rs->discard > 0) {
+		memcpy(&rs->writReply.asBytes[CMDBUF_SIZE - rs->discard], data, qMin(n, rs->discard));
+	}
+
+	rs->discard = qMax((qint64) 0, rs->discard - n);
+
+	if (rs->writLength && !rs->discard) {
+		if (!memcmp(rs->writReply.command, "WRIT", sizeof(rs->writReply.command)) && rs->writReply.rcode == STAT_OK) {
+			rs->padRemaining = rs->writLength + 2;
+			rs->padZeros = rs->writLength;
+			rs->padChecksum = 0xffff;
+			rs->padChecksumSent = 0;
+			rs->discard = CMDBUF_SIZE;
+		}
+		rs->writLength = 0;
+	}
+}
+
+//
+// Next bytes of the padding owed to the server
+//
+int FDCLink::padBytes(tresync_t *rs, quint8 *out, int max)
+{
+	int n;
+
+	for (n = 0; n < max && rs->padRemaining > 0; n++, rs->padRemaining--) {
+		if (rs->padZeros > 0) {
+			out[n] = 0;
+			rs->padZeros--;
+		}
+		else {
+			out[n] = (rs->padChecksum >> (8 * rs->padChecksumSent++)) & 0xff;
+		}
+	}
+
+	return n;
+}
+
+quint16 FDCLink::calcChecksum(const quint8 *data, int length)
+{
+	int i;
+	quint16 checksum;
+
+	checksum = 0;
+
+	for (i = 0; i < length; i++) {
+		checksum += data[i];
+	}
+
+	return checksum;
+}
+
+QString FDCLink::rcodeString(quint16 rcode)
+{
+	switch (rcode) {
+		case STAT_OK:
+			return QString("OK");
+		case STAT_NOT_READY:
+			return QString("NOT READY");
+		case STAT_CHECKSUM_ERR:
+			return QString("CHECKSUM ERROR");
+		case STAT_WRITE_ERR:
+			return QString("WRITE ERROR");
+		default:
+			return QString("UNKNOWN");
+	}
+}
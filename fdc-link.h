@@ -0,0 +1,213 @@
+#ifndef FDCLINK_H
+#define FDCLINK_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <atomic>
+#include <functional>
+
+#include "fdc-serial.h"
+#include "fdc-metrics.h"
+#include "fdc-shm.h"
+#include "fdc-capture.h"
+#include "fdc-feed.h"
+#include "fdc-fingerprint.h"
+#include "fdc-memory.h"
+#include "fdc-mount.h"
+#include "fdc-writ.h"
+
+#define MAX_DRIVE		4
+#define CMDBUF_SIZE		10
+#define COMMAND_LENGTH		8                       // does not include checksum bytes
+#define	TRACK_MAX_5		35			// Minidisk tracks
+#define	TRACK_MAX_8		77			// 8" tracks
+#define	TRACK_LEN_5		137*16			// Minidisk track length
+#define	TRACK_LEN_8		137*32			// 8" track length
+#define TRACKBUF_LEN		TRACK_LEN_8		// maximum valid track length
+#define TRACKBUF_LEN_CRC	(TRACKBUF_LEN+2)	// maximum valid track length with CRC
+#define STAT_OK			0x0000			// OK
+#define STAT_NOT_READY		0x0001			// Not Ready
+#define STAT_CHECKSUM_ERR	0x0002			// Checksum Error
+#define STAT_WRITE_ERR		0x0003			// Write Error
+
+#define RESPONSE_TIMEOUT	500			// ms to wait for a response message
+#define TRACK_GAP_TIMEOUT	100			// ms idle gap that ends a track transfer
+#define OUTQ_LIMIT		512			// default bytes allowed in the output queue
+#define CANCEL_POLL		10			// ms between cancellation checks
+
+#define LINK_OK			0			// Transaction completed
+#define LINK_NOT_OPEN		1			// Serial port not open
+#define LINK_TIMEOUT		2			// No (complete) response
+#define LINK_IO_ERROR		3			// read()/write() error
+#define LINK_BAD_RESPONSE	4			// Unexpected response command
+#define LINK_SHORT_TRACK	5			// Track transfer ended early
+#define LINK_CHECKSUM_ERR	6			// Track checksum mismatch
+#define LINK_CANCELLED		7			// Cancelled by the caller
+
+typedef struct TCOMMAND {
+	union {
+		quint8 asBytes[CMDBUF_SIZE];
+		struct {
+			char command[4];
+			union {
+				quint16 param1;
+				quint16 rcode;
+			};
+			union {
+				quint16 param2;
+				quint16 rdata;
+			};
+			quint16 checksum;
+		};
+	};
+} tcommand_t;
+
+typedef struct TTRANSACTION {
+	int cmd;				// CMD_STAT, CMD_READ or CMD_WRIT
+	quint8 drive;
+	quint16 track;
+	quint16 length;				// track length (READ/WRIT)
+	int result;				// LINK_ code
+	qint64 tQueued;				// command handed to the transport
+	qint64 tSent;				// command drained from the output queue
+	qint64 tFirst;				// first byte of the response (or track)
+	qint64 tResp;				// response (or track) complete
+	qint64 tData;				// WRIT track drained from the output queue
+	qint64 tWsta;				// first byte of the WSTA response
+	qint64 tDone;				// transaction complete
+	tfingerprint_t print;			// READ track data as received
+} ttransaction_t;
+
+//
+// Cancellation token. May be cancelled from any thread (or a signal handler);
+// transactions using it notice within CANCEL_POLL ms.
+//
+class FDCCancel
+{
+public:
+	FDCCancel() { cancelled = false; }
+
+	void cancel(void) { cancelled = true; }
+	void reset(void) { cancelled = false; }
+	bool isCancelled(void) const { return cancelled; }
+
+private:
+	std::atomic<bool> cancelled;
+};
+
+//
+// Absolute deadline msecs from now, on the fdcNow() clock
+//
+static inline qint64 fdcDeadline(int msecs)
+{
+	return fdcNow() + msecs * 1000000LL;
+}
+
+//
+// What is owed to and by the server after a transaction was abandoned part
+// way. A partly sent frame is completed with zeros and a checksum that is
+// guaranteed wrong, so the server rejects it instead of taking the next
+// command as data, and the bytes the server still has to send are discarded
+// before the next command goes out. A WRIT given up on before its response
+// arrived is special: if the server answers OK it is waiting for track data.
+//
+typedef struct TRESYNC {
+	qint64 padRemaining;			// bytes still owed to the server
+	qint64 padZeros;			// of which zero filled data
+	quint16 padChecksum;			// deliberately wrong checksum
+	int padChecksumSent;			// checksum bytes already sent
+	qint64 discard;				// response bytes still to arrive
+	qint64 until;				// stop waiting for them (fdcNow() ns)
+	quint16 writLength;			// track data owed if the WRIT reply is OK
+	tcommand_t writReply;			// that reply as it arrives
+} tresync_t;
+
+//
+// FDC side of the serial drive protocol. Each transaction blocks until it
+// completes or times out and returns one of the LINK_ codes. The last
+// response message is left in response, and expect names the response the
+// transaction was waiting for when it finished.
+//
+// Writes go out through a bounded output queue: no more than outQueueLimit
+// bytes (0 for no limit) are left pending in QSerialPort and the kernel, and
+// every message is drained before its transaction starts timing, so latency
+// reflects wire time rather than time spent in buffers.
+//
+// Every transaction may carry an absolute deadline (fdcNow() ns, 0 for the
+// protocol's own timeouts) and a cancellation token. Either ends it within
+// CANCEL_POLL ms with LINK_TIMEOUT or LINK_CANCELLED, and the link is put
+// back in step before the next command.
+//
+class FDCLink
+{
+public:
+	FDCLink();
+	~FDCLink();
+
+	bool open(const QString &portName, quint32 baudRate, int backend = SERIAL_BACKEND_QT);
+	void close(void);
+	bool isOpen(void) const;
+	QString errorString(void) const;
+	FDCSerial *serial(void) const { return port; }
+	void setOutQueueLimit(qint64 limit) { outQueueLimit = limit; }
+	void setPollHook(std::function<void()> hook) { pollHook = hook; }
+	void setShm(FDCShm *shm, const QString &linkName);
+	void setCapture(FDCCapture *capture) { this->capture = capture; }
+	void setFeed(FDCFeed *feed) { this->feed = feed; }
+
+	int stat(quint16 param1, quint16 param2, qint64 deadline = 0, FDCCancel *cancel = NULL);
+	int read(quint8 drive, quint16 track, quint16 length, quint8 *buf, qint64 deadline = 0, FDCCancel *cancel = NULL);
+	int writ(quint8 drive, quint16 track, quint16 length, quint8 *buf, qint64 deadline = 0, FDCCancel *cancel = NULL);
+	int writSummed(quint8 drive, quint16 track, quint16 length, quint8 *buf, quint16 checksum, qint64 deadline = 0, FDCCancel *cancel = NULL);
+
+	tcommand_t response;
+	const char *expect;
+	qint64 received;
+	ttransaction_t last;
+	FDCMetrics metrics;
+	FDCMountWatch mounts;
+	FDCWritPhases writs;
+
+	static quint16 calcChecksum(const quint8 *data, int length);
+	static QString rcodeString(quint16 rcode);
+	static void abandon(tresync_t *rs, const quint8 *frame, qint64 frameLen, qint64 sent, qint64 reply, quint32 baud);
+	static void abandonWrit(tresync_t *rs, const quint8 *received, int count, quint16 length);
+	static int padBytes(tresync_t *rs, quint8 *out, int max);
+	static void absorb(tresync_t *rs, const quint8 *data, qint64 n);
+
+private:
+	FDCSerial *port;
+	tcommand_t cmdBuf;
+	qint64 outQueueLimit;
+	qint64 deadline;
+	FDCCancel *cancel;
+	std::function<void()> pollHook;
+	tresync_t resync;
+	FDCShm *shm;
+	int shmSlot;
+	FDCCapture *capture;
+	FDCFeed *feed;
+	const quint8 *payload;			// track buffer of the READ or WRIT
+	qint64 rxFirst;
+	FDCFingerprint rxPrint;
+	qint64 rxPrintLen;
+	quint16 rxSum;
+	bool accounted;
+	QString lastError;
+
+	void begin(int cmd, quint8 drive, quint16 track, quint16 length, qint64 deadline, FDCCancel *cancel);
+	int finish(int result);
+	int check(void);
+	int slice(qint64 until) const;
+	void catchUp(void);
+	int waitOut(qint64 limit, qint64 until);
+	int send(const quint8 *data, qint64 length, qint64 reply);
+	int receive(quint8 *buf, qint64 length, int gap, qint64 *count);
+	void digest(const quint8 *data, qint64 offset, qint64 n);
+	void sampleQueues(void);
+	int sendCommand(const char *command, quint16 param1, quint16 param2, qint64 reply);
+	int recvResponse(const char *command, int msecs);
+};
+
+#endif
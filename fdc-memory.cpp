@@ -0,0 +1,186 @@
+/**********************************************************************************
+*
+*  Memory budgets for the FDC+ Serial Drive Simulator
+*
+*  Caps are set per subsystem with --mem-limit (or FDC_MEM_LIMIT for the
+*  dialog), e.g.
+*
+*      fdc-sim-gui --workload --port ttyUSB0 --workflows 100000 --mem-limit engine=64M
+*
+*  Usage is published with the metrics when --shm is given, so a monitor
+*  sees every instance's footprint per subsystem.
+*
+***********************************************************************************/
+
+#include "fdc-memory.h"
+
+#include <QStringList>
+
+#include <stdlib.h>
+
+static tmempool_t pools[MEM_COUNT];
+
+static const char *poolNames[MEM_COUNT] = { "store", "engine", "sessions", "analysis" };
+
+bool FDCMemory::reserve(int pool, qint64 bytes)
+{
+	tmempool_t *p;
+	qint64 used, cap, peak;
+
+	p = &pools[pool];
+	used = p->used.load(std::memory_order_relaxed);
+
+	do {
+		cap = p->limit.load(std::memory_order_relaxed);
+		if (cap && used + bytes > cap) {
+			p->denied++;
+			return false;
+		}
+	} while (!p->used.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed));
+
+	peak = p->peak.load(std::memory_order_relaxed);
+	while (used + bytes > peak && !p->peak.compare_exchange_weak(peak, used + bytes, std::memory_order_relaxed)) {
+	}
+
+	return true;
+}
+
+void FDCMemory::release(int pool, qint64 bytes)
+{
+	pools[pool].used.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+//
+// malloc() against a budget. NULL if over the cap or out of memory.
+//
+void *FDCMemory::alloc(int pool, size_t bytes)
+{
+	void *p;
+
+	if (!reserve(pool, bytes)) {
+		return NULL;
+	}
+
+	if ((p = malloc(bytes)) == NULL) {
+		release(pool, bytes);
+	}
+
+	return p;
+}
+
+void FDCMemory::free(int pool, void *p, size_t bytes)
+{
+	if (p != NULL) {
+		::free(p);
+		release(pool, bytes);
+	}
+}
+
+void FDCMemory::setLimit(int pool, qint64 bytes)
+{
+	pools[pool].limit = qMax((qint64) 0, bytes);
+}
+
+//
+// "store=256M,engine=64M,...", sizes in bytes or with a K, M or G suffix
+//
+bool FDCMemory::setLimits(const QString &spec, QString *error)
+{
+	QStringList parts;
+	QString size;
+	qint64 bytes, scale;
+	bool ok;
+	int pool;
+
+	for (const QString &item : spec.split(',')) {
+		parts = item.trimmed().split('=');
+
+		for (pool = 0; pool < MEM_COUNT && parts.size() == 2 && parts[0] != poolNames[pool]; pool++) {
+		}
+
+		if (parts.size() != 2 || pool == MEM_COUNT) {
+			*error = QString("%1: expected store, engine, sessions or analysis=size").arg(item);
+			return false;
+		}
+
+		size = parts[1].toUpper();
+		scale = 1;
+
+		if (size.endsWith('K')) {
+			scale = 1024;
+		}
+		else if (size.endsWith('M')) {
+			scale = 1024 * 1024;
+		}
+		else if (size.endsWith('G')) {
+			scale = 1024 * 1024 * 1024;
+		}
+
+		if (scale != 1) {
+			size.chop(1);
+		}
+
+		bytes = size.toLongLong(&ok);
+
+		if (!ok || bytes < 0) {
+			*error = QString("%1: bad size").arg(item);
+			return false;
+		}
+
+		setLimit(pool, bytes * scale);
+	}
+
+	return true;
+}
+
+qint64 FDCMemory::used(int pool)
+{
+	return pools[pool].used.load(std::memory_order_relaxed);
+}
+
+qint64 FDCMemory::peak(int pool)
+{
+	return pools[pool].peak.load(std::memory_order_relaxed);
+}
+
+qint64 FDCMemory::limit(int pool)
+{
+	return pools[pool].limit.load(std::memory_order_relaxed);
+}
+
+//
+// Bytes left under the cap, -1 if uncapped
+//
+qint64 FDCMemory::available(int pool)
+{
+	return (limit(pool)) ? qMax((qint64) 0, limit(pool) - used(pool)) : -1;
+}
+
+quint64 FDCMemory::denied(int pool)
+{
+	return pools[pool].denied.load(std::memory_order_relaxed);
+}
+
+const char *FDCMemory::name(int pool)
+{
+	return poolNames[pool];
+}
+
+QString FDCMemory::report()
+{
+	QString s;
+	int pool;
+
+	s = QString("%1 %2 %3 %4 %5\n").arg("memory", -9).arg("used KB", 10).arg("peak KB", 10).arg("limit KB", 10).arg("denied", 7);
+
+	for (pool = 0; pool < MEM_COUNT; pool++) {
+		s += QString("%1 %2 %3 %4 %5\n")
+			.arg(poolNames[pool], -9)
+			.arg(used(pool) / 1024, 10)
+			.arg(peak(pool) / 1024, 10)
+			.arg((limit(pool)) ? QString::number(limit(pool) / 1024) : QString("-"), 10)
+			.arg(denied(pool), 7);
+	}
+
+	return s;
+}
@@ -0,0 +1,54 @@
+#ifndef FDCMEMORY_H
+#define FDCMEMORY_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <atomic>
+
+#define MEM_STORE		0			// resident track data
+#define MEM_ENGINE		1			// coroutine workflow frames
+#define MEM_SESSIONS		2			// links and clients with their metrics
+#define MEM_ANALYSIS		3			// captures and logs loaded for analysis
+#define MEM_COUNT		4
+
+//
+// One named budget. limit 0 means uncapped.
+//
+typedef struct TMEMPOOL {
+	std::atomic<qint64> used;
+	std::atomic<qint64> peak;
+	std::atomic<qint64> limit;
+	std::atomic<quint64> denied;		// requests refused at the cap
+} tmempool_t;
+
+//
+// Process wide memory accounting. Every subsystem that can grow with the
+// length of a run takes its memory through reserve() (for mappings and
+// containers it sizes itself) or alloc(), against its own budget. A request
+// that would go over the cap is refused and counted, and the subsystem
+// carries on without it: a store or session isn't created, a workflow isn't
+// started, a log is analysed as far as it fits.
+//
+class FDCMemory
+{
+public:
+	static bool reserve(int pool, qint64 bytes);
+	static void release(int pool, qint64 bytes);
+	static void *alloc(int pool, size_t bytes);
+	static void free(int pool, void *p, size_t bytes);
+
+	static void setLimit(int pool, qint64 bytes);
+	static bool setLimits(const QString &spec, QString *error);
+
+	static qint64 used(int pool);
+	static qint64 peak(int pool);
+	static qint64 limit(int pool);
+	static qint64 available(int pool);
+	static quint64 denied(int pool);
+	static const char *name(int pool);
+
+	static QString report(void);
+};
+
+#endif
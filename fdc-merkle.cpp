@@ -0,0 +1,621 @@
+/**********************************************************************************
+*
+*  Merkle integrity index for the FDC+ Serial Drive Simulator
+*
+*  Every disk image gets an index beside it (image.dsk.merkle) with a hash
+*  per sector, per track and a tree over the tracks. Images are only hashed
+*  when they have changed since their index was made; after that, checking
+*  two copies compares a root hash each, and only disks that differ are
+*  walked down to the tracks and sectors that changed:
+*
+*      fdc-sim-gui --merkle-index ~/disks
+*      fdc-sim-gui --merkle-diff ~/disks,/mnt/backup/disks
+*      fdc-sim-gui --merkle-sync ~/disks,/mnt/backup/disks
+*      fdc-sim-gui --merkle-verify ~/disks/cpm22.dsk --port ttyUSB0 --drive 0
+*
+*  --merkle-sync copies just the differing tracks into the second copy and
+*  updates its index in place. The FDC+ protocol has no way to ask the
+*  server for a hash, so --merkle-verify reads the server's disk (held
+*  tracks come from the --track-cache if there is one, and any of them that
+*  differ are read again from the server before they are reported) and
+*  compares its tree with the image's.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+
+#include <string.h>
+
+#include "fdc-merkle.h"
+#include "fdc-fingerprint.h"
+#include "fdc-link.h"
+#include "fdc-cache.h"
+
+FDCMerkle::FDCMerkle()
+{
+	memset(&hdr, 0, sizeof(hdr));
+	fresh = false;
+}
+
+bool FDCMerkle::geometry(qint64 imageSize, quint16 *trackMax, quint16 *trackLen)
+{
+	if (imageSize == (qint64) TRACK_MAX_8 * TRACK_LEN_8) {
+		*trackMax = TRACK_MAX_8;
+		*trackLen = TRACK_LEN_8;
+		return true;
+	}
+
+	if (imageSize == (qint64) TRACK_MAX_5 * TRACK_LEN_5) {
+		*trackMax = TRACK_MAX_5;
+		*trackLen = TRACK_LEN_5;
+		return true;
+	}
+
+	return false;
+}
+
+//
+// The images a path names: the file itself, or every file in the
+// directory that is the size of a disk
+//
+QStringList FDCMerkle::images(const QString &path)
+{
+	QStringList found;
+	quint16 trackMax, trackLen;
+
+	if (!QFileInfo(path).isDir()) {
+		return QStringList() << path;
+	}
+
+	for (const QString &name : QDir(path).entryList(QDir::Files, QDir::Name)) {
+		if (!name.endsWith(MERKLE_SUFFIX) && geometry(QFileInfo(QDir(path).filePath(name)).size(), &trackMax, &trackLen)) {
+			found.append(QDir(path).filePath(name));
+		}
+	}
+
+	return found;
+}
+
+//
+// Empty tree for a disk: every sector and track hash 0, the nodes above
+// them hashed as usual, so trees filled in by setTrack() match built ones
+//
+bool FDCMerkle::create(quint16 trackMax, quint16 trackLen)
+{
+	int n;
+
+	if (trackMax == 0 || trackLen == 0 || trackLen % MERKLE_SECTOR_LEN) {
+		lastError = QString("%1 tracks of %2 bytes is not a disk").arg(trackMax).arg(trackLen);
+		return false;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MERKLE_MAGIC;
+	hdr.version = MERKLE_VERSION;
+	hdr.headerLen = sizeof(tmerkleheader_t);
+	hdr.trackMax = trackMax;
+	hdr.trackLen = trackLen;
+	hdr.sectorLen = MERKLE_SECTOR_LEN;
+	hdr.sectors = trackLen / MERKLE_SECTOR_LEN;
+
+	for (hdr.leaves = 1; hdr.leaves < trackMax; hdr.leaves <<= 1) {
+	}
+
+	sectorHashes.fill(0, trackMax * hdr.sectors);
+	nodes.fill(0, 2 * hdr.leaves);
+
+	for (n = hdr.leaves - 1; n >= 1; n--) {
+		nodes[n] = FDCFingerprint::hash64((const quint8 *) &nodes[2 * n], 2 * sizeof(quint64));
+	}
+
+	hdr.root = nodes[1];
+	indexFile.clear();
+	fresh = true;
+
+	return true;
+}
+
+//
+// Hash a track's sectors, the track and the path from it to the root
+//
+void FDCMerkle::setTrack(quint16 track, const quint8 *data)
+{
+	quint64 *sectors;
+	int s, n;
+
+	sectors = &sectorHashes[track * hdr.sectors];
+
+	for (s = 0; s < hdr.sectors; s++) {
+		sectors[s] = FDCFingerprint::hash64(data + s * hdr.sectorLen, hdr.sectorLen);
+	}
+
+	n = hdr.leaves + track;
+	nodes[n] = FDCFingerprint::hash64((const quint8 *) sectors, hdr.sectors * sizeof(quint64));
+
+	for (n /= 2; n >= 1; n /= 2) {
+		nodes[n] = FDCFingerprint::hash64((const quint8 *) &nodes[2 * n], 2 * sizeof(quint64));
+	}
+
+	hdr.root = nodes[1];
+}
+
+bool FDCMerkle::build(const QString &imageFile)
+{
+	QFile file(imageFile);
+	QFileInfo info(imageFile);
+	QByteArray image;
+	quint16 trackMax, trackLen, t;
+
+	if (!geometry(info.size(), &trackMax, &trackLen)) {
+		lastError = QString("%1: not a disk image (%2 bytes)").arg(imageFile).arg(info.size());
+		return false;
+	}
+
+	if (!file.open(QIODevice::ReadOnly) || (image = file.read(info.size())).size() != info.size()) {
+		lastError = QString("%1: %2").arg(imageFile).arg(file.errorString());
+		return false;
+	}
+
+	if (!create(trackMax, trackLen)) {
+		return false;
+	}
+
+	for (t = 0; t < trackMax; t++) {
+		setTrack(t, (const quint8 *) image.constData() + t * trackLen);
+	}
+
+	return stamp(imageFile);
+}
+
+//
+// Record the image's size and modification time, so open() can tell
+// whether the index is still the image's
+//
+bool FDCMerkle::stamp(const QString &imageFile)
+{
+	QFileInfo info(imageFile);
+
+	if (info.size() != (qint64) hdr.trackMax * hdr.trackLen) {
+		lastError = QString("%1: not a %2 byte image").arg(imageFile).arg((qint64) hdr.trackMax * hdr.trackLen);
+		return false;
+	}
+
+	hdr.imageSize = info.size();
+	hdr.imageModified = info.lastModified().toMSecsSinceEpoch();
+
+	return true;
+}
+
+//
+// The index beside the image if it is still the image's, reading only its
+// header; otherwise hash the image and write a new one
+//
+bool FDCMerkle::open(const QString &imageFile)
+{
+	QFileInfo info(imageFile);
+
+	if (QFileInfo(indexFor(imageFile)).exists() && load(indexFor(imageFile), true)
+		&& hdr.imageSize == info.size() && hdr.imageModified == info.lastModified().toMSecsSinceEpoch()) {
+		return true;
+	}
+
+	return build(imageFile) && save(indexFor(imageFile));
+}
+
+bool FDCMerkle::load(const QString &fileName, bool headerOnly)
+{
+	QFile file(fileName);
+	tmerkleheader_t h;
+	qint64 expect;
+
+	if (!file.open(QIODevice::ReadOnly)) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	if (file.read((char *) &h, sizeof(h)) != sizeof(h) || h.magic != MERKLE_MAGIC || h.version != MERKLE_VERSION
+		|| h.headerLen != sizeof(tmerkleheader_t) || h.sectorLen != MERKLE_SECTOR_LEN
+		|| h.sectors * h.sectorLen != h.trackLen || h.leaves < h.trackMax || (h.leaves & (h.leaves - 1))) {
+		lastError = QString("%1: not a Merkle index").arg(fileName);
+		return false;
+	}
+
+	expect = sizeof(h) + ((qint64) h.trackMax * h.sectors + 2 * h.leaves) * sizeof(quint64);
+
+	if (file.size() != expect) {
+		lastError = QString("%1: %2 bytes, should be %3").arg(fileName).arg(file.size()).arg(expect);
+		return false;
+	}
+
+	hdr = h;
+	indexFile = fileName;
+	fresh = false;
+	sectorHashes.clear();
+	nodes.clear();
+
+	if (headerOnly) {
+		return true;
+	}
+
+	sectorHashes.resize(hdr.trackMax * hdr.sectors);
+	nodes.resize(2 * hdr.leaves);
+
+	if (file.read((char *) sectorHashes.data(), sectorHashes.size() * sizeof(quint64)) != (qint64) (sectorHashes.size() * sizeof(quint64))
+		|| file.read((char *) nodes.data(), nodes.size() * sizeof(quint64)) != (qint64) (nodes.size() * sizeof(quint64))
+		|| nodes[1] != hdr.root) {
+		lastError = QString("%1: damaged index").arg(fileName);
+		sectorHashes.clear();
+		nodes.clear();
+		return false;
+	}
+
+	return true;
+}
+
+//
+// The hashes under the root, if open() only read the header
+//
+bool FDCMerkle::loadTree()
+{
+	return !nodes.isEmpty() || load(indexFile, false);
+}
+
+bool FDCMerkle::save(const QString &fileName)
+{
+	QSaveFile file(fileName);
+
+	if (!file.open(QIODevice::WriteOnly)
+		|| file.write((const char *) &hdr, sizeof(hdr)) != sizeof(hdr)
+		|| file.write((const char *) sectorHashes.constData(), sectorHashes.size() * sizeof(quint64)) != (qint64) (sectorHashes.size() * sizeof(quint64))
+		|| file.write((const char *) nodes.constData(), nodes.size() * sizeof(quint64)) != (qint64) (nodes.size() * sizeof(quint64))
+		|| !file.commit()) {
+		lastError = QString("%1: %2").arg(fileName).arg(file.errorString());
+		return false;
+	}
+
+	indexFile = fileName;
+
+	return true;
+}
+
+//
+// Tracks whose hashes differ, walking down from the root only where the
+// two trees disagree. compared counts the nodes looked at. Both trees must
+// be loaded and of the same geometry.
+//
+QVector<quint16> FDCMerkle::diff(const FDCMerkle &other, int *compared) const
+{
+	QVector<quint16> tracks;
+	QVector<int> stack;
+	int n;
+
+	*compared = 0;
+	stack.append(1);
+
+	while (!stack.isEmpty()) {
+		n = stack.takeLast();
+		(*compared)++;
+
+		if (nodes[n] == other.nodes[n]) {
+			continue;
+		}
+
+		if (n >= (int) hdr.leaves) {
+			if (n - (int) hdr.leaves < hdr.trackMax) {
+				tracks.append(n - hdr.leaves);
+			}
+			continue;
+		}
+
+		// Right first so tracks come out in order
+		stack.append(2 * n + 1);
+		stack.append(2 * n);
+	}
+
+	return tracks;
+}
+
+QVector<int> FDCMerkle::diffSectors(const FDCMerkle &other, quint16 track) const
+{
+	QVector<int> found;
+	int s;
+
+	for (s = 0; s < hdr.sectors; s++) {
+		if (sector(track, s) != other.sector(track, s)) {
+			found.append(s);
+		}
+	}
+
+	return found;
+}
+
+static QString sectorList(const QVector<int> &sectors)
+{
+	QStringList list;
+
+	for (int s : sectors) {
+		list.append(QString::number(s));
+	}
+
+	return list.join(',');
+}
+
+//
+// Index every image named, hashing only those that changed
+//
+int runMerkleIndex(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCMerkle merkle;
+	qint64 t0, hashed;
+	int images, built, failed;
+
+	t0 = fdcNow();
+	images = built = failed = 0;
+	hashed = 0;
+
+	for (const QString &path : opts.merkleFiles) {
+		for (const QString &image : FDCMerkle::images(path)) {
+			images++;
+
+			if (!merkle.open(image)) {
+				out << merkle.errorString() << "\n";
+				failed++;
+				continue;
+			}
+
+			if (merkle.rebuilt()) {
+				out << QString("%1: indexed, root %2\n").arg(image).arg(merkle.root(), 16, 16, QChar('0'));
+				hashed += (qint64) merkle.trackMax() * merkle.trackLen();
+				built++;
+			}
+		}
+	}
+
+	out << QString("%1 images, %2 indexed (%3 KB hashed), %4 already current, %5 failed, %6 ms\n")
+		.arg(images).arg(built).arg(hashed / 1024).arg(images - built - failed).arg(failed)
+		.arg((fdcNow() - t0) / 1e6, 0, 'f', 1);
+
+	return (failed) ? 1 : 0;
+}
+
+//
+// Make the copy's image match the original in the tracks that differ,
+// then bring its index up to date without hashing the rest
+//
+static bool syncTracks(const QString &from, const QString &to, FDCMerkle *merkle, const QVector<quint16> &tracks, QString *error)
+{
+	QFile src(from), dst(to);
+	QByteArray data;
+
+	if (!src.open(QIODevice::ReadOnly) || !dst.open(QIODevice::ReadWrite)) {
+		*error = QString("%1: %2").arg((src.isOpen()) ? to : from).arg((src.isOpen()) ? dst.errorString() : src.errorString());
+		return false;
+	}
+
+	for (quint16 t : tracks) {
+		if (!src.seek((qint64) t * merkle->trackLen()) || (data = src.read(merkle->trackLen())).size() != merkle->trackLen()
+			|| !dst.seek((qint64) t * merkle->trackLen()) || dst.write(data) != data.size()) {
+			*error = QString("%1: track %2 not copied").arg(to).arg(t);
+			return false;
+		}
+
+		merkle->setTrack(t, (const quint8 *) data.constData());
+	}
+
+	dst.close();
+
+	return merkle->stamp(to) && merkle->save(FDCMerkle::indexFor(to));
+}
+
+//
+// Compare two images or two directories of images (paired by name) by
+// their indexes, and with --merkle-sync copy the differing tracks from the
+// first to the second
+//
+int runMerkleDiff(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCMerkle a, b;
+	QStringList pairs;
+	QVector<quint16> tracks;
+	QString from, to, error;
+	qint64 t0, fetched;
+	int disks, same, differ, missing, failed, compared, nodes, rebuilt;
+
+	if (opts.merkleFiles.size() != 2) {
+		out << "Give the original and the copy, e.g. --merkle-diff disks,backup/disks\n";
+		return 2;
+	}
+
+	t0 = fdcNow();
+	disks = same = differ = missing = failed = nodes = rebuilt = 0;
+	fetched = 0;
+
+	for (const QString &image : FDCMerkle::images(opts.merkleFiles[0])) {
+		from = image;
+		to = (QFileInfo(opts.merkleFiles[1]).isDir()) ? QDir(opts.merkleFiles[1]).filePath(QFileInfo(image).fileName()) : opts.merkleFiles[1];
+		disks++;
+
+		if (!QFileInfo(to).exists()) {
+			out << QString("%1: missing\n").arg(to);
+			missing++;
+			continue;
+		}
+
+		if (!a.open(from)) {
+			out << a.errorString() << "\n";
+			failed++;
+			continue;
+		}
+
+		if (!b.open(to)) {
+			out << b.errorString() << "\n";
+			failed++;
+			continue;
+		}
+
+		rebuilt += a.rebuilt() + b.rebuilt();
+
+		if (a.trackMax() != b.trackMax() || a.trackLen() != b.trackLen()) {
+			out << QString("%1: not the same kind of disk as %2\n").arg(to).arg(from);
+			failed++;
+			continue;
+		}
+
+		nodes++;
+
+		if (a.root() == b.root()) {
+			same++;
+			continue;
+		}
+
+		if (!a.loadTree()) {
+			out << a.errorString() << "\n";
+			failed++;
+			continue;
+		}
+
+		if (!b.loadTree()) {
+			out << b.errorString() << "\n";
+			failed++;
+			continue;
+		}
+
+		tracks = a.diff(b, &compared);
+		nodes += compared - 1;
+		differ++;
+
+		out << QString("%1: %2 track%3\n").arg(to).arg(tracks.size()).arg((tracks.size() == 1) ? " differs" : "s differ");
+
+		for (quint16 t : tracks) {
+			out << QString("    track %1 sectors %2\n").arg(t, 2).arg(sectorList(a.diffSectors(b, t)));
+		}
+
+		fetched += (qint64) tracks.size() * a.trackLen();
+
+		if (opts.merkleSync) {
+			if (!syncTracks(from, to, &b, tracks, &error)) {
+				out << error << "\n";
+				failed++;
+				continue;
+			}
+			out << QString("    copied, root now %1\n").arg(b.root(), 16, 16, QChar('0'));
+		}
+	}
+
+	out << QString("%1 disks: %2 identical, %3 differ (%4 KB of tracks), %5 missing, %6 failed\n")
+		.arg(disks).arg(same).arg(differ).arg(fetched / 1024).arg(missing).arg(failed);
+	out << QString("%1 hashes compared, %2 indexes rebuilt, %3 ms\n")
+		.arg(nodes).arg(rebuilt).arg((fdcNow() - t0) / 1e6, 0, 'f', 1);
+
+	return (differ && !opts.merkleSync) || missing || failed;
+}
+
+//
+// Read the disk on --drive and compare it with an image's index
+//
+int runMerkleVerify(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCMerkle image, server;
+	FDCLink link;
+	FDCTrackCache cache;
+	QVector<quint16> tracks, unread;
+	QVector<bool> fromFile;
+	quint8 buf[TRACKBUF_LEN_CRC];
+	quint64 hits;
+	qint64 t0;
+	int t, r, compared, wire;
+
+	if (opts.merkleFiles.size() != 1) {
+		out << "--merkle-verify takes one image\n";
+		return 2;
+	}
+
+	if (!image.open(opts.merkleFiles[0]) || !image.loadTree()) {
+		out << image.errorString() << "\n";
+		return 1;
+	}
+
+	server.create(image.trackMax(), image.trackLen());
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	if (!(link.response.rdata & (1 << opts.drive))) {
+		out << QString("Drive %1 is not mounted\n").arg(opts.drive);
+		return 1;
+	}
+
+	if (!opts.cacheDir.isEmpty() && !cache.open(opts.cacheDir, opts.serverId, image.trackMax(), image.trackLen())) {
+		out << cache.errorString() << "\n";
+		return 1;
+	}
+
+	t0 = fdcNow();
+
+	fromFile.fill(false, image.trackMax());
+
+	for (wire = 0, t = 0; t < image.trackMax(); t++) {
+		hits = cache.hits;
+		r = (cache.isOpen()) ? cache.read(&link, opts.drive, t, buf) : link.read(opts.drive, t, image.trackLen(), buf);
+
+		if (r != LINK_OK) {
+			unread.append(t);
+			continue;
+		}
+
+		fromFile[t] = (cache.hits != hits);
+		wire += !fromFile[t];
+		server.setTrack(t, buf);
+	}
+
+	tracks = image.diff(server, &compared);
+
+	// A held copy may be older than the server's disk: nothing is reported
+	// as different on its word alone
+	for (quint16 t : tracks) {
+		if (fromFile[t]) {
+			if (cache.confirm(&link, opts.drive, t, buf) == LINK_OK) {
+				server.setTrack(t, buf);
+			}
+			else {
+				unread.append(t);
+			}
+		}
+	}
+
+	// Every READ the cache made, its checks included
+	if (cache.isOpen()) {
+		tracks = image.diff(server, &compared);
+		wire = cache.misses + cache.confirmed + cache.stale;
+	}
+
+	for (quint16 t : tracks) {
+		if (unread.contains(t)) {
+			out << QString("track %1 could not be read\n").arg(t, 2);
+		}
+		else {
+			out << QString("track %1 sectors %2 differ\n").arg(t, 2).arg(sectorList(image.diffSectors(server, t)));
+		}
+	}
+
+	out << QString("Drive %1 against %2: %3 of %4 tracks differ, %5 unreadable, %6 read from the server, %7 hashes compared, %8 ms\n")
+		.arg(opts.drive).arg(opts.merkleFiles[0]).arg(tracks.size() - unread.size()).arg(image.trackMax())
+		.arg(unread.size()).arg(wire).arg(compared).arg((fdcNow() - t0) / 1e6, 0, 'f', 1);
+
+	return (tracks.isEmpty()) ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#ifndef FDCMERKLE_H
+#define FDCMERKLE_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "fdc-bench.h"
+
+#define MERKLE_MAGIC		0x4d434446		// "FDCM"
+#define MERKLE_VERSION		1			// bump on any layout change
+#define MERKLE_SUFFIX		".merkle"		// index file beside the image
+#define MERKLE_SECTOR_LEN	137			// bytes per sector, both disk types
+
+//
+// Index file layout: this header, then an XXH64 per sector, track by
+// track, then the tree as a heap of 2 * leaves hashes (node 1 is the root,
+// node n has children 2n and 2n + 1, track t is node leaves + t, node 0
+// and leaves past the last track are 0). The index is trusted while the
+// image's size and modification time are the ones recorded here.
+//
+typedef struct TMERKLEHEADER {
+	quint32 magic;
+	quint16 version;
+	quint16 headerLen;			// sizeof(tmerkleheader_t)
+	quint16 trackMax;
+	quint16 trackLen;
+	quint16 sectorLen;
+	quint16 sectors;			// per track
+	quint32 leaves;				// trackMax rounded up to a power of two
+	quint32 reserved;
+	qint64 imageSize;
+	qint64 imageModified;			// ms since the epoch
+	quint64 root;
+} tmerkleheader_t;
+
+//
+// Merkle tree over the sectors and tracks of one disk image. A sector's
+// hash is XXH64 of its bytes, a track's is XXH64 of its sector hashes and
+// every node above is XXH64 of its two children. Equal roots mean equal
+// disks, and two trees are compared from the root down, only into the
+// subtrees whose hashes differ, so the cost follows the amount of change
+// and not the size of the disk. Like the track fingerprints this finds
+// corruption and change, not deliberate collisions.
+//
+class FDCMerkle
+{
+public:
+	FDCMerkle();
+
+	bool create(quint16 trackMax, quint16 trackLen);
+	bool build(const QString &imageFile);
+	bool open(const QString &imageFile);
+	bool load(const QString &indexFile, bool headerOnly);
+	bool loadTree(void);
+	bool save(const QString &indexFile);
+	bool stamp(const QString &imageFile);
+	QString errorString(void) const { return lastError; }
+
+	void setTrack(quint16 track, const quint8 *data);
+	QVector<quint16> diff(const FDCMerkle &other, int *compared) const;
+	QVector<int> diffSectors(const FDCMerkle &other, quint16 track) const;
+
+	bool rebuilt(void) const { return fresh; }
+	quint64 root(void) const { return hdr.root; }
+	quint16 trackMax(void) const { return hdr.trackMax; }
+	quint16 trackLen(void) const { return hdr.trackLen; }
+	int sectors(void) const { return hdr.sectors; }
+	quint64 sector(quint16 track, int sector) const { return sectorHashes[track * hdr.sectors + sector]; }
+	quint64 track(quint16 track) const { return nodes[hdr.leaves + track]; }
+
+	static QString indexFor(const QString &imageFile) { return imageFile + MERKLE_SUFFIX; }
+	static bool geometry(qint64 imageSize, quint16 *trackMax, quint16 *trackLen);
+	static QStringList images(const QString &path);
+
+private:
+	tmerkleheader_t hdr;
+	QVector<quint64> sectorHashes;
+	QVector<quint64> nodes;
+	QString indexFile;			// where the tree is, while only the header is loaded
+	bool fresh;				// hashed from the image, not loaded
+	QString lastError;
+};
+
+int runMerkleIndex(const tbenchopts_t &opts);
+int runMerkleDiff(const tbenchopts_t &opts);
+int runMerkleVerify(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,205 @@
+/**********************************************************************************
+*
+*  Link metrics for the FDC+ Serial Drive Simulator
+*
+***********************************************************************************/
+
+#include <string.h>
+
+#include "fdc-metrics.h"
+
+/*
+** Histogram
+*/
+
+FDCHistogram::FDCHistogram()
+{
+	reset();
+}
+
+void FDCHistogram::reset()
+{
+	memset(buckets, 0, sizeof(buckets));
+	total = 0;
+	sum = 0;
+	minValue = 0;
+	maxValue = 0;
+}
+
+int FDCHistogram::bucketOf(qint64 value)
+{
+	int msb, shift, bucket;
+
+	if (value < HIST_SUB_COUNT) {
+		return (value < 0) ? 0 : (int) value;
+	}
+
+	msb = 63 - __builtin_clzll((quint64) value);
+	shift = msb - HIST_SUB_BITS;
+	bucket = (shift + 1) * HIST_SUB_COUNT + ((value >> shift) & (HIST_SUB_COUNT - 1));
+
+	return qMin(bucket, HIST_BUCKETS - 1);
+}
+
+qint64 FDCHistogram::bucketValue(int bucket)
+{
+	int magnitude, sub;
+
+	magnitude = bucket / HIST_SUB_COUNT;
+	sub = bucket % HIST_SUB_COUNT;
+
+	if (magnitude == 0) {
+		return sub;
+	}
+
+	// Highest value that falls in the bucket
+	return ((qint64) (HIST_SUB_COUNT + sub + 1) << (magnitude - 1)) - 1;
+}
+
+void FDCHistogram::record(qint64 value)
+{
+	record(value, 1);
+}
+
+void FDCHistogram::record(qint64 value, quint64 count)
+{
+	if (count == 0) {
+		return;
+	}
+
+	if (total == 0 || value < minValue) {
+		minValue = value;
+	}
+	if (value > maxValue) {
+		maxValue = value;
+	}
+
+	buckets[bucketOf(value)] += count;
+	total += count;
+	sum += value * (qint64) count;
+}
+
+void FDCHistogram::add(const FDCHistogram &other)
+{
+	int b;
+
+	if (other.total == 0) {
+		return;
+	}
+
+	if (total == 0 || other.minValue < minValue) {
+		minValue = other.minValue;
+	}
+	if (other.maxValue > maxValue) {
+		maxValue = other.maxValue;
+	}
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		buckets[b] += other.buckets[b];
+	}
+
+	total += other.total;
+	sum += other.sum;
+}
+
+qint64 FDCHistogram::percentile(double p) const
+{
+	quint64 rank, seen;
+	int b;
+
+	if (total == 0) {
+		return 0;
+	}
+
+	rank = qMax((quint64) 1, (quint64) (p * total + 0.5));
+	seen = 0;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		if ((seen += buckets[b]) >= rank) {
+			return qBound(minValue, bucketValue(b), maxValue);
+		}
+	}
+
+	return maxValue;
+}
+
+/*
+** Link metrics
+*/
+
+FDCMetrics::FDCMetrics()
+{
+	reset();
+}
+
+void FDCMetrics::reset()
+{
+	int c;
+
+	for (c = 0; c < CMD_COUNT; c++) {
+		commands[c] = 0;
+		errors[c] = 0;
+		timeouts[c] = 0;
+		cancels[c] = 0;
+		latency[c].reset();
+	}
+
+	resyncs = 0;
+	resyncDiscard = 0;
+	bytesOut = 0;
+	bytesIn = 0;
+	throttled = 0;
+	queueDelay.reset();
+	outQueue.reset();
+	inQueue.reset();
+	userQueueMax = 0;
+}
+
+const char *FDCMetrics::commandName(int cmd)
+{
+	switch (cmd) {
+		case CMD_STAT:
+			return "STAT";
+		case CMD_READ:
+			return "READ";
+		case CMD_WRIT:
+			return "WRIT";
+		default:
+			return "????";
+	}
+}
+
+QString FDCMetrics::report() const
+{
+	QString s;
+	int c;
+
+	s += QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+		.arg("cmd", -5).arg("count", 8).arg("errors", 7).arg("timeouts", 9).arg("cancels", 8)
+		.arg("p50 ms", 9).arg("p99 ms", 9).arg("max ms", 9);
+
+	for (c = 0; c < CMD_COUNT; c++) {
+		s += QString("%1 %2 %3 %4 %5 %6 %7 %8\n")
+			.arg(commandName(c), -5)
+			.arg(commands[c], 8)
+			.arg(errors[c], 7)
+			.arg(timeouts[c], 9)
+			.arg(cancels[c], 8)
+			.arg(latency[c].percentile(0.50) / 1e6, 9, 'f', 2)
+			.arg(latency[c].percentile(0.99) / 1e6, 9, 'f', 2)
+			.arg(latency[c].max() / 1e6, 9, 'f', 2);
+	}
+
+	s += QString("bytes out %1, in %2, throttled writes %3\n").arg(bytesOut).arg(bytesIn).arg(throttled);
+	s += QString("resynchronised %1 times, %2 stale bytes discarded\n").arg(resyncs).arg(resyncDiscard);
+	s += QString("queue delay p50 %1 ms, p99 %2 ms, max %3 ms\n")
+		.arg(queueDelay.percentile(0.50) / 1e6, 0, 'f', 2)
+		.arg(queueDelay.percentile(0.99) / 1e6, 0, 'f', 2)
+		.arg(queueDelay.max() / 1e6, 0, 'f', 2);
+	s += QString("output queue p99 %1 max %2 bytes, input queue p99 %3 max %4 bytes, user buffer max %5 bytes\n")
+		.arg(outQueue.percentile(0.99)).arg(outQueue.max())
+		.arg(inQueue.percentile(0.99)).arg(inQueue.max())
+		.arg(userQueueMax);
+
+	return s;
+}
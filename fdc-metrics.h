@@ -0,0 +1,92 @@
+#ifndef FDCMETRICS_H
+#define FDCMETRICS_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <time.h>
+
+#define HIST_SUB_BITS		4			// 16 sub-buckets per power of two
+#define HIST_SUB_COUNT		(1 << HIST_SUB_BITS)
+#define HIST_MAGNITUDES		40			// values up to 2^44 (about 4.9 hours in ns)
+#define HIST_BUCKETS		((HIST_MAGNITUDES + 1) * HIST_SUB_COUNT)
+
+#define CMD_STAT		0
+#define CMD_READ		1
+#define CMD_WRIT		2
+#define CMD_COUNT		3
+
+//
+// Monotonic nanosecond clock shared by the link, metrics and captures
+//
+static inline qint64 fdcNow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//
+// Log-linear histogram, relative bucket error under 1/HIST_SUB_COUNT.
+// Fixed size so it can be copied or published without allocation.
+//
+class FDCHistogram
+{
+public:
+	FDCHistogram();
+
+	void reset(void);
+	void record(qint64 value);
+	void record(qint64 value, quint64 count);
+	void add(const FDCHistogram &other);
+
+	quint64 count(void) const { return total; }
+	qint64 min(void) const { return (total) ? minValue : 0; }
+	qint64 max(void) const { return maxValue; }
+	double mean(void) const { return (total) ? (double) sum / total : 0.0; }
+	qint64 percentile(double p) const;
+
+	static int bucketOf(qint64 value);
+	static qint64 bucketValue(int bucket);
+
+	quint64 buckets[HIST_BUCKETS];
+	quint64 total;
+	qint64 sum;
+	qint64 minValue;
+	qint64 maxValue;
+};
+
+//
+// Counters and histograms kept by one link. Latencies are in nanoseconds and
+// measured from the moment the command left the wire, not when it was queued.
+//
+class FDCMetrics
+{
+public:
+	FDCMetrics();
+
+	void reset(void);
+	QString report(void) const;
+
+	static const char *commandName(int cmd);
+
+	quint64 commands[CMD_COUNT];
+	quint64 errors[CMD_COUNT];
+	quint64 timeouts[CMD_COUNT];
+	quint64 cancels[CMD_COUNT];
+	quint64 resyncs;				// abandoned transactions caught up on
+	qint64 resyncDiscard;				// response bytes thrown away doing so
+	quint64 bytesOut;
+	quint64 bytesIn;
+	quint64 throttled;				// writes that waited for the queue limit
+
+	FDCHistogram latency[CMD_COUNT];		// command on wire to transaction done
+	FDCHistogram queueDelay;			// write() to last byte on the wire
+	FDCHistogram outQueue;				// TIOCOUTQ + user space samples
+	FDCHistogram inQueue;				// TIOCINQ + user space samples
+	qint64 userQueueMax;				// largest QSerialPort bytesToWrite()
+};
+
+#endif
@@ -0,0 +1,160 @@
+/**********************************************************************************
+*
+*  Offline what-if throughput model for the FDC+ Serial Drive Simulator
+*
+*  Takes a capture made at one baud rate and predicts the same session at
+*  others, e.g.
+*
+*      fdc-sim-gui --bench-serial --port ttyUSB0 --backend posix --capture site.cap
+*      fdc-sim-gui --model site.cap --model-baud 230400,403200,460800,921600
+*
+*  Every transaction is split into wire time (bytes on the line, which scales
+*  with the baud rate), server time (from the last command byte to the first
+*  response byte, plus any time the server streamed slower than the line),
+*  transport overhead (whatever is left, driver and USB latency) and the
+*  client gap before the next command. Only wire time changes with the baud
+*  rate; --model-overhead replaces the measured overhead to model another
+*  transport.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QVector>
+
+#include <string.h>
+
+#include "fdc-model.h"
+#include "fdc-capture.h"
+#include "fdc-link.h"
+
+typedef struct TMODELTOTALS {
+	qint64 transactions;
+	qint64 bytes;				// on the line, both directions
+	qint64 wire;				// ns at the captured baud rate
+	qint64 server;
+	qint64 overhead;
+	qint64 gaps;
+	qint64 fixed;				// failed transactions, not modelled
+} tmodeltotals_t;
+
+//
+// Wire time of n bytes at baud, 10 bits per byte
+//
+static qint64 wireNs(qint64 bytes, quint32 baud)
+{
+	return bytes * 10 * 1000000000LL / baud;
+}
+
+//
+// Split one completed transaction into line bytes and server time
+//
+static void split(const tcaprecord_t &rec, quint32 baud, qint64 *bytes, qint64 *server)
+{
+	qint64 in, byte;
+
+	byte = wireNs(1, baud);
+	in = (rec.cmd == CMD_READ) ? rec.length + 2 : CMDBUF_SIZE;
+
+	// Command, then the server's turnaround to the first response byte and
+	// any stalls while it streams the rest
+	*bytes = CMDBUF_SIZE + in;
+	*server = qMax((qint64) 0, rec.tFirst - rec.tSent - byte);
+	*server += qMax((qint64) 0, rec.tResp - rec.tFirst - (in - 1) * byte);
+
+	// WRIT track out and WSTA back
+	if (rec.cmd == CMD_WRIT && rec.tData && rec.tWsta) {
+		*bytes += rec.length + 2 + CMDBUF_SIZE;
+		*server += qMax((qint64) 0, rec.tWsta - rec.tData - byte);
+		*server += qMax((qint64) 0, rec.tDone - rec.tWsta - (CMDBUF_SIZE - 1) * byte);
+	}
+}
+
+int runModel(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCCapture capture;
+	tcaprecord_t rec;
+	tmodeltotals_t t;
+	QVector<quint32> bauds;
+	qint64 bytes, server, wire, prevDone, measured, duration, overhead;
+	quint32 baud;
+
+	if (!capture.open(opts.modelFile)) {
+		out << capture.errorString() << "\n";
+		return 1;
+	}
+
+	baud = capture.header().baud;
+
+	if (!baud) {
+		out << "Capture has no baud rate\n";
+		return 1;
+	}
+
+	memset(&t, 0, sizeof(t));
+	prevDone = 0;
+
+	while (capture.read(&rec)) {
+		if (prevDone) {
+			t.gaps += qMax((qint64) 0, rec.tQueued - prevDone);
+		}
+		prevDone = rec.tDone;
+
+		t.transactions++;
+
+		if (rec.result != LINK_OK || !rec.tFirst || !rec.tResp) {
+			t.fixed += rec.tDone - rec.tQueued;
+			continue;
+		}
+
+		split(rec, baud, &bytes, &server);
+		wire = wireNs(bytes, baud);
+
+		t.bytes += bytes;
+		t.wire += wire;
+		t.server += server;
+		t.overhead += qMax((qint64) 0, rec.tDone - rec.tQueued - wire - server);
+	}
+
+	if (!t.transactions) {
+		out << "Capture is empty\n";
+		return 1;
+	}
+
+	measured = t.wire + t.server + t.overhead + t.gaps + t.fixed;
+
+	out << QString("%1: %2 transactions on %3 (%4) at %5 baud\n")
+		.arg(opts.modelFile).arg(t.transactions).arg(capture.header().port).arg(capture.header().transport).arg(baud);
+	out << QString("wire %1 s, server %2 s, transport overhead %3 s (%4 us per transaction), client gaps %5 s, failed %6 s\n\n")
+		.arg(t.wire / 1e9, 0, 'f', 3).arg(t.server / 1e9, 0, 'f', 3)
+		.arg(t.overhead / 1e9, 0, 'f', 3).arg(t.overhead / 1e3 / t.transactions, 0, 'f', 1)
+		.arg(t.gaps / 1e9, 0, 'f', 3).arg(t.fixed / 1e9, 0, 'f', 3);
+
+	bauds.append(baud);
+	for (quint32 b : opts.modelBauds) {
+		if (b && b != baud) {
+			bauds.append(b);
+		}
+	}
+
+	overhead = (opts.modelOverhead >= 0) ? opts.modelOverhead * 1000LL * t.transactions : t.overhead;
+
+	out << QString("%1 %2 %3 %4 %5 %6\n")
+		.arg("baud", 8).arg("duration s", 11).arg("speedup", 8).arg("line %", 7).arg("server %", 9).arg("tx/s", 8);
+
+	for (quint32 b : bauds) {
+		wire = wireNs(t.bytes, b);
+		duration = wire + t.server + overhead + t.gaps + t.fixed;
+
+		out << QString("%1 %2 %3 %4 %5 %6%7\n")
+			.arg(b, 8)
+			.arg(duration / 1e9, 11, 'f', 3)
+			.arg((double) measured / duration, 8, 'f', 2)
+			.arg(100.0 * wire / duration, 7, 'f', 1)
+			.arg(100.0 * t.server / duration, 9, 'f', 1)
+			.arg(t.transactions * 1e9 / duration, 8, 'f', 1)
+			.arg((b == baud) ? "  (captured)" : "");
+	}
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef FDCMODEL_H
+#define FDCMODEL_H
+
+#include "fdc-bench.h"
+
+int runModel(const tbenchopts_t &opts);
+
+#endif
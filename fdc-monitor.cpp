@@ -0,0 +1,87 @@
+/**********************************************************************************
+*
+*  Shared memory metrics monitor for the FDC+ Serial Drive Simulator
+*
+*  Attaches read only to a running simulator's metrics segment and prints
+*  every link's counters and latency, once or every --interval ms:
+*
+*      fdc-sim-gui --monitor /fdc-lab1 --interval 500
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+
+#include "fdc-monitor.h"
+#include "fdc-shm.h"
+
+int runMonitor(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCShm shm;
+	FDCMetrics metrics;
+	QVector<quint64> done;
+	QString name;
+	qint64 updated, now, then;
+	quint64 total;
+	int slot, c, pool;
+
+	if (!shm.attach(opts.shmName)) {
+		out << shm.errorString() << "\n";
+		return 1;
+	}
+
+	then = 0;
+
+	do {
+		now = fdcNow();
+
+		out << QString("%1: pid %2, %3 links\n").arg(shm.name()).arg(shm.pid()).arg(shm.links());
+
+		done.resize(shm.links());
+
+		for (slot = 0; slot < shm.links(); slot++) {
+			if (!shm.snapshot(slot, &metrics, &name, &updated)) {
+				continue;
+			}
+
+			for (total = 0, c = 0; c < CMD_COUNT; c++) {
+				total += metrics.commands[c];
+			}
+
+			out << QString("\n%1: updated %2 s ago").arg(name).arg((now - updated) / 1e9, 0, 'f', 2);
+			if (then) {
+				out << QString(", %1 transactions/s").arg((total - done[slot]) * 1e9 / (now - then), 0, 'f', 1);
+			}
+			out << "\n" << metrics.report();
+
+			done[slot] = total;
+		}
+
+		// Names are the reader's, so only as many pools as both know
+		out << QString("\n%1 %2 %3 %4 %5\n").arg("memory", -9).arg("used KB", 10).arg("peak KB", 10).arg("limit KB", 10).arg("denied", 7);
+
+		for (pool = 0; pool < qMin(shm.memPools(), MEM_COUNT); pool++) {
+			const tshmmemory_t &mem = shm.memory(pool);
+
+			out << QString("%1 %2 %3 %4 %5\n")
+				.arg(FDCMemory::name(pool), -9)
+				.arg(mem.used.load(std::memory_order_relaxed) / 1024, 10)
+				.arg(mem.peak.load(std::memory_order_relaxed) / 1024, 10)
+				.arg((mem.limit.load(std::memory_order_relaxed)) ? QString::number(mem.limit.load(std::memory_order_relaxed) / 1024) : QString("-"), 10)
+				.arg(mem.denied.load(std::memory_order_relaxed), 7);
+		}
+
+		out << "\n";
+		out.flush();
+
+		then = now;
+
+		if (opts.interval > 0) {
+			QThread::msleep(opts.interval);
+		}
+	} while (opts.interval > 0);
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef FDCMONITOR_H
+#define FDCMONITOR_H
+
+#include "fdc-bench.h"
+
+int runMonitor(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,246 @@
+/**********************************************************************************
+*
+*  Mount mask tracking for the FDC+ Serial Drive Simulator
+*
+*  A real FDC+ reports NOT READY until the server's STAT mount mask shows the
+*  disk, so the time a mount or unmount takes to reach the mask is time the
+*  operator waits after swapping disks. Every STAT the link sends feeds an
+*  FDCMountWatch; --mount-probe measures the delay end to end by driving the
+*  server's mounts through a hook command:
+*
+*      fdc-sim-gui --mount-probe --port ttyUSB0 --drive 1 --mount-hook "ssh srv fdc-ctl" --passes 20
+*
+*  The hook is run as "<hook> unmount <drive>" and "<hook> mount <drive>".
+*  Without one, transitions made by hand are timestamped until Ctrl-C.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QProcess>
+#include <QThread>
+#include <QStringList>
+
+#include <signal.h>
+#include <string.h>
+
+#include "fdc-mount.h"
+#include "fdc-link.h"
+
+FDCMountWatch::FDCMountWatch()
+{
+	reset();
+}
+
+void FDCMountWatch::reset()
+{
+	propagation[0].reset();
+	propagation[1].reset();
+	unexpected = 0;
+	seen = false;
+	current = 0;
+	lastSent = 0;
+	count = 0;
+	memset(pending, 0, sizeof(pending));
+	memset(pendingMounted, 0, sizeof(pendingMounted));
+	memset(log, 0, sizeof(log));
+}
+
+//
+// An operator (or hook) changed a drive at t; pair it with the transition
+//
+void FDCMountWatch::expect(quint8 drive, bool mounted, qint64 t)
+{
+	if (drive < MOUNT_DRIVES) {
+		pending[drive] = t;
+		pendingMounted[drive] = mounted;
+	}
+}
+
+//
+// Feed one STAT response. Returns the number of drives that changed.
+//
+int FDCMountWatch::update(quint16 mask, qint64 tSent, qint64 tSeen)
+{
+	tmountevent_t *e;
+	quint16 changed;
+	int drive, n;
+
+	if (!seen) {
+		seen = true;
+		current = mask;
+		lastSent = tSent;
+		return 0;
+	}
+
+	changed = mask ^ current;
+
+	for (n = 0, drive = 0; drive < MOUNT_DRIVES; drive++) {
+		if (!(changed & (1 << drive))) {
+			continue;
+		}
+
+		e = &log[count++ % MOUNT_LOG_LEN];
+		e->drive = drive;
+		e->mounted = (mask >> drive) & 1;
+		e->tBefore = lastSent;
+		e->tSeen = tSeen;
+		e->tOperator = 0;
+
+		if (pending[drive] && pendingMounted[drive] == e->mounted) {
+			e->tOperator = pending[drive];
+			propagation[e->mounted].record(qMax((qint64) 0, tSeen - e->tOperator));
+			pending[drive] = 0;
+		}
+		else {
+			unexpected++;
+		}
+
+		n++;
+	}
+
+	current = mask;
+	lastSent = tSent;
+
+	return n;
+}
+
+QString FDCMountWatch::describe(const tmountevent_t &event)
+{
+	QString s;
+
+	s = QString("drive %1 %2 at %3 s (changed within the last %4 ms)")
+		.arg(event.drive).arg((event.mounted) ? "mounted" : "unmounted")
+		.arg(event.tSeen / 1e9, 0, 'f', 3).arg((event.tSeen - event.tBefore) / 1e6, 0, 'f', 1);
+
+	if (event.tOperator) {
+		s += QString(", %1 ms after the operator").arg((event.tSeen - event.tOperator) / 1e6, 0, 'f', 1);
+	}
+
+	return s;
+}
+
+// Ctrl-C ends a watch
+static FDCCancel interrupted;
+
+static void interruptHandler(int)
+{
+	interrupted.cancel();
+}
+
+//
+// Run the hook, 0 if it succeeded
+//
+static int runHook(const QString &hook, const char *action, int drive)
+{
+	return QProcess::execute("/bin/sh", QStringList() << "-c" << QString("%1 %2 %3").arg(hook).arg(action).arg(drive));
+}
+
+//
+// STAT every interval ms until the drive shows mounted (or not), then
+// return the STATs sent, -1 on timeout or interrupt
+//
+static int pollUntil(FDCLink &link, quint8 drive, bool mounted, int interval, qint64 until)
+{
+	int stats;
+
+	for (stats = 0; fdcNow() < until && !interrupted.isCancelled(); stats++) {
+		if (link.stat(drive, 0, 0, &interrupted) == LINK_OK && link.mounts.known() && ((link.mounts.mask() >> drive) & 1) == mounted) {
+			return stats + 1;
+		}
+		QThread::msleep(interval);
+	}
+
+	return -1;
+}
+
+int mountProbe(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	struct sigaction sa, oldSa;
+	qint64 t, hookTime;
+	int interval, pass, seen, direction, failures;
+
+	interval = (opts.interval > 0) ? opts.interval : 10;
+	interrupted.reset();
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	out << QString("mount mask 0x%1\n").arg(link.mounts.mask(), 4, 16, QChar('0'));
+	out.flush();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldSa);
+
+	failures = 0;
+
+	if (opts.mountHook.isEmpty()) {
+		// Watch for changes made by hand
+		for (seen = 0; !interrupted.isCancelled(); QThread::msleep(interval)) {
+			if (link.stat(opts.drive, 0, 0, &interrupted) != LINK_OK) {
+				continue;
+			}
+			for (; seen < link.mounts.events(); seen++) {
+				out << FDCMountWatch::describe(link.mounts.event(seen)) << "\n";
+				out.flush();
+			}
+		}
+	}
+	else {
+		// Unmount, then mount, timing each until the mask shows it
+		for (pass = 0; pass < opts.passes * 2 && !interrupted.isCancelled(); pass++) {
+			direction = ((link.mounts.mask() >> opts.drive) & 1) ? 0 : 1;
+
+			t = fdcNow();
+			if (runHook(opts.mountHook, (direction) ? "mount" : "unmount", opts.drive) != 0) {
+				out << QString("%1 %2 %3 failed\n").arg(opts.mountHook).arg((direction) ? "mount" : "unmount").arg(opts.drive);
+				failures++;
+				break;
+			}
+			hookTime = fdcNow() - t;
+
+			link.mounts.expect(opts.drive, direction, fdcNow());
+
+			if (pollUntil(link, opts.drive, direction, interval, fdcNow() + MOUNT_TIMEOUT * 1000000LL) == -1) {
+				if (!interrupted.isCancelled()) {
+					out << QString("drive %1 not %2 after %3 s\n").arg(opts.drive).arg((direction) ? "mounted" : "unmounted").arg(MOUNT_TIMEOUT / 1000);
+					failures++;
+				}
+				continue;
+			}
+
+			out << FDCMountWatch::describe(link.mounts.latest()) << QString(", hook took %1 ms\n").arg(hookTime / 1e6, 0, 'f', 1);
+			out.flush();
+		}
+
+		out << QString("\n%1 %2 %3 %4 %5\n").arg("", -8).arg("count", 6).arg("p50 ms", 9).arg("p99 ms", 9).arg("max ms", 9);
+
+		for (direction = 0; direction < 2; direction++) {
+			const FDCHistogram &h = link.mounts.propagation[direction];
+
+			out << QString("%1 %2 %3 %4 %5\n")
+				.arg((direction) ? "mount" : "unmount", -8).arg(h.count(), 6)
+				.arg(h.percentile(0.50) / 1e6, 9, 'f', 1).arg(h.percentile(0.99) / 1e6, 9, 'f', 1).arg(h.max() / 1e6, 9, 'f', 1);
+		}
+
+		out << QString("resolution %1 ms (STAT interval)\n").arg(interval);
+
+		if (link.mounts.unexpected) {
+			out << QString("%1 transitions the hook didn't make\n").arg(link.mounts.unexpected);
+		}
+	}
+
+	sigaction(SIGINT, &oldSa, NULL);
+	link.close();
+
+	return (failures) ? 1 : 0;
+}
@@ -0,0 +1,61 @@
+#ifndef FDCMOUNT_H
+#define FDCMOUNT_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include "fdc-metrics.h"
+#include "fdc-bench.h"
+
+#define MOUNT_DRIVES		16			// bits in the STAT mount mask
+#define MOUNT_LOG_LEN		64			// transitions kept
+#define MOUNT_TIMEOUT		30000			// ms to wait for a change to show
+
+typedef struct TMOUNTEVENT {
+	quint8 drive;
+	bool mounted;
+	qint64 tBefore;				// last STAT still showing the old state left (tSent)
+	qint64 tSeen;				// STAT first showing the new state answered
+	qint64 tOperator;			// operator change that caused it, 0 if unknown
+} tmountevent_t;
+
+//
+// Follows the mount mask in STAT responses. Every transition of every drive
+// is timestamped: the server changed state after tBefore and before tSeen,
+// so the STAT interval is the resolution. An operator change announced with
+// expect() is paired with the transition it causes, and the time until it
+// showed is recorded in propagation[unmount/mount].
+//
+class FDCMountWatch
+{
+public:
+	FDCMountWatch();
+
+	void reset(void);
+	int update(quint16 mask, qint64 tSent, qint64 tSeen);
+	void expect(quint8 drive, bool mounted, qint64 t);
+
+	bool known(void) const { return seen; }
+	quint16 mask(void) const { return current; }
+	int events(void) const { return count; }
+	const tmountevent_t &event(int n) const { return log[n % MOUNT_LOG_LEN]; }
+	const tmountevent_t &latest(void) const { return event(count - 1); }
+
+	static QString describe(const tmountevent_t &event);
+
+	FDCHistogram propagation[2];		// ns, operator change to STAT showing it
+	quint64 unexpected;			// transitions nobody announced
+
+private:
+	bool seen;
+	quint16 current;
+	qint64 lastSent;
+	qint64 pending[MOUNT_DRIVES];		// announced change time, 0 if none
+	bool pendingMounted[MOUNT_DRIVES];
+	tmountevent_t log[MOUNT_LOG_LEN];
+	int count;
+};
+
+int mountProbe(const tbenchopts_t &opts);
+
+#endif
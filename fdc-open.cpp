@@ -0,0 +1,254 @@
+/**********************************************************************************
+*
+*  Open loop load for the FDC+ Serial Drive Simulator
+*
+*  STATs and READs arrive on a fixed schedule, as from an FDC polling on its
+*  own clock, whatever the server is doing:
+*
+*      fdc-sim-gui --open-loop --port ttyUSB0 --stat-rate 10 --read-rate 2 --duration 60000
+*
+*  A closed loop benchmark sends the next command when the last one is done,
+*  so while the server stalls it stops asking and the stall shows up as one
+*  slow transaction instead of every transaction that should have been sent
+*  meanwhile (coordinated omission). Here each arrival keeps its place in the
+*  schedule: if the link is still busy when it is due it goes out as soon as
+*  the link is free, and its latency runs from when it was due. Both views
+*  are reported side by side.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+
+#include <vector>
+
+#include <signal.h>
+#include <string.h>
+
+#include "fdc-open.h"
+#include "fdc-engine.h"
+
+// Ctrl-C stops the schedule
+static FDCCancel interrupted;
+
+static void interruptHandler(int)
+{
+	interrupted.cancel();
+}
+
+//
+// Every arrival due before end on one link, in order of when it is due.
+// One transaction is on the wire at a time as with a real FDC, so arrivals
+// that fall due while it is busy wait their turn. Past end plus OPEN_DRAIN
+// ms the rest are not sent and are counted as waiting until then, the
+// least they would have waited.
+//
+static FDCTask sender(FDCClient *client, const tbenchopts_t *opts, qint64 first, qint64 end, topenstream_t *streams)
+{
+	quint8 buf[TRACKBUF_LEN_CRC];
+	double rate[CMD_COUNT], period[CMD_COUNT];
+	qint64 start[CMD_COUNT], next[CMD_COUNT], n[CMD_COUNT];
+	qint64 due, deadline, now;
+	tresult_t r;
+	int cmd, c;
+
+	rate[CMD_STAT] = opts->statRate;
+	rate[CMD_READ] = opts->readRate;
+	rate[CMD_WRIT] = 0.0;
+
+	for (c = 0; c < CMD_COUNT; c++) {
+		period[c] = (rate[c] > 0.0) ? 1e9 / rate[c] : 0.0;
+		// READs half a STAT period in so the schedules don't coincide
+		start[c] = first + ((c == CMD_READ && rate[CMD_STAT] > 0.0) ? (qint64) (period[CMD_STAT] / 2) : 0);
+		next[c] = start[c];
+		n[c] = 0;
+	}
+
+	for (;;) {
+		for (cmd = -1, c = CMD_STAT; c <= CMD_READ; c++) {
+			if (rate[c] > 0.0 && next[c] < end && (cmd == -1 || next[c] < next[cmd])) {
+				cmd = c;
+			}
+		}
+
+		if (cmd == -1 || interrupted.isCancelled()) {
+			break;
+		}
+
+		due = next[cmd];
+		topenstream_t &s = streams[cmd];
+
+		n[cmd]++;
+		next[cmd] = start[cmd] + (qint64) (n[cmd] * period[cmd]);
+
+		if ((now = fdcNow()) > end + OPEN_DRAIN * 1000000LL) {
+			s.arrivals++;
+			s.unsent++;
+			s.intended.record(now - due);
+			continue;
+		}
+
+		co_await client->engine()->sleepUntil(due);
+
+		s.lag.record(fdcNow() - due);
+		deadline = (opts->deadline) ? fdcDeadline(opts->deadline) : 0;
+
+		if (cmd == CMD_STAT) {
+			r = co_await client->stat(opts->drive, n[cmd] % opts->trackMax, deadline, &interrupted);
+		}
+		else {
+			r = co_await client->read(opts->drive, n[cmd] % opts->trackMax, buf, opts->trackLen, deadline, &interrupted);
+		}
+
+		if (r.result == LINK_CANCELLED) {
+			co_return;
+		}
+
+		s.arrivals++;
+
+		// A timeout is a wait like any other as far as the FDC is concerned
+		s.intended.record(fdcNow() - due);
+
+		if (r.result == LINK_OK) {
+			s.service.record(r.latency);
+		}
+		else {
+			s.failed++;
+		}
+	}
+}
+
+static QString row(const FDCHistogram &h)
+{
+	return QString(" %1 %2 %3 %4")
+		.arg(h.percentile(0.50) / 1e6, 8, 'f', 2).arg(h.percentile(0.99) / 1e6, 8, 'f', 2)
+		.arg(h.percentile(0.999) / 1e6, 8, 'f', 2).arg(h.max() / 1e6, 8, 'f', 2);
+}
+
+int runOpenLoop(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCEnginePool pool(opts.threads);
+	std::vector<FDCClient *> clients;
+	std::vector<topenstream_t> streams;
+	topenstream_t total[CMD_COUNT];
+	FDCClient *client;
+	struct sigaction sa, oldSa;
+	qint64 first, end, elapsed;
+	double p99;
+	int c, cmd;
+
+	if (opts.statRate <= 0.0 && opts.readRate <= 0.0) {
+		out << "Nothing to send: --stat-rate and --read-rate are both 0\n";
+		return 2;
+	}
+
+	for (const QString &port : opts.ports) {
+		client = new FDCClient(pool.next());
+
+		if (!client->open(port, opts.baudRate)) {
+			out << client->errorString() << "\n";
+			delete client;
+			continue;
+		}
+
+		clients.push_back(client);
+	}
+
+	if (clients.empty()) {
+		return 1;
+	}
+
+	streams.resize(clients.size() * CMD_COUNT);
+
+	for (topenstream_t &s : streams) {
+		s.service.reset();
+		s.intended.reset();
+		s.lag.reset();
+		s.arrivals = 0;
+		s.failed = 0;
+		s.unsent = 0;
+	}
+
+	out << QString("Open loop on %1 link%2 for %3 s: %4 STAT/s and %5 READ/s per link on a fixed schedule\n")
+		.arg(clients.size()).arg((clients.size() == 1) ? "" : "s").arg(opts.duration / 1000.0, 0, 'f', 1)
+		.arg(opts.statRate, 0, 'f', 1).arg(opts.readRate, 0, 'f', 1);
+	out.flush();
+
+	interrupted.reset();
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldSa);
+
+	first = fdcNow() + OPEN_START * 1000000LL;
+	end = first + opts.duration * 1000000LL;
+
+	for (c = 0; c < (int) clients.size(); c++) {
+		clients[c]->engine()->spawn(sender(clients[c], &opts, first, end, &streams[c * CMD_COUNT]));
+	}
+
+	pool.wait();
+
+	elapsed = fdcNow() - first;
+
+	sigaction(SIGINT, &oldSa, NULL);
+
+	for (cmd = 0; cmd < CMD_COUNT; cmd++) {
+		total[cmd].service.reset();
+		total[cmd].intended.reset();
+		total[cmd].lag.reset();
+		total[cmd].arrivals = 0;
+		total[cmd].failed = 0;
+		total[cmd].unsent = 0;
+
+		for (c = 0; c < (int) clients.size(); c++) {
+			topenstream_t &s = streams[c * CMD_COUNT + cmd];
+
+			total[cmd].service.add(s.service);
+			total[cmd].intended.add(s.intended);
+			total[cmd].lag.add(s.lag);
+			total[cmd].arrivals += s.arrivals;
+			total[cmd].failed += s.failed;
+			total[cmd].unsent += s.unsent;
+		}
+	}
+
+	for (FDCClient *c : clients) {
+		delete c;
+	}
+
+	out << QString("\n%1 %2 %3 %4 |").arg("", 4).arg("arrivals", 8).arg("failed", 6).arg("unsent", 6);
+	out << QString(" %1 %2 %3 %4 |").arg("wire p50", 8).arg("p99", 8).arg("p999", 8).arg("max", 8);
+	out << QString(" %1 %2 %3 %4 |").arg("due p50", 8).arg("p99", 8).arg("p999", 8).arg("max", 8);
+	out << QString(" %1\n").arg("lag max");
+
+	for (cmd = CMD_STAT; cmd <= CMD_READ; cmd++) {
+		if (total[cmd].arrivals) {
+			out << QString("%1 %2 %3 %4 |").arg(FDCMetrics::commandName(cmd), 4)
+				.arg(total[cmd].arrivals, 8).arg(total[cmd].failed, 6).arg(total[cmd].unsent, 6);
+			out << row(total[cmd].service) << " |" << row(total[cmd].intended);
+			out << QString(" | %1\n").arg(total[cmd].lag.max() / 1e6, 7, 'f', 2);
+		}
+	}
+
+	// What a closed loop benchmark would have said against what was felt
+	out << "\n";
+
+	for (cmd = CMD_STAT; cmd <= CMD_READ; cmd++) {
+		if (total[cmd].service.count()) {
+			p99 = total[cmd].service.percentile(0.99);
+			out << QString("%1 p99 %2 ms from when due, %3 ms from the wire (%4x)\n")
+				.arg(FDCMetrics::commandName(cmd))
+				.arg(total[cmd].intended.percentile(0.99) / 1e6, 0, 'f', 2)
+				.arg(p99 / 1e6, 0, 'f', 2)
+				.arg((p99 > 0.0) ? total[cmd].intended.percentile(0.99) / p99 : 0.0, 0, 'f', 1);
+		}
+	}
+
+	out << QString("%1 s").arg(elapsed / 1e9, 0, 'f', 1);
+	if (interrupted.isCancelled()) {
+		out << ", interrupted";
+	}
+	out << "\n";
+
+	return (total[CMD_STAT].failed || total[CMD_READ].failed || total[CMD_STAT].unsent || total[CMD_READ].unsent) ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef FDCOPEN_H
+#define FDCOPEN_H
+
+#include <QtGlobal>
+
+#include "fdc-bench.h"
+#include "fdc-metrics.h"
+
+#define OPEN_START		20			// ms from spawning to the first arrival
+#define OPEN_DRAIN		5000			// ms after the schedule ends to catch up
+
+//
+// One command's arrivals on one link. service is what a closed loop
+// benchmark reports; intended runs from the arrival's place in the schedule,
+// so time spent waiting for the link to come free, stalls included, counts.
+//
+typedef struct TOPENSTREAM {
+	FDCHistogram service;			// ns, command on wire to done
+	FDCHistogram intended;			// ns, intended send time to done
+	FDCHistogram lag;			// ns, intended send time to handed to the link
+	quint64 arrivals;
+	quint64 failed;
+	quint64 unsent;				// still waiting OPEN_DRAIN ms after the end
+} topenstream_t;
+
+int runOpenLoop(const tbenchopts_t &opts);
+
+#endif
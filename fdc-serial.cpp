@@ -0,0 +1,472 @@
+/**********************************************************************************
+*
+*  Serial transports for the FDC+ Serial Drive Simulator
+*
+*  FDCQtSerial wraps QSerialPort. FDCPosixSerial opens the tty directly,
+*  configures it through termios2 (so 403.2K and other non-standard rates can
+*  be set with BOTHER) and waits with epoll, reading straight into the caller's
+*  buffer without QSerialPort's internal ring buffer and socket notifiers.
+*
+***********************************************************************************/
+
+#include "fdc-serial.h"
+#include "fdc-link.h"
+
+#include <QElapsedTimer>
+
+#ifdef Q_OS_LINUX
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#endif
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#ifndef Q_OS_LINUX
+#include <termios.h>
+#include <sys/ioctl.h>
+#endif
+#endif
+
+FDCSerial *FDCSerial::create(int backend)
+{
+#ifdef Q_OS_LINUX
+	if (backend == SERIAL_BACKEND_POSIX) {
+		return new FDCPosixSerial;
+	}
+#else
+	Q_UNUSED(backend);
+#endif
+
+	return new FDCQtSerial;
+}
+
+bool FDCSerial::available(int backend)
+{
+#ifdef Q_OS_LINUX
+	return (backend == SERIAL_BACKEND_QT || backend == SERIAL_BACKEND_POSIX);
+#else
+	return (backend == SERIAL_BACKEND_QT);
+#endif
+}
+
+qint64 FDCSerial::kernelOutQueue(int fd)
+{
+#ifdef Q_OS_UNIX
+	int n;
+
+	if (fd != -1 && ioctl(fd, TIOCOUTQ, &n) == 0) {
+		return n;
+	}
+#else
+	Q_UNUSED(fd);
+#endif
+
+	return 0;
+}
+
+qint64 FDCSerial::kernelInQueue(int fd)
+{
+#ifdef Q_OS_UNIX
+	int n;
+
+	if (fd != -1 && ioctl(fd, FIONREAD, &n) == 0) {
+		return n;
+	}
+#else
+	Q_UNUSED(fd);
+#endif
+
+	return 0;
+}
+
+//
+// Poll the kernel output queue, sleeping about as long as the excess takes
+// to go out on the wire (10 bits per byte at 8N1).
+//
+bool FDCSerial::waitKernelQueue(int fd, qint64 limit, int msecs)
+{
+	QElapsedTimer timer;
+	qint64 pending, usecs;
+
+	timer.start();
+
+	while ((pending = kernelOutQueue(fd)) > limit) {
+		if (timer.elapsed() >= msecs) {
+			return false;
+		}
+
+		usecs = (baudRate) ? (pending - limit) * 10 * 1000000LL / baudRate : 1000;
+		usleep(qBound((qint64) 50, usecs, (qint64) 10000));
+	}
+
+	// Last character out of the shift register
+	if (limit == 0 && fd != -1) {
+#if defined(Q_OS_LINUX)
+		ioctl(fd, TCSBRK, 1);
+#elif defined(Q_OS_UNIX)
+		tcdrain(fd);
+#endif
+	}
+
+	return true;
+}
+
+/*
+** QSerialPort transport
+*/
+
+FDCQtSerial::FDCQtSerial()
+{
+	serialPort = new QSerialPort;
+}
+
+FDCQtSerial::~FDCQtSerial()
+{
+	close();
+	delete serialPort;
+}
+
+bool FDCQtSerial::open(const QString &portName, quint32 baudRate)
+{
+	close();
+
+	serialPort->setPortName(portName);
+
+	if (!serialPort->open(QIODevice::ReadWrite)) {
+		lastError = QString("Could not open serial port '%1' (%2)").arg(portName).arg(serialPort->error());
+		return false;
+	}
+
+	if (serialPort->setBaudRate(baudRate) == false) {
+		lastError = QString("Could not set baudrate to %1").arg(baudRate);
+		serialPort->close();
+		return false;
+	}
+
+	serialPort->setDataBits(QSerialPort::Data8);
+	serialPort->setParity(QSerialPort::NoParity);
+	serialPort->setStopBits(QSerialPort::OneStop);
+	serialPort->setFlowControl(QSerialPort::NoFlowControl);
+	serialPort->setDataTerminalReady(true);
+	serialPort->setRequestToSend(true);
+	serialPort->clear();
+
+	this->baudRate = baudRate;
+
+	return true;
+}
+
+void FDCQtSerial::close()
+{
+	if (serialPort->isOpen()) {
+		serialPort->clear();
+		serialPort->close();
+	}
+}
+
+bool FDCQtSerial::isOpen() const
+{
+	return serialPort->isOpen();
+}
+
+void FDCQtSerial::clear()
+{
+	serialPort->clear();
+}
+
+qint64 FDCQtSerial::write(const quint8 *data, qint64 length)
+{
+	return serialPort->write((const char *) data, length);
+}
+
+qint64 FDCQtSerial::read(quint8 *data, qint64 maxLength, int msecs)
+{
+	if (serialPort->bytesAvailable() == 0 && !serialPort->waitForReadyRead(msecs)) {
+		return (serialPort->error() == QSerialPort::TimeoutError || serialPort->error() == QSerialPort::NoError) ? 0 : -1;
+	}
+
+	return serialPort->read((char *) data, maxLength);
+}
+
+QString FDCQtSerial::errorString() const
+{
+	return (lastError.isEmpty()) ? serialPort->errorString() : lastError;
+}
+
+int FDCQtSerial::handle() const
+{
+#ifdef Q_OS_UNIX
+	return (serialPort->isOpen()) ? serialPort->handle() : -1;
+#else
+	return -1;
+#endif
+}
+
+qint64 FDCQtSerial::outQueue()
+{
+	return serialPort->bytesToWrite() + kernelOutQueue(handle());
+}
+
+qint64 FDCQtSerial::inQueue()
+{
+	return serialPort->bytesAvailable() + kernelInQueue(handle());
+}
+
+qint64 FDCQtSerial::userQueue()
+{
+	return serialPort->bytesToWrite();
+}
+
+bool FDCQtSerial::waitOutQueue(qint64 limit, int msecs)
+{
+	QElapsedTimer timer;
+
+	timer.start();
+
+	// Without an event loop QSerialPort only hands data to the kernel here
+	while (serialPort->bytesToWrite() > 0) {
+		if (timer.elapsed() >= msecs || !serialPort->waitForBytesWritten(msecs - timer.elapsed())) {
+			return false;
+		}
+	}
+
+	return waitKernelQueue(handle(), limit, qMax((qint64) 0, msecs - timer.elapsed()));
+}
+
+#ifdef Q_OS_LINUX
+
+/*
+** POSIX termios/epoll transport
+*/
+
+FDCPosixSerial::FDCPosixSerial()
+{
+	fd = -1;
+	epfd = -1;
+}
+
+FDCPosixSerial::~FDCPosixSerial()
+{
+	close();
+}
+
+bool FDCPosixSerial::open(const QString &portName, quint32 baudRate)
+{
+	struct epoll_event ev;
+	QString path;
+
+	close();
+
+	path = (portName.startsWith('/')) ? portName : QString("/dev/") + portName;
+
+	if ((fd = ::open(path.toLocal8Bit().constData(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC)) == -1) {
+		lastError = QString("Could not open serial port '%1' (%2)").arg(portName).arg(strerror(errno));
+		return false;
+	}
+
+	if (!setBaudRate(baudRate)) {
+		close();
+		return false;
+	}
+
+	this->baudRate = baudRate;
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		setError("epoll_create1");
+		close();
+		return false;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		setError("epoll_ctl");
+		close();
+		return false;
+	}
+
+	clear();
+
+	return true;
+}
+
+bool FDCPosixSerial::setBaudRate(quint32 baudRate)
+{
+	struct termios2 tio;
+	int bits;
+
+	if (ioctl(fd, TCGETS2, &tio) == -1) {
+		setError("TCGETS2");
+		return false;
+	}
+
+	// Raw 8N1, no flow control, reads never block in the kernel
+	tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
+	tio.c_oflag &= ~OPOST;
+	tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+	tio.c_cflag &= ~(CSIZE | PARENB | CSTOPB | CRTSCTS | CBAUD | (CBAUD << IBSHIFT));
+	tio.c_cflag |= CS8 | CREAD | CLOCAL | BOTHER | (BOTHER << IBSHIFT);
+	tio.c_ispeed = baudRate;
+	tio.c_ospeed = baudRate;
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+
+	if (ioctl(fd, TCSETS2, &tio) == -1) {
+		lastError = QString("Could not set baudrate to %1 (%2)").arg(baudRate).arg(strerror(errno));
+		return false;
+	}
+
+	// DTR and RTS asserted, as with the QSerialPort backend
+	bits = TIOCM_DTR | TIOCM_RTS;
+	ioctl(fd, TIOCMBIS, &bits);
+
+	return true;
+}
+
+void FDCPosixSerial::close()
+{
+	if (epfd != -1) {
+		::close(epfd);
+		epfd = -1;
+	}
+
+	if (fd != -1) {
+		ioctl(fd, TCFLSH, TCIOFLUSH);
+		::close(fd);
+		fd = -1;
+	}
+}
+
+bool FDCPosixSerial::isOpen() const
+{
+	return (fd != -1);
+}
+
+void FDCPosixSerial::clear()
+{
+	if (fd != -1) {
+		ioctl(fd, TCFLSH, TCIOFLUSH);
+	}
+}
+
+qint64 FDCPosixSerial::write(const quint8 *data, qint64 length)
+{
+	struct epoll_event ev;
+	QElapsedTimer timer;
+	qint64 written, msecs, left;
+	ssize_t n;
+
+	// Same allowance as a transaction: the data's wire time plus the
+	// response timeout, so a stalled port can't hold the writer forever
+	msecs = RESPONSE_TIMEOUT + ((baudRate) ? length * 10 * 1000 / baudRate : 0);
+	written = 0;
+	timer.start();
+
+	while (written < length) {
+		n = ::write(fd, data + written, length - written);
+
+		if (n > 0) {
+			written += n;
+		}
+		else if (n == -1 && errno == EAGAIN) {
+			// Output queue full, wait for room
+			if ((left = msecs - timer.elapsed()) <= 0) {
+				lastError = QString("write: timed out with %1 of %2 bytes sent").arg(written).arg(length);
+				return (written) ? written : -1;
+			}
+			ev.events = EPOLLIN | EPOLLOUT;
+			ev.data.fd = fd;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+			while (epoll_wait(epfd, &ev, 1, left) == 1 && !(ev.events & EPOLLOUT) && (left = msecs - timer.elapsed()) > 0);
+			ev.events = EPOLLIN;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+		}
+		else if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		else {
+			setError("write");
+			return -1;
+		}
+	}
+
+	return written;
+}
+
+qint64 FDCPosixSerial::read(quint8 *data, qint64 maxLength, int msecs)
+{
+	struct epoll_event ev;
+	ssize_t n;
+	int r;
+
+	// Try first, most calls during a track transfer find data already queued
+	if ((n = ::read(fd, data, maxLength)) > 0) {
+		return n;
+	}
+
+	if (n == -1 && errno != EAGAIN && errno != EINTR) {
+		setError("read");
+		return -1;
+	}
+
+	do {
+		r = epoll_wait(epfd, &ev, 1, msecs);
+	} while (r == -1 && errno == EINTR);
+
+	if (r == 0) {
+		return 0;
+	}
+
+	if (r == -1) {
+		setError("epoll_wait");
+		return -1;
+	}
+
+	if ((n = ::read(fd, data, maxLength)) == -1) {
+		if (errno == EAGAIN) {
+			return 0;
+		}
+		setError("read");
+	}
+	else if (n == 0) {
+		// Readable with nothing to read is a hangup, not a timeout, or the
+		// caller would be straight back here
+		lastError = (ev.events & EPOLLHUP) ? "read: port hung up" : "read: end of file";
+		return -1;
+	}
+
+	return n;
+}
+
+QString FDCPosixSerial::errorString() const
+{
+	return lastError;
+}
+
+qint64 FDCPosixSerial::outQueue()
+{
+	return kernelOutQueue(fd);
+}
+
+qint64 FDCPosixSerial::inQueue()
+{
+	return kernelInQueue(fd);
+}
+
+bool FDCPosixSerial::waitOutQueue(qint64 limit, int msecs)
+{
+	return waitKernelQueue(fd, limit, msecs);
+}
+
+void FDCPosixSerial::setError(const char *what)
+{
+	lastError = QString("%1: %2").arg(what).arg(strerror(errno));
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef FDCSERIAL_H
+#define FDCSERIAL_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QSerialPort>
+
+#define SERIAL_BACKEND_QT	0			// QSerialPort
+#define SERIAL_BACKEND_POSIX	1			// termios/epoll (Linux only)
+
+//
+// Serial transport used by the protocol engine. read() waits up to msecs
+// for data and returns the number of bytes placed directly in the caller's
+// buffer, 0 on timeout or -1 on error. write() returns the bytes written,
+// fewer than length if the port stopped taking them, or -1 on error.
+//
+// outQueue() and inQueue() report bytes not yet on the wire and bytes not
+// yet read, kernel (TIOCOUTQ/TIOCINQ) plus any user space buffering, which
+// userQueue() reports on its own. waitOutQueue() waits until no more than
+// limit bytes are pending; a limit of 0 also waits for the transmitter to
+// empty, like tcdrain().
+//
+class FDCSerial
+{
+public:
+	FDCSerial() { baudRate = 0; }
+	virtual ~FDCSerial() {}
+
+	virtual bool open(const QString &portName, quint32 baudRate) = 0;
+	virtual void close(void) = 0;
+	virtual bool isOpen(void) const = 0;
+	virtual void clear(void) = 0;
+	virtual qint64 write(const quint8 *data, qint64 length) = 0;
+	virtual qint64 read(quint8 *data, qint64 maxLength, int msecs) = 0;
+	virtual QString errorString(void) const = 0;
+	virtual const char *name(void) const = 0;
+	virtual qint64 outQueue(void) = 0;
+	virtual qint64 inQueue(void) = 0;
+	virtual qint64 userQueue(void) { return 0; }
+	virtual bool waitOutQueue(qint64 limit, int msecs) = 0;
+
+	quint32 baud(void) const { return baudRate; }
+
+	static FDCSerial *create(int backend);
+	static bool available(int backend);
+
+protected:
+	quint32 baudRate;
+
+	static qint64 kernelOutQueue(int fd);
+	static qint64 kernelInQueue(int fd);
+	bool waitKernelQueue(int fd, qint64 limit, int msecs);
+};
+
+class FDCQtSerial : public FDCSerial
+{
+public:
+	FDCQtSerial();
+	~FDCQtSerial();
+
+	bool open(const QString &portName, quint32 baudRate);
+	void close(void);
+	bool isOpen(void) const;
+	void clear(void);
+	qint64 write(const quint8 *data, qint64 length);
+	qint64 read(quint8 *data, qint64 maxLength, int msecs);
+	QString errorString(void) const;
+	const char *name(void) const { return "QSerialPort"; }
+	qint64 outQueue(void);
+	qint64 inQueue(void);
+	qint64 userQueue(void);
+	bool waitOutQueue(qint64 limit, int msecs);
+
+	int handle(void) const;
+
+private:
+	QSerialPort *serialPort;
+	QString lastError;
+};
+
+#ifdef Q_OS_LINUX
+class FDCPosixSerial : public FDCSerial
+{
+public:
+	FDCPosixSerial();
+	~FDCPosixSerial();
+
+	bool open(const QString &portName, quint32 baudRate);
+	void close(void);
+	bool isOpen(void) const;
+	void clear(void);
+	qint64 write(const quint8 *data, qint64 length);
+	qint64 read(quint8 *data, qint64 maxLength, int msecs);
+	QString errorString(void) const;
+	const char *name(void) const { return "termios/epoll"; }
+	qint64 outQueue(void);
+	qint64 inQueue(void);
+	bool waitOutQueue(qint64 limit, int msecs);
+
+	int handle(void) const { return fd; }
+
+private:
+	int fd;
+	int epfd;
+	QString lastError;
+
+	bool setBaudRate(quint32 baudRate);
+	void setError(const char *what);
+};
+#endif
+
+#endif
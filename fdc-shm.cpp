@@ -0,0 +1,298 @@
+/**********************************************************************************
+*
+*  Shared memory metrics segment for the FDC+ Serial Drive Simulator
+*
+*  Run with --shm (or FDC_SHM set for the dialog) and the metrics of every
+*  link appear in /dev/shm, where any number of monitors can watch them:
+*
+*      fdc-sim-gui --workload --port ttyUSB0 --shm /fdc-lab1
+*      fdc-sim-gui --monitor /fdc-lab1 --interval 500
+*
+*  Writers bump a per-slot sequence to odd, copy the metrics in and bump it
+*  back to even. Readers copy the slot and retry if the sequence was odd or
+*  changed underneath them (a seqlock), so neither side ever blocks.
+*
+***********************************************************************************/
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include "fdc-shm.h"
+#include "fdc-link.h"
+
+static_assert(std::atomic<quint32>::is_always_lock_free, "seqlock needs a lock free counter");
+static_assert(MEM_COUNT <= SHM_MEM_POOLS, "memory pools don't fit the segment");
+
+FDCShm::FDCShm()
+{
+	header = NULL;
+	slotTable = NULL;
+	size = 0;
+	owner = false;
+}
+
+FDCShm::~FDCShm()
+{
+	close();
+}
+
+QString FDCShm::defaultName()
+{
+#ifdef Q_OS_UNIX
+	return QString("/fdc-sim-%1").arg(getpid());
+#else
+	return QString();
+#endif
+}
+
+bool FDCShm::create(const QString &name)
+{
+	return map(name, true);
+}
+
+bool FDCShm::attach(const QString &name)
+{
+	return map(name, false);
+}
+
+bool FDCShm::map(const QString &name, bool create)
+{
+#ifdef Q_OS_UNIX
+	struct stat st;
+	void *p;
+	int fd;
+
+	close();
+
+	shmName = (name.startsWith('/')) ? name : "/" + name;
+	size = sizeof(tshmheader_t) + SHM_MAX_LINKS * sizeof(tshmslot_t);
+
+	if ((fd = shm_open(shmName.toLocal8Bit().constData(), (create) ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644)) == -1) {
+		lastError = QString("%1: %2").arg(shmName).arg(strerror(errno));
+		return false;
+	}
+
+	if (create && ftruncate(fd, size) == -1) {
+		lastError = QString("%1: %2").arg(shmName).arg(strerror(errno));
+		::close(fd);
+		shm_unlink(shmName.toLocal8Bit().constData());
+		return false;
+	}
+
+	if (!create && (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(tshmheader_t))) {
+		lastError = QString("%1: not a metrics segment").arg(shmName);
+		::close(fd);
+		return false;
+	}
+
+	if (!create) {
+		size = st.st_size;
+	}
+
+	p = mmap(NULL, size, (create) ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (p == MAP_FAILED) {
+		lastError = QString("%1: %2").arg(shmName).arg(strerror(errno));
+		if (create) {
+			shm_unlink(shmName.toLocal8Bit().constData());
+		}
+		return false;
+	}
+
+	header = (tshmheader_t *) p;
+	slotTable = (tshmslot_t *) ((char *) p + sizeof(tshmheader_t));
+	owner = create;
+
+	if (create) {
+		// Zero filled by ftruncate; magic last so readers never see a half made header
+		header->version = SHM_VERSION;
+		header->headerSize = sizeof(tshmheader_t);
+		header->slotSize = sizeof(tshmslot_t);
+		header->maxLinks = SHM_MAX_LINKS;
+		header->pid = getpid();
+		header->started = fdcNow();
+		header->memPools = MEM_COUNT;
+		std::atomic_thread_fence(std::memory_order_release);
+		header->magic = SHM_MAGIC;
+		return true;
+	}
+
+	if (header->magic != SHM_MAGIC || header->version != SHM_VERSION
+		|| header->headerSize != sizeof(tshmheader_t) || header->slotSize != sizeof(tshmslot_t)
+		|| size < sizeof(tshmheader_t) + header->maxLinks * sizeof(tshmslot_t)) {
+		lastError = QString("%1: unsupported metrics segment version").arg(shmName);
+		close();
+		return false;
+	}
+
+	return true;
+#else
+	Q_UNUSED(name);
+	Q_UNUSED(create);
+	lastError = QString("Shared memory not supported");
+	return false;
+#endif
+}
+
+void FDCShm::close()
+{
+#ifdef Q_OS_UNIX
+	if (header != NULL) {
+		munmap(header, size);
+		if (owner) {
+			shm_unlink(shmName.toLocal8Bit().constData());
+		}
+	}
+#endif
+
+	header = NULL;
+	slotTable = NULL;
+	owner = false;
+}
+
+//
+// Claim a slot for a link. Returns -1 when read only or full.
+//
+int FDCShm::addLink(const QString &linkName)
+{
+	QByteArray n;
+	quint32 slot;
+
+	if (!owner || (slot = header->links.load()) >= header->maxLinks) {
+		return -1;
+	}
+
+	while (!header->links.compare_exchange_weak(slot, slot + 1)) {
+		if (slot >= header->maxLinks) {
+			return -1;
+		}
+	}
+
+	n = linkName.toLocal8Bit();
+	strncpy(slotTable[slot].name, n.constData(), SHM_NAME_LEN - 1);
+
+	return slot;
+}
+
+void FDCShm::publish(int slot, const FDCMetrics &metrics)
+{
+	store(slot, metrics, NULL, -1, 0, 0, 0);
+}
+
+//
+// Publish after a transaction, with what it did to the drive state: the
+// mount mask as the last STAT showed it and, for READ and WRIT, the drive
+// and track
+//
+void FDCShm::publish(int slot, const FDCMetrics &metrics, const FDCMountWatch &mounts, int cmd, quint8 drive, quint16 track, int result)
+{
+	store(slot, metrics, &mounts, cmd, drive, track, result);
+}
+
+void FDCShm::store(int slot, const FDCMetrics &metrics, const FDCMountWatch *mounts, int cmd, quint8 drive, quint16 track, int result)
+{
+	tshmslot_t *s;
+	tshmdrive_t *d;
+	quint32 seq;
+	int pool;
+
+	if (!owner || slot < 0) {
+		return;
+	}
+
+	s = &slotTable[slot];
+
+	seq = s->seq.load(std::memory_order_relaxed);
+	s->seq.store(seq | 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	s->metrics = metrics;
+	s->updated = fdcNow();
+
+	if (mounts != NULL) {
+		s->drives.known = mounts->known();
+		s->drives.mounted = mounts->mask();
+	}
+
+	if ((cmd == CMD_READ || cmd == CMD_WRIT) && drive < MOUNT_DRIVES) {
+		d = &s->drives.drive[drive];
+		d->track = track;
+		d->cmd = cmd;
+		d->result = result;
+		d->done = s->updated;
+		d->transfers++;
+		d->failures += (result != LINK_OK);
+	}
+
+	// Skip 0 so it always means never published
+	s->seq.store((seq | 1) + 1, std::memory_order_release);
+
+	for (pool = 0; pool < MEM_COUNT; pool++) {
+		header->memory[pool].used.store(FDCMemory::used(pool), std::memory_order_relaxed);
+		header->memory[pool].peak.store(FDCMemory::peak(pool), std::memory_order_relaxed);
+		header->memory[pool].limit.store(FDCMemory::limit(pool), std::memory_order_relaxed);
+		header->memory[pool].denied.store(FDCMemory::denied(pool), std::memory_order_relaxed);
+	}
+}
+
+int FDCShm::links() const
+{
+	return (header) ? (int) qMin(header->links.load(std::memory_order_acquire), header->maxLinks) : 0;
+}
+
+//
+// Consistent copy of a slot, and its drive state if drives isn't NULL.
+// Returns false if it has never been published, or if it stays mid update
+// for SHM_READ_TIMEOUT ms (a publisher that died or stopped while writing).
+//
+bool FDCShm::snapshot(int slot, FDCMetrics *metrics, QString *linkName, qint64 *updated, tshmdrives_t *drives) const
+{
+	const tshmslot_t *s;
+	quint32 before, after;
+	qint64 until;
+
+	if (slot < 0 || slot >= links()) {
+		return false;
+	}
+
+	s = &slotTable[slot];
+	until = fdcNow() + SHM_READ_TIMEOUT * 1000000LL;
+
+	do {
+		while ((before = s->seq.load(std::memory_order_acquire)) & 1) {
+			// Writer mid update, normally only for a copy's time
+			if (fdcNow() >= until) {
+				return false;
+			}
+		}
+
+		if (before == 0) {
+			return false;
+		}
+
+		*metrics = s->metrics;
+		*updated = s->updated;
+		if (drives != NULL) {
+			*drives = s->drives;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		after = s->seq.load(std::memory_order_relaxed);
+	} while (before != after && fdcNow() < until);
+
+	if (before != after) {
+		return false;
+	}
+
+	*linkName = QString::fromLocal8Bit(s->name, strnlen(s->name, SHM_NAME_LEN));
+
+	return true;
+}
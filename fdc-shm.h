@@ -0,0 +1,125 @@
+#ifndef FDCSHM_H
+#define FDCSHM_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <atomic>
+
+#include "fdc-metrics.h"
+#include "fdc-memory.h"
+#include "fdc-mount.h"
+
+#define SHM_MAGIC		0x53434446		// "FDCS"
+#define SHM_VERSION		3			// bump on any layout change
+#define SHM_MAX_LINKS		32
+#define SHM_NAME_LEN		64
+#define SHM_MEM_POOLS		8			// room for MEM_COUNT to grow
+#define SHM_READ_TIMEOUT	10			// ms a reader waits on a slot mid update
+
+//
+// One memory budget, MEM_ order. Each field is independent, so no seqlock.
+//
+typedef struct TSHMMEMORY {
+	std::atomic<qint64> used;
+	std::atomic<qint64> peak;
+	std::atomic<qint64> limit;
+	std::atomic<quint64> denied;
+} tshmmemory_t;
+
+//
+// What a link last did to one drive. Counts are since the link started.
+//
+typedef struct TSHMDRIVE {
+	quint16 track;				// last track READ or WRIT
+	quint8 cmd;				// CMD_READ or CMD_WRIT
+	quint8 result;				// its LINK_ code
+	quint32 reserved;
+	qint64 done;				// fdcNow() it finished, 0 if never used
+	quint64 transfers;
+	quint64 failures;			// transfers that didn't return LINK_OK
+} tshmdrive_t;
+
+typedef struct TSHMDRIVES {
+	bool known;				// a STAT has answered
+	quint16 mounted;			// its mount mask
+	tshmdrive_t drive[MOUNT_DRIVES];
+} tshmdrives_t;
+
+//
+// Segment layout. The header is followed by SHM_MAX_LINKS slots. A reader
+// must check magic, version and slotSize before trusting anything else.
+//
+typedef struct TSHMHEADER {
+	quint32 magic;
+	quint16 version;
+	quint16 headerSize;			// sizeof(tshmheader_t)
+	quint32 slotSize;			// sizeof(tshmslot_t)
+	quint32 maxLinks;
+	std::atomic<quint32> links;		// slots in use
+	quint32 reserved;
+	qint64 pid;				// publishing process
+	qint64 started;				// fdcNow() when created
+	quint32 memPools;			// MEM_COUNT of the publisher
+	quint32 reserved2;
+	tshmmemory_t memory[SHM_MEM_POOLS];	// updated with every publish
+} tshmheader_t;
+
+//
+// One link's metrics under a seqlock. seq is odd while the single writer
+// is updating the slot and 0 until it has published once.
+//
+typedef struct TSHMSLOT {
+	std::atomic<quint32> seq;
+	quint32 reserved;
+	qint64 updated;				// fdcNow() of the last publish
+	char name[SHM_NAME_LEN];
+	FDCMetrics metrics;
+	tshmdrives_t drives;
+} tshmslot_t;
+
+//
+// Live metrics in a POSIX shared memory segment. The simulator creates it
+// and publishes after every transaction; monitors attach read only and take
+// consistent snapshots without a system call or a lock the protocol threads
+// could wait on. Each slot must only be published from one thread.
+//
+class FDCShm
+{
+public:
+	FDCShm();
+	~FDCShm();
+
+	bool create(const QString &name);
+	bool attach(const QString &name);
+	void close(void);
+	bool isOpen(void) const { return header != NULL; }
+	QString errorString(void) const { return lastError; }
+	QString name(void) const { return shmName; }
+
+	int addLink(const QString &linkName);
+	void publish(int slot, const FDCMetrics &metrics);
+	void publish(int slot, const FDCMetrics &metrics, const FDCMountWatch &mounts, int cmd, quint8 drive, quint16 track, int result);
+
+	int links(void) const;
+	qint64 pid(void) const { return (header) ? header->pid : 0; }
+	qint64 started(void) const { return (header) ? header->started : 0; }
+	bool snapshot(int slot, FDCMetrics *metrics, QString *linkName, qint64 *updated, tshmdrives_t *drives = NULL) const;
+	int memPools(void) const { return (header) ? (int) qMin(header->memPools, (quint32) SHM_MEM_POOLS) : 0; }
+	const tshmmemory_t &memory(int pool) const { return header->memory[pool]; }
+
+	static QString defaultName(void);
+
+private:
+	tshmheader_t *header;
+	tshmslot_t *slotTable;
+	size_t size;
+	bool owner;
+	QString shmName;
+	QString lastError;
+
+	bool map(const QString &name, bool create);
+	void store(int slot, const FDCMetrics &metrics, const FDCMountWatch *mounts, int cmd, quint8 drive, quint16 track, int result);
+};
+
+#endif
@@ -107,20 +107,20 @@
 #include <QtWidgets>
 #include <QMessageBox>
 
+#include <string.h>
+
 #include "fdc-sim-gui.h"
-#include "grnled.xpm"
-#include "redled.xpm"
+#include "fdc-cli.h"
+#include "fdc-startup.h"
 
 FDCDialog::FDCDialog(QWidget *parent)
 	: QDialog(parent)
 {
+	QString error;
+
 	// Title
 	setWindowTitle(tr("FDC+ Serial Drive Simulator"));
 
-	// Pixmaps
-	grnLED = new QPixmap(greenled_xpm);
-	redLED = new QPixmap(redled_xpm);
-
 	// Layouts
 	QVBoxLayout *mainLayout = new QVBoxLayout;
 	QHBoxLayout *commLayout = new QHBoxLayout;
@@ -129,6 +129,7 @@ FDCDialog::FDCDialog(QWidget *parent)
 	QHBoxLayout *statLayout = new QHBoxLayout;
 	QHBoxLayout *paramLayout = new QHBoxLayout;
 	QHBoxLayout *buttonLayout = new QHBoxLayout;
+	QHBoxLayout *editLayout = new QHBoxLayout;
 	QHBoxLayout *infoLayout = new QHBoxLayout;
 
 	// Information
@@ -138,12 +139,8 @@ FDCDialog::FDCDialog(QWidget *parent)
 	label->setAlignment(Qt::AlignRight);
 	infoLayout->addWidget(label);
 
-	// Communications Ports
+	// Communications Ports, listed once the dialog is up (see listSerialPorts)
 	serialPortBox = new QComboBox;
-	serialPorts = QSerialPortInfo::availablePorts();
-	for (const QSerialPortInfo &info : serialPorts) {
-		serialPortBox->addItem(info.portName());
-	}
 	serialPortBox->setPlaceholderText(tr("None"));
 	serialPortBox->setCurrentIndex(-1);
 	connect(serialPortBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int index){ serialPortSlot(index); });
@@ -158,6 +155,15 @@ FDCDialog::FDCDialog(QWidget *parent)
 
 	commLayout->addWidget(baudRateBox);
 
+	backendBox = new QComboBox;
+	backendBox->addItem("QSerialPort", SERIAL_BACKEND_QT);
+	if (FDCSerial::available(SERIAL_BACKEND_POSIX)) {
+		backendBox->addItem("termios/epoll", SERIAL_BACKEND_POSIX);
+	}
+	connect(backendBox, QOverload<int>::of(&QComboBox::currentIndexChanged), [this](int index){ backendSlot(index); });
+
+	commLayout->addWidget(backendBox);
+
 	// Disk Type
 	diskBox = new QComboBox;
 	diskBox->addItem("8 Inch", TRACK_LEN_8);
@@ -204,16 +210,46 @@ FDCDialog::FDCDialog(QWidget *parent)
 	statButton = new QPushButton(tr("STAT"));
 	readButton = new QPushButton(tr("READ"));
 	writButton = new QPushButton(tr("WRIT"));
+	abortButton = new QPushButton(tr("Abort"));
+	abortButton->setEnabled(false);
 
 	buttonLayout->addWidget(statButton);
 	buttonLayout->addWidget(readButton);
 	buttonLayout->addWidget(writButton);
+	buttonLayout->addWidget(abortButton);
 	
 	mainLayout->addLayout(buttonLayout);
 
 	connect(statButton, &QPushButton::clicked, this, &FDCDialog::statButtonSlot);
 	connect(readButton, &QPushButton::clicked, this, &FDCDialog::readButtonSlot);
 	connect(writButton, &QPushButton::clicked, this, &FDCDialog::writButtonSlot);
+	connect(abortButton, &QPushButton::clicked, this, &FDCDialog::abortButtonSlot);
+
+	// Sector editor, edits held until flushed
+	label = new QLabel(tr("Offset:"));
+	editLayout->addWidget(label);
+	editWhereEdit = new QLineEdit();
+	editWhereEdit->setPlaceholderText(tr("0x40 or s3+7"));
+	editLayout->addWidget(editWhereEdit);
+	label = new QLabel(tr("Bytes:"));
+	editLayout->addWidget(label);
+	editBytesEdit = new QLineEdit();
+	editBytesEdit->setPlaceholderText(tr("hex"));
+	editLayout->addWidget(editBytesEdit);
+	editButton = new QPushButton(tr("Edit"));
+	editLayout->addWidget(editButton);
+	flushButton = new QPushButton(tr("Flush"));
+	editLayout->addWidget(flushButton);
+	label = new QLabel(tr("Auto"));
+	editLayout->addWidget(label);
+	flushAutoCheck = new QCheckBox;
+	flushAutoCheck->setChecked(true);
+	editLayout->addWidget(flushAutoCheck);
+
+	mainLayout->addLayout(editLayout);
+
+	connect(editButton, &QPushButton::clicked, this, &FDCDialog::editButtonSlot);
+	connect(flushButton, &QPushButton::clicked, this, &FDCDialog::flushButtonSlot);
 
 	// Message Line
 	messageLabel = new QLabel;
@@ -224,9 +260,53 @@ FDCDialog::FDCDialog(QWidget *parent)
 
 	setLayout(mainLayout);
 
-	// Serial Port Object
-	serialPort = new QSerialPort;
+	FDCStartup::mark("widgets");
+
+	// Serial Link Object. Keep the dialog responsive (and Abort clickable)
+	// while a transaction is waiting on the line.
+	link = new FDCLink;
+	link->setPollHook([]() { QCoreApplication::processEvents(); });
+	busy = false;
+	mountEvents = 0;
+	portIndex = -1;
+
+	// Memory budgets, as for --mem-limit
+	if (qEnvironmentVariableIsSet("FDC_MEM_LIMIT") && !FDCMemory::setLimits(qEnvironmentVariable("FDC_MEM_LIMIT"), &error)) {
+		QMessageBox::warning(this, "Memory Limit Error", error);
+	}
+
+	// Live metrics for external monitors if FDC_SHM names a segment
+	shm = new FDCShm;
+	if (qEnvironmentVariableIsSet("FDC_SHM")) {
+		if (shm->create(qEnvironmentVariable("FDC_SHM"))) {
+			link->setShm(shm, "dialog");
+		}
+		else {
+			QMessageBox::warning(this, "Shared Memory Error", shm->errorString());
+		}
+	}
+
+	// Live transaction feed for external analysers if FDC_FEED names one
+	feed = new FDCFeed;
+	if (qEnvironmentVariableIsSet("FDC_FEED")) {
+		if (feed->create(qEnvironmentVariable("FDC_FEED"), "dialog", "", baudRateBox->currentData().toInt())) {
+			link->setFeed(feed);
+		}
+		else {
+			QMessageBox::warning(this, "Shared Memory Error", feed->errorString());
+		}
+	}
 	baudRate = baudRateBox->currentData().toInt();
+	backend = backendBox->currentData().toInt();
+
+	// Write-back buffer for the sector editor, its store made by the first edit,
+	// and a persistent track cache for it and READ if FDC_TRACK_CACHE names
+	// one
+	writeBack = new FDCWriteBack(link);
+	cache = new FDCTrackCache;
+	writeBack->setCache(cache);
+
+	FDCStartup::mark("link");
 
 	// Initialize heads
 	for (driveNum = 0; driveNum < MAX_DRIVE; driveNum++) {
@@ -243,30 +323,96 @@ FDCDialog::FDCDialog(QWidget *parent)
 	timer->setInterval(statTimerEdit->text().toInt());
 	connect(timer, &QTimer::timeout, this, &FDCDialog::timerSlot);
 	timer->start();
+
+	// Enumerating ports can take tens of ms; do it after the dialog is shown
+	QTimer::singleShot(0, this, &FDCDialog::listSerialPorts);
+}
+
+//
+// Fill the port list without selecting (and opening) any of them
+//
+void FDCDialog::listSerialPorts()
+{
+	serialPorts = QSerialPortInfo::availablePorts();
+
+	serialPortBox->blockSignals(true);
+	for (const QSerialPortInfo &info : serialPorts) {
+		serialPortBox->addItem(info.portName());
+	}
+	serialPortBox->setCurrentIndex(-1);
+	serialPortBox->blockSignals(false);
+
+	FDCStartup::mark("serial ports");
+	FDCStartup::ready();
 }
 
 void FDCDialog::diskSlot(int index)
 {
+	// Held tracks are the old length; write back what was edited first
+	flushCmd(0);
+
+	if (writeBack->dirtyTracks() && QMessageBox::question(this,
+		"Write-back Error",
+		QString(tr("%1 edited tracks could not be written back. Change the disk type and lose them?")).arg(writeBack->dirtyTracks())) != QMessageBox::Yes) {
+		// Stay on the disk type the edits were made to
+		diskBox->blockSignals(true);
+		diskBox->setCurrentIndex(diskBox->findData(trackLen));
+		diskBox->blockSignals(false);
+		return;
+	}
+
 	if ((trackLen = diskBox->itemData(index).toInt()) == TRACK_LEN_8) {
 		trackMax = TRACK_MAX_8;
 	}
 	else {
 		trackMax = TRACK_MAX_5;
 	}
+
+	// The next edit makes a store for the new length
+	writeBack->close();
+	openCache();
 }
 
 void FDCDialog::serialPortSlot(int index)
 {
-	serialPort->setPortName(serialPortBox->itemText(index));
+	Q_UNUSED(index);
 
-	updateSerialPort();
+	if (!updateSerialPort()) {
+		// Stay on the port the edits were made through
+		serialPortBox->blockSignals(true);
+		serialPortBox->setCurrentIndex(portIndex);
+		serialPortBox->blockSignals(false);
+	}
 }
 
 void FDCDialog::baudRateSlot(int index)
 {
+	quint32 previous;
+
+	previous = baudRate;
 	baudRate = baudRateBox->itemData(index).toInt();
 
-	updateSerialPort();
+	if (!updateSerialPort()) {
+		baudRate = previous;
+		baudRateBox->blockSignals(true);
+		baudRateBox->setCurrentIndex(baudRateBox->findData(baudRate));
+		baudRateBox->blockSignals(false);
+	}
+}
+
+void FDCDialog::backendSlot(int index)
+{
+	int previous;
+
+	previous = backend;
+	backend = backendBox->itemData(index).toInt();
+
+	if (!updateSerialPort()) {
+		backend = previous;
+		backendBox->blockSignals(true);
+		backendBox->setCurrentIndex(backendBox->findData(backend));
+		backendBox->blockSignals(false);
+	}
 }
 
 void FDCDialog::driveNumEditSlot()
@@ -327,114 +473,294 @@ void FDCDialog::writButtonSlot()
 	writCmd();
 }
 
+void FDCDialog::abortButtonSlot()
+{
+	abort.cancel();
+}
+
+void FDCDialog::editButtonSlot()
+{
+	editCmd();
+}
+
+void FDCDialog::flushButtonSlot()
+{
+	flushCmd(0);
+}
+
+//
+// Edits go back before the dialog closes
+//
+void FDCDialog::done(int r)
+{
+	if (busy) {
+		return;
+	}
+
+	if (writeBack->dirtyTracks()) {
+		flushCmd(0);
+	}
+
+	if (writeBack->dirtyTracks() && QMessageBox::question(this,
+		"Write-back Error",
+		QString(tr("%1 edited tracks could not be written back. Close and lose them?")).arg(writeBack->dirtyTracks())) != QMessageBox::Yes) {
+		return;
+	}
+
+	QDialog::done(r);
+}
+
 void FDCDialog::timerSlot()
 {
-	if (!serialPort->isOpen()) {
+	if (!link->isOpen() || busy) {
 		return;
 	}
 
 	if (statAutoCheck->isChecked()) {
 		statCmd();
 	}
+
+	if (flushAutoCheck->isChecked() && writeBack->dirtyTracks()) {
+		flushCmd(WB_FLUSH_AGE * 1000000LL);
+	}
 }
 
-void FDCDialog::updateSerialPort()
+//
+// Reopen the link with the port, baud rate and backend selected. Held
+// tracks may be another server's after this, so what was edited is
+// written back through the old link first and the buffer emptied. Returns
+// false, changing nothing, if edits could not be written back and are
+// to be kept.
+//
+bool FDCDialog::updateSerialPort()
 {
-	if (serialPort->isOpen()) {
-		serialPort->clear();
-		serialPort->close();
-	}
+	flushCmd(0);
 
-	if (serialPortBox->currentIndex() == -1) {
-		return;
+	if (writeBack->dirtyTracks() && QMessageBox::question(this,
+		"Write-back Error",
+		QString(tr("%1 edited tracks could not be written back. Change the port and lose them?")).arg(writeBack->dirtyTracks())) != QMessageBox::Yes) {
+		return false;
 	}
 
-	if (serialPort->open(QIODevice::ReadWrite)) {
-		if (serialPort->setBaudRate(baudRate) == false) {
-			QMessageBox::critical(this,
-				"Serial Port Error",
-				QString("Could not set baudrate to %1").arg(baudRate));
-		}
-		serialPort->setDataBits(QSerialPort::Data8);
-		serialPort->setParity(QSerialPort::NoParity);
-		serialPort->setStopBits(QSerialPort::OneStop);
-		serialPort->setFlowControl(QSerialPort::NoFlowControl);
-		serialPort->setDataTerminalReady(true);
-		serialPort->setRequestToSend(true);
-		serialPort->clear();
+	writeBack->close();
+	link->close();
+	cache->close();
+
+	if ((portIndex = serialPortBox->currentIndex()) == -1) {
+		return true;
 	}
-	else {
+
+	if (!link->open(serialPortBox->currentText(), baudRate, backend)) {
 		QMessageBox::critical(this,
 			"Serial Port Error",
-			QString("Could not open serial port '%1' (%2)").arg(serialPort->portName()).arg(serialPort->error()));
+			link->errorString());
 		serialPortBox->setCurrentIndex(-1);
 	}
+
+	openCache();
+
+	return true;
 }
 
-void FDCDialog::statCmd()
+//
+// The cache file for the server on the selected port and the disk type
+//
+void FDCDialog::openCache()
 {
-        qint64 bytesAvail;
-	int d;
-
-	if (!serialPort->isOpen()) {
-		QMessageBox::critical(this,
-			"Serial Port Error",
-			QString(tr("Serial port not open")));
+	cache->close();
 
+	if (!qEnvironmentVariableIsSet("FDC_TRACK_CACHE") || !link->isOpen()) {
 		return;
 	}
 
-	cmdBuf.command[0] = 'S';
-	cmdBuf.command[1] = 'T';
-	cmdBuf.command[2] = 'A';
-	cmdBuf.command[3] = 'T';
+	if (!cache->open(qEnvironmentVariable("FDC_TRACK_CACHE"), serialPortBox->currentText(), trackMax, trackLen)) {
+		messageLabel->setText(cache->errorString());
+	}
+}
 
-	cmdBuf.param1 = driveNum;	// MSB head load, LSB drive number
+//
+// Events are processed while a transaction runs, so everything that could
+// start another one or pull the port from under it is disabled until it is
+// done. Returns false if a transaction is already running.
+//
+bool FDCDialog::setBusy(bool state)
+{
+	if (state && busy) {
+		return false;
+	}
 
-	for (d = 0; d < MAX_DRIVE; d++) {
-		cmdBuf.param1 |= (headStatus[d] != 0)  << d;
+	busy = state;
+
+	if (state) {
+		abort.reset();
 	}
 
-	cmdBuf.param2 = 0;		// Track Number
+	statButton->setEnabled(!state && !statAutoCheck->isChecked());
+	readButton->setEnabled(!state);
+	writButton->setEnabled(!state);
+	editButton->setEnabled(!state);
+	flushButton->setEnabled(!state);
+	abortButton->setEnabled(state);
+	serialPortBox->setEnabled(!state);
+	baudRateBox->setEnabled(!state);
+	backendBox->setEnabled(!state);
+	diskBox->setEnabled(!state);
 
-	cmdBuf.checksum = calcChecksum(cmdBuf.asBytes, COMMAND_LENGTH);
+	return true;
+}
+
+//
+// Time in ms from the last command leaving the wire to its completion
+//
+double FDCDialog::wireTime()
+{
+	return (link->last.tDone - link->last.tSent) / 1e6;
+}
+
+//
+// Report transport and framing errors common to all commands. Returns true
+// if the transaction did not complete.
+//
+bool FDCDialog::linkError(int result)
+{
+	switch (result) {
+		case LINK_OK:
+			return false;
+
+		case LINK_NOT_OPEN:
+			QMessageBox::critical(this,
+				"Serial Port Error",
+				QString(tr("Serial port not open")));
+			break;
+
+		case LINK_IO_ERROR:
+			messageLabel->setText(QString("read() error"));
+			break;
+
+		case LINK_TIMEOUT:
+			messageLabel->setText(QString("Timeout waiting for '%1' response").arg(link->expect));
+			break;
+
+		case LINK_CANCELLED:
+			messageLabel->setText(QString("'%1' aborted").arg(link->expect));
+			break;
+
+		case LINK_BAD_RESPONSE:
+			messageLabel->setText(QString("Did not receive '%1' response '%2'").arg(link->expect).arg(QString::fromLatin1(link->response.command, 4)));
+			break;
+
+		default:
+			return false;
+	}
+
+	return true;
+}
+
+void FDCDialog::statCmd()
+{
+	quint16 param1;
+	int d, e, r, lost;
+
+	param1 = driveNum;	// MSB head load, LSB drive number
+
+	for (d = 0; d < MAX_DRIVE; d++) {
+		param1 |= (headStatus[d] != 0)  << d;
+	}
+
+	if (!setBusy(true)) {
+		return;
+	}
 
-	serialPort->write((char *) cmdBuf.asBytes, CMDBUF_SIZE);
+	r = link->stat(param1, 0, 0, &abort);
 
-	// Wait for STAT response
-	cmdBufIdx = 0;
-	do {
-		bytesAvail = serialPort->waitForReadyRead(500);
-		cmdBufIdx += serialPort->read((char *) &cmdBuf.asBytes[cmdBufIdx], CMDBUF_SIZE-cmdBufIdx);
-	} while (cmdBufIdx < CMDBUF_SIZE && cmdBufIdx != -1);
+	setBusy(false);
 
-	if (cmdBufIdx == -1) {
-		messageLabel->setText(QString("read() error"));
+	if (linkError(r)) {
 		return;
 	}
 
-	if (QString(cmdBuf.command).left(4) != QString("STAT")) {
-		messageLabel->setText(QString("Did not receive 'STAT' response '%1'").arg(QString(cmdBuf.command).left(4)));
+	// A mount or unmount on the server stays up until the next one, even
+	// while auto STAT is polling. Tracks held for editing on that drive
+	// were of the disk that was there before; if the log wrapped since the
+	// last look, any drive could have changed.
+	if (link->mounts.events() != mountEvents) {
+		lost = 0;
+
+		if (link->mounts.events() - mountEvents > MOUNT_LOG_LEN) {
+			for (d = 0; d < MAX_DRIVE; d++) {
+				lost += writeBack->forgetDrive(d);
+			}
+		}
+		else {
+			for (e = mountEvents; e < link->mounts.events(); e++) {
+				lost += writeBack->forgetDrive(link->mounts.event(e).drive);
+			}
+		}
+
+		mountEvents = link->mounts.events();
+
+		if (lost) {
+			messageLabel->setText(QString("Server %1, %2 edited tracks lost").arg(FDCMountWatch::describe(link->mounts.latest())).arg(lost));
+		}
+		else {
+			messageLabel->setText(QString("Server %1").arg(FDCMountWatch::describe(link->mounts.latest())));
+		}
 	}
 	else if (statAutoCheck->isChecked() == false) {
-		messageLabel->setText(QString("Received 'STAT' response 0x%1").arg(cmdBuf.rdata, 4, 16, QChar('0')));
+		messageLabel->setText(QString("Received 'STAT' response 0x%1 (%2 ms)").arg(link->response.rdata, 4, 16, QChar('0')).arg(wireTime(), 0, 'f', 2));
 	}
 }
 
 void FDCDialog::readCmd()
 {
-        qint64 bytesAvail;
-	quint16 checksum;
-	quint16 *p;
+	int r, how;
 
-	if (!serialPort->isOpen()) {
+	if (driveNum < 0 || driveNum >= MAX_DRIVE) {
 		QMessageBox::critical(this,
 			"Serial Port Error",
-			QString(tr("Serial port not open")));
+			QString(tr("Invalid drive number")));
+
+		return;
+	}
 
+	if (!setBusy(true)) {
 		return;
 	}
 
+	// Held tracks come from the cache file once the drive has been checked
+	how = CACHE_MISS;
+	if (cache->isOpen() && trackNum < trackMax) {
+		r = cache->read(link, driveNum, trackNum, trackBuf, &how, &abort);
+	}
+	else {
+		r = link->read(driveNum, trackNum, trackLen, trackBuf, 0, &abort);
+	}
+
+	setBusy(false);
+
+	if (r == LINK_OK && how == CACHE_HIT) {
+		messageLabel->setText(QString("Track from the cache file (generation %1) CRC32C %2").arg(cache->generation(driveNum))
+			.arg(FDCFingerprint::of(trackBuf, trackLen).crc, 8, 16, QChar('0')));
+	}
+	else if (r == LINK_OK) {
+		messageLabel->setText(QString("Received %1 byte track (%2 ms) CRC32C %3").arg(trackLen).arg(wireTime(), 0, 'f', 2)
+			.arg(link->last.print.crc, 8, 16, QChar('0')));
+	}
+	else if (r == LINK_CHECKSUM_ERR) {
+		messageLabel->setText(QString("Received %1 byte track with checksum error").arg(trackLen));
+	}
+	else if (r == LINK_SHORT_TRACK || r == LINK_TIMEOUT) {
+		messageLabel->setText(QString("Received %1 of %2 bytes").arg(link->received).arg(trackLen+2));
+	}
+	else {
+		linkError(r);
+	}
+}
+
+void FDCDialog::writCmd()
+{
+	int r;
+
 	if (driveNum < 0 || driveNum >= MAX_DRIVE) {
 		QMessageBox::critical(this,
 			"Serial Port Error",
@@ -443,176 +769,154 @@ void FDCDialog::readCmd()
 		return;
 	}
 
-	cmdBuf.command[0] = 'R';
-	cmdBuf.command[1] = 'E';
-	cmdBuf.command[2] = 'A';
-	cmdBuf.command[3] = 'D';
-	cmdBuf.param1 = trackNum | (driveNum << 12);
-	cmdBuf.param2 = trackLen;
-
-	cmdBuf.checksum = calcChecksum(cmdBuf.asBytes, COMMAND_LENGTH);
-
-	serialPort->write((char *) cmdBuf.asBytes, CMDBUF_SIZE);
+	if (!setBusy(true)) {
+		return;
+	}
 
-	trkBufIdx = 0;
+	r = link->writ(driveNum, trackNum, trackLen, trackBuf, 0, &abort);
 
-	do {
-		bytesAvail = serialPort->waitForReadyRead(100);
-		trkBufIdx += serialPort->read((char *) &trackBuf[trkBufIdx], TRACKBUF_LEN_CRC-trkBufIdx);
-	} while (trkBufIdx < trackLen + 2 && bytesAvail);
+	setBusy(false);
 
-	if (trkBufIdx == trackLen + 2) {
-		checksum = calcChecksum(trackBuf, TRACKBUF_LEN);
-		p = (quint16 *) &trackBuf[trackLen];
+	if (linkError(r)) {
+		return;
+	}
 
-		messageLabel->setText(QString("Received %1 byte track").arg(trackLen));
+	// The track written replaces any copy held for editing
+	if (link->response.rcode == STAT_OK) {
+		writeBack->forget(driveNum, trackNum);
 	}
-	else if (trkBufIdx == -1) {
-		messageLabel->setText(QString("read() error"));
+
+	if (!strcmp(link->expect, "WRIT")) {
+		messageLabel->setText(QString("Received %1 WSTA response").arg(FDCLink::rcodeString(link->response.rcode)));
 	}
 	else {
-		messageLabel->setText(QString("Received %1 of %2 bytes").arg(trkBufIdx).arg(trackLen+2));
+		messageLabel->setText(QString("Received WSTA %1 response (%2 ms: ack %3, data %4, commit %5, burst position %6)")
+			.arg(FDCLink::rcodeString(link->response.rcode)).arg(wireTime(), 0, 'f', 2)
+			.arg(link->writs.last[WRIT_PHASE_ACK] / 1e6, 0, 'f', 2)
+			.arg(link->writs.last[WRIT_PHASE_DATA] / 1e6, 0, 'f', 2)
+			.arg(link->writs.last[WRIT_PHASE_COMMIT] / 1e6, 0, 'f', 2)
+			.arg(link->writs.burst()));
 	}
 }
 
-void FDCDialog::writCmd()
+//
+// Apply the offset and bytes to the current track's held copy, reading it
+// first if it isn't held. Nothing is written until it is flushed.
+//
+void FDCDialog::editCmd()
 {
-        qint64 bytesAvail;
-	quint16 checksum;
+	QVector<twbedit_t> list;
+	QString error;
+	quint64 before;
+	int r;
 
-	if (!serialPort->isOpen()) {
+	if (driveNum < 0 || driveNum >= MAX_DRIVE) {
 		QMessageBox::critical(this,
 			"Serial Port Error",
-			QString(tr("Serial port not open")));
+			QString(tr("Invalid drive number")));
 
 		return;
 	}
 
-	if (driveNum < 0 || driveNum >= MAX_DRIVE) {
-		QMessageBox::critical(this,
-			"Serial Port Error",
-			QString(tr("Invalid drive number")));
+	if (!writeBack->isOpen() && !writeBack->create(trackMax, trackLen)) {
+		QMessageBox::warning(this, "Memory Limit Error", writeBack->errorString());
+		return;
+	}
 
+	if (!FDCWriteBack::parseEdits(QString("%1:%2=%3").arg(trackNum).arg(editWhereEdit->text()).arg(editBytesEdit->text()), trackMax, trackLen, &list, &error)) {
+		messageLabel->setText(error);
 		return;
 	}
 
-	cmdBuf.command[0] = 'W';
-	cmdBuf.command[1] = 'R';
-	cmdBuf.command[2] = 'I';
-	cmdBuf.command[3] = 'T';
-	cmdBuf.param1 = trackNum | (driveNum << 12);
-	cmdBuf.param2 = trackLen;
+	if (!setBusy(true)) {
+		return;
+	}
 
-	cmdBuf.checksum = calcChecksum(cmdBuf.asBytes, COMMAND_LENGTH);
+	before = writeBack->changed;
 
-	serialPort->write((char *) cmdBuf.asBytes, CMDBUF_SIZE);
+	r = writeBack->edit(driveNum, trackNum, list[0].offset, (const quint8 *) list[0].bytes.constData(), list[0].bytes.size(), &abort);
 
-	// Wait for WRIT response
-	cmdBufIdx = 0;
-	do {
-		bytesAvail = serialPort->waitForReadyRead(500);
-		cmdBufIdx += serialPort->read((char *) &cmdBuf.asBytes[cmdBufIdx], CMDBUF_SIZE-cmdBufIdx);
-	} while (cmdBufIdx < CMDBUF_SIZE && cmdBufIdx != -1);
+	setBusy(false);
 
-	if (cmdBufIdx == -1) {
-		messageLabel->setText(QString("read() error"));
+	if (r == LINK_CHECKSUM_ERR || r == LINK_SHORT_TRACK) {
+		messageLabel->setText(QString("Track could not be read to edit"));
 		return;
 	}
 
-	if (QString(cmdBuf.command).left(4) != QString("WRIT")) {
-		messageLabel->setText(QString("Did not receive 'WRIT' response '%1'").arg(QString(cmdBuf.command).left(4)));
+	if (linkError(r)) {
 		return;
 	}
 
-	if (cmdBuf.rcode == STAT_OK) {
-		checksum = calcChecksum(trackBuf, trackLen);
-		trackBuf[trackLen] = checksum & 0x00ff;                 // LSB of checksum
-		trackBuf[trackLen+1] = (checksum >> 8) & 0x00ff;        // MSB of checksum
+	const twbtrack_t &t = writeBack->state(driveNum, trackNum);
 
-		serialPort->write((char *) trackBuf, trackLen + 2);
+	if (t.dirty) {
+		messageLabel->setText(QString("Sector %1+%2: %3 bytes changed, %4 edits held for bytes 0x%5-0x%6, %7 tracks to write back")
+			.arg(list[0].offset / WB_SECTOR_LEN).arg(list[0].offset % WB_SECTOR_LEN).arg(writeBack->changed - before)
+			.arg(t.edits).arg(t.lo, 4, 16, QChar('0')).arg(t.hi - 1, 4, 16, QChar('0')).arg(writeBack->dirtyTracks()));
 	}
 	else {
-		messageLabel->setText(QString("Received "));
-		switch (cmdBuf.rcode) {
-			case STAT_NOT_READY:
-				messageLabel->setText(messageLabel->text() + QString("NOT READY"));
-				break;
-			case STAT_CHECKSUM_ERR:
-				messageLabel->setText(messageLabel->text() + QString("CHECKSUM ERROR"));
-				break;
-			case STAT_WRITE_ERR:
-				messageLabel->setText(messageLabel->text() + QString("WRITE ERROR"));
-				break;
-			default:
-				messageLabel->setText(messageLabel->text() + QString("UNKNOWN"));
-				break;
-		}
-		messageLabel->setText(messageLabel->text() + QString(" WSTA response"));
-
-		return;
+		messageLabel->setText(QString("Sector %1+%2: no change").arg(list[0].offset / WB_SECTOR_LEN).arg(list[0].offset % WB_SECTOR_LEN));
 	}
+}
 
-	// Wait for WSTA response
-	cmdBufIdx = 0;
-	do {
-		bytesAvail = serialPort->waitForReadyRead(500);
-		cmdBufIdx += serialPort->read((char *) &cmdBuf.asBytes[cmdBufIdx], CMDBUF_SIZE-cmdBufIdx);
-	} while (cmdBufIdx < CMDBUF_SIZE && cmdBufIdx != -1);
+//
+// One WRIT per track dirty for at least age ns
+//
+void FDCDialog::flushCmd(qint64 age)
+{
+	quint64 before;
+	int r;
 
-	if (cmdBufIdx == -1) {
-		messageLabel->setText(QString("read() error"));
+	if (!writeBack->isOpen() || !writeBack->dirtyTracks()) {
 		return;
 	}
 
-	if (QString(cmdBuf.command).left(4) != QString("WSTA")) {
-		messageLabel->setText(QString("Did not receive 'WSTA' response '%1'").arg(QString(cmdBuf.command).left(4)));
-	}
-	else {
-		messageLabel->setText(QString("Received WSTA "));
-		switch (cmdBuf.rcode) {
-			case STAT_OK:
-				messageLabel->setText(messageLabel->text() + QString("OK"));
-				break;
-			case STAT_NOT_READY:
-				messageLabel->setText(messageLabel->text() + QString("NOT READY"));
-				break;
-			case STAT_CHECKSUM_ERR:
-				messageLabel->setText(messageLabel->text() + QString("CHECKSUM ERROR"));
-				break;
-			case STAT_WRITE_ERR:
-				messageLabel->setText(messageLabel->text() + QString("WRITE ERROR"));
-				break;
-			default:
-				messageLabel->setText(messageLabel->text() + QString("UNKNOWN"));
-				break;
-		}
-		messageLabel->setText(messageLabel->text() + QString(" response"));
-
+	if (!setBusy(true)) {
 		return;
 	}
-}
 
-quint16 FDCDialog::calcChecksum(const quint8 *data, int length)
-{
-	int i;
-	quint16 checksum;
+	before = writeBack->writs;
 
-	checksum = 0;
+	r = writeBack->flushAll(age, &abort);
 
-	for (i = 0; i < length; i++) {
-		checksum += data[i];
+	setBusy(false);
+
+	if (linkError(r)) {
+		return;
 	}
 
-	return checksum;
+	// Tracks the server refused stay dirty for the next flush
+	if (age == 0 && writeBack->dirtyTracks()) {
+		messageLabel->setText(QString("Wrote back %1 tracks, %2 refused (last WSTA %3)")
+			.arg(writeBack->writs - before).arg(writeBack->dirtyTracks()).arg(FDCLink::rcodeString(link->response.rcode)));
+	}
+	else if (writeBack->writs != before) {
+		messageLabel->setText(QString("Wrote back %1 tracks").arg(writeBack->writs - before));
+	}
 }
 
 int main(int argc, char **argv)
 {
+	int r;
+
+	FDCStartup::begin(argc, argv);
+
+	if (cliHeadless(argc, argv)) {
+		r = cliMain(argc, argv);
+		FDCStartup::finish();
+		return r;
+	}
+
 	QApplication app(argc, argv);
+	FDCStartup::mark("QApplication");
 	app.setStyle(QStyleFactory::create("Fusion"));
 	FDCDialog *dialog = new FDCDialog;
+	FDCStartup::mark("dialog");
 	dialog->show();
-	return app.exec();
+	FDCStartup::mark("show");
+	r = app.exec();
+	FDCStartup::finish();
+	return r;
 }
 
 
@@ -8,6 +8,9 @@ INCLUDEPATH += .
 QT += core
 QT += widgets
 QT += serialport
+unix:!macx: LIBS += -lrt
+CONFIG += c++2a
+*-g++*: QMAKE_CXXFLAGS += -fcoroutines
 
 # You can make your code fail to compile if you use deprecated APIs.
 # In order to do so, uncomment the following line.
@@ -18,7 +21,63 @@ QT += serialport
 
 # Input
 SOURCES += fdc-sim-gui.cpp
+SOURCES += fdc-serial.cpp
+SOURCES += fdc-link.cpp
+SOURCES += fdc-cli.cpp
+SOURCES += fdc-bench.cpp
+SOURCES += fdc-metrics.cpp
+SOURCES += fdc-shm.cpp
+SOURCES += fdc-monitor.cpp
+SOURCES += fdc-capture.cpp
+SOURCES += fdc-model.cpp
+SOURCES += fdc-clock.cpp
+SOURCES += fdc-fingerprint.cpp
+SOURCES += fdc-store.cpp
+SOURCES += fdc-memory.cpp
+SOURCES += fdc-mount.cpp
+SOURCES += fdc-writ.cpp
+SOURCES += fdc-boot.cpp
+SOURCES += fdc-stress.cpp
+SOURCES += fdc-feed.cpp
+SOURCES += fdc-writeback.cpp
+SOURCES += fdc-startup.cpp
+SOURCES += fdc-cache.cpp
+SOURCES += fdc-import.cpp
+SOURCES += fdc-arrow.cpp
+SOURCES += fdc-top.cpp
+SOURCES += fdc-merkle.cpp
+linux: SOURCES += fdc-engine.cpp
+linux: SOURCES += fdc-workload.cpp
+linux: SOURCES += fdc-knee.cpp
+linux: SOURCES += fdc-open.cpp
 
 HEADERS += fdc-sim-gui.h
-HEADERS += grnled.xpm
-HEADERS += redled.xpm
+HEADERS += fdc-serial.h
+HEADERS += fdc-link.h
+HEADERS += fdc-cli.h
+HEADERS += fdc-bench.h
+HEADERS += fdc-metrics.h
+HEADERS += fdc-shm.h
+HEADERS += fdc-monitor.h
+HEADERS += fdc-capture.h
+HEADERS += fdc-model.h
+HEADERS += fdc-clock.h
+HEADERS += fdc-fingerprint.h
+HEADERS += fdc-store.h
+HEADERS += fdc-memory.h
+HEADERS += fdc-mount.h
+HEADERS += fdc-writ.h
+HEADERS += fdc-boot.h
+HEADERS += fdc-stress.h
+HEADERS += fdc-feed.h
+HEADERS += fdc-writeback.h
+HEADERS += fdc-startup.h
+HEADERS += fdc-cache.h
+HEADERS += fdc-import.h
+HEADERS += fdc-arrow.h
+HEADERS += fdc-top.h
+HEADERS += fdc-merkle.h
+linux: HEADERS += fdc-engine.h
+linux: HEADERS += fdc-workload.h
+linux: HEADERS += fdc-knee.h
+linux: HEADERS += fdc-open.h
@@ -0,0 +1,108 @@
+/**********************************************************************************
+*
+*  Startup profile for the FDC+ Serial Drive Simulator
+*
+*  Where the time goes between main() and being able to send a command:
+*
+*      fdc-sim-gui --bench-serial --port ttyUSB0 --startup-profile
+*      fdc-sim-gui --startup-profile
+*
+*  Headless commands are ready when the first command is about to go out;
+*  the dialog when it is shown and its event loop is running. Anything that
+*  isn't needed by then (serial port enumeration, the write-back store, CRC
+*  tables) is built on first use instead.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+
+#include <string.h>
+
+#include "fdc-startup.h"
+#include "fdc-metrics.h"
+
+bool FDCStartup::profile = false;
+int FDCStartup::count = 0;
+tstartupmark_t FDCStartup::marks[STARTUP_MARKS];
+std::mutex FDCStartup::marksLock;
+std::atomic<bool> FDCStartup::isReady(false);
+std::atomic<bool> FDCStartup::reported(false);
+
+void FDCStartup::begin(int argc, char **argv)
+{
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--startup-profile")) {
+			profile = true;
+		}
+	}
+
+	count = 0;
+	mark("main");
+}
+
+void FDCStartup::mark(const char *phase)
+{
+	std::lock_guard<std::mutex> lock(marksLock);
+
+	if (count < STARTUP_MARKS && !isReady.load(std::memory_order_relaxed)) {
+		marks[count].phase = phase;
+		marks[count].t = fdcNow();
+		count++;
+	}
+}
+
+//
+// First command about to go out, or the dialog taking input
+//
+void FDCStartup::markReady()
+{
+	if (isReady.exchange(true)) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(marksLock);
+
+		if (count < STARTUP_MARKS) {
+			marks[count].phase = "ready";
+			marks[count].t = fdcNow();
+			count++;
+		}
+	}
+
+	finish();
+}
+
+//
+// Print the profile once, at ready or on the way out if nothing was sent
+//
+void FDCStartup::finish()
+{
+	if (!profile || reported.exchange(true)) {
+		return;
+	}
+
+	QTextStream err(stderr);
+
+	err << report();
+	err.flush();
+}
+
+QString FDCStartup::report()
+{
+	std::lock_guard<std::mutex> lock(marksLock);
+	QString s;
+	int i;
+
+	s = QString("Startup profile%1\n").arg((isReady) ? "" : " (no command sent)");
+
+	for (i = 0; i < count; i++) {
+		s += QString("  %1 %2 ms  +%3 ms\n").arg(marks[i].phase, -20)
+			.arg((marks[i].t - marks[0].t) / 1e6, 8, 'f', 3)
+			.arg((i) ? (marks[i].t - marks[i - 1].t) / 1e6 : 0.0, 0, 'f', 3);
+	}
+
+	return s;
+}
@@ -0,0 +1,45 @@
+#ifndef FDCSTARTUP_H
+#define FDCSTARTUP_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include <atomic>
+#include <mutex>
+
+#define STARTUP_MARKS		32			// phases kept, later ones are dropped
+
+typedef struct TSTARTUPMARK {
+	const char *phase;
+	qint64 t;				// fdcNow() ns
+} tstartupmark_t;
+
+//
+// Startup phase timing from main() to ready to send the first command,
+// printed to stderr with --startup-profile. Phases are marked on the main
+// thread as startup goes; ready() is called by the link or client about to
+// send, on any thread, and only the first call counts. The marks are kept
+// under a lock, since the engine thread's ready can race the main thread.
+//
+class FDCStartup
+{
+public:
+	static void begin(int argc, char **argv);
+	static void mark(const char *phase);
+	static void ready(void) { if (!isReady.load(std::memory_order_relaxed)) { markReady(); } }
+	static void finish(void);
+	static bool enabled(void) { return profile; }
+	static QString report(void);
+
+private:
+	static bool profile;
+	static int count;
+	static tstartupmark_t marks[STARTUP_MARKS];
+	static std::mutex marksLock;
+	static std::atomic<bool> isReady;
+	static std::atomic<bool> reported;
+
+	static void markReady(void);
+};
+
+#endif
@@ -0,0 +1,236 @@
+/**********************************************************************************
+*
+*  Resident track store for the FDC+ Serial Drive Simulator
+*
+*  One anonymous mapping holds every track of every disk. With THP the
+*  mapping is aligned to a huge page and madvise()d before it is first
+*  touched so the kernel backs it with huge pages at fault time; with
+*  hugetlb it comes from the pool reserved in /proc/sys/vm/nr_hugepages.
+*  Disk images are copied in rather than mapped: page cache pages of an
+*  ordinary file are never huge.
+*
+*  What the kernel actually did is read back from /proc/self/smaps.
+*
+***********************************************************************************/
+
+#include "fdc-store.h"
+#include "fdc-memory.h"
+
+#include <QFile>
+#include <QStringList>
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+FDCTrackStore::FDCTrackStore()
+{
+	base = NULL;
+	mapped = 0;
+	count = 0;
+	tracks = 0;
+	length = 0;
+	got = STORE_PAGES_NORMAL;
+}
+
+FDCTrackStore::~FDCTrackStore()
+{
+	close();
+}
+
+bool FDCTrackStore::create(int disks, quint16 trackMax, quint16 trackLen, int pages)
+{
+	size_t rounded;
+	void *p;
+
+	close();
+
+	count = disks;
+	tracks = trackMax;
+	length = trackLen;
+	rounded = (size() + STORE_HUGE_PAGE - 1) & ~((size_t) STORE_HUGE_PAGE - 1);
+
+	if (!FDCMemory::reserve(MEM_STORE, rounded)) {
+		lastError = QString("%1 disks need %2 MB, over the store budget of %3 MB")
+			.arg(disks).arg(rounded >> 20).arg(FDCMemory::limit(MEM_STORE) >> 20);
+		count = 0;
+		return false;
+	}
+
+#ifdef Q_OS_UNIX
+#ifdef Q_OS_LINUX
+	if (pages == STORE_PAGES_HUGETLB) {
+		p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+
+		if (p != MAP_FAILED) {
+			base = (quint8 *) p;
+			mapped = rounded;
+			got = STORE_PAGES_HUGETLB;
+			return true;
+		}
+
+		// No pool reserved, or not enough left in it
+		pages = STORE_PAGES_THP;
+	}
+
+	if (pages == STORE_PAGES_THP) {
+		quintptr start, aligned;
+
+		// One huge page extra so the store can start on a boundary
+		if ((p = mmap(NULL, rounded + STORE_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+			lastError = QString("mmap: %1").arg(strerror(errno));
+			FDCMemory::release(MEM_STORE, rounded);
+			count = 0;
+			return false;
+		}
+
+		start = (quintptr) p;
+		aligned = (start + STORE_HUGE_PAGE - 1) & ~((quintptr) STORE_HUGE_PAGE - 1);
+
+		if (aligned > start) {
+			munmap(p, aligned - start);
+		}
+		if (start + STORE_HUGE_PAGE > aligned) {
+			munmap((void *) (aligned + rounded), start + STORE_HUGE_PAGE - aligned);
+		}
+
+		base = (quint8 *) aligned;
+		mapped = rounded;
+		got = (madvise(base, mapped, MADV_HUGEPAGE) == 0) ? STORE_PAGES_THP : STORE_PAGES_NORMAL;
+
+		// Fault it all in now, while the advice is fresh and memory is there
+		memset(base, 0, mapped);
+
+		return true;
+	}
+#endif
+
+	if ((p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		lastError = QString("mmap: %1").arg(strerror(errno));
+		FDCMemory::release(MEM_STORE, rounded);
+		count = 0;
+		return false;
+	}
+
+	base = (quint8 *) p;
+	mapped = rounded;
+	got = STORE_PAGES_NORMAL;
+
+#ifdef Q_OS_LINUX
+	// Base pages even when THP is set to always, so comparisons are fair
+	madvise(base, mapped, MADV_NOHUGEPAGE);
+#endif
+
+	memset(base, 0, mapped);
+#else
+	Q_UNUSED(pages);
+
+	if ((base = (quint8 *) calloc(1, rounded)) == NULL) {
+		lastError = QString("Out of memory");
+		FDCMemory::release(MEM_STORE, rounded);
+		count = 0;
+		return false;
+	}
+
+	mapped = rounded;
+	got = STORE_PAGES_NORMAL;
+#endif
+
+	return true;
+}
+
+void FDCTrackStore::close()
+{
+	if (base != NULL) {
+#ifdef Q_OS_UNIX
+		munmap(base, mapped);
+#else
+		free(base);
+#endif
+		FDCMemory::release(MEM_STORE, mapped);
+	}
+
+	base = NULL;
+	mapped = 0;
+	count = 0;
+	got = STORE_PAGES_NORMAL;
+}
+
+//
+// Bytes of the store backed by huge pages, from the smaps entries that
+// overlap it
+//
+qint64 FDCTrackStore::hugeBytes() const
+{
+	QFile smaps("/proc/self/smaps");
+	QList<QByteArray> fields;
+	QByteArray line;
+	quintptr start, end, from, to;
+	qint64 bytes, kb;
+	bool inside, ok;
+
+	if (base == NULL || !smaps.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+
+	bytes = 0;
+	inside = false;
+	from = (quintptr) base;
+	to = from + mapped;
+
+	while (!(line = smaps.readLine()).isEmpty()) {
+		fields = line.simplified().split(' ');
+
+		// Mapping header: start-end perms offset dev inode [path]
+		if (fields[0].contains('-') && !fields[0].endsWith(':')) {
+			start = fields[0].split('-')[0].toULongLong(&ok, 16);
+			end = fields[0].split('-')[1].toULongLong(&ok, 16);
+			inside = (start < to && end > from);
+			continue;
+		}
+
+		if (!inside || fields.size() < 2) {
+			continue;
+		}
+
+		if (fields[0] == "AnonHugePages:" || fields[0] == "Private_Hugetlb:" || fields[0] == "Shared_Hugetlb:") {
+			kb = fields[1].toLongLong();
+			bytes += kb * 1024;
+		}
+	}
+
+	return qMin(bytes, (qint64) mapped);
+}
+
+QString FDCTrackStore::pagesName(int pages)
+{
+	switch (pages) {
+		case STORE_PAGES_THP:
+			return "thp";
+
+		case STORE_PAGES_HUGETLB:
+			return "hugetlb";
+
+		default:
+			return "normal";
+	}
+}
+
+int FDCTrackStore::pagesFromName(const QString &name)
+{
+	if (name == "normal") {
+		return STORE_PAGES_NORMAL;
+	}
+	else if (name == "thp") {
+		return STORE_PAGES_THP;
+	}
+	else if (name == "hugetlb") {
+		return STORE_PAGES_HUGETLB;
+	}
+
+	return -1;
+}
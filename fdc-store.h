@@ -0,0 +1,55 @@
+#ifndef FDCSTORE_H
+#define FDCSTORE_H
+
+#include <QtGlobal>
+#include <QString>
+
+#define STORE_PAGES_NORMAL	0			// base pages
+#define STORE_PAGES_THP		1			// transparent huge pages, madvise()
+#define STORE_PAGES_HUGETLB	2			// MAP_HUGETLB from the reserved pool
+#define STORE_HUGE_PAGE		(2 * 1024 * 1024)
+
+//
+// Resident track data for many disks in one anonymous mapping, track t of
+// disk d at (d * trackMax + t) * trackLen. Asking for huge pages cuts the TLB
+// misses a bulk verify or diff takes on every few KB; if the pool or the
+// kernel can't supply them the store falls back a step (hugetlb to THP to
+// base pages) and reports what it actually got. The mapping counts against
+// the MEM_STORE budget.
+//
+class FDCTrackStore
+{
+public:
+	FDCTrackStore();
+	~FDCTrackStore();
+
+	bool create(int disks, quint16 trackMax, quint16 trackLen, int pages = STORE_PAGES_NORMAL);
+	void close(void);
+	bool isOpen(void) const { return base != NULL; }
+	QString errorString(void) const { return lastError; }
+
+	quint8 *track(int disk, quint16 track) const { return base + ((qint64) disk * tracks + track) * length; }
+	quint8 *disk(int disk) const { return track(disk, 0); }
+	int disks(void) const { return count; }
+	quint16 trackMax(void) const { return tracks; }
+	quint16 trackLen(void) const { return length; }
+	qint64 diskSize(void) const { return (qint64) tracks * length; }
+	qint64 size(void) const { return (qint64) count * diskSize(); }
+
+	int pages(void) const { return got; }
+	qint64 hugeBytes(void) const;
+
+	static QString pagesName(int pages);
+	static int pagesFromName(const QString &name);
+
+private:
+	quint8 *base;
+	size_t mapped;
+	int count;
+	quint16 tracks;
+	quint16 length;
+	int got;
+	QString lastError;
+};
+
+#endif
@@ -0,0 +1,347 @@
+/**********************************************************************************
+*
+*  Mixed load stress with a shadow oracle for the FDC+ Serial Drive Simulator
+*
+*  Random READs and WRITs across every mounted drive, back to back, with a
+*  copy in memory of what each track must hold. Every READ is checked
+*  against it, so a server that caches writes to go faster is caught the
+*  moment it returns a stale track or loses one:
+*
+*      fdc-sim-gui --stress --port ttyUSB0 --ops 100000 --writes 30 --tracks 8
+*
+*  Every track written carries a stamp (drive, track, version) so a bad READ
+*  says what it got instead. Fewer --tracks makes each track hotter. The
+*  tracks are written with random data; the originals are written back at
+*  the end, also when the run is stopped early with Ctrl-C.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QVector>
+#include <QRandomGenerator>
+
+#include <string.h>
+#include <signal.h>
+
+#include "fdc-stress.h"
+#include "fdc-link.h"
+#include "fdc-store.h"
+
+static const char *kindNames[STRESS_KINDS] = { "lost write", "stale read", "misdirected", "corrupt" };
+
+// Ctrl-C ends the run early, the tracks are still put back
+static std::atomic<bool> interrupted;
+
+static void interruptHandler(int)
+{
+	interrupted = true;
+}
+
+//
+// Version v of a track: stamp, then a pattern from the seed and version
+//
+static void fillTrack(quint8 *buf, quint16 length, quint8 drive, quint16 track, quint32 version, quint64 seed)
+{
+	quint64 x;
+	int i;
+
+	x = seed ^ ((quint64) drive << 56) ^ ((quint64) track << 32) ^ version;
+	x = (x) ? x : 1;
+
+	for (i = 0; i < length; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		buf[i] = x;
+	}
+
+	qToLittleEndian<quint32>(STRESS_MAGIC, buf);
+	qToLittleEndian<quint16>(drive, buf + 4);
+	qToLittleEndian<quint16>(track, buf + 6);
+	qToLittleEndian<quint32>(version, buf + 8);
+}
+
+//
+// The stamp of a track the run wrote, false (and all 0) if it has none
+//
+static bool readStamp(const quint8 *buf, quint8 *drive, quint16 *track, quint32 *version)
+{
+	if (qFromLittleEndian<quint32>(buf) != STRESS_MAGIC) {
+		*drive = 0;
+		*track = 0;
+		*version = 0;
+		return false;
+	}
+
+	*drive = qFromLittleEndian<quint16>(buf + 4);
+	*track = qFromLittleEndian<quint16>(buf + 6);
+	*version = qFromLittleEndian<quint32>(buf + 8);
+
+	return true;
+}
+
+int runStress(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCTrackStore shadow, original;
+	FDCFeed feed;
+	QVector<tstresstrack_t> tracks;
+	QVector<quint8> drives;
+	quint8 trackBuf[TRACKBUF_LEN_CRC];
+	quint8 writeBuf[TRACKBUF_LEN_CRC];
+	QRandomGenerator rng;
+	FDCHistogram commit;
+	struct sigaction sa, oldSa;
+	quint64 violations[STRESS_KINDS];
+	quint64 reads, writes, inDoubt, errors, shown;
+	quint16 mounted, track, stampTrack;
+	quint32 seed, version, next;
+	quint8 drive, stampDrive;
+	qint64 op, start, elapsed, tRead, latency;
+	int d, kind, pages, restored, restoreErrors;
+	bool stamped;
+
+	seed = (opts.seed) ? opts.seed : QRandomGenerator::global()->generate();
+	rng.seed(seed);
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	if (!opts.feedName.isEmpty()) {
+		if (!feed.create(opts.feedName, link.serial()->name(), opts.portName, opts.baudRate)) {
+			out << feed.errorString() << "\n";
+			return 1;
+		}
+		link.setFeed(&feed);
+	}
+
+	mounted = link.response.rdata;
+
+	for (d = 0; d < MAX_DRIVE; d++) {
+		if (mounted & (1 << d)) {
+			drives.append(d);
+		}
+	}
+
+	if (drives.isEmpty()) {
+		out << "No drives mounted\n";
+		return 1;
+	}
+
+	pages = (opts.pages != -1) ? opts.pages : STORE_PAGES_NORMAL;
+
+	if (!shadow.create(MAX_DRIVE, opts.trackMax, opts.trackLen, pages) || !original.create(MAX_DRIVE, opts.trackMax, opts.trackLen, pages)) {
+		out << ((shadow.isOpen()) ? original.errorString() : shadow.errorString()) << "\n";
+		return 1;
+	}
+
+	// The shadow starts as the tracks are now, kept to be put back
+	tracks.resize(MAX_DRIVE * opts.trackMax);
+	memset(tracks.data(), 0, tracks.size() * sizeof(tstresstrack_t));
+
+	for (d = 0; d < drives.size(); d++) {
+		drive = drives[d];
+		for (track = 0; track < opts.trackMax; track++) {
+			if (link.read(drive, track, opts.trackLen, trackBuf) != LINK_OK) {
+				out << QString("Drive %1 track %2 can't be read before the run\n").arg(drive).arg(track);
+				return 1;
+			}
+			memcpy(original.track(drive, track), trackBuf, opts.trackLen);
+			memcpy(shadow.track(drive, track), trackBuf, opts.trackLen);
+		}
+	}
+
+	out << QString("%1 ops over drives").arg(opts.ops);
+	for (d = 0; d < drives.size(); d++) {
+		out << " " << drives[d];
+	}
+	out << QString(", %1 tracks each, %2% WRIT, seed %3").arg(opts.trackMax).arg(opts.writePercent).arg(seed);
+	if (opts.pages != -1) {
+		out << QString(", shadow on %1 pages").arg(FDCTrackStore::pagesName(shadow.pages()));
+	}
+	out << "\n";
+	out.flush();
+
+	memset(violations, 0, sizeof(violations));
+	reads = writes = inDoubt = errors = shown = 0;
+	link.metrics.reset();
+
+	interrupted = false;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldSa);
+
+	start = fdcNow();
+
+	for (op = 0; op < opts.ops && !interrupted; op++) {
+		drive = drives[rng.bounded((int) drives.size())];
+		track = rng.bounded((int) opts.trackMax);
+		tstresstrack_t &t = tracks[drive * opts.trackMax + track];
+
+		if ((int) rng.bounded(100) < opts.writePercent) {
+			next = ++t.written;
+			fillTrack(writeBuf, opts.trackLen, drive, track, next, seed);
+			writes++;
+
+			if (link.writ(drive, track, opts.trackLen, writeBuf) == LINK_OK && link.response.rcode == STAT_OK) {
+				memcpy(shadow.track(drive, track), writeBuf, opts.trackLen);
+				t.version = next;
+				t.pending = 0;
+				t.tWritten = link.last.tDone;
+				t.op = op;
+				t.commit = link.writs.last[WRIT_PHASE_COMMIT];
+			}
+			else {
+				// Refused or given up on: a READ says whether it landed. Every
+				// version in doubt since the last acknowledged one may have
+				if (!t.pending) {
+					t.pending = next;
+				}
+				errors++;
+				inDoubt++;
+			}
+			continue;
+		}
+
+		reads++;
+
+		if (link.read(drive, track, opts.trackLen, trackBuf) != LINK_OK) {
+			errors++;
+			continue;
+		}
+
+		tRead = link.last.tDone;
+		latency = link.last.tDone - link.last.tSent;
+
+		if (!memcmp(trackBuf, shadow.track(drive, track), opts.trackLen)) {
+			t.pending = 0;
+			continue;
+		}
+
+		// One of the WRITs in doubt did land; later ones still may
+		if (t.pending && readStamp(trackBuf, &stampDrive, &stampTrack, &version)
+			&& stampDrive == drive && stampTrack == track && version >= t.pending && version <= t.written) {
+			fillTrack(writeBuf, opts.trackLen, drive, track, version, seed);
+			if (!memcmp(trackBuf, writeBuf, opts.trackLen)) {
+				memcpy(shadow.track(drive, track), writeBuf, opts.trackLen);
+				t.version = version;
+				t.pending = (version < t.written) ? version + 1 : 0;
+				continue;
+			}
+		}
+
+		stamped = readStamp(trackBuf, &stampDrive, &stampTrack, &version);
+
+		if ((stamped && stampDrive == drive && stampTrack == track && version < t.version)
+			|| (!stamped && t.version && !memcmp(trackBuf, original.track(drive, track), opts.trackLen))) {
+			// An older version: gone for good unless a re-read has the right one
+			kind = STRESS_LOST;
+			if (link.read(drive, track, opts.trackLen, writeBuf) == LINK_OK && !memcmp(writeBuf, shadow.track(drive, track), opts.trackLen)) {
+				kind = STRESS_STALE;
+			}
+		}
+		else if (stamped && (stampDrive != drive || stampTrack != track)) {
+			kind = STRESS_MISDIRECTED;
+		}
+		else {
+			kind = STRESS_CORRUPT;
+		}
+
+		violations[kind]++;
+
+		if (shown++ < STRESS_SHOW) {
+			out << QString("op %1 drive %2 track %3: %4, read ").arg(op).arg(drive).arg(track).arg(kindNames[kind]);
+
+			if (stamped) {
+				out << QString("drive %1 track %2 version %3").arg(stampDrive).arg(stampTrack).arg(version);
+			}
+			else if (!memcmp(trackBuf, original.track(drive, track), opts.trackLen)) {
+				out << "the original track";
+			}
+			else {
+				out << "unrecognised data";
+			}
+
+			out << QString(" in %1 ms, expected version %2").arg(latency / 1e6, 0, 'f', 2).arg(t.version);
+
+			if (t.version) {
+				out << QString(" written %1 ops (%2 ms) before, commit %3 ms")
+					.arg(op - t.op).arg((tRead - t.tWritten) / 1e6, 0, 'f', 1).arg(t.commit / 1e6, 0, 'f', 2);
+			}
+
+			out << "\n";
+			out.flush();
+		}
+
+		// Go on from what the server has so one fault isn't counted on every READ
+		if (kind != STRESS_STALE) {
+			memcpy(shadow.track(drive, track), trackBuf, opts.trackLen);
+			t.version = (stamped && stampDrive == drive && stampTrack == track) ? version : 0;
+		}
+	}
+
+	elapsed = fdcNow() - start;
+
+	for (d = 0; d < drives.size(); d++) {
+		commit.add(link.writs.phases[drives[d]][WRIT_PHASE_COMMIT]);
+	}
+
+	if (interrupted) {
+		out << QString("\nInterrupted after %1 of %2 ops").arg(op).arg(opts.ops);
+	}
+
+	out << QString("\n%1 READs, %2 WRITs in %3 s, %4 ops/s\n")
+		.arg(reads).arg(writes).arg(elapsed / 1e9, 0, 'f', 1).arg(op * 1e9 / qMax((qint64) 1, elapsed), 0, 'f', 1);
+	out << QString("READ p50 %1 ms p99 %2 ms, WRIT p50 %3 ms p99 %4 ms, commit p99 %5 ms\n")
+		.arg(link.metrics.latency[CMD_READ].percentile(0.50) / 1e6, 0, 'f', 2)
+		.arg(link.metrics.latency[CMD_READ].percentile(0.99) / 1e6, 0, 'f', 2)
+		.arg(link.metrics.latency[CMD_WRIT].percentile(0.50) / 1e6, 0, 'f', 2)
+		.arg(link.metrics.latency[CMD_WRIT].percentile(0.99) / 1e6, 0, 'f', 2)
+		.arg(commit.percentile(0.99) / 1e6, 0, 'f', 2);
+	out << QString("%1 transactions failed, %2 WRITs left in doubt\n").arg(errors).arg(inDoubt);
+
+	for (kind = 0; kind < STRESS_KINDS; kind++) {
+		out << QString("%1 %2\n").arg(kindNames[kind], -12).arg(violations[kind]);
+	}
+
+	// Put the disks back as they were, and check they are. Ctrl-C is still
+	// caught here, so a second one can't leave tracks of random data
+	for (restored = 0, restoreErrors = 0, d = 0; d < tracks.size(); d++) {
+		if (tracks[d].written) {
+			drive = d / opts.trackMax;
+			track = d % opts.trackMax;
+			memcpy(writeBuf, original.track(drive, track), opts.trackLen);
+			if (link.writ(drive, track, opts.trackLen, writeBuf) == LINK_OK && link.response.rcode == STAT_OK
+				&& link.read(drive, track, opts.trackLen, trackBuf) == LINK_OK && !memcmp(trackBuf, original.track(drive, track), opts.trackLen)) {
+				restored++;
+			}
+			else {
+				restoreErrors++;
+			}
+		}
+	}
+
+	out << QString("%1 tracks restored").arg(restored);
+	if (restoreErrors) {
+		out << QString(", %1 COULD NOT BE RESTORED").arg(restoreErrors);
+	}
+	out << "\n";
+
+	sigaction(SIGINT, &oldSa, NULL);
+
+	link.setFeed(NULL);
+	link.close();
+
+	for (kind = 0; kind < STRESS_KINDS && !violations[kind]; kind++) {
+	}
+
+	return (kind < STRESS_KINDS || restoreErrors) ? 1 : 0;
+}
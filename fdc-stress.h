@@ -0,0 +1,34 @@
+#ifndef FDCSTRESS_H
+#define FDCSTRESS_H
+
+#include <QtGlobal>
+
+#include "fdc-bench.h"
+
+#define STRESS_MAGIC		0x53434446		// "FDCS" at the start of every track written
+#define STRESS_STAMP_LEN	12			// magic, drive, track, version
+#define STRESS_SHOW		20			// violations printed in full
+
+#define STRESS_LOST		0			// acknowledged write gone, older version back for good
+#define STRESS_STALE		1			// older version read, the right one on a re-read
+#define STRESS_MISDIRECTED	2			// another track's data
+#define STRESS_CORRUPT		3			// no version of any track
+#define STRESS_KINDS		4
+
+//
+// What the shadow knows about one track. Version 0 is the track as found;
+// version n is the nth WRIT the stress run made to it.
+//
+typedef struct TSTRESSTRACK {
+	quint32 version;			// the server must return this one
+	quint32 pending;			// first WRIT in doubt (no WSTA), 0 for none;
+						// any version from it to written may land
+	quint32 written;			// highest version sent
+	qint64 tWritten;			// WSTA OK for it (fdcNow() ns)
+	qint64 op;				// at op number
+	qint64 commit;				// ns, its WRIT commit phase
+} tstresstrack_t;
+
+int runStress(const tbenchopts_t &opts);
+
+#endif
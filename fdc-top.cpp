@@ -0,0 +1,401 @@
+/**********************************************************************************
+*
+*  Terminal dashboard for the FDC+ Serial Drive Simulator
+*
+*  Attaches read only to a running simulator's metrics segment, like
+*  --monitor, and keeps a live view of every link on the terminal: rates,
+*  latency percentiles over the last interval, failures and drive state.
+*  Works over ssh on any ANSI terminal, no curses needed:
+*
+*      fdc-sim-gui --workload --port ttyUSB0 --shm /fdc-lab1
+*      fdc-sim-gui --top /fdc-lab1 --interval 250
+*
+*  q quits, r redraws the whole screen. Only the lines that changed are
+*  rewritten, in one write() per frame, and frames come at most every
+*  TOP_MIN_INTERVAL ms. The simulator never knows it's being watched: the
+*  dashboard only reads the segment. With stdout not a terminal it prints
+*  plain frames instead, once or every --interval ms.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+#include <string.h>
+#include <signal.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "fdc-top.h"
+#include "fdc-shm.h"
+#include "fdc-link.h"
+
+static std::atomic<bool> interrupted;
+static std::atomic<bool> resized;
+
+static void interruptHandler(int)
+{
+	interrupted = true;
+}
+
+static void resizeHandler(int)
+{
+	resized = true;
+}
+
+static const char *resultName(int result)
+{
+	static const char *names[] = { "OK", "CLOSED", "TIMEOUT", "IO", "BADRESP", "SHORT", "CHECKSUM", "CANCEL" };
+
+	return (result >= 0 && result < (int) (sizeof(names) / sizeof(names[0]))) ? names[result] : "?";
+}
+
+static QString rate(quint64 now, quint64 then, qint64 ns, double scale = 1.0)
+{
+	return (ns > 0) ? QString::number((now - then) * 1e9 / ns / scale, 'f', 1) : QString("-");
+}
+
+//
+// Percentile of what was recorded between two snapshots of a histogram
+//
+static QString intervalPercentile(const FDCHistogram &now, const FDCHistogram &then, double p)
+{
+	FDCHistogram delta;
+	int b;
+
+	for (b = 0; b < HIST_BUCKETS; b++) {
+		if (now.buckets[b] > then.buckets[b]) {
+			delta.record(FDCHistogram::bucketValue(b), now.buckets[b] - then.buckets[b]);
+		}
+	}
+
+	return (delta.count()) ? QString::number(delta.percentile(p) / 1e6, 'f', 2) : QString("-");
+}
+
+static QString uptime(qint64 ns)
+{
+	qint64 s;
+
+	s = ns / 1000000000LL;
+
+	return QString("%1:%2:%3").arg(s / 3600).arg((s / 60) % 60, 2, 10, QChar('0')).arg(s % 60, 2, 10, QChar('0'));
+}
+
+//
+// One frame of the dashboard, a line per row of the screen
+//
+static QStringList frame(const FDCShm &shm, QVector<ttoplink_t> &last, int interval)
+{
+	QStringList lines, throughput, latency, failures, drives;
+	FDCMetrics metrics;
+	tshmdrives_t d;
+	QString name, mounted;
+	qint64 updated, now, ns;
+	quint64 total, then, failed;
+	int slot, c, drive, pool;
+
+	now = fdcNow();
+
+	lines << QString("%1  pid %2  up %3  %4 link%5  every %6 ms")
+		.arg(shm.name()).arg(shm.pid()).arg(uptime(now - shm.started()))
+		.arg(shm.links()).arg((shm.links() == 1) ? "" : "s").arg(interval);
+
+	throughput << "";
+	throughput << QString("%1 %2 %3 %4 %5 %6 %7 %8").arg("LINK", -16).arg("TRANS/S", 8)
+		.arg("STAT/S", 7).arg("READ/S", 7).arg("WRIT/S", 7).arg("KB/S OUT", 9).arg("KB/S IN", 9).arg("IDLE S", 7);
+
+	latency << "";
+	latency << QString("%1 %2 %3 %4 %5 %6 %7 %8").arg("LATENCY MS", -16).arg("STAT p50", 9).arg("p99", 7)
+		.arg("READ p50", 9).arg("p99", 7).arg("WRIT p50", 9).arg("p99", 7).arg("MAX", 8);
+
+	failures << "";
+	failures << QString("%1 %2 %3 %4 %5 %6 %7").arg("FAILURES", -16).arg("ERRORS", 8).arg("TIMEOUTS", 9)
+		.arg("CANCELS", 8).arg("RESYNCS", 8).arg("DISCARDED", 10).arg("THROTTLED", 10);
+
+	drives << "";
+	drives << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9").arg("DRIVE", -5).arg("LINK", -16).arg("MOUNTED", -7)
+		.arg("TRACK", 5).arg("LAST", -4).arg("RESULT", -8).arg("AGE S", 8).arg("TRANSFERS", 10).arg("FAILED", 7);
+
+	last.resize(shm.links());
+
+	for (slot = 0; slot < shm.links(); slot++) {
+		if (!shm.snapshot(slot, &metrics, &name, &updated, &d)) {
+			continue;
+		}
+
+		ttoplink_t &prev = last[slot];
+		ns = (prev.t) ? now - prev.t : 0;
+		name = name.left(16);
+
+		for (total = 0, then = 0, failed = 0, c = 0; c < CMD_COUNT; c++) {
+			total += metrics.commands[c];
+			then += prev.metrics.commands[c];
+		}
+
+		throughput << QString("%1 %2 %3 %4 %5 %6 %7 %8").arg(name, -16).arg(rate(total, then, ns), 8)
+			.arg(rate(metrics.commands[CMD_STAT], prev.metrics.commands[CMD_STAT], ns), 7)
+			.arg(rate(metrics.commands[CMD_READ], prev.metrics.commands[CMD_READ], ns), 7)
+			.arg(rate(metrics.commands[CMD_WRIT], prev.metrics.commands[CMD_WRIT], ns), 7)
+			.arg(rate(metrics.bytesOut, prev.metrics.bytesOut, ns, 1024.0), 9)
+			.arg(rate(metrics.bytesIn, prev.metrics.bytesIn, ns, 1024.0), 9)
+			.arg((now - updated) / 1e9, 7, 'f', 2);
+
+		latency << QString("%1 %2 %3 %4 %5 %6 %7 %8").arg(name, -16)
+			.arg(intervalPercentile(metrics.latency[CMD_STAT], prev.metrics.latency[CMD_STAT], 0.50), 9)
+			.arg(intervalPercentile(metrics.latency[CMD_STAT], prev.metrics.latency[CMD_STAT], 0.99), 7)
+			.arg(intervalPercentile(metrics.latency[CMD_READ], prev.metrics.latency[CMD_READ], 0.50), 9)
+			.arg(intervalPercentile(metrics.latency[CMD_READ], prev.metrics.latency[CMD_READ], 0.99), 7)
+			.arg(intervalPercentile(metrics.latency[CMD_WRIT], prev.metrics.latency[CMD_WRIT], 0.50), 9)
+			.arg(intervalPercentile(metrics.latency[CMD_WRIT], prev.metrics.latency[CMD_WRIT], 0.99), 7)
+			.arg(qMax(metrics.latency[CMD_STAT].max(), qMax(metrics.latency[CMD_READ].max(), metrics.latency[CMD_WRIT].max())) / 1e6, 8, 'f', 2);
+
+		for (c = 0; c < CMD_COUNT; c++) {
+			failed += metrics.errors[c];
+		}
+
+		failures << QString("%1 %2 %3 %4 %5 %6 %7").arg(name, -16).arg(failed, 8)
+			.arg(metrics.timeouts[CMD_STAT] + metrics.timeouts[CMD_READ] + metrics.timeouts[CMD_WRIT], 9)
+			.arg(metrics.cancels[CMD_STAT] + metrics.cancels[CMD_READ] + metrics.cancels[CMD_WRIT], 8)
+			.arg(metrics.resyncs, 8).arg(metrics.resyncDiscard, 10).arg(metrics.throttled, 10);
+
+		// Drives the link has used or that STAT shows mounted
+		for (drive = 0; drive < MOUNT_DRIVES; drive++) {
+			const tshmdrive_t &s = d.drive[drive];
+
+			if (!s.done && !(d.mounted & (1 << drive))) {
+				continue;
+			}
+
+			mounted = (!d.known) ? "?" : (d.mounted & (1 << drive)) ? "yes" : "no";
+
+			if (s.done) {
+				drives << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9").arg(drive, -5).arg(name, -16).arg(mounted, -7)
+					.arg(s.track, 5).arg(FDCMetrics::commandName(s.cmd), -4).arg(resultName(s.result), -8)
+					.arg((now - s.done) / 1e9, 8, 'f', 2).arg(s.transfers, 10).arg(s.failures, 7);
+			}
+			else {
+				drives << QString("%1 %2 %3").arg(drive, -5).arg(name, -16).arg(mounted);
+			}
+		}
+
+		prev.metrics = metrics;
+		prev.t = now;
+	}
+
+	lines << throughput << latency << failures << drives;
+
+	lines << "";
+	lines << QString("%1 %2 %3 %4 %5").arg("MEMORY", -16).arg("USED KB", 10).arg("PEAK KB", 10).arg("LIMIT KB", 10).arg("DENIED", 7);
+
+	for (pool = 0; pool < qMin(shm.memPools(), MEM_COUNT); pool++) {
+		const tshmmemory_t &mem = shm.memory(pool);
+
+		lines << QString("%1 %2 %3 %4 %5")
+			.arg(FDCMemory::name(pool), -16)
+			.arg(mem.used.load(std::memory_order_relaxed) / 1024, 10)
+			.arg(mem.peak.load(std::memory_order_relaxed) / 1024, 10)
+			.arg((mem.limit.load(std::memory_order_relaxed)) ? QString::number(mem.limit.load(std::memory_order_relaxed) / 1024) : QString("-"), 10)
+			.arg(mem.denied.load(std::memory_order_relaxed), 7);
+	}
+
+	return lines;
+}
+
+#ifdef Q_OS_UNIX
+//
+// Escape sequences that turn what is on the screen into lines: each line
+// that differs is rewritten in place and cleared to the end, and rows no
+// longer used are cleared
+//
+static QByteArray redraw(const QStringList &lines, QStringList *shown, int rows, int cols, bool full)
+{
+	QByteArray out;
+	QString line;
+	int i, n;
+
+	if (full) {
+		out += "\033[H\033[2J";
+		shown->clear();
+	}
+
+	n = qMin(lines.size(), rows);
+
+	for (i = 0; i < n; i++) {
+		line = lines[i].left(cols);
+
+		if (i < shown->size() && (*shown)[i] == line) {
+			continue;
+		}
+
+		out += QString("\033[%1;1H").arg(i + 1).toLatin1() + line.toLocal8Bit() + "\033[K";
+
+		if (i < shown->size()) {
+			(*shown)[i] = line;
+		}
+		else {
+			shown->append(line);
+		}
+	}
+
+	for (i = n; i < shown->size(); i++) {
+		out += QString("\033[%1;1H\033[K").arg(i + 1).toLatin1();
+	}
+
+	while (shown->size() > n) {
+		shown->removeLast();
+	}
+
+	return out;
+}
+
+static void screenSize(int *rows, int *cols)
+{
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+		*rows = ws.ws_row;
+		*cols = ws.ws_col;
+	}
+	else {
+		*rows = 24;
+		*cols = 80;
+	}
+}
+
+static void writeAll(const QByteArray &bytes)
+{
+	qint64 off;
+	ssize_t n;
+
+	for (off = 0; off < bytes.size(); off += n) {
+		if ((n = write(STDOUT_FILENO, bytes.constData() + off, bytes.size() - off)) <= 0) {
+			return;
+		}
+	}
+}
+
+//
+// Redraw every interval until q, SIGINT or SIGTERM, waiting for keys in
+// between. The terminal is put back as it was however it ends.
+//
+static void runScreen(const FDCShm &shm, QVector<ttoplink_t> &last, int interval)
+{
+	struct sigaction sa, oldInt, oldTerm, oldWinch;
+	struct termios saved, raw;
+	struct pollfd pfd;
+	QStringList shown;
+	qint64 next, wait;
+	bool keys, full;
+	int rows, cols;
+	char key;
+
+	interrupted = false;
+	resized = false;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldInt);
+	sigaction(SIGTERM, &sa, &oldTerm);
+	sa.sa_handler = resizeHandler;
+	sigaction(SIGWINCH, &sa, &oldWinch);
+
+	// Keys without Enter or echo, if there is a keyboard
+	keys = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+	if (keys) {
+		raw = saved;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+	}
+
+	// Alternate screen, cursor hidden
+	writeAll("\033[?1049h\033[?25l");
+
+	screenSize(&rows, &cols);
+	full = true;
+	next = fdcNow();
+
+	while (!interrupted) {
+		if (resized.exchange(false)) {
+			screenSize(&rows, &cols);
+			full = true;
+			next = fdcNow();
+		}
+
+		if (fdcNow() >= next) {
+			writeAll(redraw(frame(shm, last, interval), &shown, rows, cols, full));
+			full = false;
+			next = qMax(next + (qint64) interval * 1000000, fdcNow());
+		}
+
+		wait = qMax((qint64) 0, (next - fdcNow()) / 1000000);
+
+		pfd.fd = STDIN_FILENO;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, (keys) ? 1 : 0, (int) wait) > 0 && read(STDIN_FILENO, &key, 1) == 1) {
+			if (key == 'q' || key == 'Q') {
+				break;
+			}
+
+			// r or ^L after something else scribbled on the screen
+			if (key == 'r' || key == 'R' || key == 12) {
+				full = true;
+				next = fdcNow();
+			}
+		}
+	}
+
+	writeAll("\033[?25h\033[?1049l");
+
+	if (keys) {
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+	}
+
+	sigaction(SIGINT, &oldInt, NULL);
+	sigaction(SIGTERM, &oldTerm, NULL);
+	sigaction(SIGWINCH, &oldWinch, NULL);
+}
+#endif
+
+int runTop(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	QVector<ttoplink_t> last;
+	FDCShm shm;
+	int interval;
+
+	if (!shm.attach(opts.shmName)) {
+		out << shm.errorString() << "\n";
+		return 1;
+	}
+
+	interval = (opts.interval > 0) ? qMax(opts.interval, TOP_MIN_INTERVAL) : TOP_INTERVAL;
+
+#ifdef Q_OS_UNIX
+	if (isatty(STDOUT_FILENO)) {
+		runScreen(shm, last, interval);
+		return 0;
+	}
+#endif
+
+	// Not a terminal: plain frames, like --monitor
+	do {
+		out << frame(shm, last, interval).join('\n') << "\n\n";
+		out.flush();
+
+		if (opts.interval > 0) {
+			QThread::msleep(interval);
+		}
+	} while (opts.interval > 0);
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef FDCTOP_H
+#define FDCTOP_H
+
+#include <QtGlobal>
+
+#include "fdc-metrics.h"
+#include "fdc-bench.h"
+
+#define TOP_INTERVAL		500			// ms between redraws by default
+#define TOP_MIN_INTERVAL	100			// fastest redraw --interval allows
+
+//
+// A link as it was at the last redraw, to turn counters and histograms
+// into rates and percentiles over the interval
+//
+typedef struct TTOPLINK {
+	FDCMetrics metrics;
+	qint64 t;				// fdcNow() of the snapshot, 0 before the first
+} ttoplink_t;
+
+int runTop(const tbenchopts_t &opts);
+
+#endif
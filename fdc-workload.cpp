@@ -0,0 +1,166 @@
+/**********************************************************************************
+*
+*  Coroutine workloads for the FDC+ Serial Drive Simulator
+*
+*  Many virtual FDC workflows share a few links and engine threads, e.g.
+*
+*      fdc-sim-gui --workload --port ttyUSB0,ttyUSB1 --threads 2 --workflows 1000
+*
+***********************************************************************************/
+
+#include <QTextStream>
+
+#include <atomic>
+
+#include <signal.h>
+#include <string.h>
+
+#include "fdc-workload.h"
+#include "fdc-engine.h"
+
+// Ctrl-C cancels every outstanding transaction and ends the workflows
+static FDCCancel interrupted;
+
+static void interruptHandler(int)
+{
+	interrupted.cancel();
+}
+
+//
+// One virtual FDC: STAT then READ every track, starting at its own offset
+// so workflows sharing a link don't all hit the same track. Each transaction
+// gets opts->deadline ms if set.
+//
+static FDCTask readWorkflow(FDCClient *client, const tbenchopts_t *opts, int offset, std::atomic<int> *failures)
+{
+	quint8 buf[TRACKBUF_LEN_CRC];
+	tresult_t r;
+	int pass, i;
+	quint16 track;
+	qint64 deadline;
+
+	for (pass = 0; pass < opts->passes; pass++) {
+		for (i = 0; i < opts->trackMax; i++) {
+			track = (offset + i) % opts->trackMax;
+
+			deadline = (opts->deadline) ? fdcDeadline(opts->deadline) : 0;
+
+			r = co_await client->stat(opts->drive, track, deadline, &interrupted);
+			if (r.result == LINK_CANCELLED) {
+				co_return;
+			}
+			if (r.result != LINK_OK) {
+				(*failures)++;
+				continue;
+			}
+
+			deadline = (opts->deadline) ? fdcDeadline(opts->deadline) : 0;
+
+			r = co_await client->read(opts->drive, track, buf, opts->trackLen, deadline, &interrupted);
+			if (r.result == LINK_CANCELLED) {
+				co_return;
+			}
+			if (r.result != LINK_OK) {
+				(*failures)++;
+			}
+		}
+	}
+}
+
+int runWorkload(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCEnginePool pool(opts.threads);
+	std::vector<FDCClient *> clients;
+	FDCShm shm;
+	std::atomic<int> failures;
+	FDCMetrics total;
+	FDCClient *client;
+	struct sigaction sa, oldSa;
+	qint64 t;
+	int c, w, refused;
+
+	failures = 0;
+	interrupted.reset();
+
+	for (const QString &port : opts.ports) {
+		client = new FDCClient(pool.next());
+
+		if (!client->open(port, opts.baudRate)) {
+			out << client->errorString() << "\n";
+			delete client;
+			continue;
+		}
+
+		clients.push_back(client);
+	}
+
+	if (clients.empty()) {
+		return 1;
+	}
+
+	if (!opts.shmName.isEmpty()) {
+		if (!shm.create(opts.shmName)) {
+			out << shm.errorString() << "\n";
+			return 1;
+		}
+		for (c = 0; c < (int) clients.size(); c++) {
+			clients[c]->setShm(&shm);
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interruptHandler;
+	sigaction(SIGINT, &sa, &oldSa);
+
+	t = fdcNow();
+	refused = 0;
+
+	// Workflows past the engine memory budget are not started
+	for (w = 0; w < opts.workflows; w++) {
+		client = clients[w % clients.size()];
+		if (!client->engine()->spawn(readWorkflow(client, &opts, w, &failures))) {
+			refused++;
+		}
+	}
+
+	pool.wait();
+
+	t = fdcNow() - t;
+
+	sigaction(SIGINT, &oldSa, NULL);
+
+	for (c = 0; c < (int) clients.size(); c++) {
+		client = clients[c];
+
+		out << QString("%1: %2 bytes in, %3 bytes out\n").arg(client->portName()).arg(client->metrics.bytesIn).arg(client->metrics.bytesOut);
+
+		total.bytesIn += client->metrics.bytesIn;
+		total.bytesOut += client->metrics.bytesOut;
+		total.resyncs += client->metrics.resyncs;
+		total.resyncDiscard += client->metrics.resyncDiscard;
+		for (w = 0; w < CMD_COUNT; w++) {
+			total.commands[w] += client->metrics.commands[w];
+			total.errors[w] += client->metrics.errors[w];
+			total.timeouts[w] += client->metrics.timeouts[w];
+			total.cancels[w] += client->metrics.cancels[w];
+			total.latency[w].add(client->metrics.latency[w]);
+		}
+
+		delete client;
+	}
+
+	out << QString("%1 workflows on %2 links, %3 threads, %4 s, %5 failed transactions\n")
+		.arg(opts.workflows).arg(clients.size()).arg(pool.size())
+		.arg(t / 1e9, 0, 'f', 2).arg(failures.load());
+	if (refused) {
+		out << QString("%1 workflows not started, over the engine memory budget\n").arg(refused);
+	}
+	if (interrupted.isCancelled()) {
+		out << "Interrupted\n";
+	}
+	out << total.report();
+	out << FDCMemory::report();
+
+	return (failures) ? 1 : 0;
+}
@@ -0,0 +1,8 @@
+#ifndef FDCWORKLOAD_H
+#define FDCWORKLOAD_H
+
+#include "fdc-bench.h"
+
+int runWorkload(const tbenchopts_t &opts);
+
+#endif
@@ -0,0 +1,134 @@
+/**********************************************************************************
+*
+*  WRIT phase breakdown for the FDC+ Serial Drive Simulator
+*
+*  Every WRIT that gets its WSTA is split into ack, data and commit time.
+*  --bench-writ writes bursts of tracks back unchanged and prints the
+*  breakdown, e.g.
+*
+*      fdc-sim-gui --bench-writ --port ttyUSB0 --drive 1 --tracks 32 --burst 1,4,16,32
+*
+***********************************************************************************/
+
+#include "fdc-writ.h"
+
+static const char *phaseNames[WRIT_PHASES] = { "ack", "data", "commit" };
+
+FDCWritPhases::FDCWritPhases()
+{
+	reset();
+}
+
+void FDCWritPhases::reset()
+{
+	int d, p;
+
+	for (d = 0; d < WRIT_DRIVES; d++) {
+		for (p = 0; p < WRIT_PHASES; p++) {
+			phases[d][p].reset();
+		}
+	}
+
+	for (p = 0; p < WRIT_BURST_CLASSES; p++) {
+		commitByBurst[p].reset();
+	}
+
+	for (p = 0; p < WRIT_PHASES; p++) {
+		last[p] = 0;
+	}
+
+	lastDrive = -1;
+	lastDone = 0;
+	position = 0;
+}
+
+//
+// One completed WRIT, timestamps as in ttransaction_t
+//
+void FDCWritPhases::record(quint8 drive, qint64 tSent, qint64 tResp, qint64 tData, qint64 tWsta, qint64 tDone)
+{
+	if (drive >= WRIT_DRIVES || !tResp || !tData || !tWsta) {
+		return;
+	}
+
+	if (drive != lastDrive || tSent - lastDone > WRIT_BURST_GAP * 1000000LL) {
+		position = 0;
+	}
+
+	position++;
+	lastDrive = drive;
+	lastDone = tDone;
+
+	last[WRIT_PHASE_ACK] = tResp - tSent;
+	last[WRIT_PHASE_DATA] = tData - tResp;
+	last[WRIT_PHASE_COMMIT] = tWsta - tData;
+
+	phases[drive][WRIT_PHASE_ACK].record(last[WRIT_PHASE_ACK]);
+	phases[drive][WRIT_PHASE_DATA].record(last[WRIT_PHASE_DATA]);
+	phases[drive][WRIT_PHASE_COMMIT].record(last[WRIT_PHASE_COMMIT]);
+
+	commitByBurst[burstClass(position)].record(last[WRIT_PHASE_COMMIT]);
+}
+
+//
+// 1, 2, 3-4, 5-8, ... by position in the burst
+//
+int FDCWritPhases::burstClass(int position)
+{
+	int c;
+
+	for (c = 0; c < WRIT_BURST_CLASSES - 1 && position > (1 << c); c++) {
+	}
+
+	return c;
+}
+
+QString FDCWritPhases::burstName(int burstClass)
+{
+	if (burstClass < 2) {
+		return QString::number(burstClass + 1);
+	}
+
+	if (burstClass == WRIT_BURST_CLASSES - 1) {
+		return QString("%1+").arg((1 << (burstClass - 1)) + 1);
+	}
+
+	return QString("%1-%2").arg((1 << (burstClass - 1)) + 1).arg(1 << burstClass);
+}
+
+const char *FDCWritPhases::phaseName(int phase)
+{
+	return phaseNames[phase];
+}
+
+QString FDCWritPhases::report() const
+{
+	QString s;
+	int d, p;
+
+	s = QString("%1 %2 %3 %4 %5 %6\n").arg("drive", -6).arg("phase", -7).arg("count", 7).arg("p50 ms", 9).arg("p99 ms", 9).arg("max ms", 9);
+
+	for (d = 0; d < WRIT_DRIVES; d++) {
+		for (p = 0; p < WRIT_PHASES && phases[d][WRIT_PHASE_ACK].count(); p++) {
+			const FDCHistogram &h = phases[d][p];
+
+			s += QString("%1 %2 %3 %4 %5 %6\n")
+				.arg(d, -6).arg(phaseNames[p], -7).arg(h.count(), 7)
+				.arg(h.percentile(0.50) / 1e6, 9, 'f', 2).arg(h.percentile(0.99) / 1e6, 9, 'f', 2).arg(h.max() / 1e6, 9, 'f', 2);
+		}
+	}
+
+	s += QString("\n%1 %2 %3 %4 %5 %6\n").arg("burst", -6).arg("", -7).arg("count", 7).arg("p50 ms", 9).arg("p99 ms", 9).arg("max ms", 9);
+
+	for (p = 0; p < WRIT_BURST_CLASSES; p++) {
+		const FDCHistogram &h = commitByBurst[p];
+
+		if (h.count()) {
+			s += QString("%1 %2 %3 %4 %5 %6\n")
+				.arg(burstName(p), -6).arg("commit", -7).arg(h.count(), 7)
+				.arg(h.percentile(0.50) / 1e6, 9, 'f', 2).arg(h.percentile(0.99) / 1e6, 9, 'f', 2).arg(h.max() / 1e6, 9, 'f', 2);
+		}
+	}
+
+	return s;
+}
@@ -0,0 +1,50 @@
+#ifndef FDCWRIT_H
+#define FDCWRIT_H
+
+#include <QtGlobal>
+#include <QString>
+
+#include "fdc-metrics.h"
+
+#define WRIT_DRIVES		4			// as MAX_DRIVE
+#define WRIT_PHASE_ACK		0			// WRIT on the wire to WRIT response
+#define WRIT_PHASE_DATA		1			// WRIT response to track drained
+#define WRIT_PHASE_COMMIT	2			// track drained to first byte of WSTA
+#define WRIT_PHASES		3
+#define WRIT_BURST_CLASSES	7			// 1, 2, 3-4, 5-8, 9-16, 17-32, 33+
+#define WRIT_BURST_GAP		100			// ms between WRITs that ends a burst
+
+//
+// A WRIT split into its three waits. Ack is the server getting ready to
+// take a track, data is the track on the wire, and commit is the server
+// storing it before it answers WSTA, which is where its flush behaviour
+// shows. Each is kept per drive; commit is also kept by position in a
+// burst of back to back WRITs to one drive, so a write-back cache filling
+// up (or a flush every n tracks) shows as commit growing along the burst.
+//
+class FDCWritPhases
+{
+public:
+	FDCWritPhases();
+
+	void reset(void);
+	void record(quint8 drive, qint64 tSent, qint64 tResp, qint64 tData, qint64 tWsta, qint64 tDone);
+	QString report(void) const;
+
+	int burst(void) const { return position; }
+
+	static int burstClass(int position);
+	static QString burstName(int burstClass);
+	static const char *phaseName(int phase);
+
+	FDCHistogram phases[WRIT_DRIVES][WRIT_PHASES];	// ns
+	FDCHistogram commitByBurst[WRIT_BURST_CLASSES];	// ns, all drives
+	qint64 last[WRIT_PHASES];			// ns, latest WRIT
+
+private:
+	int lastDrive;
+	qint64 lastDone;
+	int position;					// of the latest WRIT in its burst
+};
+
+#endif
@@ -0,0 +1,383 @@
+/**********************************************************************************
+*
+*  Write-back track buffer and sector editor for the FDC+ Serial Drive Simulator
+*
+*  Edits are made to a copy of the track held on this side of the link and
+*  go back to the server as one WRIT per track, however many there were:
+*
+*      fdc-sim-gui --edit 2:s0+3=e5e5e5e5,2:s1+3=e5,2:0x1000=00ff --port ttyUSB0 --drive 1
+*
+*  Each edit is track:where=hex bytes, where is a byte offset into the track
+*  or sN+offset into sector N (WB_SECTOR_LEN bytes each, as sent). The track
+*  checksum is kept up to date from the bytes that changed, so a flush costs
+*  the WRIT and nothing else. The dialog edits the same way and flushes on
+*  demand, WB_FLUSH_AGE ms after a track was first edited, or on exit.
+*
+***********************************************************************************/
+
+#include <QTextStream>
+#include <QStringList>
+
+#include <string.h>
+
+#include "fdc-writeback.h"
+
+FDCWriteBack::FDCWriteBack(FDCLink *link)
+{
+	this->link = link;
+	cache = NULL;
+	edits = 0;
+	changed = 0;
+	reads = 0;
+	writs = 0;
+}
+
+FDCWriteBack::~FDCWriteBack()
+{
+	close();
+}
+
+//
+// A store for every drive, on STORE_PAGES_ pages. Dirty tracks are lost if
+// the buffer is remade, so flush first.
+//
+bool FDCWriteBack::create(quint16 trackMax, quint16 trackLen, int pages)
+{
+	close();
+
+	if (!store.create(MAX_DRIVE, trackMax, trackLen, pages)) {
+		return false;
+	}
+
+	tracks.resize(MAX_DRIVE * trackMax);
+	memset(tracks.data(), 0, tracks.size() * sizeof(twbtrack_t));
+
+	return true;
+}
+
+void FDCWriteBack::close()
+{
+	store.close();
+	tracks.clear();
+}
+
+//
+// Apply n bytes at offset, fetching the track first unless a dirty copy is
+// held. A clean copy is read again: it is only as new as the last READ or
+// flush, and anything written to the track since by another client would
+// be undone by the whole track WRIT. Returns the READ's LINK_ code if that
+// fails, with nothing applied. With a track cache the fetch goes through
+// FDCTrackCache::confirm(), still a READ, which keeps what was read and
+// drops the drive's held copies if the one for this track was out of date.
+//
+int FDCWriteBack::edit(quint8 drive, quint16 track, int offset, const quint8 *bytes, int n, FDCCancel *cancel)
+{
+	quint8 *data;
+	int i, r;
+
+	twbtrack_t &t = tracks[drive * store.trackMax() + track];
+
+	data = store.track(drive, track);
+
+	if (!t.dirty) {
+		if (cache != NULL && cache->isOpen() && cache->trackLen() == store.trackLen()) {
+			r = cache->confirm(link, drive, track, buf, NULL, cancel);
+		}
+		else {
+			r = link->read(drive, track, store.trackLen(), buf, 0, cancel);
+		}
+
+		if (r != LINK_OK) {
+			return r;
+		}
+		memcpy(data, buf, store.trackLen());
+		t.sum = buf[store.trackLen()] | (buf[store.trackLen() + 1] << 8);
+		t.held = true;
+		reads++;
+	}
+
+	// Only the bytes that change move the checksum
+	for (i = 0; i < n; i++) {
+		if (data[offset + i] != bytes[i]) {
+			t.sum += bytes[i] - data[offset + i];
+			data[offset + i] = bytes[i];
+			changed++;
+
+			if (!t.dirty) {
+				t.dirty = true;
+				t.tDirty = fdcNow();
+				t.lo = offset + i;
+			}
+			t.lo = qMin((int) t.lo, offset + i);
+			t.hi = qMax((int) t.hi, offset + i + 1);
+		}
+	}
+
+	t.edits++;
+	edits++;
+
+	return LINK_OK;
+}
+
+//
+// One WRIT for everything edited in the track since the last flush. The
+// WSTA is in link->response; the track stays dirty unless it was STAT_OK.
+//
+int FDCWriteBack::flush(quint8 drive, quint16 track, FDCCancel *cancel)
+{
+	int r;
+
+	twbtrack_t &t = tracks[drive * store.trackMax() + track];
+
+	if (!t.dirty) {
+		return LINK_OK;
+	}
+
+	memcpy(buf, store.track(drive, track), store.trackLen());
+
+	if ((r = link->writSummed(drive, track, store.trackLen(), buf, t.sum, 0, cancel)) == LINK_OK && link->response.rcode == STAT_OK) {
+		t.dirty = false;
+		t.edits = 0;
+		t.lo = 0;
+		t.hi = 0;
+		writs++;
+
+		if (cache != NULL && cache->isOpen() && cache->trackLen() == store.trackLen()) {
+			cache->store(drive, track, store.track(drive, track), t.sum);
+		}
+	}
+
+	return r;
+}
+
+//
+// Flush every track dirty for at least age ns (0 for all of them). Stops at
+// the first transaction that fails and returns its LINK_ code.
+//
+int FDCWriteBack::flushAll(qint64 age, FDCCancel *cancel)
+{
+	qint64 now;
+	int i, r;
+
+	now = fdcNow();
+
+	for (i = 0; i < tracks.size(); i++) {
+		if (tracks[i].dirty && now - tracks[i].tDirty >= age) {
+			if ((r = flush(i / store.trackMax(), i % store.trackMax(), cancel)) != LINK_OK) {
+				return r;
+			}
+		}
+	}
+
+	return LINK_OK;
+}
+
+//
+// Drop the held copy, e.g. when the track was written some other way
+//
+void FDCWriteBack::forget(quint8 drive, quint16 track)
+{
+	if (cache != NULL && cache->isOpen()) {
+		cache->drop(drive, track);
+	}
+
+	if (tracks.isEmpty()) {
+		return;
+	}
+
+	memset(&tracks[drive * store.trackMax() + track], 0, sizeof(twbtrack_t));
+}
+
+//
+// Drop every copy held for the drive, dirty or not, when its disk changed
+// on the server. Returns how many edited tracks were lost.
+//
+int FDCWriteBack::forgetDrive(quint8 drive)
+{
+	int t, n;
+
+	if (tracks.isEmpty() || drive >= MAX_DRIVE) {
+		return 0;
+	}
+
+	for (n = 0, t = 0; t < store.trackMax(); t++) {
+		n += tracks[drive * store.trackMax() + t].dirty;
+	}
+
+	memset(&tracks[drive * store.trackMax()], 0, store.trackMax() * sizeof(twbtrack_t));
+
+	return n;
+}
+
+int FDCWriteBack::dirtyTracks() const
+{
+	int i, n;
+
+	for (n = 0, i = 0; i < tracks.size(); i++) {
+		n += tracks[i].dirty;
+	}
+
+	return n;
+}
+
+//
+// "2:s3+7=e5e5,2:0x40=00ff": track, then a byte offset or sN+offset into
+// sector N, then the bytes in hex
+//
+bool FDCWriteBack::parseEdits(const QString &spec, quint16 trackMax, quint16 trackLen, QVector<twbedit_t> *list, QString *error)
+{
+	QStringList parts, where;
+	twbedit_t e;
+	int sector, offset;
+	bool ok;
+
+	list->clear();
+
+	for (const QString &item : spec.split(',')) {
+		parts = item.trimmed().split('=');
+		where = parts[0].split(':');
+
+		if (parts.size() != 2 || where.size() != 2) {
+			*error = QString("%1: expected track:offset=hex or track:sN+offset=hex").arg(item);
+			return false;
+		}
+
+		e.track = where[0].toUInt(&ok, 0);
+
+		if (!ok || e.track >= trackMax) {
+			*error = QString("%1: no such track").arg(item);
+			return false;
+		}
+
+		if (where[1].startsWith('s')) {
+			where = where[1].mid(1).split('+');
+			sector = where[0].toInt(&ok, 0);
+			offset = (where.size() > 1 && ok) ? where[1].toInt(&ok, 0) : 0;
+
+			if (!ok || where.size() > 2 || sector < 0 || sector >= trackLen / WB_SECTOR_LEN || offset < 0 || offset >= WB_SECTOR_LEN) {
+				*error = QString("%1: no such sector or offset").arg(item);
+				return false;
+			}
+
+			e.offset = sector * WB_SECTOR_LEN + offset;
+		}
+		else {
+			e.offset = where[1].toInt(&ok, 0);
+
+			if (!ok || e.offset < 0 || e.offset >= trackLen) {
+				*error = QString("%1: offset out of the track").arg(item);
+				return false;
+			}
+		}
+
+		e.bytes = QByteArray::fromHex(parts[1].toLatin1());
+
+		if (e.bytes.isEmpty() || parts[1].size() != e.bytes.size() * 2 || e.offset + e.bytes.size() > trackLen) {
+			*error = QString("%1: bad hex, or it runs off the track").arg(item);
+			return false;
+		}
+
+		list->append(e);
+	}
+
+	return true;
+}
+
+//
+// Apply --edit to --drive and flush, one WRIT per track, then read each
+// track back to check it
+//
+int runEdit(const tbenchopts_t &opts)
+{
+	QTextStream out(stdout);
+	FDCLink link;
+	FDCTrackCache cache;
+	FDCWriteBack wb(&link);
+	QVector<twbedit_t> list;
+	quint8 trackBuf[TRACKBUF_LEN_CRC];
+	QString error;
+	quint64 before;
+	int i, r, verified, failed;
+
+	if (!FDCWriteBack::parseEdits(opts.edits, opts.trackMax, opts.trackLen, &list, &error)) {
+		out << error << "\n";
+		return 2;
+	}
+
+	if (!link.open(opts.portName, opts.baudRate, (opts.backend != -1) ? opts.backend : (FDCSerial::available(SERIAL_BACKEND_POSIX)) ? SERIAL_BACKEND_POSIX : SERIAL_BACKEND_QT)) {
+		out << link.errorString() << "\n";
+		return 1;
+	}
+
+	if (link.stat(opts.drive, 0) != LINK_OK) {
+		out << QString("%1: no STAT response\n").arg(link.serial()->name());
+		return 1;
+	}
+
+	if (!(link.response.rdata & (1 << opts.drive))) {
+		out << QString("Drive %1 is not mounted\n").arg(opts.drive);
+		return 1;
+	}
+
+	if (!wb.create(opts.trackMax, opts.trackLen, (opts.pages != -1) ? opts.pages : STORE_PAGES_NORMAL)) {
+		out << wb.errorString() << "\n";
+		return 1;
+	}
+
+	if (!opts.cacheDir.isEmpty()) {
+		if (!cache.open(opts.cacheDir, opts.serverId, (opts.trackLen == TRACK_LEN_5) ? TRACK_MAX_5 : TRACK_MAX_8, opts.trackLen)) {
+			out << cache.errorString() << "\n";
+			return 1;
+		}
+		wb.setCache(&cache);
+	}
+
+	for (i = 0; i < list.size(); i++) {
+		const twbedit_t &e = list[i];
+
+		before = wb.changed;
+
+		if ((r = wb.edit(opts.drive, e.track, e.offset, (const quint8 *) e.bytes.constData(), e.bytes.size())) != LINK_OK) {
+			out << QString("Drive %1 track %2 can't be read, %3 edits not applied\n").arg(opts.drive).arg(e.track).arg(list.size() - i);
+			return 1;
+		}
+
+		out << QString("Track %1 sector %2+%3: %4 bytes, %5 changed\n")
+			.arg(e.track, 2).arg(e.offset / WB_SECTOR_LEN, 2).arg(e.offset % WB_SECTOR_LEN, -3)
+			.arg(e.bytes.size()).arg(wb.changed - before);
+	}
+
+	r = wb.flushAll();
+
+	out << QString("%1 edits, %2 bytes changed, %3 tracks read, %4 written")
+		.arg(wb.edits).arg(wb.changed).arg(wb.reads).arg(wb.writs);
+
+	if (cache.stale) {
+		out << QString(" (the track cache was out of date for drive %1, dropped)").arg(opts.drive);
+	}
+
+	if (r != LINK_OK || wb.dirtyTracks()) {
+		out << QString(", %1 NOT WRITTEN (%2)\n").arg(wb.dirtyTracks())
+			.arg((r == LINK_OK) ? FDCLink::rcodeString(link.response.rcode) : QString("no WSTA"));
+		return 1;
+	}
+
+	out << "\n";
+
+	// What the server has now is what was edited
+	for (verified = 0, failed = 0, i = 0; i < opts.trackMax; i++) {
+		if (wb.state(opts.drive, i).held) {
+			if (link.read(opts.drive, i, opts.trackLen, trackBuf) == LINK_OK && !memcmp(trackBuf, wb.data(opts.drive, i), opts.trackLen)) {
+				verified++;
+			}
+			else {
+				out << QString("Track %1 does not read back as edited\n").arg(i);
+				failed++;
+			}
+		}
+	}
+
+	out << QString("%1 tracks read back as edited\n").arg(verified);
+
+	return (failed) ? 1 : 0;
+}
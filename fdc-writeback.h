@@ -0,0 +1,90 @@
+#ifndef FDCWRITEBACK_H
+#define FDCWRITEBACK_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+#include "fdc-link.h"
+#include "fdc-store.h"
+#include "fdc-cache.h"
+#include "fdc-bench.h"
+
+#define WB_SECTOR_LEN		137			// bytes per sector as sent, both disk types
+#define WB_FLUSH_AGE		2000			// ms a track stays dirty before an auto flush
+
+//
+// What the write-back buffer knows about one track
+//
+typedef struct TWBTRACK {
+	bool held;				// a copy is in the store, clean or dirty
+	bool dirty;				// edited since it was read or flushed
+	quint16 sum;				// 16 bit sum of the copy, kept by every edit
+	quint32 edits;				// coalesced into the next WRIT
+	quint16 lo;				// first byte changed since the last flush
+	quint16 hi;				// one past the last
+	qint64 tDirty;				// first edit since the last flush (fdcNow() ns)
+} twbtrack_t;
+
+//
+// One edit as given on the command line: bytes at offset in a track
+//
+typedef struct TWBEDIT {
+	quint16 track;
+	int offset;
+	QByteArray bytes;
+} twbedit_t;
+
+//
+// Client side write-back buffer for one link. A track is READ when an edit
+// finds it clean, since the server may have changed it, and held; any
+// number of edits to it are applied to the copy, its checksum adjusted for
+// the bytes that changed, and it goes back as one WRIT when flushed: on
+// demand, once it has been dirty long enough, or before the buffer is
+// closed. Copies live in a track store against the MEM_STORE budget, and
+// forgetDrive() drops a drive's when its disk is changed. With a track
+// cache set, tracks to edit are still always READ, through the cache so it
+// checks its copy and keeps what is read and flushed.
+//
+class FDCWriteBack
+{
+public:
+	FDCWriteBack(FDCLink *link);
+	~FDCWriteBack();
+
+	bool create(quint16 trackMax, quint16 trackLen, int pages = STORE_PAGES_NORMAL);
+	void close(void);
+	bool isOpen(void) const { return store.isOpen(); }
+	QString errorString(void) const { return store.errorString(); }
+	quint16 trackLen(void) const { return store.trackLen(); }
+	void setCache(FDCTrackCache *cache) { this->cache = cache; }
+
+	int edit(quint8 drive, quint16 track, int offset, const quint8 *bytes, int n, FDCCancel *cancel = NULL);
+	int flush(quint8 drive, quint16 track, FDCCancel *cancel = NULL);
+	int flushAll(qint64 age = 0, FDCCancel *cancel = NULL);
+	void forget(quint8 drive, quint16 track);
+	int forgetDrive(quint8 drive);
+
+	const twbtrack_t &state(quint8 drive, quint16 track) const { return tracks[drive * store.trackMax() + track]; }
+	const quint8 *data(quint8 drive, quint16 track) const { return store.track(drive, track); }
+	int dirtyTracks(void) const;
+
+	quint64 edits;				// applied
+	quint64 changed;			// bytes that actually changed
+	quint64 reads;				// tracks fetched to edit
+	quint64 writs;				// tracks flushed
+
+	static bool parseEdits(const QString &spec, quint16 trackMax, quint16 trackLen, QVector<twbedit_t> *list, QString *error);
+
+private:
+	FDCLink *link;
+	FDCTrackCache *cache;
+	FDCTrackStore store;
+	QVector<twbtrack_t> tracks;
+	quint8 buf[TRACKBUF_LEN_CRC];
+};
+
+int runEdit(const tbenchopts_t &opts);
+
+#endif